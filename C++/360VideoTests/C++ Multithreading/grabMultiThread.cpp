@@ -3,10 +3,34 @@
 Multithreaded application to test multithreaded Simple Grab Performance
 with the Ladybug 5
 
-Must be compiled with:  g++ -pthread -o <name> grabMultiThread.cpp
+Build with the Makefile in this directory.
 
 Kieran Hunt 21/01/2019
 
+The grab loop runs on the main thread and never waits for conversion or
+disk writes unless every frame slot is in use. Each grabbed frame is copied
+into one of NUM_FRAME_SLOTS slots and handed to a converter thread, which
+color-processes it and passes the slot to six long-lived workers, one per
+camera sensor. Converted images live in buffer sets from a LadybugFramePool,
+so nothing is allocated per frame. Each worker encodes its image to JPEG in
+memory on a shared LadybugJpegEncoder pool and queues it on a
+LadybugFileWriter, so no worker waits for the disk. A slot and its buffer
+set go back to the grab loop once all six images have been encoded.
+
+Usage: grabMultiThread [-n FRAMES] [-t THREADS] [-q QUALITY] [-s -c CALIBRATION_FILE]
+
+    -n FRAMES   Number of frames to grab. Default is 10.
+    -t THREADS  Number of JPEG encoder threads. Default is one per hardware
+                thread. With more threads than cameras, each image is split
+                into strips that are encoded in parallel.
+    -q QUALITY  JPEG quality, 1 - 100. Default is 85.
+    -s          Use a synthetic RAW8 image instead of a camera. This is for
+                benchmarking the pool on a machine without a Ladybug.
+    -c FILE     Calibration file used to process the synthetic image.
+
+Set LADYBUG_METRICS_FILE to write per-stage latency histograms while the
+program runs (see ladybugMetrics.h).
+
 */
 
 #include <iostream>
@@ -14,9 +38,20 @@ Kieran Hunt 21/01/2019
 #include <cstdlib>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
 #include <string>
+#include <vector>
 #include "ladybug.h"
+#include "ladybuggeom.h"
 #include "ladybugstream.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugFrameQueue.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
 
 
 
@@ -81,165 +116,454 @@ std::string getWriteableDirectory()
     return writeableDirectory;
 }
 
+double getCurrentMs()
+{
+    timespec currentTime;
+    if (clock_gettime(CLOCK_MONOTONIC, &currentTime))
+    {
+        return 0.0;
+    }
+    return currentTime.tv_sec * 1000.0 + currentTime.tv_nsec / 1000000.0;
+}
+
 } // namespace
 
 using namespace std;
 
-#define NUM_THREADS 6
+// One worker per camera sensor
+#define NUM_THREADS LADYBUG_NUM_CAMERAS
+
+// Number of frames that can be in flight between the grab loop and the workers
+#define NUM_FRAME_SLOTS 4
+
+// Size of the synthetic Ladybug5 sensor image
+#define SYNTHETIC_COLS 2048
+#define SYNTHETIC_ROWS 2448
+
+// A grabbed frame shared by the converter and the six camera workers
+struct FrameHandle
+{
+    LadybugImage image;
+    unsigned char *pRawData;
+    unsigned int uiRawCapacity;
+    LadybugBufferSet *pBufferSet;
+    int frames;
+    std::atomic<int> refCount;
+};
+
+// The grab loop hands slots to the converter, and the converter to each
+// camera worker, one producer and one consumer each. Slots come back to the
+// grab loop from the converter or whichever worker finishes last, so the
+// free list takes several producers. A pop fails once its queue is closed
+// and drained.
+typedef LadybugSpscQueue<FrameHandle *> FrameQueue;
+
+LadybugMpmcQueue<FrameHandle *> freeSlots;
+FrameQueue convertQueue;
+FrameQueue cameraQueues[NUM_THREADS];
+LadybugFramePool framePool;
+LadybugJpegEncoder jpegEncoder;
+LadybugFileWriter fileWriter;
+
+struct converterData
+{
+    LadybugContext context;
+};
 
 struct threadData
 {
     int uiCamera;
-        LadybugImage image;
-        LadybugContext context;
-        LadybugCameraInfo caminfo;
-        int frames;
-        int threadID;
-}; 
+    LadybugCameraInfo caminfo;
+    unsigned long framesSaved;
+};
 
-void *saveSingleImage(void *threadID)
+// Copy a grabbed image into a free slot. The SDK reuses its grab buffer on the
+// next ladybugGrabImage() call, so the raw data has to outlive the grab.
+void fillSlot(FrameHandle *slot, const LadybugImage &image, int frames)
 {
-    struct threadData *myData;
-    myData = (struct threadData *) threadID;
-    
-    // Allocate memory for the 6 processed images
-    unsigned char *arpBuffers[LADYBUG_NUM_CAMERAS] = {0};
-    for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+    unsigned int uiRawSize = image.uiDataSizeBytes;
+    if (uiRawSize == 0)
     {
-        arpBuffers[uiCamera] = new unsigned char[myData->image.uiRows * myData->image.uiCols * 4];
+        uiRawSize = image.uiFullCols * image.uiFullRows * LADYBUG_NUM_CAMERAS;
+    }
 
-        // Initialize the entire buffer so that the alpha channel has a valid (maximum) value.
-        memset(arpBuffers[uiCamera], 0xff, myData->image.uiRows * myData->image.uiCols * 4);
+    if (slot->uiRawCapacity < uiRawSize)
+    {
+        delete[] slot->pRawData;
+        slot->pRawData = new unsigned char[uiRawSize];
+        slot->uiRawCapacity = uiRawSize;
     }
+    memcpy(slot->pRawData, image.pData, uiRawSize);
+
+    slot->image = image;
+    slot->image.pData = slot->pRawData;
+    slot->frames = frames;
+}
 
-    // Color-process the image
-    printf("Converting image...\n");
-    LadybugError error = ::ladybugConvertImage(myData->context, &myData->image, arpBuffers, LADYBUG_BGRU);
+// Build a RAW8 BGGR test pattern the same shape as a Ladybug5 image
+void makeSyntheticImage(LadybugImage *pImage, unsigned char *pData)
+{
+    const unsigned int uiCameraSize = SYNTHETIC_COLS * SYNTHETIC_ROWS;
+    for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+    {
+        unsigned char *pCamera = pData + uiCamera * uiCameraSize;
+        for (unsigned int uiRow = 0; uiRow < SYNTHETIC_ROWS; uiRow++)
+        {
+            for (unsigned int uiCol = 0; uiCol < SYNTHETIC_COLS; uiCol++)
+            {
+                pCamera[uiRow * SYNTHETIC_COLS + uiCol] =
+                    (unsigned char)((uiRow + uiCol + uiCamera * 40) & 0xff);
+            }
+        }
+    }
 
-    // Save the image as 6 individual raw (unstitched, distorted) images
-    printf("Saving images...\n");
+    pImage->uiCols = SYNTHETIC_COLS;
+    pImage->uiRows = SYNTHETIC_ROWS;
+    pImage->uiFullCols = SYNTHETIC_COLS;
+    pImage->uiFullRows = SYNTHETIC_ROWS;
+    pImage->dataFormat = LADYBUG_DATAFORMAT_RAW8;
+    pImage->resolution = LADYBUG_RESOLUTION_2448x2048;
+    pImage->bStippled = true;
+    pImage->stippledFormat = LADYBUG_BGGR;
+    pImage->uiDataSizeBytes = uiCameraSize * LADYBUG_NUM_CAMERAS;
+    pImage->pData = pData;
+}
 
-    LadybugProcessedImage processedImage;
-    processedImage.pData = arpBuffers[myData->uiCamera];
-    processedImage.pixelFormat = LADYBUG_BGRU;
-    processedImage.uiCols = myData->image.uiCols;
-    processedImage.uiRows = myData->image.uiRows;
+void *convertFrames(void *arg)
+{
+    converterData *myData = (converterData *)arg;
 
-    char pszOutputFilePath[256] = {0};
-    sprintf(pszOutputFilePath, "ladybug_frame%03u_%u_camera_%02u.jpg", myData->frames, myData->caminfo.serialHead, myData->uiCamera);
-    const std::string outputPath = getWriteableDirectory() + std::string(pszOutputFilePath);
+    FrameHandle *frame;
+    while (convertQueue.pop(&frame))
+    {
+        frame->pBufferSet = framePool.acquire();
 
-    error = ::ladybugSaveImage(myData->context, &processedImage, outputPath.c_str(), LADYBUG_FILEFORMAT_JPG);
-    //_HANDLE_ERROR;
+        LadybugStageTimer convertTimer(LADYBUG_STAGE_CONVERT);
+        convertTimer.setBytes((unsigned long long)frame->pBufferSet->uiBufferSize * LADYBUG_NUM_CAMERAS);
+        LadybugError error = ::ladybugConvertImage(myData->context, &frame->image, frame->pBufferSet->arpBuffers, LADYBUG_BGRU);
+        convertTimer.stop();
+        if (error != LADYBUG_OK)
+        {
+            printf("Error: converting frame %d - %s\n", frame->frames, ::ladybugErrorToString(error));
+            framePool.release(frame->pBufferSet);
+            frame->pBufferSet = NULL;
+            freeSlots.push(frame);
+            continue;
+        }
 
-    printf("Saved camera %u image to %s.\n", myData->uiCamera, outputPath.c_str());
+        frame->refCount = NUM_THREADS;
+        for (int i = 0; i < NUM_THREADS; i++)
+        {
+            cameraQueues[i].push(frame);
+        }
+    }
 
-    // Clean up the buffers
-    for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+    for (int i = 0; i < NUM_THREADS; i++)
     {
-        delete arpBuffers[uiCamera];
+        cameraQueues[i].close();
     }
+
+    return NULL;
 }
 
-int main(int /* argc */, char ** /* argv[] */)
+void *saveSingleImage(void *arg)
 {
+    threadData *myData = (threadData *)arg;
+
+    FrameHandle *frame;
+    while (cameraQueues[myData->uiCamera].pop(&frame))
+    {
+        // Encode the image as an individual raw (unstitched, distorted) image
+        std::vector<unsigned char> jpeg;
+        LadybugError error = jpegEncoder.encodeImage(
+            frame->pBufferSet->arpBuffers[myData->uiCamera],
+            frame->image.uiCols,
+            frame->image.uiRows,
+            LADYBUG_BGRU,
+            &jpeg);
+
+        char pszOutputFilePath[256] = {0};
+        sprintf(pszOutputFilePath, "ladybug_frame%03u_%u_camera_%02u.jpg", frame->frames, myData->caminfo.serialHead, myData->uiCamera);
+        const std::string outputPath = getWriteableDirectory() + std::string(pszOutputFilePath);
+
+        // The last worker to finish with the frame returns the slot to the grab loop
+        if (--frame->refCount == 0)
+        {
+            framePool.release(frame->pBufferSet);
+            frame->pBufferSet = NULL;
+            freeSlots.push(frame);
+        }
+
+        if (error == LADYBUG_OK)
+        {
+            error = fileWriter.write(outputPath, std::move(jpeg));
+        }
+        if (error != LADYBUG_OK)
+        {
+            printf("Error: saving %s - %s\n", outputPath.c_str(), ::ladybugErrorToString(error));
+        }
+        else
+        {
+            myData->framesSaved++;
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int numFrames = 10;
+    unsigned int uiNumThreads = 0;
+    int iQuality = 85;
+    bool bSynthetic = false;
+    const char *pszConfigFile = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            numFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            uiNumThreads = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+        {
+            iQuality = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            bSynthetic = true;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            pszConfigFile = argv[++i];
+        }
+        else
+        {
+            printf("Usage: %s [-n FRAMES] [-t THREADS] [-q QUALITY] [-s -c CALIBRATION_FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (bSynthetic && pszConfigFile == NULL)
+    {
+        printf("Error: a calibration file (-c) is required with a synthetic source\n");
+        return EXIT_FAILURE;
+    }
+
+    LadybugMetrics &metrics = LadybugMetrics::instance();
+    metrics.setName("grabmultithread");
+    metrics.startPeriodicDumpFromEnvironment();
+
     // Initialize context.
     LadybugContext context;
     LadybugError error = ::ladybugCreateContext(&context);
     _HANDLE_ERROR;
 
-    // Initialize the first ladybug on the bus.
-    printf("Initializing...\n");
-    error = ::ladybugInitializeFromIndex(context, 0);
-    _HANDLE_ERROR;
-
-    // Get camera info
     LadybugCameraInfo caminfo;
-    error = ladybugGetCameraInfo(context, &caminfo);
-    //_HANDLE_ERROR("ladybugGetCameraInfo()");
+    memset(&caminfo, 0, sizeof(caminfo));
 
-    // Start up the camera according to device type and data format
-    printf("Starting %s (%u)...\n", caminfo.pszModelName, caminfo.serialHead);
+    // The converter uses its own context so that it never shares library
+    // state with the grab loop.
+    LadybugContext convertContext = NULL;
 
-    error = ::ladybugStart(context, LADYBUG_DATAFORMAT_RAW8);
-    _HANDLE_ERROR;
-
-    // Set color processing method
-    printf("Setting debayering method...\n");
-    error = ::ladybugSetColorProcessingMethod(context, LADYBUG_NEAREST_NEIGHBOR_FAST);
-    _HANDLE_ERROR;
+    unsigned char *pSyntheticData = NULL;
+    LadybugImage syntheticImage;
 
-    for (int frames = 0; frames < 10; frames++)
+    if (bSynthetic)
     {
+        printf("Using a synthetic %ux%u RAW8 source...\n", SYNTHETIC_COLS, SYNTHETIC_ROWS);
+        pSyntheticData = new unsigned char[SYNTHETIC_COLS * SYNTHETIC_ROWS * LADYBUG_NUM_CAMERAS];
+        makeSyntheticImage(&syntheticImage, pSyntheticData);
 
-        // Grab a single image.
-        printf("Grabbing image\n");
-        error = LADYBUG_FAILED;
-        LadybugImage image;
-
-        for (int i = 0; i < 10 && error != LADYBUG_OK; i++)
-        {
-            printf(".");
-            error = ::ladybugGrabImage(context, &image);
-        }
-        printf("\n");
+        error = ::ladybugCreateContext(&convertContext);
+        _HANDLE_ERROR;
+        error = ::ladybugLoadConfig(convertContext, pszConfigFile);
+        _HANDLE_ERROR;
+    }
+    else
+    {
+        // Initialize the first ladybug on the bus.
+        printf("Initializing...\n");
+        error = ::ladybugInitializeFromIndex(context, 0);
         _HANDLE_ERROR;
 
-        //call threads here
+        // Get camera info
+        error = ladybugGetCameraInfo(context, &caminfo);
+        _HANDLE_ERROR;
 
-        pthread_t threads[NUM_THREADS];
-        struct threadData td[NUM_THREADS];
-        int rc;
+        // Start up the camera according to device type and data format
+        printf("Starting %s (%u)...\n", caminfo.pszModelName, caminfo.serialHead);
 
-        for (int i = 0; i < NUM_THREADS; i++)
-        {
-            cout << "creating thread " << i << endl;
-            
-            td[i].uiCamera = i;
-            td[i].context = context;
-            td[i].image = image;
-            td[i].frames = frames;
-            td[i].caminfo = caminfo;
-            td[i].threadID = i;
+        error = ::ladybugStart(context, LADYBUG_DATAFORMAT_RAW8);
+        _HANDLE_ERROR;
 
-            rc = pthread_create(&threads[i], NULL, saveSingleImage, (void *)i);
+        // Hand the head's calibration to the converter context
+        printf("Loading config info...\n");
+        error = ::ladybugLoadConfig(context, NULL);
+        _HANDLE_ERROR;
 
-            if (rc)
-            {
-                cout << "Error creating thread " << rc << endl;
-                exit(-1);
-            }
-        }
-        pthread_exit(NULL);
+        error = ::ladybugCreateContextWithCalibration(context, &convertContext);
+        _HANDLE_ERROR;
     }
 
-    // Destroy the context
-    printf("Destroying context...\n");
-    error = ::ladybugDestroyContext(&context);
+    // Set color processing method
+    printf("Setting debayering method...\n");
+    error = ::ladybugSetColorProcessingMethod(convertContext, LADYBUG_NEAREST_NEIGHBOR_FAST);
     _HANDLE_ERROR;
 
-    printf("Done.\n");
+    // Set up the frame slots and queues
+    FrameHandle slots[NUM_FRAME_SLOTS];
+    freeSlots.initialize(NUM_FRAME_SLOTS);
+    convertQueue.initialize(NUM_FRAME_SLOTS);
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        cameraQueues[i].initialize(NUM_FRAME_SLOTS);
+    }
+    for (int i = 0; i < NUM_FRAME_SLOTS; i++)
+    {
+        slots[i].pRawData = NULL;
+        slots[i].uiRawCapacity = 0;
+        slots[i].pBufferSet = NULL;
+        slots[i].refCount = 0;
+        freeSlots.push(&slots[i]);
+    }
 
-    return 0;
-}
+    // Start the encoder pool and the file writer
+    error = jpegEncoder.initialize(uiNumThreads, iQuality);
+    _HANDLE_ERROR;
+    error = fileWriter.start();
+    _HANDLE_ERROR;
 
+    // Start the converter and one worker per camera
+    pthread_t converterThread;
+    converterData cd;
+    cd.context = convertContext;
 
+    int rc = pthread_create(&converterThread, NULL, convertFrames, &cd);
+    if (rc)
+    {
+        cout << "Error creating converter thread " << rc << endl;
+        exit(-1);
+    }
 
-int createThreads()
-{
     pthread_t threads[NUM_THREADS];
-    int rc;
+    threadData td[NUM_THREADS];
 
     for (int i = 0; i < NUM_THREADS; i++)
     {
         cout << "creating thread " << i << endl;
-        rc = pthread_create(&threads[i], NULL, saveSingleImage, (void *)i);
 
+        td[i].uiCamera = i;
+        td[i].caminfo = caminfo;
+        td[i].framesSaved = 0;
+
+        rc = pthread_create(&threads[i], NULL, saveSingleImage, &td[i]);
         if (rc)
         {
             cout << "Error creating thread " << rc << endl;
             exit(-1);
         }
     }
-    pthread_exit(NULL);
-}
\ No newline at end of file
+
+    const double dStartMs = getCurrentMs();
+    double dStalledMs = 0.0;
+    int framesGrabbed = 0;
+
+    for (int frames = 0; frames < numFrames; frames++)
+    {
+        // Grab a single image.
+        LadybugImage image;
+        LadybugStageTimer grabTimer(LADYBUG_STAGE_GRAB);
+
+        if (bSynthetic)
+        {
+            image = syntheticImage;
+            error = LADYBUG_OK;
+        }
+        else
+        {
+            error = LADYBUG_FAILED;
+            for (int i = 0; i < 10 && error != LADYBUG_OK; i++)
+            {
+                error = ::ladybugGrabImage(context, &image);
+            }
+        }
+        if (error != LADYBUG_OK)
+        {
+            printf("Error: Ladybug library reported - %s\n", ::ladybugErrorToString(error));
+            break;
+        }
+        grabTimer.setBytes(image.uiDataSizeBytes);
+        grabTimer.stop();
+
+        // Every slot gets a buffer set, so the converter never waits on the pool
+        if (!framePool.isInitialized())
+        {
+            error = framePool.initialize(NUM_FRAME_SLOTS, image.uiCols, image.uiRows, LADYBUG_BGRU);
+            if (error != LADYBUG_OK)
+            {
+                printf("Error: allocating frame buffers - %s\n", ::ladybugErrorToString(error));
+                break;
+            }
+        }
+
+        // Wait for a free slot. This only blocks when the workers are NUM_FRAME_SLOTS frames behind.
+        const double dWaitMs = getCurrentMs();
+        FrameHandle *slot = NULL;
+        freeSlots.pop(&slot);
+        dStalledMs += getCurrentMs() - dWaitMs;
+
+        fillSlot(slot, image, frames);
+        convertQueue.push(slot);
+        framesGrabbed++;
+    }
+
+    // Let the pipeline drain, then stop the threads
+    convertQueue.close();
+    pthread_join(converterThread, NULL);
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    const double dElapsedMs = getCurrentMs() - dStartMs;
+    printf("Grabbed %d frames in %.1fms (%.2f fps), grab loop stalled for %.1fms\n",
+           framesGrabbed, dElapsedMs, framesGrabbed * 1000.0 / dElapsedMs, dStalledMs);
+    // Write whatever is still queued
+    fileWriter.stop();
+    jpegEncoder.shutdown();
+
+    framePool.printStats("Frame pool");
+    jpegEncoder.printStats("JPEG encoder");
+    fileWriter.printStats("File writer");
+    freeSlots.printStats("Free slots");
+    convertQueue.printStats("Convert queue");
+    metrics.stopPeriodicDump();
+    metrics.printSummary();
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        printf("Camera %d: saved %lu images\n", i, td[i].framesSaved);
+    }
+
+    // Clean up the buffers
+    for (int i = 0; i < NUM_FRAME_SLOTS; i++)
+    {
+        delete[] slots[i].pRawData;
+    }
+    delete[] pSyntheticData;
+
+    // Destroy the contexts
+    printf("Destroying context...\n");
+    error = ::ladybugDestroyContext(&convertContext);
+    _HANDLE_ERROR;
+    error = ::ladybugDestroyContext(&context);
+    _HANDLE_ERROR;
+
+    printf("Done.\n");
+
+    return 0;
+}
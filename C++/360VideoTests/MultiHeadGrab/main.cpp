@@ -0,0 +1,418 @@
+//=============================================================================
+// Grabs from every Ladybug on the bus at the same time and saves the six
+// camera images of each head's frames as JPEG files.
+//
+// This program does:
+//  - enumerate the cameras and start one context per head
+//  - capture each head on its own thread with ladybugLockNext()
+//  - convert, encode and write each head's frames on that head's own thread,
+//    with its own frame pool, JPEG encoder and file writer
+//  - match frames across heads by timestamp and log the groups to a CSV file
+//
+// Usage: LadybugMultiHeadGrab [-t SECONDS] [-n HEADS] [-q QUALITY]
+//                             [-m TOLERANCE_MS] [-r FPS] [-s FPS] [-o DIR]
+//
+//  -t SECONDS       How long to capture (default 10)
+//  -n HEADS         Use at most HEADS cameras (default all). With -s, the
+//                   number of synthetic heads (default 2).
+//  -q QUALITY       JPEG quality (default 85)
+//  -m TOLERANCE_MS  Largest timestamp difference between frames of a group
+//                   (default 10)
+//  -r FPS           Expected frame rate, for counting dropped frames
+//                   (default learnt from the first frames, or the -s rate)
+//  -s FPS           Grab from synthetic sources at FPS frames per second
+//                   instead of cameras. See ladybugSyntheticSource.h.
+//  -o DIR           Output directory (default the home directory)
+//
+// Files are named ladybug_SERIAL_frameNNNNNN_camera_NN.jpg. groups.csv holds
+// one line per group with the frame index and timestamp of every head.
+// Dropped frames and jitter are reported per head (see ladybugFrameTiming.h).
+//
+// Set LADYBUG_METRICS_FILE to write per-stage latency histograms while the
+// program runs (see ladybugMetrics.h).
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ladybug.h"
+#include "ladybuggeom.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugDemosaic.h"
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugMultiHeadCapture.h"
+#include "ladybugSyntheticSource.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <pwd.h>
+
+#define _HANDLE_ERROR                                 \
+    if (error != LADYBUG_OK)                          \
+    {                                                 \
+        printf(                                       \
+            "Error: Ladybug library reported - %s\n", \
+            ::ladybugErrorToString(error));           \
+        return EXIT_FAILURE;                          \
+    }
+
+namespace
+{
+std::string getWriteableDirectory()
+{
+    std::string writeableDirectory;
+    const char *homedir;
+
+    if ((homedir = getenv("HOME")) == NULL)
+    {
+        struct passwd *pw = getpwuid(getuid());
+        homedir = (pw == NULL) ? NULL : pw->pw_dir;
+    }
+    if (homedir != NULL)
+    {
+        writeableDirectory.append(homedir).append("/");
+    }
+
+    return writeableDirectory;
+}
+
+// Converts, encodes and writes the frames of one head
+class HeadSink : public LadybugHeadSink
+{
+public:
+    HeadSink()
+        : m_processContext(NULL), m_bDemosaic(false), m_uiSerial(0), m_ulFramesSaved(0), m_ulErrors(0)
+    {
+    }
+
+    ~HeadSink()
+    {
+        shutdown();
+    }
+
+    // Convert with ladybugConvertImage() on processContext, or with the
+    // in-tree demosaicer if it is NULL
+    LadybugError initialize(LadybugContext processContext, unsigned int uiSerial, const std::string &outputDirectory, int iQuality, unsigned int uiEncodeThreads)
+    {
+        m_processContext = processContext;
+        m_bDemosaic = (processContext == NULL);
+        m_uiSerial = uiSerial;
+        m_outputDirectory = outputDirectory;
+
+        LadybugError error = LADYBUG_OK;
+        if (m_bDemosaic)
+        {
+            // Heads share the machine, so do not pin the workers to cores
+            error = m_demosaicer.initialize(LADYBUG_DEMOSAIC_NEAREST, LADYBUG_SIMD_AVX2, false);
+        }
+        if (error == LADYBUG_OK)
+        {
+            error = m_jpegEncoder.initialize(uiEncodeThreads, iQuality);
+        }
+        if (error == LADYBUG_OK)
+        {
+            error = m_fileWriter.start();
+        }
+        return error;
+    }
+
+    void shutdown()
+    {
+        m_fileWriter.stop();
+        m_jpegEncoder.shutdown();
+        m_demosaicer.shutdown();
+        if (m_processContext != NULL)
+        {
+            ::ladybugDestroyContext(&m_processContext);
+            m_processContext = NULL;
+        }
+    }
+
+    void processFrame(unsigned int /* uiHead */, const LadybugLockedFrame &frame)
+    {
+        const LadybugImage &image = frame.image;
+
+        // The pool is sized from the first frame
+        unsigned int uiCols = image.uiCols;
+        unsigned int uiRows = image.uiRows;
+        if (m_bDemosaic)
+        {
+            m_demosaicer.getOutputSize(image, &uiCols, &uiRows);
+        }
+        if (!m_framePool.isInitialized() &&
+            m_framePool.initialize(1, uiCols, uiRows, LADYBUG_BGRU) != LADYBUG_OK)
+        {
+            m_ulErrors++;
+            return;
+        }
+        LadybugBufferSet *pBufferSet = m_framePool.acquire();
+
+        LadybugError error = LADYBUG_OK;
+        if (m_bDemosaic)
+        {
+            error = m_demosaicer.demosaic(image, pBufferSet->arpBuffers);
+        }
+        else
+        {
+            LadybugImage convertImage = image;
+            LadybugStageTimer convertTimer(LADYBUG_STAGE_CONVERT);
+            convertTimer.setBytes((unsigned long long)pBufferSet->uiBufferSize * LADYBUG_NUM_CAMERAS);
+            error = ::ladybugConvertImage(m_processContext, &convertImage, pBufferSet->arpBuffers, LADYBUG_BGRU);
+        }
+
+        std::vector<unsigned char> jpegs[LADYBUG_NUM_CAMERAS];
+        if (error == LADYBUG_OK)
+        {
+            error = m_jpegEncoder.encodeImages(pBufferSet->arpBuffers, LADYBUG_NUM_CAMERAS, uiCols, uiRows, LADYBUG_BGRU, jpegs);
+        }
+        m_framePool.release(pBufferSet);
+
+        for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS && error == LADYBUG_OK; uiCamera++)
+        {
+            char pszFileName[128] = {0};
+            sprintf(pszFileName, "ladybug_%u_frame%06llu_camera_%02u.jpg", m_uiSerial, frame.ulFrameIndex, uiCamera);
+            error = m_fileWriter.write(m_outputDirectory + pszFileName, std::move(jpegs[uiCamera]));
+        }
+
+        if (error == LADYBUG_OK)
+        {
+            m_ulFramesSaved++;
+        }
+        else
+        {
+            m_ulErrors++;
+        }
+    }
+
+    void printStats(const char *pszName) const
+    {
+        printf("%s: %llu frames saved, %llu errors\n", pszName, m_ulFramesSaved, m_ulErrors);
+
+        const std::string name(pszName);
+        m_framePool.printStats((name + " frame pool").c_str());
+        if (m_bDemosaic)
+        {
+            m_demosaicer.printStats((name + " demosaicer").c_str());
+        }
+        m_jpegEncoder.printStats((name + " JPEG encoder").c_str());
+        m_fileWriter.printStats((name + " file writer").c_str());
+    }
+
+private:
+    LadybugContext m_processContext;
+    bool m_bDemosaic;
+    LadybugDemosaicer m_demosaicer;
+    LadybugFramePool m_framePool;
+    LadybugJpegEncoder m_jpegEncoder;
+    LadybugFileWriter m_fileWriter;
+    unsigned int m_uiSerial;
+    std::string m_outputDirectory;
+
+    // Only touched on the head's sink thread, and read after stop()
+    unsigned long long m_ulFramesSaved;
+    unsigned long long m_ulErrors;
+};
+
+// The capture thread owns the camera context, so frames are converted on a
+// second context loaded with the same calibration
+LadybugError createProcessContext(LadybugContext cameraContext, LadybugContext *pProcessContext)
+{
+    LadybugError error = ::ladybugLoadConfig(cameraContext, NULL);
+    if (error != LADYBUG_OK)
+    {
+        return error;
+    }
+
+    error = ::ladybugCreateContextWithCalibration(cameraContext, pProcessContext);
+    if (error == LADYBUG_OK)
+    {
+        error = ::ladybugSetColorProcessingMethod(*pProcessContext, LADYBUG_NEAREST_NEIGHBOR_FAST);
+    }
+    return error;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double dSeconds = 10.0;
+    unsigned int uiMaxHeads = 0;
+    int iQuality = 85;
+    bool bSynthetic = false;
+    LadybugSyntheticConfig syntheticConfig;
+    LadybugMultiHeadConfig config;
+    std::string outputDirectory = getWriteableDirectory();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            dSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            uiMaxHeads = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+        {
+            iQuality = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            config.dMatchToleranceMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            config.dFrameRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            bSynthetic = true;
+            syntheticConfig.dFrameRate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            outputDirectory = std::string(argv[++i]) + "/";
+        }
+        else
+        {
+            printf("Usage: %s [-t SECONDS] [-n HEADS] [-q QUALITY] [-m TOLERANCE_MS] [-r FPS] [-s FPS] [-o DIR]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    LadybugMetrics &metrics = LadybugMetrics::instance();
+    metrics.setName("multiheadgrab");
+    metrics.startPeriodicDumpFromEnvironment();
+
+    LadybugError error = LADYBUG_OK;
+
+    // The sources must outlive the capture
+    std::vector<std::unique_ptr<LadybugSyntheticSource> > syntheticSources;
+    LadybugMultiHeadCapture capture;
+    std::vector<unsigned int> serials;
+
+    if (bSynthetic)
+    {
+        const unsigned int uiNumHeads = (uiMaxHeads == 0) ? 2 : uiMaxHeads;
+        printf("Generating synthetic frames for %u heads...\n", uiNumHeads);
+
+        std::vector<LadybugFrameSource *> sources;
+        syntheticConfig.uiNumBuffers = config.uiNumBuffers;
+        if (config.dFrameRate == 0.0)
+        {
+            config.dFrameRate = syntheticConfig.dFrameRate;
+        }
+        for (unsigned int i = 0; i < uiNumHeads; i++)
+        {
+            syntheticSources.push_back(std::unique_ptr<LadybugSyntheticSource>(new LadybugSyntheticSource()));
+            syntheticConfig.uiSerialNumber++;
+            error = syntheticSources.back()->initialize(syntheticConfig);
+            _HANDLE_ERROR;
+            sources.push_back(syntheticSources.back().get());
+            serials.push_back(syntheticConfig.uiSerialNumber);
+        }
+
+        error = capture.initialize(config, sources);
+        _HANDLE_ERROR;
+    }
+    else
+    {
+        printf("Initializing...\n");
+        config.uiMaxHeads = uiMaxHeads;
+        error = capture.initialize(config);
+        _HANDLE_ERROR;
+
+        for (unsigned int i = 0; i < capture.getNumHeads(); i++)
+        {
+            const LadybugCameraInfo &caminfo = capture.getCameraInfo(i);
+            printf("Head %u: %s (%u)\n", i, caminfo.pszModelName, caminfo.serialHead);
+            serials.push_back(caminfo.serialHead);
+        }
+    }
+
+    // Split the encoder threads between the heads
+    const unsigned int uiNumHeads = capture.getNumHeads();
+    const unsigned int uiEncodeThreads = std::max(1u, std::thread::hardware_concurrency() / uiNumHeads);
+
+    std::vector<std::unique_ptr<HeadSink> > sinks;
+    for (unsigned int i = 0; i < uiNumHeads; i++)
+    {
+        LadybugContext processContext = NULL;
+        if (!bSynthetic)
+        {
+            error = createProcessContext(capture.getContext(i), &processContext);
+            _HANDLE_ERROR;
+        }
+
+        sinks.push_back(std::unique_ptr<HeadSink>(new HeadSink()));
+        error = sinks.back()->initialize(processContext, serials[i], outputDirectory, iQuality, uiEncodeThreads);
+        _HANDLE_ERROR;
+        capture.setSink(i, sinks.back().get());
+    }
+
+    const std::string groupsPath = outputDirectory + "groups.csv";
+    FILE *pGroups = fopen(groupsPath.c_str(), "w");
+    if (pGroups == NULL)
+    {
+        printf("Error: could not open %s\n", groupsPath.c_str());
+        return EXIT_FAILURE;
+    }
+    fprintf(pGroups, "group,spread_ms");
+    for (unsigned int i = 0; i < uiNumHeads; i++)
+    {
+        fprintf(pGroups, ",frame_%u,time_us_%u", serials[i], serials[i]);
+    }
+    fprintf(pGroups, "\n");
+
+    printf("Capturing from %u heads for %.1f s...\n", uiNumHeads, dSeconds);
+    error = capture.start();
+    _HANDLE_ERROR;
+
+    const std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds((long long)(dSeconds * 1000.0));
+    while (std::chrono::steady_clock::now() < end)
+    {
+        LadybugFrameGroup group;
+        if (!capture.nextGroup(&group, 100))
+        {
+            continue;
+        }
+
+        fprintf(pGroups, "%llu,%.3f", group.ulGroupIndex, group.dSpreadMs);
+        for (unsigned int i = 0; i < uiNumHeads; i++)
+        {
+            fprintf(pGroups, ",%llu,%llu", group.arulFrameIndex[i], group.arulTimeUs[i]);
+        }
+        fprintf(pGroups, "\n");
+    }
+
+    capture.stop();
+    fclose(pGroups);
+
+    capture.printStats("Capture");
+    for (unsigned int i = 0; i < uiNumHeads; i++)
+    {
+        char pszName[64] = {0};
+        sprintf(pszName, "Head %u", i);
+        sinks[i]->shutdown();
+        sinks[i]->printStats(pszName);
+    }
+    metrics.stopPeriodicDump();
+    metrics.printSummary();
+
+    printf("Wrote %s.\n", groupsPath.c_str());
+    printf("Done.\n");
+
+    return 0;
+}
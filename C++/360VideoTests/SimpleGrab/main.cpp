@@ -25,16 +25,49 @@
 //  - start transmission of images
 //  - grab an image
 //  - color process the grabbed image
-//  - save the 6 raw images in BMP files
+//  - save the 6 raw images in BMP files on a background writer thread
 //  - destroy the context
 //
+// Usage: LadybugSimpleGrab [-l NUM_BUFFERS] [-d METHOD] [-s FPS] [-p PPM_DIR]
+//
+//  -l NUM_BUFFERS  Capture with ladybugLockNext() into NUM_BUFFERS driver
+//                  buffers on a separate thread, so the camera keeps
+//                  delivering images while frames are converted and saved.
+//  -d METHOD       Demosaic with the in-tree kernels (nearest, bilinear or
+//                  down4) on one thread per camera instead of
+//                  ladybugConvertImage(). See ladybugDemosaic.h.
+//  -s FPS          Grab from a synthetic source at FPS frames per second
+//                  (0 for as fast as possible) instead of a camera. See
+//                  ladybugSyntheticSource.h. Implies -d nearest unless -d is
+//                  given, as there is no calibration to convert with.
+//  -p PPM_DIR      Like -s, with frames read from the PPM files in PPM_DIR.
+//
+// The timestamps of the grabbed images are checked for dropped frames and
+// jitter, and the capture thread for falling behind (see
+// ladybugFrameTiming.h).
+//
+// Set LADYBUG_METRICS_FILE to write per-stage latency histograms while the
+// program runs (see ladybugMetrics.h).
+//
 //=============================================================================
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ladybug.h"
+#include "ladybuggeom.h"
 #include "ladybugstream.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugDemosaic.h"
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugFrameSource.h"
+#include "ladybugFrameTiming.h"
+#include "ladybugLockNextCapture.h"
+#include "ladybugMetrics.h"
+#include "ladybugSyntheticSource.h"
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
 
@@ -97,34 +130,237 @@ std::string getWriteableDirectory()
     return writeableDirectory;
 }
 
+void putLittleEndian(unsigned char *pDst, unsigned int uiValue, unsigned int uiBytes)
+{
+    for (unsigned int i = 0; i < uiBytes; i++)
+    {
+        pDst[i] = (unsigned char)(uiValue >> (8 * i));
+    }
+}
+
+// Encode a BGRU image as a 24-bit BMP in memory
+void encodeBmp(const unsigned char *pImage, unsigned int uiCols, unsigned int uiRows, std::vector<unsigned char> *pOutput)
+{
+    const unsigned int uiHeaderSize = 14 + 40;
+    const unsigned int uiStride = (uiCols * 3 + 3) & ~3u;
+    const unsigned int uiImageSize = uiStride * uiRows;
+
+    pOutput->assign(uiHeaderSize + uiImageSize, 0);
+    unsigned char *pHeader = pOutput->data();
+
+    // BITMAPFILEHEADER
+    pHeader[0] = 'B';
+    pHeader[1] = 'M';
+    putLittleEndian(pHeader + 2, uiHeaderSize + uiImageSize, 4);
+    putLittleEndian(pHeader + 10, uiHeaderSize, 4);
+
+    // BITMAPINFOHEADER
+    putLittleEndian(pHeader + 14, 40, 4);
+    putLittleEndian(pHeader + 18, uiCols, 4);
+    putLittleEndian(pHeader + 22, uiRows, 4);
+    putLittleEndian(pHeader + 26, 1, 2);
+    putLittleEndian(pHeader + 28, 24, 2);
+    putLittleEndian(pHeader + 34, uiImageSize, 4);
+
+    // Rows are stored bottom up
+    for (unsigned int uiRow = 0; uiRow < uiRows; uiRow++)
+    {
+        const unsigned char *pSrc = pImage + (size_t)(uiRows - 1 - uiRow) * uiCols * 4;
+        unsigned char *pDst = pHeader + uiHeaderSize + (size_t)uiRow * uiStride;
+        for (unsigned int uiCol = 0; uiCol < uiCols; uiCol++)
+        {
+            pDst[0] = pSrc[0];
+            pDst[1] = pSrc[1];
+            pDst[2] = pSrc[2];
+            pSrc += 4;
+            pDst += 3;
+        }
+    }
+}
+
 } // namespace
 
-int main(int /* argc */, char /* argv[] */)
+int main(int argc, char **argv)
 {
-    // Initialize context.
-    LadybugContext context;
-    LadybugError error = ::ladybugCreateContext(&context);
-    _HANDLE_ERROR;
+    unsigned int uiNumBuffers = 0;
+    bool bDemosaic = false;
+    LadybugDemosaicMethod demosaicMethod = LADYBUG_DEMOSAIC_NEAREST;
+    bool bSynthetic = false;
+    LadybugSyntheticConfig syntheticConfig;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "-l") == 0)
+        {
+            uiNumBuffers = (unsigned int)atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-d") == 0)
+        {
+            bDemosaic = true;
+            const char *pszMethod = argv[++i];
+            if (strcmp(pszMethod, "nearest") == 0)
+            {
+                demosaicMethod = LADYBUG_DEMOSAIC_NEAREST;
+            }
+            else if (strcmp(pszMethod, "bilinear") == 0)
+            {
+                demosaicMethod = LADYBUG_DEMOSAIC_BILINEAR;
+            }
+            else if (strcmp(pszMethod, "down4") == 0)
+            {
+                demosaicMethod = LADYBUG_DEMOSAIC_DOWN4;
+            }
+            else
+            {
+                printf("Error: unknown demosaic method %s\n", pszMethod);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+        {
+            bSynthetic = true;
+            syntheticConfig.dFrameRate = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-p") == 0)
+        {
+            bSynthetic = true;
+            syntheticConfig.ppmDirectory = argv[++i];
+        }
+        else
+        {
+            printf("Usage: %s [-l NUM_BUFFERS] [-d nearest|bilinear|down4] [-s FPS] [-p PPM_DIR]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const bool bLockNext = uiNumBuffers > 0;
+    if (bLockNext && uiNumBuffers < 3)
+    {
+        printf("Error: lock next capture needs at least 3 buffers\n");
+        return EXIT_FAILURE;
+    }
 
-    // Initialize the first ladybug on the bus.
-    printf("Initializing...\n");
-    error = ::ladybugInitializeFromIndex(context, 0);
-    _HANDLE_ERROR;
+    // A synthetic source has no calibration for ladybugConvertImage()
+    bDemosaic = bDemosaic || bSynthetic;
 
-    // Get camera info
+    LadybugMetrics &metrics = LadybugMetrics::instance();
+    metrics.setName("simplegrab");
+    metrics.startPeriodicDumpFromEnvironment();
+
+    LadybugContext context = NULL;
+    LadybugError error = LADYBUG_OK;
     LadybugCameraInfo caminfo;
-    error = ladybugGetCameraInfo(context, &caminfo);
-    _HANDLE_ERROR("ladybugGetCameraInfo()");
+
+    // Images are grabbed from the camera or the synthetic source through pSource
+    LadybugCameraSource cameraSource;
+    LadybugSyntheticSource syntheticSource;
+    LadybugFrameSource *pSource = &cameraSource;
+
+    if (bSynthetic)
+    {
+        printf("Generating synthetic frames...\n");
+        if (bLockNext)
+        {
+            syntheticConfig.uiNumBuffers = uiNumBuffers;
+        }
+        error = syntheticSource.initialize(syntheticConfig);
+        _HANDLE_ERROR;
+        syntheticSource.getCameraInfo(&caminfo);
+        pSource = &syntheticSource;
+    }
+    else
+    {
+        // Initialize context.
+        error = ::ladybugCreateContext(&context);
+        _HANDLE_ERROR;
+
+        // Initialize the first ladybug on the bus.
+        printf("Initializing...\n");
+        if (bLockNext)
+        {
+            error = ::ladybugInitializePlus(context, 0, uiNumBuffers, NULL, 0);
+        }
+        else
+        {
+            error = ::ladybugInitializeFromIndex(context, 0);
+        }
+        _HANDLE_ERROR;
+        cameraSource.setContext(context);
+
+        // Get camera info
+        error = ladybugGetCameraInfo(context, &caminfo);
+        _HANDLE_ERROR("ladybugGetCameraInfo()");
+    }
 
     // Start up the camera according to device type and data format
     printf("Starting %s (%u)...\n", caminfo.pszModelName, caminfo.serialHead);
 
-    error = ::ladybugStart(context, LADYBUG_DATAFORMAT_RAW8);
-    _HANDLE_ERROR;
+    // In lock next mode the capture thread owns the camera context, so
+    // images are converted and saved through a second context loaded with
+    // the same calibration.
+    LadybugContext processContext = context;
+    LadybugLockNextCapture capture;
+    unsigned int uiConsumer = 0;
+    LadybugFrameTimingAnalyzer timing;
+
+    if (bSynthetic)
+    {
+        if (bLockNext)
+        {
+            // Keep two buffers free, as with the camera
+            error = capture.initialize(pSource, uiNumBuffers - 2, 1000);
+            _HANDLE_ERROR;
+            uiConsumer = capture.addConsumer();
+            capture.setTimingAnalyzer(&timing);
+            error = capture.start();
+            _HANDLE_ERROR;
+        }
+    }
+    else if (bLockNext)
+    {
+        error = ::ladybugStartLockNext(context, LADYBUG_DATAFORMAT_RAW8);
+        _HANDLE_ERROR;
+
+        printf("Loading config info...\n");
+        error = ::ladybugLoadConfig(context, NULL);
+        _HANDLE_ERROR;
+
+        error = ::ladybugCreateContextWithCalibration(context, &processContext);
+        _HANDLE_ERROR;
+
+        // Keep two driver buffers free for the camera to fill
+        error = capture.initialize(context, uiNumBuffers - 2, 1000);
+        _HANDLE_ERROR;
+        uiConsumer = capture.addConsumer();
+        capture.setTimingAnalyzer(&timing);
+        error = capture.start();
+        _HANDLE_ERROR;
+    }
+    else
+    {
+        error = ::ladybugStart(context, LADYBUG_DATAFORMAT_RAW8);
+        _HANDLE_ERROR;
+    }
 
     // Set color processing method
-    printf("Setting debayering method...\n");
-    error = ::ladybugSetColorProcessingMethod(context, LADYBUG_NEAREST_NEIGHBOR_FAST);
+    if (!bSynthetic)
+    {
+        printf("Setting debayering method...\n");
+        error = ::ladybugSetColorProcessingMethod(processContext, LADYBUG_NEAREST_NEIGHBOR_FAST);
+        _HANDLE_ERROR;
+    }
+
+    // Buffers for the 6 processed images, reused for every frame
+    LadybugFramePool framePool;
+
+    LadybugDemosaicer demosaicer;
+    if (bDemosaic)
+    {
+        error = demosaicer.initialize(demosaicMethod);
+        _HANDLE_ERROR;
+    }
+
+    // Writes the BMP files so the grab loop never waits for the disk
+    LadybugFileWriter fileWriter;
+    error = fileWriter.start();
     _HANDLE_ERROR;
 
     for (int frames = 0; frames < 30; frames++)
@@ -134,60 +370,132 @@ int main(int /* argc */, char /* argv[] */)
         printf("Grabbing image\n");
         error = LADYBUG_FAILED;
         LadybugImage image;
+        LadybugLockedFrame *pFrame = NULL;
+        LadybugStageTimer grabTimer(LADYBUG_STAGE_GRAB);
 
-        for (int i = 0; i < 10 && error != LADYBUG_OK; i++)
+        if (bLockNext)
         {
-            printf(".");
-            error = ::ladybugGrabImage(context, &image);
+            pFrame = capture.nextFrame(uiConsumer, 10000);
+            if (pFrame != NULL)
+            {
+                image = pFrame->image;
+                error = LADYBUG_OK;
+            }
+            else
+            {
+                error = capture.getError() != LADYBUG_OK ? capture.getError() : LADYBUG_TIMEOUT;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 10 && error != LADYBUG_OK; i++)
+            {
+                printf(".");
+                error = pSource->grabImage(&image);
+            }
+            if (error == LADYBUG_OK)
+            {
+                timing.addFrame(image);
+            }
         }
         printf("\n");
         _HANDLE_ERROR;
+        grabTimer.setBytes(image.uiDataSizeBytes);
+        grabTimer.stop();
 
-        // Allocate memory for the 6 processed images
-        unsigned char *arpBuffers[LADYBUG_NUM_CAMERAS] = {0};
-        for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+        // Get the buffers for the 6 processed images. The pool is sized from the first frame.
+        unsigned int uiCols = image.uiCols;
+        unsigned int uiRows = image.uiRows;
+        if (bDemosaic)
         {
-            arpBuffers[uiCamera] = new unsigned char[image.uiRows * image.uiCols * 4];
-
-            // Initialize the entire buffer so that the alpha channel has a valid (maximum) value.
-            memset(arpBuffers[uiCamera], 0xff, image.uiRows * image.uiCols * 4);
+            demosaicer.getOutputSize(image, &uiCols, &uiRows);
         }
+        if (!framePool.isInitialized())
+        {
+            error = framePool.initialize(1, uiCols, uiRows, LADYBUG_BGRU);
+            _HANDLE_ERROR;
+        }
+        LadybugBufferSet *pBufferSet = framePool.acquire();
+        unsigned char **arpBuffers = pBufferSet->arpBuffers;
 
         // Color-process the image
         printf("Converting image...\n");
-        error = ::ladybugConvertImage(context, &image, arpBuffers, LADYBUG_BGRU);
+        if (bDemosaic)
+        {
+            // The demosaicer times itself
+            error = demosaicer.demosaic(image, arpBuffers);
+        }
+        else
+        {
+            LadybugStageTimer convertTimer(LADYBUG_STAGE_CONVERT);
+            convertTimer.setBytes((unsigned long long)pBufferSet->uiBufferSize * LADYBUG_NUM_CAMERAS);
+            error = ::ladybugConvertImage(processContext, &image, arpBuffers, LADYBUG_BGRU);
+        }
+
+        // The raw image is no longer needed, so let the driver reuse its buffer
+        capture.release(pFrame);
 
         // Save the image as 6 individual raw (unstitched, distorted) images
         printf("Saving images...\n");
         for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
         {
-            LadybugProcessedImage processedImage;
-            processedImage.pData = arpBuffers[uiCamera];
-            processedImage.pixelFormat = LADYBUG_BGRU;
-            processedImage.uiCols = image.uiCols;
-            processedImage.uiRows = image.uiRows;
-
             char pszOutputFilePath[256] = {0};
             sprintf(pszOutputFilePath, "ladybug_frame%03u_%u_camera_%02u.bmp", frames,caminfo.serialHead, uiCamera);
             const std::string outputPath = getWriteableDirectory() + std::string(pszOutputFilePath);
 
-            error = ::ladybugSaveImage(context, &processedImage, outputPath.c_str(), LADYBUG_FILEFORMAT_BMP);
+            std::vector<unsigned char> bmp;
+            {
+                LadybugStageTimer encodeTimer(LADYBUG_STAGE_ENCODE);
+                encodeBmp(arpBuffers[uiCamera], uiCols, uiRows, &bmp);
+                encodeTimer.setBytes(bmp.size());
+            }
+
+            error = fileWriter.write(outputPath, std::move(bmp));
             _HANDLE_ERROR;
 
-            printf("Saved camera %u image to %s.\n", uiCamera, outputPath.c_str());
+            printf("Queued camera %u image for %s.\n", uiCamera, outputPath.c_str());
         }
 
-        // Clean up the buffers
-        for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+        // Return the buffers to the pool
+        framePool.release(pBufferSet);
+    }
+
+    fileWriter.stop();
+
+    framePool.printStats("Frame pool");
+    if (bDemosaic)
+    {
+        demosaicer.shutdown();
+        demosaicer.printStats("Demosaicer");
+    }
+    fileWriter.printStats("File writer");
+    metrics.stopPeriodicDump();
+    metrics.printSummary();
+
+    if (bLockNext)
+    {
+        capture.stop();
+        capture.printStats("Capture");
+    }
+    timing.printStats("Frame timing");
+
+    if (bSynthetic)
+    {
+        syntheticSource.printStats("Synthetic source");
+    }
+    else
+    {
+        if (bLockNext)
         {
-            delete arpBuffers[uiCamera];
+            error = ::ladybugDestroyContext(&processContext);
+            _HANDLE_ERROR;
         }
-    }
 
-    // Destroy the context
-    printf("Destroying context...\n");
-    error = ::ladybugDestroyContext(&context);
-    _HANDLE_ERROR;
+        // Destroy the context
+        printf("Destroying context...\n");
+        error = ::ladybugDestroyContext(&context);
+        _HANDLE_ERROR;
+    }
 
     printf("Done.\n");
 
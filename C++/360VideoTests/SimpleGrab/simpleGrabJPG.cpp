@@ -25,16 +25,27 @@
 //  - start transmission of images
 //  - grab an image
 //  - color process the grabbed image
-//  - save the 6 raw images in BMP files
+//  - encode the 6 raw images to JPEG in parallel and save them
 //  - destroy the context
 //
+// Usage: simpleGrabJPG [-t THREADS] [-q QUALITY]
+//
+//  -t THREADS  Number of JPEG encoder threads. Default is one per hardware
+//              thread. With more threads than cameras, each image is split
+//              into strips that are encoded in parallel.
+//  -q QUALITY  JPEG quality, 1 - 100. Default is 85.
+//
 //=============================================================================
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ladybug.h"
 #include "ladybugstream.h"
+#include "ladybugFileWriter.h"
+#include "ladybugJpegEncoder.h"
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
 
@@ -99,11 +110,39 @@ std::string getWriteableDirectory()
 
 } // namespace
 
-int main(int /* argc */, char ** /* argv[] */)
+int main(int argc, char **argv)
 {
+    unsigned int uiNumThreads = 0;
+    int iQuality = 85;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            uiNumThreads = (unsigned int)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+        {
+            iQuality = atoi(argv[++i]);
+        }
+        else
+        {
+            printf("Usage: %s [-t THREADS] [-q QUALITY]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Encode on a thread pool and write the files in the background
+    LadybugJpegEncoder encoder;
+    LadybugError error = encoder.initialize(uiNumThreads, iQuality);
+    _HANDLE_ERROR;
+
+    LadybugFileWriter writer;
+    error = writer.start();
+    _HANDLE_ERROR;
+
     // Initialize context.
     LadybugContext context;
-    LadybugError error = ::ladybugCreateContext(&context);
+    error = ::ladybugCreateContext(&context);
     _HANDLE_ERROR;
 
     // Initialize the first ladybug on the bus.
@@ -157,24 +196,23 @@ int main(int /* argc */, char ** /* argv[] */)
         printf("Converting image...\n");
         error = ::ladybugConvertImage(context, &image, arpBuffers, LADYBUG_BGRU);
 
-        // Save the image as 6 individual raw (unstitched, distorted) images
-        printf("Saving images...\n");
+        // Encode the 6 individual raw (unstitched, distorted) images at the same time
+        printf("Encoding images...\n");
+        std::vector<unsigned char> arJpegs[LADYBUG_NUM_CAMERAS];
+        error = encoder.encodeImages(arpBuffers, LADYBUG_NUM_CAMERAS, image.uiCols, image.uiRows, LADYBUG_BGRU, arJpegs);
+        _HANDLE_ERROR;
+
+        // Queue the files. They are written while the next image is grabbed.
         for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
         {
-            LadybugProcessedImage processedImage;
-            processedImage.pData = arpBuffers[uiCamera];
-            processedImage.pixelFormat = LADYBUG_BGRU;
-            processedImage.uiCols = image.uiCols;
-            processedImage.uiRows = image.uiRows;
-
             char pszOutputFilePath[256] = {0};
             sprintf(pszOutputFilePath, "ladybug_frame%03u_%u_camera_%02u.jpg", frames,caminfo.serialHead, uiCamera);
             const std::string outputPath = getWriteableDirectory() + std::string(pszOutputFilePath);
 
-            error = ::ladybugSaveImage(context, &processedImage, outputPath.c_str(), LADYBUG_FILEFORMAT_JPG);
+            error = writer.write(outputPath, std::move(arJpegs[uiCamera]));
             _HANDLE_ERROR;
 
-            printf("Saved camera %u image to %s.\n", uiCamera, outputPath.c_str());
+            printf("Queued camera %u image for %s.\n", uiCamera, outputPath.c_str());
         }
 
         // Clean up the buffers
@@ -184,6 +222,10 @@ int main(int /* argc */, char ** /* argv[] */)
         }
     }
 
+    writer.stop();
+    encoder.printStats("JPEG encoder");
+    writer.printStats("File writer");
+
     // Destroy the context
     printf("Destroying context...\n");
     error = ::ladybugDestroyContext(&context);
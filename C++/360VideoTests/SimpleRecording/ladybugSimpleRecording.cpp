@@ -24,7 +24,11 @@
 //
 // This example displays the grabbed images only when the grabbing function 
 // returns LADYBUG_TIMEOUT. This means that saving images is the highest 
-// priority. 
+// priority. With WindowPreviewEveryNFrames set, one image in that many is
+// color processed for the window on a separate thread, and dropped if that
+// thread is still busy, so the window never slows down grabbing (see
+// ladybugPreview.h). Use a downsampling ColorProcessingMethod to keep the
+// preview cheap.
 //
 // Right click the mouse in the client area to popup a menu and select 
 // various options, or use the following hot keys:
@@ -39,6 +43,61 @@
 // in the .ini file. The accuracy of the result depends on the GPS device and 
 // the GPS data update rate.
 //
+// Dropped frames and the grab loop falling behind the camera are printed to
+// the console as they happen, and summarized on exit (see
+// ladybugFrameTiming.h).
+//
+// With a JPEG data format, the JPEG quality is lowered when frames start to
+// back up in the image buffers, the camera's JPEG buffer fills or frames are
+// dropped, and raised again once the load is low (see
+// ladybugJpegQualityGovernor.h). Every change is printed to the console.
+//
+// Images are written to the stream on a separate thread (see
+// ladybugStreamWriter.h). Up to StreamInFlightFrames images wait for the
+// disk before grabbing is held back. Each 2GB stream file is allocated in
+// full when it is created, so it does not fragment as it grows. Recording
+// stops before the disk fills, once less than StreamDiskReserveMB would be
+// left beyond the 2GB the Ladybug library needs, and every image already
+// queued is still written. The write rate and latency are shown with the
+// amount written, and summarized when recording stops.
+//
+// With StreamFrameIndex, each frame's place in the stream, timestamp and
+// GPS position are also saved to BaseStreamName.idx, and flushed to disk
+// about once a second, with the calibration in BaseStreamName.cal (see
+// ladybugFrameIndex.h). After a power loss, ladybugStreamIndex rebuilds
+// the stream from them.
+//
+// With StreamStripeDirectories set, the stream is split across several
+// directories, one per disk, each written on its own thread, so recording
+// is not limited by the speed of one disk (see ladybugStripedStreamWriter.h).
+// A manifest in the first directory keeps the order of the frames.
+//
+// With PreTriggerSeconds set, the last few seconds of images are kept in
+// memory while not recording, as grabbed and without conversion (see
+// ladybugPreTriggerBuffer.h). When recording starts, from the keyboard,
+// SIGUSR1 or the camera entering the GPS area set by TriggerLatitude,
+// TriggerLongitude and TriggerRadius, the stream begins with those images.
+//
+// With PanoramaInterval set, a stitched panorama of the recording is saved
+// every few seconds next to the stream, with the image's GPS position in
+// its EXIF tags, for checking a drive without processing the stream. The
+// panoramas are rendered on a thread of their own, skipped when it is
+// busy, and limited to PanoramaCpuPercent of a CPU (see
+// ladybugPanoramaRecorder.h).
+//
+// Run with --headless, or set Headless=true in the .ini file, to record
+// without a window, e.g. on a robot with no display. A capture thread then
+// locks each frame and hands it to a writer thread that writes the stream,
+// so recording never waits for rendering. With PreviewInterval set, in
+// seconds, the window's preview converts a frame that often, at the
+// ColorProcessingMethod, and a preview thread saves a JPEG of each camera
+// from it, skipping the frames in between. Recording starts at once, or on a trigger
+// with PreTriggerSeconds set, and stops on Ctrl+C or SIGTERM (see
+// ladybugLockNextCapture.h).
+//
+// Set LADYBUG_METRICS_FILE to write per-stage latency histograms while the
+// program runs (see ladybugMetrics.h).
+//
 // Note: This example has to be run with freeglut.dll and Ladybug SDK 1.3Alpha02
 //     or later.
 // 
@@ -47,7 +106,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <assert.h>
+#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 #include <GL/freeglut.h>
 
 #ifdef _WIN32
@@ -69,6 +135,21 @@
 #include <ladybugrenderer.h>
 #include <ladybugstream.h>
 
+#include "ladybugFrameTiming.h"
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugJpegQualityGovernor.h"
+#include "ladybugLockNextCapture.h"
+#include "ladybugMetrics.h"
+#include "ladybugNmeaParser.h"
+#include "ladybugPanoramaRecorder.h"
+#include "ladybugPreTriggerBuffer.h"
+#include "ladybugPreview.h"
+#include "ladybugStreamWriter.h"
+#include "ladybugStripedStreamWriter.h"
+#include "ladybugThreadPlacement.h"
+
 // Macros to check, report on, and handle Ladybug API error codes.
 #define _HANDLE_ERROR \
     if( error != LADYBUG_OK ) \
@@ -128,6 +209,38 @@ struct GPSDATA
 #define INI_BAUD_RATE                  "BaudRate"
 #define INI_UPDATE_RATE                "UpdateRate"
 #define INI_DISTANCE_X                 "Distance_x"
+#define INI_GRAB_CPUS                  "GrabCpus"
+#define INI_CONVERT_CPUS               "ConvertCpus"
+#define INI_ENCODE_CPUS                "EncodeCpus"
+#define INI_WRITE_CPUS                 "WriteCpus"
+#define INI_GRAB_REALTIME_PRIORITY     "GrabRealtimePriority"
+#define INI_EXPECTED_FRAME_RATE        "ExpectedFrameRate"
+#define INI_JPEG_QUALITY_CONTROL       "JPEGQualityControl"
+#define INI_JPEG_MIN_QUALITY           "JPEGMinQuality"
+#define INI_JPEG_MAX_QUALITY           "JPEGMaxQuality"
+#define INI_HEADLESS                   "Headless"
+#define INI_PREVIEW_INTERVAL           "PreviewInterval"
+#define INI_WINDOW_PREVIEW_EVERY_N     "WindowPreviewEveryNFrames"
+#define INI_STREAM_IN_FLIGHT_FRAMES    "StreamInFlightFrames"
+#define INI_STREAM_IN_FLIGHT_MB        "StreamInFlightMB"
+#define INI_STREAM_DISK_RESERVE_MB     "StreamDiskReserveMB"
+#define INI_STREAM_PREALLOCATE         "StreamPreallocateSegments"
+#define INI_STREAM_FRAME_INDEX         "StreamFrameIndex"
+#define INI_STREAM_STRIPE_DIRECTORIES  "StreamStripeDirectories"
+#define INI_PRE_TRIGGER_SECONDS        "PreTriggerSeconds"
+#define INI_PRE_TRIGGER_MB             "PreTriggerMB"
+#define INI_TRIGGER_LATITUDE           "TriggerLatitude"
+#define INI_TRIGGER_LONGITUDE          "TriggerLongitude"
+#define INI_TRIGGER_RADIUS             "TriggerRadius"
+#define INI_PANORAMA_INTERVAL          "PanoramaInterval"
+#define INI_PANORAMA_WIDTH             "PanoramaWidth"
+#define INI_PANORAMA_CPU_PERCENT       "PanoramaCpuPercent"
+
+// Least time between updates of the window title while recording
+#define TITLE_INTERVAL_MS 250.0
+
+// Time between the status lines printed while recording headless
+#define STATUS_INTERVAL_MS 10000.0
 
 // Values in INI file
 char pszStreamBaseName[_MAX_PATH];
@@ -144,6 +257,17 @@ int iPortNumber = 1;
 int iBaudRate = 4800;
 int iUpdateRate = 1;
 int iDistance_x = 10;
+int iGrabRealtimePriority = 0;
+bool bHeadless = false;
+int iPreviewInterval = 0;
+int iWindowPreviewEveryNFrames = 10;
+bool bPreTrigger = false;
+double dTriggerLatitude = 0.0;
+double dTriggerLongitude = 0.0;
+double dTriggerRadius = 0.0;
+double dPanoramaInterval = 0.0;
+int iPanoramaWidth = 2048;
+double dPanoramaCpuPercent = 25.0;
 
 enum DisplayModes
 {
@@ -155,15 +279,33 @@ enum DisplayModes
 static double lastIdleTime;
 unsigned int frameCounter = 0;
 double frameRate = 0.0;
+LadybugFrameTimingAnalyzer frameTiming;
+LadybugJpegQualityGovernor jpegGovernor;
+bool bJpegQualityControl = true;
+unsigned long long ulGovernorFrames = 0;
+double dGovernorSeconds = 0.0;
 double totalMBWritten = 0.0;
 unsigned long totalNumberOfImagesWritten = 0;
+unsigned long totalNumberOfImagesQueued = 0;
 bool fullScreenMode = false;
 bool isTextureUpdated = false;
+double dLastTitleMs = 0.0;
+char pszRecordingName[_MAX_PATH] = {0};
+std::atomic<bool> bStopRequested( false );
+std::atomic<bool> bTriggerRequested( false );
 
 LadybugOutputImage uiDisplayMode = LADYBUG_PANORAMIC;
 
 LadybugContext context = NULL;            // Ladybug context
-LadybugStreamContext streamContext = NULL;      // Ladybug stream context
+LadybugStreamWriter streamWriter;         // Writes the stream on its own thread
+LadybugStreamWriterConfig streamWriterConfig;
+LadybugStripedStreamWriter stripedWriter; // Writes the stream across several disks
+LadybugStripedStreamWriterConfig stripedWriterConfig;
+LadybugStreamSink* pStreamWriter = &streamWriter; // The writer of the current recording
+LadybugPreTriggerBuffer preTrigger;       // Keeps the images before recording starts
+LadybugPreTriggerConfig preTriggerConfig;
+LadybugPreview preview;                   // Converts images for the window or the preview files on its own thread
+LadybugPanoramaRecorder panoramas;        // Saves a panorama of the recording every few seconds
 LadybugError error;                       // Ladybug error message
 LadybugImage image_Current, image_Prev; // Ladybug image
 bool b[256];                    // keyboard state
@@ -171,6 +313,7 @@ bool bRecordingInProgress = false;
 int menu;
 LadybugGPSContext GPScontext = NULL;
 GPSDATA GPS_Data_Prev, GPS_Data_Current;
+LadybugNmeaParser nmeaParser;   // GPS position from the NMEA sentences in each image
 
 //=============================================================================
 // A class for reading INI file.  
@@ -516,6 +659,169 @@ loadIniFile( const char* pszINIFilename )
         uiDisplayMode = LADYBUG_PANORAMIC;
     }
 
+    //
+    // Thread placement. These keys are optional; a stage without CPUs is
+    // left to the scheduler.
+    //
+    LadybugThreadPlacement& placement = LadybugThreadPlacement::instance();
+    const char* arpszCpuKeys[ LADYBUG_NUM_STAGES ] = { NULL };
+    arpszCpuKeys[ LADYBUG_STAGE_GRAB ] = INI_GRAB_CPUS;
+    arpszCpuKeys[ LADYBUG_STAGE_CONVERT ] = INI_CONVERT_CPUS;
+    arpszCpuKeys[ LADYBUG_STAGE_ENCODE ] = INI_ENCODE_CPUS;
+    arpszCpuKeys[ LADYBUG_STAGE_WRITE ] = INI_WRITE_CPUS;
+    for ( int iStage = 0; iStage < LADYBUG_NUM_STAGES; iStage++ )
+    {
+        char pszCpuList[ _MAX_PATH ];
+        if ( arpszCpuKeys[ iStage ] == NULL ||
+            iniFile.getString( arpszCpuKeys[ iStage ], pszCpuList, _MAX_PATH, "" ) != ReadINIFile::OK )
+        {
+            continue;
+        }
+
+        if ( placement.setStageCpus( (LadybugStage)iStage, pszCpuList ) != LADYBUG_OK )
+        {
+            printf( "Invalid CPU list %s=%s\n", arpszCpuKeys[ iStage ], pszCpuList );
+            bErrorFound = true;
+        }
+    }
+
+    iniFile.getInt( INI_GRAB_REALTIME_PRIORITY, &iGrabRealtimePriority, 0 );
+    if ( placement.setGrabRealtimePriority( iGrabRealtimePriority ) != LADYBUG_OK )
+    {
+        printf( "Invalid %s=%d\n", INI_GRAB_REALTIME_PRIORITY, iGrabRealtimePriority );
+        bErrorFound = true;
+    }
+
+    //
+    // Frame timing. 0 learns the frame rate from the first frames.
+    //
+    LadybugFrameTimingConfig timingConfig;
+    iniFile.getDouble( INI_EXPECTED_FRAME_RATE, &timingConfig.dFrameRate, 0.0 );
+    if ( timingConfig.dFrameRate < 0.0 )
+    {
+        printf( "Invalid %s=%f\n", INI_EXPECTED_FRAME_RATE, timingConfig.dFrameRate );
+        bErrorFound = true;
+    }
+    frameTiming.initialize( timingConfig );
+
+    //
+    // JPEG quality. The quality control keys are optional.
+    //
+    LadybugJpegGovernorConfig governorConfig;
+    iniFile.getInt( INI_JPEG_COMPRESSION_QUALITY, &governorConfig.iInitialQuality, 80 );
+    iniFile.getBool( INI_JPEG_QUALITY_CONTROL, &bJpegQualityControl, true );
+    iniFile.getInt( INI_JPEG_MIN_QUALITY, &governorConfig.iMinQuality, 50 );
+    iniFile.getInt( INI_JPEG_MAX_QUALITY, &governorConfig.iMaxQuality, governorConfig.iInitialQuality );
+    if ( governorConfig.iInitialQuality < 1 || governorConfig.iInitialQuality > 100 ||
+        governorConfig.iMinQuality < 1 || governorConfig.iMinQuality > governorConfig.iMaxQuality ||
+        governorConfig.iMaxQuality > 100 )
+    {
+        printf( "Invalid JPEG quality settings\n" );
+        bErrorFound = true;
+    }
+    jpegGovernor.initialize( governorConfig );
+
+    //
+    // Stream writing. These keys are optional.
+    //
+    int iInFlightFrames = 0;
+    int iInFlightMB = 0;
+    int iDiskReserveMB = 0;
+    iniFile.getInt( INI_STREAM_IN_FLIGHT_FRAMES, &iInFlightFrames, 16 );
+    iniFile.getInt( INI_STREAM_IN_FLIGHT_MB, &iInFlightMB, 512 );
+    iniFile.getInt( INI_STREAM_DISK_RESERVE_MB, &iDiskReserveMB, 64 );
+    if ( iInFlightFrames < 1 || iInFlightMB < 1 || iDiskReserveMB < 0 )
+    {
+        printf( "Invalid stream writing settings\n" );
+        bErrorFound = true;
+    }
+    else
+    {
+        streamWriterConfig.uiMaxInFlightFrames = iInFlightFrames;
+        streamWriterConfig.ulMaxInFlightBytes = iInFlightMB * 1024ULL * 1024;
+        streamWriterConfig.ulDiskReserveBytes = iDiskReserveMB * 1024ULL * 1024;
+    }
+    iniFile.getBool( INI_STREAM_PREALLOCATE, &streamWriterConfig.bPreallocateSegments, true );
+    iniFile.getBool( INI_STREAM_FRAME_INDEX, &streamWriterConfig.bWriteFrameIndex, true );
+
+    char pszStripeDirectories[ _MAX_PATH ];
+    iniFile.getString( INI_STREAM_STRIPE_DIRECTORIES, pszStripeDirectories, _MAX_PATH, "" );
+    for ( char* pszDirectory = strtok( pszStripeDirectories, "," ); 
+        pszDirectory != NULL; 
+        pszDirectory = strtok( NULL, "," ) )
+    {
+        while ( *pszDirectory == ' ' )
+        {
+            pszDirectory++;
+        }
+        if ( *pszDirectory != '\0' )
+        {
+            stripedWriterConfig.directories.push_back( pszDirectory );
+        }
+    }
+
+    //
+    // Pre-trigger recording. These keys are optional.
+    //
+    int iPreTriggerMB = 0;
+    iniFile.getDouble( INI_PRE_TRIGGER_SECONDS, &preTriggerConfig.dSeconds, 0.0 );
+    iniFile.getInt( INI_PRE_TRIGGER_MB, &iPreTriggerMB, 1024 );
+    iniFile.getDouble( INI_TRIGGER_LATITUDE, &dTriggerLatitude, 0.0 );
+    iniFile.getDouble( INI_TRIGGER_LONGITUDE, &dTriggerLongitude, 0.0 );
+    iniFile.getDouble( INI_TRIGGER_RADIUS, &dTriggerRadius, 0.0 );
+    bPreTrigger = preTriggerConfig.dSeconds > 0.0;
+    preTriggerConfig.ulBytes = iPreTriggerMB * 1024ULL * 1024;
+    if ( preTriggerConfig.dSeconds < 0.0 || iPreTriggerMB < 1 || dTriggerRadius < 0.0 )
+    {
+        printf( "Invalid pre-trigger settings\n" );
+        bPreTrigger = false;
+        bErrorFound = true;
+    }
+    if ( dTriggerRadius > 0.0 && !( bPreTrigger && bRecordingGPSData ) )
+    {
+        printf( "%s needs %s and %s\n", INI_TRIGGER_RADIUS, INI_PRE_TRIGGER_SECONDS, INI_RECORDING_GPS_DATA );
+        dTriggerRadius = 0.0;
+        bErrorFound = true;
+    }
+
+    //
+    // Headless recording. These keys are optional.
+    //
+    iniFile.getBool( INI_HEADLESS, &bHeadless, false );
+    iniFile.getInt( INI_PREVIEW_INTERVAL, &iPreviewInterval, 0 );
+    if ( iPreviewInterval < 0 )
+    {
+        printf( "Invalid %s=%d\n", INI_PREVIEW_INTERVAL, iPreviewInterval );
+        bErrorFound = true;
+    }
+
+    //
+    // Display. This key is optional.
+    //
+    iniFile.getInt( INI_WINDOW_PREVIEW_EVERY_N, &iWindowPreviewEveryNFrames, 10 );
+    if ( iWindowPreviewEveryNFrames < 0 )
+    {
+        printf( "Invalid %s=%d\n", INI_WINDOW_PREVIEW_EVERY_N, iWindowPreviewEveryNFrames );
+        iWindowPreviewEveryNFrames = 10;
+        bErrorFound = true;
+    }
+
+    //
+    // Panoramas saved while recording. These keys are optional.
+    //
+    iniFile.getDouble( INI_PANORAMA_INTERVAL, &dPanoramaInterval, 0.0 );
+    iniFile.getInt( INI_PANORAMA_WIDTH, &iPanoramaWidth, 2048 );
+    iniFile.getDouble( INI_PANORAMA_CPU_PERCENT, &dPanoramaCpuPercent, 25.0 );
+    if ( dPanoramaInterval < 0.0 || iPanoramaWidth < 2 || dPanoramaCpuPercent <= 0.0 || dPanoramaCpuPercent > 100.0 )
+    {
+        printf( "Invalid %s=%f, %s=%d or %s=%f\n", 
+            INI_PANORAMA_INTERVAL, dPanoramaInterval, 
+            INI_PANORAMA_WIDTH, iPanoramaWidth, 
+            INI_PANORAMA_CPU_PERCENT, dPanoramaCpuPercent );
+        dPanoramaInterval = 0.0;
+        bErrorFound = true;
+    }
+
     // Close ini file
     iniFile.close();
 
@@ -540,6 +846,15 @@ bool isHighBitDepth( LadybugDataFormat format)
         format == LADYBUG_DATAFORMAT_HALF_HEIGHT_RAW16;
 }
 
+/** Determine if the data format is JPEG compressed. */
+bool isJpeg( LadybugDataFormat format )
+{
+    return format == LADYBUG_DATAFORMAT_COLOR_SEP_JPEG8 ||
+        format == LADYBUG_DATAFORMAT_COLOR_SEP_HALF_HEIGHT_JPEG8 ||
+        format == LADYBUG_DATAFORMAT_COLOR_SEP_JPEG12 ||
+        format == LADYBUG_DATAFORMAT_COLOR_SEP_HALF_HEIGHT_JPEG12;
+}
+
 /*
 Returns the current time in milliseconds based on a monotonically 
 increasing clock with an unspecified starting time.
@@ -571,12 +886,73 @@ void sleepMs(unsigned int ms)
 }
 
 
+//=============================================================================
+// Refresh the recording totals from the stream writer
+//=============================================================================
+void
+updateRecordingTotals( LadybugStreamWriterStats* pStats )
+{
+    pStreamWriter->getStats( pStats );
+    totalMBWritten = pStats->dMBWritten;
+    totalNumberOfImagesWritten = (unsigned long)pStats->ulFramesWritten;
+}
+
+//=============================================================================
+// Stop recording. Every frame queued so far is written before the stream 
+// is closed. Returns the error that stopped writing, if any.
+//=============================================================================
+LadybugError
+stopRecording( void )
+{
+    bRecordingInProgress = false;
+    panoramas.stop();
+
+    // Images still held from before the trigger go to the stream first
+    const LadybugError flushError = preTrigger.stop();
+    const LadybugError stopError = pStreamWriter->stop();
+
+    LadybugStreamWriterStats writerStats;
+    updateRecordingTotals( &writerStats );
+    pStreamWriter->printStats( "Stream writer" );
+
+    // Keep the images before the next trigger
+    if ( preTrigger.isInitialized() )
+    {
+        preTrigger.arm();
+    }
+    return flushError != LADYBUG_OK ? flushError : stopError;
+}
+
+
 //=============================================================================
 // Clean up
 //=============================================================================
 void
 cleanUp( void )
 {
+    // The stream was opened on the camera's context; close it, with the
+    // frames still queued and the pre-trigger images, while the context
+    // and the GPS are still there
+    if ( bRecordingInProgress )
+    {
+        stopRecording();
+    }
+    if ( preTrigger.isInitialized() )
+    {
+        preTrigger.printStats( "Pre-trigger" );
+        preTrigger.shutdown();
+    }
+    if ( preview.isInitialized() )
+    {
+        preview.printStats( "Preview" );
+        preview.shutdown();
+    }
+    if ( panoramas.isInitialized() )
+    {
+        panoramas.shutdown();
+        panoramas.printStats( "Panoramas" );
+    }
+
     if ( GPScontext != NULL )
     {
         //
@@ -601,19 +977,153 @@ cleanUp( void )
         context = NULL;
     }
 
-    if ( streamContext != NULL )
+
+    if ( !bHeadless )
     {
-        error = ladybugDestroyStreamContext ( &streamContext );
-        _HANDLE_ERROR;
-        streamContext = NULL;
+        glutDestroyMenu( menu );
     }
 
-    glutDestroyMenu( menu );
+    frameTiming.printStats( "Frame timing" );
+    if ( bRecordingGPSData )
+    {
+        nmeaParser.printStats( "GPS" );
+    }
+    if ( bJpegQualityControl && isJpeg( ladybugDataFormat ) )
+    {
+        jpegGovernor.printStats( "JPEG quality" );
+    }
+    LadybugThreadPlacement::instance().printReport( "Thread" );
+    LadybugMetrics::instance().stopPeriodicDump();
+    LadybugMetrics::instance().printSummary();
 
     return;
 }
 
 
+//=============================================================================
+// Start recording to a new stream. The stream is named from the .ini file.
+// Sets error if the stream could not be opened.
+//=============================================================================
+void
+startRecording( void )
+{
+    // Get file name 
+    ReadINIFile iniFile;
+    ReadINIFile::Error iniFileError; 
+    char pszStreamNameOpened[ _MAX_PATH ];
+
+    // Open the ini file
+    iniFile.open( INI_FILENAME );
+
+    // Get stream file base name from ini file
+    iniFileError = iniFile.getString( 
+        INI_RECORDING_FILE_BASE_NAME, 
+        pszStreamBaseName, _MAX_PATH,  "pgrLadybugStream" );
+#ifdef _WIN32
+    // Try to record stream to "My Documents".
+    char buf[_MAX_PATH];
+    HRESULT hres = SHGetFolderPath( NULL, CSIDL_PERSONAL, NULL, 0, buf);
+    if ( hres == S_OK)
+    {
+        // Set stream name to "My Documents" folder
+        sprintf( pszRecordingName,
+            "%s\\%s\0",buf, pszStreamBaseName );
+    }
+    else
+    {
+        // Set stream name to current folder
+        strcpy( pszRecordingName, buf);
+    }
+#else
+    const char *homedir = getenv("HOME");
+
+    if (homedir == NULL)
+    {
+        uid_t uid = getuid();
+        passwd *pw = getpwuid(uid);
+
+        if (pw == NULL)
+        {
+            homedir = NULL;
+        }
+        else
+        {
+            homedir = pw->pw_dir;
+        }
+    }
+    
+    if (homedir != NULL)
+    {
+        sprintf( pszRecordingName,
+            "%s/%s",homedir, pszStreamBaseName );
+    }
+#endif
+    if ( bRecordingGPSData )
+    {
+        //Read GPS distance for recording
+        iniFileError = iniFile.getInt( 
+            INI_DISTANCE_X, &iDistance_x, 10 );
+        sprintf( pszRecordingName,
+            "%s_GPS_%dMeter\0",pszStreamBaseName, iDistance_x );
+    }
+
+    iniFile.close();
+
+    // Used to track image/frame stats
+    totalMBWritten = 0;
+    totalNumberOfImagesWritten = 0;
+    totalNumberOfImagesQueued = 0;
+
+    if ( stripedWriterConfig.directories.empty() )
+    {
+        pStreamWriter = &streamWriter;
+        error = streamWriter.start( 
+            context, 
+            pszRecordingName, 
+            streamWriterConfig,
+            pszStreamNameOpened );
+    }
+    else
+    {
+        // Each stripe's stream is named like the single stream, in its own directory
+        const char* pszSlash = strrchr( pszRecordingName, '/' );
+        stripedWriterConfig.stripe = streamWriterConfig;
+        pStreamWriter = &stripedWriter;
+        error = stripedWriter.start( 
+            context, 
+            pszSlash != NULL ? pszSlash + 1 : pszRecordingName, 
+            stripedWriterConfig,
+            pszStreamNameOpened );
+    }
+    bRecordingInProgress = (error == LADYBUG_OK );
+    if ( bRecordingInProgress )
+    {
+        if ( stripedWriterConfig.directories.empty() )
+        {
+            printf( "Recording to %s\n", pszStreamNameOpened );
+        }
+        else
+        {
+            printf( "Recording to %zu stripes, frame order in %s\n", 
+                stripedWriterConfig.directories.size(), pszStreamNameOpened );
+        }
+        if ( panoramas.isInitialized() )
+        {
+            panoramas.start( pszRecordingName );
+            printf( "Saving a panorama every %.1fs as %s-pano-NNNNNN.jpg\n", dPanoramaInterval, pszRecordingName );
+        }
+
+        // Begin the stream with the images kept before the trigger
+        LadybugPreTriggerStats preTriggerStats;
+        preTrigger.getStats( &preTriggerStats );
+        if ( preTrigger.trigger( pStreamWriter ) == LADYBUG_OK )
+        {
+            printf( "Recording from %.1fs (%u images) before the trigger\n", 
+                preTriggerStats.dSecondsHeld, preTriggerStats.uiFramesHeld );
+        }
+    }
+}
+
 //=============================================================================
 // Process keyboard command
 //=============================================================================
@@ -626,12 +1136,6 @@ keyboard( unsigned char k, int /*x*/, int /*y*/ )
     {
     case 'q':
     case 'Q':
-        if ( bRecordingInProgress )
-        {
-            error = ladybugStopStream( streamContext );
-            _HANDLE_ERROR;      
-        }
-
         cleanUp();
         exit (0);
         break; 
@@ -645,103 +1149,11 @@ keyboard( unsigned char k, int /*x*/, int /*y*/ )
         frameCounter = 0;   
         if ( !bRecordingInProgress )
         {
-            // Get file name 
-            ReadINIFile iniFile;
-            ReadINIFile::Error iniFileError; 
-            char pszStreamNameToOpen[ _MAX_PATH ];
-            char pszStreamNameOpened[ _MAX_PATH ];
-
-            // Open the ini file
-            iniFile.open( INI_FILENAME );
-
-            // Get stream file base name from ini file
-            iniFileError = iniFile.getString( 
-                INI_RECORDING_FILE_BASE_NAME, 
-                pszStreamBaseName, _MAX_PATH,  "pgrLadybugStream" );
-#ifdef _WIN32
-            // Try to record stream to "My Documents".
-            char buf[_MAX_PATH];
-            HRESULT hres = SHGetFolderPath( NULL, CSIDL_PERSONAL, NULL, 0, buf);
-            if ( hres == S_OK)
-            {
-                // Set stream name to "My Documents" folder
-                sprintf( pszStreamNameToOpen,
-                    "%s\\%s\0",buf, pszStreamBaseName );
-            }
-            else
-            {
-                // Set stream name to current folder
-                strcpy( pszStreamNameToOpen, buf);
-            }
-#else
-            const char *homedir = getenv("HOME");
-
-            if (homedir == NULL)
-            {
-                uid_t uid = getuid();
-                passwd *pw = getpwuid(uid);
-
-                if (pw == NULL)
-                {
-                    homedir = NULL;
-                }
-                else
-                {
-                    homedir = pw->pw_dir;
-                }
-            }
-            
-            if (homedir != NULL)
-            {
-                sprintf( pszStreamNameToOpen,
-                    "%s/%s",homedir, pszStreamBaseName );
-            }
-#endif
-            if ( bRecordingGPSData )
-            {
-                //Read GPS distance for recording
-                iniFileError = iniFile.getInt( 
-                    INI_DISTANCE_X, &iDistance_x, 10 );
-                sprintf( pszStreamNameToOpen,
-                    "%s_GPS_%dMeter\0",pszStreamBaseName, iDistance_x );
-            }
-
-            iniFile.close();
-
-            if ( streamContext == NULL )
-            {
-                error = ladybugCreateStreamContext( &streamContext );
-                _HANDLE_ERROR;      
-            } 
-
-            // Used to track image/frame stats
-            totalMBWritten = 0;
-            totalNumberOfImagesWritten = 0;
-
-
-            error = ladybugInitializeStreamForWriting( 
-                streamContext, 
-                pszStreamNameToOpen, 
-                context,
-                pszStreamNameOpened,
-                true );
-            bRecordingInProgress = (error == LADYBUG_OK );
-            if ( bRecordingInProgress )
-            {
-                printf( "Recording to %s\n", pszStreamNameOpened );
-            }
-            else
-            {
-                error = ladybugStopStream ( streamContext );
-            }
+            startRecording();
         }
         else
         {
-            //
-            // Stop recording
-            //
-            error = ladybugStopStream( streamContext );
-            bRecordingInProgress = false;
+            error = stopRecording();
         }
         _DISPLAY_ERROR_MSG_AND_RETURN;  
         break;
@@ -874,6 +1286,17 @@ startCamera( void)
     //
     ladybugSetGrabTimeout( context, 0 );
 
+    //
+    // This thread grabs, so give it the grab CPUs and scheduling policy.
+    // The SDK's capture threads started below inherit them.
+    //
+    if ( LadybugThreadPlacement::instance().placeCurrentThread( LADYBUG_STAGE_GRAB, "grab" ) != LADYBUG_OK )
+    {
+        printf( "Could not apply the grab thread placement. "
+            "SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least %d.\n",
+            iGrabRealtimePriority );
+    }
+
     //
     // Start Ladybug with the specified data format
     //
@@ -898,6 +1321,7 @@ startCamera( void)
         error = ladybugLockNext( context, &image_Prev );
     } while ( ( error != LADYBUG_OK )  && ( iTryTimes++ < 10) );    
     _HANDLE_ERROR;
+    frameTiming.addFrame( image_Prev );
 
     //
     // Load config file from the head
@@ -936,18 +1360,44 @@ startCamera( void)
     ladybugSetAlphaMasking( context, true );
 
 
-    // we will not use auto buffer usage feature, set it to a fixed percentage
+    // we will not use auto buffer usage feature; the quality is set here
+    // and adjusted by jpegGovernor while grabbing
     printf( "Disabling Auto JPEG Quality control...\n");
     error = ladybugSetAutoJPEGQualityControlFlag( context, false);
     _HANDLE_ERROR;
 
-    printf( "Setting JPEG quality to 80...\n");
-    error = ladybugSetJPEGQuality(context, 80);
+    printf( "Setting JPEG quality to %d...\n", jpegGovernor.getQuality() );
+    error = ladybugSetJPEGQuality( context, jpegGovernor.getQuality() );
     _HANDLE_ERROR;
 
-    if ( bRecordingAutoStart )
+    if ( bPreTrigger )
+    {
+        printf( "Allocating %lluMB to keep %.1fs before a trigger...\n", 
+            preTriggerConfig.ulBytes / ( 1024 * 1024 ), preTriggerConfig.dSeconds );
+        error = preTrigger.initialize( preTriggerConfig );
+        _HANDLE_ERROR;
+        preTrigger.arm();
+    }
+
+    if ( dPanoramaInterval > 0.0 )
     {
-        keyboard('r', 0, 0);
+        LadybugPanoramaRecorderConfig panoramaConfig;
+        panoramaConfig.dIntervalSeconds = dPanoramaInterval;
+        panoramaConfig.uiCols = iPanoramaWidth;
+        panoramaConfig.uiRows = iPanoramaWidth / 2;
+        panoramaConfig.dMaxCpuPercent = dPanoramaCpuPercent;
+        panoramaConfig.pixelFormat = isHighBitDepth( ladybugDataFormat ) ? LADYBUG_BGRU16 : LADYBUG_BGRU;
+        error = panoramas.initialize( context, panoramaConfig );
+        _HANDLE_ERROR;
+    }
+
+    if ( bRecordingAutoStart && !bHeadless )
+    {
+        startRecording();
+        if ( error != LADYBUG_OK )
+        {
+            printf( "Ladybug library reported %s\n", ::ladybugErrorToString( error ) );
+        }
     }
 
     return 0;
@@ -956,43 +1406,23 @@ startCamera( void)
 
 //=============================================================================
 // Retrieve GPS data from image
-// Get GPS data from GGA, RMC or GLL
+// Get GPS data from GGA, RMC or GLL, reading the image's NMEA sentences once
 //=============================================================================
 void retrieveGPSData( const LadybugImage* pImage,  GPSDATA* pGPS_Data )
 {
-    LadybugError gpsError;
+    unsigned char sentences[ LADYBUG_NMEA_MAX_BYTES ];
+    unsigned int uiLength = 0;
+    LadybugGpsFix fix;
 
-    LadybugNMEAGPGGA NMEAGGA_Data;
     pGPS_Data->bValidData = false;
-    gpsError = ladybugGetGPSNMEADataFromImage( pImage, "GPGGA", &NMEAGGA_Data );
-    if ( gpsError == LADYBUG_OK &&  NMEAGGA_Data.bValidData )
+    LadybugError gpsError = ladybugGetGPSNMEASentencesFromImage( 
+        pImage, sentences, sizeof( sentences ), &uiLength );
+    if ( gpsError == LADYBUG_OK && nmeaParser.parse( (const char*)sentences, uiLength, &fix ) )
     {
-        pGPS_Data->dLatitude = NMEAGGA_Data.dGGALatitude;
-        pGPS_Data->dLongitude = NMEAGGA_Data.dGGALongitude;
+        pGPS_Data->dLatitude = fix.dLatitude;
+        pGPS_Data->dLongitude = fix.dLongitude;
         pGPS_Data->bValidData = true;
     }
-    else
-    {
-        LadybugNMEAGPRMC NMEARMC_Data;
-        gpsError = ladybugGetGPSNMEADataFromImage( pImage, "GPRMC", &NMEARMC_Data );
-        if ( gpsError == LADYBUG_OK &&  NMEARMC_Data.bValidData )
-        {
-            pGPS_Data->dLatitude = NMEARMC_Data.dRMCLatitude;
-            pGPS_Data->dLongitude = NMEARMC_Data.dRMCLongitude;
-            pGPS_Data->bValidData = true;
-        }
-        else
-        {
-            LadybugNMEAGPGLL NMEAGLL_Data;
-            gpsError = ladybugGetGPSNMEADataFromImage( pImage, "GPGLL", &NMEAGLL_Data );
-            if (  gpsError == LADYBUG_OK &&  NMEAGLL_Data.bValidData )
-            {
-                pGPS_Data->dLatitude = NMEAGLL_Data.dGLLLatitude;
-                pGPS_Data->dLongitude = NMEAGLL_Data.dGLLLongitude;
-                pGPS_Data->bValidData = true;
-            }
-        }
-    }
 }
 
 //=============================================================================
@@ -1013,7 +1443,10 @@ display(void)
     glLoadIdentity();
 
     // Display Ladybug images
-    error = ladybugDisplayImage( context, uiDisplayMode );
+    {
+        LadybugStageTimer renderTimer( LADYBUG_STAGE_RENDER );
+        error = ladybugDisplayImage( context, uiDisplayMode );
+    }
     _DISPLAY_ERROR_MSG_AND_RETURN;
 
     char pszTimeString[128] = {0};
@@ -1080,84 +1513,226 @@ double dGPSDistance( double dLat1, double dLon1, double dLat2, double dLon2 )
 
 
 //=============================================================================
-// Grab and save images. Display an image only if no image waiting for writing
+// Measure the load and let the governor adjust the JPEG quality. 
+// dQueuedFraction is the fraction of the frames waiting to be written,
+// from the stream writer's budget and any buffers held for it.
 //=============================================================================
-void 
-recordingImage( void )
+void
+updateJpegQuality( double dQueuedFraction )
 {
-    char pszTimeString[128] = {0};
-    double dTimeDiff = 0;    
-    bool bRecordingCurrentImage = false;
-    double dDistance = 0;
+    if ( !bJpegQualityControl || !isJpeg( ladybugDataFormat ) )
+    {
+        return;
+    }
 
-    error = ladybugLockNext( context, &image_Current );
+    LadybugFrameTimingStats timingStats;
+    frameTiming.getStats( &timingStats );
+    if ( timingStats.ulFrames == 0 || !jpegGovernor.isDue( timingStats.ulFrames - 1 ) )
+    {
+        return;
+    }
 
-    switch ( error )
+    LadybugJpegLoad load;
+
+    //
+    // Frames the writer has not reached yet wait in the driver's image
+    // buffers. The lag behind the camera says how many there are.
+    //
+    load.dBacklog = dQueuedFraction;
+    if ( timingStats.dFrameRate > 0.0 && iNumberOfBuffers > 0 )
     {
-    case LADYBUG_OK:
-        // Calculate frame rate
-        dTimeDiff = (( image_Current.timeStamp.ulCycleSeconds * 8000.0 + 
-            image_Current.timeStamp.ulCycleCount ) -  
-            ( image_Prev.timeStamp.ulCycleSeconds * 8000.0 + 
-            image_Prev.timeStamp.ulCycleCount ) ) / 8000.0;
-        frameRate =  1.0 / dTimeDiff;
-
-        if ( bRecordingGPSData )
-        {         
-            // Retrieve the GPS data from the current image
-            if ( totalNumberOfImagesWritten == 0 )
-                // It is the first image. 
-                retrieveGPSData( &image_Current, &GPS_Data_Prev );
-            else
-                retrieveGPSData( &image_Current, &GPS_Data_Current );
+        const double dFramesWaiting = timingStats.dLagMs * timingStats.dFrameRate / 1000.0;
+        load.dBacklog = std::min( std::max( load.dBacklog, dFramesWaiting / iNumberOfBuffers ), 1.0 );
+    }
+
+    // The register runs from 0x00 (0%) to 0x7F (100%)
+    unsigned int uiBufferUsage = 0;
+    if ( ladybugGetAutoJPEGBufferUsage( context, &uiBufferUsage ) == LADYBUG_OK )
+    {
+        load.dBusUsage = uiBufferUsage / 127.0;
+    }
+
+    // Dropped frames stretch the camera time of the interval
+    const double dSeconds = timingStats.dSeconds - dGovernorSeconds;
+    if ( dSeconds > 0.0 )
+    {
+        load.dFrameRate = ( timingStats.ulFrames - ulGovernorFrames ) / dSeconds;
+        load.dTargetFrameRate = timingStats.dFrameRate;
+    }
+    ulGovernorFrames = timingStats.ulFrames;
+    dGovernorSeconds = timingStats.dSeconds;
+
+    if ( jpegGovernor.update( timingStats.ulFrames - 1, load ) )
+    {
+        const LadybugError qualityError = ladybugSetJPEGQuality( context, jpegGovernor.getQuality() );
+        if ( qualityError != LADYBUG_OK )
+        {
+            printf( "Error setting JPEG quality: %s\n", ladybugErrorToString( qualityError ) );
         }
+    }
+}
+
+//=============================================================================
+// Write an image to the stream if recording. When recording by GPS
+// distance, only images far enough from the last one recorded are written.
+// Stops recording if the write fails.
+//=============================================================================
+LadybugError
+recordImage( const LadybugImage* pImage )
+{
+    bool bRecordingCurrentImage = false;
+    double dDistance = 0;
 
-        bRecordingCurrentImage = true;
-        if ( bRecordingGPSData && iDistance_x > 0 && totalNumberOfImagesWritten != 0) 
+    if ( !bRecordingInProgress && preTrigger.isArmed() )
+    {
+        // Start recording when the camera enters the trigger area
+        if ( dTriggerRadius > 0.0 )
         {
-            // Only calculate distance when iDistance_x > 0
-            // Check the GPS distance
-            if ( GPS_Data_Current.bValidData && GPS_Data_Prev.bValidData )
-            {
-                dDistance = dGPSDistance(
+            retrieveGPSData( pImage, &GPS_Data_Current );
+            if ( GPS_Data_Current.bValidData &&
+                dGPSDistance(
                     GPS_Data_Current.dLatitude, GPS_Data_Current.dLongitude,
-                    GPS_Data_Prev.dLatitude, GPS_Data_Prev.dLongitude );
-                bRecordingCurrentImage = dDistance >= iDistance_x; 
-                if ( bRecordingCurrentImage )
-                {
-                    GPS_Data_Prev = GPS_Data_Current;
-                    printf( "Distance:%f >= %d \n", dDistance, iDistance_x );
-                }
+                    dTriggerLatitude, dTriggerLongitude ) <= dTriggerRadius )
+            {
+                printf( "Entered the trigger area\n" );
+                bTriggerRequested = true;
             }
-            else
+        }
+
+        if ( bTriggerRequested.exchange( false ) )
+        {
+            startRecording();
+            if ( error != LADYBUG_OK )
             {
-                bRecordingCurrentImage = false;
+                return error;
             }
         }
+    }
 
-        //
-        // Save the image to disk
-        //
-        if ( streamContext != NULL  && bRecordingInProgress )
+    if ( !bRecordingInProgress )
+    {
+        // Keep the image in case recording starts soon
+        bool bKept = false;
+        return preTrigger.add( *pImage, &bKept );
+    }
+
+    if ( bRecordingGPSData )
+    {         
+        // Retrieve the GPS data from the current image
+        if ( totalNumberOfImagesQueued == 0 )
+            // It is the first image. 
+            retrieveGPSData( pImage, &GPS_Data_Prev );
+        else
+            retrieveGPSData( pImage, &GPS_Data_Current );
+    }
+
+    bRecordingCurrentImage = true;
+    if ( bRecordingGPSData && iDistance_x > 0 && totalNumberOfImagesQueued != 0) 
+    {
+        // Only calculate distance when iDistance_x > 0
+        // Check the GPS distance
+        if ( GPS_Data_Current.bValidData && GPS_Data_Prev.bValidData )
         {
+            dDistance = dGPSDistance(
+                GPS_Data_Current.dLatitude, GPS_Data_Current.dLongitude,
+                GPS_Data_Prev.dLatitude, GPS_Data_Prev.dLongitude );
+            bRecordingCurrentImage = dDistance >= iDistance_x; 
             if ( bRecordingCurrentImage )
             {
-                error = ladybugWriteImageToStream( streamContext, 
-                    &image_Current, 
-                    &totalMBWritten, 
-                    &totalNumberOfImagesWritten ); 
-                if ( error != LADYBUG_OK )
-                {
-                    //
-                    // Stop recording if a write error occurs
-                    // If the return value is LADYBUG_ERROR_DISK_NOT_ENOUGH_SPACE, 
-                    // the disk is full.
-                    //
-                    bRecordingInProgress = false;
-                    ladybugStopStream ( streamContext );
-                    _DISPLAY_ERROR_MSG_AND_RETURN;  
-                }
+                GPS_Data_Prev = GPS_Data_Current;
+                printf( "Distance:%f >= %d \n", dDistance, iDistance_x );
             }
+        }
+        else
+        {
+            bRecordingCurrentImage = false;
+        }
+    }
+
+    //
+    // Queue the image for the stream writer, behind any images from before
+    // the trigger that are still being written
+    //
+    if ( !bRecordingCurrentImage )
+    {
+        return LADYBUG_OK;
+    }
+
+    bool bKept = false;
+    LadybugError writeError = preTrigger.add( *pImage, &bKept );
+    if ( writeError == LADYBUG_OK && !bKept )
+    {
+        writeError = pStreamWriter->write( *pImage );
+    }
+    if ( writeError != LADYBUG_OK )
+    {
+        //
+        // Stop recording if a write error occurs
+        // If the return value is LADYBUG_ERROR_DISK_NOT_ENOUGH_SPACE, 
+        // the disk is nearly full; the frames already queued are still 
+        // written before the stream is closed.
+        //
+        stopRecording();
+        return writeError;
+    }
+    totalNumberOfImagesQueued++;
+
+    // Copies an image for a panorama once a PanoramaInterval
+    panoramas.offer( *pImage );
+    return writeError;
+}
+
+//=============================================================================
+// Grab and save images. Display an image only if no image waiting for writing
+//=============================================================================
+void 
+recordingImage( void )
+{
+    // Room for the longest title, with the GPS string appended
+    char pszTimeString[256] = {0};
+
+    LadybugStageTimer grabTimer( LADYBUG_STAGE_GRAB );
+    error = ladybugLockNext( context, &image_Current );
+    if ( error == LADYBUG_OK )
+    {
+        grabTimer.setBytes( image_Current.uiDataSizeBytes );
+        grabTimer.stop();
+    }
+    else
+    {
+        // Time spent waiting for an image that never came is not grab latency
+        grabTimer.cancel();
+    }
+
+    switch ( error )
+    {
+    case LADYBUG_OK:
+        // Check for dropped frames and calculate the frame rate
+        frameTiming.addFrame( image_Current );
+        frameRate = frameTiming.getLastFrameRate();
+
+        updateJpegQuality( pStreamWriter->getBacklog() );
+
+        error = recordImage( &image_Current );
+        _DISPLAY_ERROR_MSG_AND_RETURN;  
+
+        // Copies one image in iWindowPreviewEveryNFrames for the preview thread
+        if ( preview.isInitialized() )
+        {
+            preview.offer( image_Current );
+        }
+
+        //
+        // Show the progress in the window title a few times a second;
+        // setting it for every frame costs the grab loop time
+        //
+        if ( bRecordingInProgress &&
+            getCurrentMs() - dLastTitleMs >= TITLE_INTERVAL_MS )
+        {
+            dLastTitleMs = getCurrentMs();
+
+            LadybugStreamWriterStats writerStats;
+            updateRecordingTotals( &writerStats );
 
             char pszGPSStr[64];
             if ( GPS_Data_Current.bValidData )
@@ -1172,11 +1747,14 @@ recordingImage( void )
             {
                 sprintf( pszGPSStr,"GPS: No Data\0" );
             }
-            sprintf( 
+            snprintf( 
                 pszTimeString,
-                "Grab: %4.1ffps Recording Total Data: %.1fMB Frames: %lu %s",
+                sizeof( pszTimeString ),
+                "Grab: %4.1ffps Recording Total Data: %.1fMB (%.1fMB/s, write p99 %.1fms) Frames: %lu %s",
                 frameRate, 
                 totalMBWritten, 
+                writerStats.dSustainedMBps,
+                writerStats.dWriteP99Ms,
                 totalNumberOfImagesWritten,
                 pszGPSStr );
 
@@ -1185,6 +1763,22 @@ recordingImage( void )
             //
             glutSetWindowTitle( pszTimeString );
         }
+        else if ( !bRecordingInProgress && preTrigger.isInitialized() &&
+            getCurrentMs() - dLastTitleMs >= TITLE_INTERVAL_MS )
+        {
+            dLastTitleMs = getCurrentMs();
+
+            LadybugPreTriggerStats preTriggerStats;
+            preTrigger.getStats( &preTriggerStats );
+            snprintf( 
+                pszTimeString,
+                sizeof( pszTimeString ),
+                "Grab: %4.1ffps Waiting for a trigger, %.1fs (%.1fMB) kept",
+                frameRate, 
+                preTriggerStats.dSecondsHeld,
+                preTriggerStats.ulBytesHeld / ( 1024.0 * 1024.0 ) );
+            glutSetWindowTitle( pszTimeString );
+        }
 
         ladybugUnlock( context, image_Prev.uiBufferIndex );
         image_Prev = image_Current;
@@ -1192,15 +1786,41 @@ recordingImage( void )
         break;      
 
     case LADYBUG_TIMEOUT:
+        if ( preview.isInitialized() )
+        {
+            // There is no image waiting, display the newest image the
+            // preview thread has converted, if it has not been shown yet
+            LadybugBufferSet* pSet = preview.acquireLatest();
+            if ( pSet == NULL )
+            {
+                break;
+            }
+
+            LadybugStageTimer renderTimer( LADYBUG_STAGE_RENDER );
+            error = ladybugUpdateTextures( 
+                context, LADYBUG_NUM_CAMERAS, (const unsigned char**)pSet->arpBuffers, pSet->pixelFormat );
+            renderTimer.stop();
+            preview.release( pSet );
+            _DISPLAY_ERROR_MSG_AND_RETURN;
+            isTextureUpdated = true;
+
+            // Redisplay
+            glutPostRedisplay();
+        }
+        else
         {
             // There is no image waiting, display the previous image.
             // Convert the image first
+            LadybugStageTimer convertTimer( LADYBUG_STAGE_CONVERT );
             error = ladybugConvertImage( context, &image_Prev, NULL );    
+            convertTimer.stop();
             _DISPLAY_ERROR_MSG_AND_RETURN;
 
             // Update images to the graphics card
             const LadybugPixelFormat pixelFormatToUse = isHighBitDepth(ladybugDataFormat) ? LADYBUG_BGRU16 : LADYBUG_BGRU;
+            LadybugStageTimer renderTimer( LADYBUG_STAGE_RENDER );
             error = ladybugUpdateTextures( context, LADYBUG_NUM_CAMERAS, NULL, pixelFormatToUse);
+            renderTimer.stop();
             _DISPLAY_ERROR_MSG_AND_RETURN;
             isTextureUpdated = true;
 
@@ -1216,8 +1836,259 @@ recordingImage( void )
 }
 
 
+//=============================================================================
+// Stop headless recording on Ctrl+C or SIGTERM
+//=============================================================================
+void
+onStopSignal( int /*iSignal*/ )
+{
+    bStopRequested = true;
+}
+
+//=============================================================================
+// Start recording on SIGUSR1 when waiting for a trigger
+//=============================================================================
+void
+onTriggerSignal( int /*iSignal*/ )
+{
+    bTriggerRequested = true;
+}
+
+//=============================================================================
+// Headless writer thread. Writes every frame the capture thread locks and
+// adjusts the JPEG quality. It shares no lock with the preview, so
+// recording never waits for it.
+//=============================================================================
+void
+writerLoop( LadybugLockNextCapture* pCapture, unsigned int uiConsumer )
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "writer" );
+
+    double dLastStatusMs = getCurrentMs();
+    while ( !bStopRequested )
+    {
+        LadybugLockedFrame* pFrame = pCapture->nextFrame( uiConsumer, 100 );
+        if ( pFrame == NULL )
+        {
+            if ( pCapture->getError() != LADYBUG_OK )
+            {
+                printf( "Error grabbing images: %s\n", ladybugErrorToString( pCapture->getError() ) );
+                bStopRequested = true;
+                break;
+            }
+            continue;
+        }
+
+        const LadybugError writeError = recordImage( &pFrame->image );
+        pCapture->release( pFrame );
+        if ( writeError != LADYBUG_OK )
+        {
+            printf( "Error writing the stream: %s\n", ladybugErrorToString( writeError ) );
+            bStopRequested = true;
+            break;
+        }
+
+        // Frames held by the capture wait for this thread, and frames in
+        // flight wait for the disk
+        LadybugCaptureStats captureStats;
+        pCapture->getStats( &captureStats );
+        const double dHeld = captureStats.uiMaxHeld > 0 ? (double)captureStats.uiHeld / captureStats.uiMaxHeld : 0.0;
+        updateJpegQuality( std::max( dHeld, pStreamWriter->getBacklog() ) );
+
+        if ( getCurrentMs() - dLastStatusMs >= STATUS_INTERVAL_MS && !bRecordingInProgress )
+        {
+            dLastStatusMs = getCurrentMs();
+            LadybugPreTriggerStats preTriggerStats;
+            preTrigger.getStats( &preTriggerStats );
+            printf( 
+                "Grab: %4.1ffps Waiting for a trigger, %.1fs (%.1fMB) kept\n",
+                frameTiming.getLastFrameRate(), 
+                preTriggerStats.dSecondsHeld,
+                preTriggerStats.ulBytesHeld / ( 1024.0 * 1024.0 ) );
+        }
+        else if ( getCurrentMs() - dLastStatusMs >= STATUS_INTERVAL_MS )
+        {
+            dLastStatusMs = getCurrentMs();
+            LadybugStreamWriterStats writerStats;
+            updateRecordingTotals( &writerStats );
+            printf( 
+                "Grab: %4.1ffps Recording Total Data: %.1fMB (%.1fMB/s, write p99 %.1fms, %u in flight) "
+                "Frames: %lu JPEG quality: %d\n",
+                frameTiming.getLastFrameRate(), 
+                totalMBWritten, 
+                writerStats.dSustainedMBps,
+                writerStats.dWriteP99Ms,
+                writerStats.uiInFlightFrames,
+                totalNumberOfImagesWritten,
+                jpegGovernor.getQuality() );
+        }
+    }
+}
+
+//=============================================================================
+// Headless preview thread. A latest-only consumer, so it never holds up
+// capture: it offers each frame it gets to the preview, which converts one
+// now and then on its own thread (see ladybugPreview.h), and saves the six
+// camera images of every converted frame as JPEG files next to the stream,
+// overwriting the previous ones.
+//=============================================================================
+void
+previewSaveLoop( LadybugLockNextCapture* pCapture, unsigned int uiConsumer )
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_ENCODE, "preview save" );
+
+    LadybugJpegEncoder encoder;
+    LadybugFileWriter fileWriter;
+    LadybugError saveError = encoder.initialize( 1, 75 );
+    if ( saveError == LADYBUG_OK )
+    {
+        saveError = fileWriter.start();
+    }
+    if ( saveError != LADYBUG_OK )
+    {
+        printf( "Preview disabled: %s\n", ladybugErrorToString( saveError ) );
+    }
+
+    while ( !bStopRequested )
+    {
+        LadybugLockedFrame* pFrame = pCapture->nextFrame( uiConsumer, 100 );
+        if ( pFrame != NULL )
+        {
+            preview.offer( pFrame->image );
+            pCapture->release( pFrame );
+        }
+
+        LadybugBufferSet* pSet = preview.acquireLatest();
+        if ( pSet == NULL )
+        {
+            continue;
+        }
+        std::vector<unsigned char> arJpegs[ LADYBUG_NUM_CAMERAS ];
+        LadybugError encodeError = saveError;
+        if ( encodeError == LADYBUG_OK )
+        {
+            encodeError = encoder.encodeImages( 
+                pSet->arpBuffers, LADYBUG_NUM_CAMERAS, pSet->uiCols, pSet->uiRows, pSet->pixelFormat, arJpegs );
+        }
+        preview.release( pSet );
+        if ( encodeError != LADYBUG_OK )
+        {
+            continue;
+        }
+
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            char pszPreviewName[ _MAX_PATH + 32 ];
+            snprintf( pszPreviewName, sizeof( pszPreviewName ), "%s-preview-camera%02u.jpg", pszRecordingName, uiCamera );
+            fileWriter.write( pszPreviewName, std::move( arJpegs[ uiCamera ] ) );
+        }
+    }
+
+    fileWriter.stop();
+    encoder.printStats( "Preview JPEG" );
+    encoder.shutdown();
+}
+
+//=============================================================================
+// Record without a display. A capture thread locks frames and hands them to
+// a writer thread, and optionally to a preview thread. Runs until Ctrl+C,
+// SIGTERM or a write error.
+//=============================================================================
+int
+runHeadless( void )
+{
+    signal( SIGINT, onStopSignal );
+    signal( SIGTERM, onStopSignal );
+
+    // The capture keeps two buffers free for the camera to fill
+    if ( iNumberOfBuffers < 3 )
+    {
+        printf( "Headless recording needs %s of at least 3\n", INI_NUMBER_OF_BUFFERS );
+        return 1;
+    }
+
+    startCamera();
+
+    // The capture locks its own images from here on
+    ladybugUnlock( context, image_Prev.uiBufferIndex );
+
+    // The same preview as the window's, at most one image per PreviewInterval
+    if ( iPreviewInterval > 0 )
+    {
+        LadybugPreviewConfig previewConfig;
+        previewConfig.uiFrameInterval = std::max( iWindowPreviewEveryNFrames, 1 );
+        previewConfig.uiIntervalMs = iPreviewInterval * 1000;
+        previewConfig.colorProcessingMethod = colorProcessingMethod;
+        previewConfig.pixelFormat = isHighBitDepth( ladybugDataFormat ) ? LADYBUG_BGRU16 : LADYBUG_BGRU;
+        error = preview.initialize( context, previewConfig );
+        _HANDLE_ERROR;
+    }
+
+    LadybugLockNextCapture capture;
+    error = capture.initialize( context, iNumberOfBuffers - 2, 100 );
+    _HANDLE_ERROR;
+    capture.setTimingAnalyzer( &frameTiming );
+    const unsigned int uiWriter = capture.addConsumer();
+    const unsigned int uiPreview = iPreviewInterval > 0 ? capture.addConsumer( true ) : 0;
+
+    if ( !bPreTrigger )
+    {
+        startRecording();
+        if ( !bRecordingInProgress )
+        {
+            printf( "Could not start recording\n" );
+            cleanUp();
+            return 1;
+        }
+    }
+
+    error = capture.start();
+    _HANDLE_ERROR;
+
+    std::thread writerThread( writerLoop, &capture, uiWriter );
+    std::thread previewThread;
+    if ( iPreviewInterval > 0 )
+    {
+        previewThread = std::thread( previewSaveLoop, &capture, uiPreview );
+    }
+
+    if ( bPreTrigger )
+    {
+        printf( "Waiting for a trigger. Send SIGUSR1 to start recording, Ctrl+C to stop.\n" );
+    }
+    else
+    {
+        printf( "Recording headless. Press Ctrl+C to stop.\n" );
+    }
+    while ( !bStopRequested )
+    {
+        sleepMs( 100 );
+    }
+
+    printf( "Stopping...\n" );
+    writerThread.join();
+    if ( previewThread.joinable() )
+    {
+        previewThread.join();
+    }
+    capture.stop();
+    capture.printStats( "Capture" );
+
+    if ( bRecordingInProgress )
+    {
+        stopRecording();
+    }
+    printf( "Recorded %lu frames, %.1fMB\n", totalNumberOfImagesWritten, totalMBWritten );
+
+    cleanUp();
+    return 0;
+}
+
+
 int main(int argc, char** argv)
 {
+    LadybugMetrics::instance().setName( "simplerecording" );
+    LadybugMetrics::instance().startPeriodicDumpFromEnvironment();
 
     //
     // Read initial configuration data from INI file
@@ -1228,6 +2099,27 @@ int main(int argc, char** argv)
             "One or more default values are being used.\n", INI_FILENAME );
     };
 
+    //
+    // --headless overrides the .ini file
+    //
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[i], "--headless" ) == 0 )
+        {
+            bHeadless = true;
+        }
+    }
+
+#ifndef _WIN32
+    // SIGUSR1 starts recording when waiting for a trigger
+    signal( SIGUSR1, onTriggerSignal );
+#endif
+
+    if ( bHeadless )
+    {
+        return runHeadless();
+    }
+
     //
     // GLUT Window Initialization
     //
@@ -1255,6 +2147,20 @@ int main(int argc, char** argv)
     error = ladybugSetDisplayWindow( context );
     _HANDLE_ERROR;
 
+    //
+    // Convert images for the window on a thread of its own, at the same
+    // color processing as the window's textures
+    //
+    if ( iWindowPreviewEveryNFrames > 0 )
+    {
+        LadybugPreviewConfig previewConfig;
+        previewConfig.uiFrameInterval = iWindowPreviewEveryNFrames;
+        previewConfig.colorProcessingMethod = colorProcessingMethod;
+        previewConfig.pixelFormat = isHighBitDepth( ladybugDataFormat ) ? LADYBUG_BGRU16 : LADYBUG_BGRU;
+        error = preview.initialize( context, previewConfig );
+        _HANDLE_ERROR;
+    }
+
     //
     // Register keyboard function:
     //
@@ -0,0 +1,260 @@
+//=============================================================================
+// ladybugDemosaicBenchmark.cpp
+//
+// Checks the SSE4.1 and AVX2 demosaic kernels in ladybugDemosaic.h against
+// the scalar reference for every method and Bayer pattern, then measures
+// the throughput of each kernel on one camera image and of
+// LadybugDemosaicer on a six camera frame.
+//
+// No camera or SDK library is needed; the Bayer images are random.
+//
+// Usage: LadybugDemosaicBenchmark [-c COLS] [-r ROWS] [-n ITERATIONS]
+//
+//  -c COLS        Columns of each camera image (default 2048)
+//  -r ROWS        Rows of each camera image (default 2448)
+//  -n ITERATIONS  Images demosaiced per measurement (default 20)
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugDemosaic.h"
+
+namespace
+{
+const LadybugDemosaicMethod s_methods[] = {
+    LADYBUG_DEMOSAIC_NEAREST, LADYBUG_DEMOSAIC_BILINEAR, LADYBUG_DEMOSAIC_DOWN4 };
+const unsigned int NUM_METHODS = sizeof( s_methods ) / sizeof( s_methods[ 0 ] );
+
+const LadybugStippledFormat s_patterns[] = { LADYBUG_RGGB, LADYBUG_GRBG, LADYBUG_GBRG, LADYBUG_BGGR };
+const char* s_patternNames[] = { "RGGB", "GRBG", "GBRG", "BGGR" };
+const unsigned int NUM_PATTERNS = sizeof( s_patterns ) / sizeof( s_patterns[ 0 ] );
+
+void fillRandom( std::vector<unsigned char>& buffer, unsigned int uiSeed )
+{
+    unsigned int x = uiSeed | 1;
+    for ( size_t i = 0; i < buffer.size(); i++ )
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buffer[ i ] = (unsigned char)x;
+    }
+}
+
+size_t getOutputBytes( LadybugDemosaicMethod method, unsigned int uiCols, unsigned int uiRows )
+{
+    unsigned int uiOutCols, uiOutRows;
+    ladybugGetDemosaicSize( method, uiCols, uiRows, &uiOutCols, &uiOutRows );
+    return (size_t)uiOutCols * uiOutRows * 4;
+}
+
+// Compare a kernel with the scalar reference. Returns the number of differing bytes.
+size_t compareWithScalar(
+    const std::vector<unsigned char>& raw,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugStippledFormat pattern,
+    LadybugDemosaicMethod method,
+    LadybugSimdLevel simdLevel )
+{
+    const size_t outputBytes = getOutputBytes( method, uiCols, uiRows );
+    std::vector<unsigned char> reference( outputBytes, 0 );
+    std::vector<unsigned char> output( outputBytes, 0 );
+
+    ladybugDemosaicImage( raw.data(), uiCols, uiRows, uiCols, pattern, method, reference.data(), LADYBUG_SIMD_SCALAR );
+    ladybugDemosaicImage( raw.data(), uiCols, uiRows, uiCols, pattern, method, output.data(), simdLevel );
+
+    size_t differences = 0;
+    for ( size_t i = 0; i < outputBytes; i++ )
+    {
+        differences += ( reference[ i ] != output[ i ] ) ? 1 : 0;
+    }
+    return differences;
+}
+
+double elapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    unsigned int uiCols = 2048;
+    unsigned int uiRows = 2448;
+    unsigned int uiIterations = 20;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( i + 1 < argc && strcmp( argv[ i ], "-c" ) == 0 )
+        {
+            uiCols = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-r" ) == 0 )
+        {
+            uiRows = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-n" ) == 0 )
+        {
+            uiIterations = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else
+        {
+            printf( "Usage: %s [-c COLS] [-r ROWS] [-n ITERATIONS]\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( uiCols < 2 || uiRows < 2 || ( uiCols & 1 ) != 0 || ( uiRows & 1 ) != 0 || uiIterations == 0 )
+    {
+        printf( "Error: the image size must be even and at least 2x2\n" );
+        return EXIT_FAILURE;
+    }
+
+    const LadybugSimdLevel bestLevel = ladybugGetBestSimdLevel();
+    printf( "Camera image %ux%u, best kernels: %s\n\n", uiCols, uiRows, ladybugGetSimdLevelName( bestLevel ) );
+
+    //
+    // Bit-exactness. A small odd-sized image exercises the scalar edges and tails.
+    //
+    std::vector<unsigned char> raw( (size_t)uiCols * uiRows );
+    fillRandom( raw, 1 );
+    std::vector<unsigned char> smallRaw( 38 * 6 );
+    fillRandom( smallRaw, 2 );
+
+    bool bAllExact = true;
+    for ( int level = LADYBUG_SIMD_SSE41; level <= bestLevel; level++ )
+    {
+        for ( unsigned int m = 0; m < NUM_METHODS; m++ )
+        {
+            for ( unsigned int p = 0; p < NUM_PATTERNS; p++ )
+            {
+                const size_t differences =
+                    compareWithScalar( raw, uiCols, uiRows, s_patterns[ p ], s_methods[ m ], (LadybugSimdLevel)level ) +
+                    compareWithScalar( smallRaw, 38, 6, s_patterns[ p ], s_methods[ m ], (LadybugSimdLevel)level );
+                if ( differences != 0 )
+                {
+                    printf( "MISMATCH: %s %s %s, %zu bytes differ\n",
+                        ladybugGetSimdLevelName( (LadybugSimdLevel)level ),
+                        ladybugGetDemosaicMethodName( s_methods[ m ] ),
+                        s_patternNames[ p ],
+                        differences );
+                    bAllExact = false;
+                }
+            }
+        }
+    }
+    printf( "Bit-exact against scalar: %s\n\n", bAllExact ? "yes" : "NO" );
+
+    //
+    // Throughput of each kernel on one camera image
+    //
+    const double dMegapixels = (double)uiCols * uiRows / 1e6;
+    printf( "%-10s %-8s %10s %10s %8s\n", "method", "kernels", "ms/image", "MPix/s", "speedup" );
+    for ( unsigned int m = 0; m < NUM_METHODS; m++ )
+    {
+        std::vector<unsigned char> output( getOutputBytes( s_methods[ m ], uiCols, uiRows ) );
+        double dScalarSeconds = 0.0;
+
+        for ( int level = LADYBUG_SIMD_SCALAR; level <= bestLevel; level++ )
+        {
+            // Warm up the caches and page in the output
+            ladybugDemosaicImage( raw.data(), uiCols, uiRows, uiCols, LADYBUG_RGGB, s_methods[ m ], output.data(), (LadybugSimdLevel)level );
+
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for ( unsigned int i = 0; i < uiIterations; i++ )
+            {
+                ladybugDemosaicImage( raw.data(), uiCols, uiRows, uiCols, LADYBUG_RGGB, s_methods[ m ], output.data(), (LadybugSimdLevel)level );
+            }
+            const double dSeconds = elapsedSeconds( start ) / uiIterations;
+            if ( level == LADYBUG_SIMD_SCALAR )
+            {
+                dScalarSeconds = dSeconds;
+            }
+
+            printf( "%-10s %-8s %10.2f %10.1f %7.1fx\n",
+                ladybugGetDemosaicMethodName( s_methods[ m ] ),
+                ladybugGetSimdLevelName( (LadybugSimdLevel)level ),
+                dSeconds * 1000.0,
+                dMegapixels / dSeconds,
+                dScalarSeconds / dSeconds );
+        }
+    }
+
+    //
+    // Six cameras, one worker per camera
+    //
+    std::vector<unsigned char> frame( (size_t)uiCols * uiRows * LADYBUG_NUM_CAMERAS );
+    fillRandom( frame, 3 );
+
+    LadybugImage image;
+    image.uiCols = image.uiFullCols = uiCols;
+    image.uiRows = image.uiFullRows = uiRows;
+    image.dataFormat = LADYBUG_DATAFORMAT_RAW8;
+    image.stippledFormat = LADYBUG_RGGB;
+    image.pData = frame.data();
+    image.uiDataSizeBytes = (unsigned int)frame.size();
+
+    printf( "\n%-10s %10s %10s %10s\n", "method", "ms/frame", "frames/s", "MPix/s" );
+    for ( unsigned int m = 0; m < NUM_METHODS; m++ )
+    {
+        LadybugDemosaicer demosaicer;
+        LadybugError error = demosaicer.initialize( s_methods[ m ] );
+        if ( error != LADYBUG_OK )
+        {
+            printf( "Error: could not start the demosaicer\n" );
+            return EXIT_FAILURE;
+        }
+
+        const size_t outputBytes = getOutputBytes( s_methods[ m ], uiCols, uiRows );
+        std::vector<unsigned char> outputs( outputBytes * LADYBUG_NUM_CAMERAS );
+        unsigned char* arpBuffers[ LADYBUG_NUM_CAMERAS ];
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            arpBuffers[ uiCamera ] = outputs.data() + uiCamera * outputBytes;
+        }
+
+        demosaicer.demosaic( image, arpBuffers );
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for ( unsigned int i = 0; i < uiIterations; i++ )
+        {
+            demosaicer.demosaic( image, arpBuffers );
+        }
+        const double dSeconds = elapsedSeconds( start ) / uiIterations;
+
+        // Every camera must match the scalar reference
+        std::vector<unsigned char> reference( outputBytes );
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            ladybugDemosaicImage(
+                frame.data() + (size_t)uiCamera * uiCols * uiRows, uiCols, uiRows, uiCols,
+                LADYBUG_RGGB, s_methods[ m ], reference.data(), LADYBUG_SIMD_SCALAR );
+            if ( memcmp( reference.data(), arpBuffers[ uiCamera ], outputBytes ) != 0 )
+            {
+                printf( "MISMATCH: camera %u differs from the scalar reference\n", uiCamera );
+                bAllExact = false;
+            }
+        }
+
+        printf( "%-10s %10.2f %10.1f %10.1f\n",
+            ladybugGetDemosaicMethodName( s_methods[ m ] ),
+            dSeconds * 1000.0,
+            1.0 / dSeconds,
+            dMegapixels * LADYBUG_NUM_CAMERAS / dSeconds );
+
+        demosaicer.shutdown();
+        demosaicer.printStats( "  Demosaicer" );
+    }
+
+    return bAllExact ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+//=============================================================================
+// ladybugNmeaBenchmark.cpp
+//
+// Checks LadybugNmeaParser on known sentences, then measures the cost per
+// image of getting a position from a typical block of GPS sentences:
+//
+//  - Changed: every block differs from the one before, so each is parsed.
+//  - Unchanged: the same block every time, as for the images grabbed
+//    between two GPS updates.
+//  - Three lookups: the way retrieveGPSData() used to work, finding GGA,
+//    then RMC, then GLL in the block and scanning each with sscanf(). Only
+//    for comparison; it checks no checksums.
+//
+// No camera or SDK library is needed.
+//
+// Usage: LadybugNmeaBenchmark [-n ITERATIONS]
+//
+//  -n ITERATIONS  Blocks parsed per measurement (default 1000000)
+//=============================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+
+#include "ladybugNmeaParser.h"
+
+namespace
+{
+// "$" + body + "*hh\r\n"
+std::string makeSentence( const char* pszBody )
+{
+    unsigned char ucSum = 0;
+    for ( const char* p = pszBody; *p != '\0'; p++ )
+    {
+        ucSum ^= (unsigned char)*p;
+    }
+    char szChecksum[ 8 ];
+    snprintf( szChecksum, sizeof( szChecksum ), "*%02X\r\n", ucSum );
+    return std::string( "$" ) + pszBody + szChecksum;
+}
+
+// What a GPS receiver at 1Hz typically sends
+std::string makeTypicalBlock( const char* pszTime )
+{
+    char szGga[ 128 ];
+    snprintf( szGga, sizeof( szGga ),
+        "GPGGA,%s,4916.4512,N,12311.1234,W,1,08,0.9,545.4,M,46.9,M,,", pszTime );
+    char szRmc[ 128 ];
+    snprintf( szRmc, sizeof( szRmc ),
+        "GPRMC,%s,A,4916.4512,N,12311.1234,W,022.4,084.4,230394,003.1,W", pszTime );
+
+    return makeSentence( szGga ) +
+        makeSentence( "GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1" ) +
+        makeSentence( "GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00" ) +
+        makeSentence( "GPGSV,3,2,11,14,25,170,00,16,57,208,39,18,67,296,40,19,40,246,00" ) +
+        makeSentence( "GPGSV,3,3,11,22,42,067,42,24,14,311,43,27,05,244,00,,,," ) +
+        makeSentence( szRmc ) +
+        makeSentence( "GPVTG,084.4,T,087.5,M,022.4,N,041.5,K" ) +
+        makeSentence( "GPZDA,201530.00,04,07,2002,00,00" );
+}
+
+bool isClose( double dA, double dB )
+{
+    return fabs( dA - dB ) < 1e-7;
+}
+
+bool check( const char* pszName, bool bPassed, int* piFailures )
+{
+    printf( "%-40s %s\n", pszName, bPassed ? "ok" : "FAILED" );
+    if ( !bPassed )
+    {
+        ( *piFailures )++;
+    }
+    return bPassed;
+}
+
+int runChecks()
+{
+    int iFailures = 0;
+    LadybugGpsFix fix;
+
+    {
+        LadybugNmeaParser parser;
+        const std::string block = makeTypicalBlock( "123519.50" );
+        const bool bValid = parser.parse( block.data(), (unsigned int)block.size(), &fix );
+        check( "Typical block gives the GGA fix",
+            bValid && fix.source == LADYBUG_GPS_FIX_GGA &&
+            isClose( fix.dLatitude, 49.0 + 16.4512 / 60.0 ) &&
+            isClose( fix.dLongitude, -( 123.0 + 11.1234 / 60.0 ) ) &&
+            isClose( fix.dAltitude, 545.4 ) &&
+            fix.ucQuality == 1 && fix.ucSatellites == 8 &&
+            fix.uiUtcMs == ( ( 12 * 60 + 35 ) * 60 + 19 ) * 1000 + 500 &&
+            fabs( fix.fSpeedKnots - 22.4f ) < 1e-4f && fabs( fix.fCourse - 84.4f ) < 1e-4f,
+            &iFailures );
+
+        LadybugGpsFix again;
+        parser.parse( block.data(), (unsigned int)block.size(), &again );
+        LadybugNmeaParserStats stats;
+        parser.getStats( &stats );
+        check( "Same block again is not parsed",
+            stats.ulUnchanged == 1 && stats.ulSentences == 8 && memcmp( &again, &fix, sizeof( fix ) ) == 0,
+            &iFailures );
+    }
+
+    {
+        // The GGA checksum is off by one, so RMC gives the position
+        LadybugNmeaParser parser;
+        std::string gga = makeSentence( "GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,," );
+        gga[ gga.size() - 3 ] = gga[ gga.size() - 3 ] == '0' ? '1' : '0';
+        const std::string block = gga + makeSentence( "GPRMC,123519,A,4807.038,S,01131.000,E,022.4,084.4,230394,003.1,W" );
+        parser.parse( block.data(), (unsigned int)block.size(), &fix );
+        LadybugNmeaParserStats stats;
+        parser.getStats( &stats );
+        check( "Bad checksum falls back to RMC",
+            fix.bValid && fix.source == LADYBUG_GPS_FIX_RMC && stats.ulChecksumErrors == 1 &&
+            isClose( fix.dLatitude, -( 48.0 + 7.038 / 60.0 ) ),
+            &iFailures );
+    }
+
+    {
+        LadybugNmeaParser parser;
+        const std::string block =
+            makeSentence( "GPGGA,123519,,,,,0,00,,,M,,M,," ) +
+            makeSentence( "GPRMC,123519,V,,,,,,,230394,," ) +
+            makeSentence( "GNGLL,4807.038,N,01131.000,E,123519,A,A" );
+        parser.parse( block.data(), (unsigned int)block.size(), &fix );
+        check( "No GGA or RMC fix falls back to GLL",
+            fix.bValid && fix.source == LADYBUG_GPS_FIX_GLL && isClose( fix.dLongitude, 11.0 + 31.0 / 60.0 ),
+            &iFailures );
+    }
+
+    {
+        LadybugNmeaParser parser;
+        const std::string block = makeSentence( "GNGGA,123519,4807.038,N,01131.000,E,2,12,0.9,5.0,M,46.9,M,," );
+        parser.parse( block.data(), (unsigned int)block.size(), &fix );
+        check( "GNGGA is used", fix.bValid && fix.source == LADYBUG_GPS_FIX_GGA && fix.ucQuality == 2, &iFailures );
+    }
+
+    {
+        LadybugNmeaParser parser;
+        const char* pszBlock = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,\r\n";
+        parser.parse( pszBlock, (unsigned int)strlen( pszBlock ), &fix );
+        check( "Sentence without a checksum is ignored", !fix.bValid, &iFailures );
+    }
+
+    {
+        LadybugNmeaParser parser;
+        const char* pszBlock = "";
+        parser.parse( pszBlock, 0, &fix );
+        check( "Empty block has no fix", !fix.bValid && fix.source == LADYBUG_GPS_FIX_NONE, &iFailures );
+    }
+
+    return iFailures;
+}
+
+// Find GGA, RMC and GLL in turn, as three separate lookups
+bool threeLookups( const char* pszBlock, double* pdLatitude, double* pdLongitude )
+{
+    const char* pszSentences[] = { "$GPGGA,", "$GPRMC,", "$GPGLL," };
+    for ( unsigned int i = 0; i < 3; i++ )
+    {
+        const char* p = strstr( pszBlock, pszSentences[ i ] );
+        if ( p == NULL )
+        {
+            continue;
+        }
+
+        double dTime = 0.0;
+        double dLatitude = 0.0;
+        double dLongitude = 0.0;
+        char cNorthSouth = 0;
+        char cEastWest = 0;
+        char cStatus = 0;
+        int iQuality = 0;
+        bool bValid = false;
+        if ( i == 0 )
+        {
+            bValid = sscanf( p, "$GPGGA,%lf,%lf,%c,%lf,%c,%d", &dTime, &dLatitude, &cNorthSouth, &dLongitude, &cEastWest, &iQuality ) == 6 &&
+                iQuality > 0;
+        }
+        else if ( i == 1 )
+        {
+            bValid = sscanf( p, "$GPRMC,%lf,%c,%lf,%c,%lf,%c", &dTime, &cStatus, &dLatitude, &cNorthSouth, &dLongitude, &cEastWest ) == 6 &&
+                cStatus == 'A';
+        }
+        else
+        {
+            bValid = sscanf( p, "$GPGLL,%lf,%c,%lf,%c,%lf,%c", &dLatitude, &cNorthSouth, &dLongitude, &cEastWest, &dTime, &cStatus ) == 6 &&
+                cStatus == 'A';
+        }
+
+        if ( bValid )
+        {
+            *pdLatitude = ( cNorthSouth == 'S' ? -1.0 : 1.0 ) * ( (int)( dLatitude / 100 ) + fmod( dLatitude, 100.0 ) / 60.0 );
+            *pdLongitude = ( cEastWest == 'W' ? -1.0 : 1.0 ) * ( (int)( dLongitude / 100 ) + fmod( dLongitude, 100.0 ) / 60.0 );
+            return true;
+        }
+    }
+    return false;
+}
+
+double elapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+void printResult( const char* pszTest, double dSeconds, unsigned long ulIterations, double dChecksum )
+{
+    printf( "%-24s %10.1f %12.2f   (%.3f)\n",
+        pszTest,
+        dSeconds * 1e9 / ulIterations,
+        ulIterations / dSeconds / 1e6,
+        dChecksum / ulIterations );
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    unsigned long ulIterations = 1000000;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( i + 1 < argc && strcmp( argv[ i ], "-n" ) == 0 )
+        {
+            ulIterations = (unsigned long)atol( argv[ ++i ] );
+        }
+        else
+        {
+            printf( "Usage: %s [-n ITERATIONS]\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( ulIterations == 0 )
+    {
+        printf( "Error: ITERATIONS must be at least 1\n" );
+        return EXIT_FAILURE;
+    }
+
+    const int iFailures = runChecks();
+
+    // Two blocks a GPS update apart, so alternating between them always
+    // changes the block
+    const std::string blocks[ 2 ] = { makeTypicalBlock( "123519.00" ), makeTypicalBlock( "123520.00" ) };
+    printf( "\n%lu blocks of %zu bytes, 8 sentences each\n\n", ulIterations, blocks[ 0 ].size() );
+    printf( "%-24s %10s %12s   %s\n", "test", "ns/image", "Mimages/s", "mean latitude" );
+
+    LadybugNmeaParser parser;
+    LadybugGpsFix fix;
+    double dChecksum = 0.0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for ( unsigned long i = 0; i < ulIterations; i++ )
+    {
+        const std::string& block = blocks[ i & 1 ];
+        parser.parse( block.data(), (unsigned int)block.size(), &fix );
+        dChecksum += fix.dLatitude;
+    }
+    printResult( "Changed", elapsedSeconds( start ), ulIterations, dChecksum );
+
+    dChecksum = 0.0;
+    start = std::chrono::steady_clock::now();
+    for ( unsigned long i = 0; i < ulIterations; i++ )
+    {
+        parser.parse( blocks[ 0 ].data(), (unsigned int)blocks[ 0 ].size(), &fix );
+        dChecksum += fix.dLatitude;
+    }
+    printResult( "Unchanged", elapsedSeconds( start ), ulIterations, dChecksum );
+
+    dChecksum = 0.0;
+    start = std::chrono::steady_clock::now();
+    for ( unsigned long i = 0; i < ulIterations; i++ )
+    {
+        double dLatitude = 0.0;
+        double dLongitude = 0.0;
+        threeLookups( blocks[ i & 1 ].c_str(), &dLatitude, &dLongitude );
+        dChecksum += dLatitude;
+    }
+    printResult( "Three lookups (sscanf)", elapsedSeconds( start ), ulIterations, dChecksum );
+
+    printf( "\nChecks: %s\n", iFailures == 0 ? "all passed" : "FAILED" );
+    return iFailures == 0 ? 0 : EXIT_FAILURE;
+}
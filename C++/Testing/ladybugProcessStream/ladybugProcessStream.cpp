@@ -27,6 +27,21 @@
 // This example reads processing parametere options from command line.
 // Use -? or -h option to display the usage help.
 //
+// Set LADYBUG_METRICS_FILE to write per-stage latency histograms while the
+// program runs (see ladybugMetrics.h).
+//
+// With -j N, the frame range is split into shards of SHARD_FRAMES frames,
+// processed by N workers at once. Each worker has its own stream and
+// processing contexts: it seeks to the start of each shard it takes with
+// ladybugGoToImage() and renders the shard's frames in order. The rendered
+// frames are written by the main thread in frame order, so the GPS file and
+// the H.264 video come out as they would from one worker. Workers may run
+// at most a few shards ahead of the frame being written. Use software
+// rendering (-s true) so the workers do not share one graphics card.
+// Stabilization follows each frame from the one before it, so it needs the
+// frames in order on one context: with -z true, -j is ignored and one
+// worker processes the whole range.
+//
 //===============================================================
 
 
@@ -36,6 +51,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 //=============================================================================
 // PGR Includes
@@ -47,6 +70,11 @@
 #include <ladybugGPS.h>
 #include <ladybugvideo.h>
 #include "getopt.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugFileWriter.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugThreadPlacement.h"
 
 //=============================================================================
 // Platform specific indludes and definitions
@@ -94,6 +122,67 @@ float fRotY = 0.0f;
 float fRotZ = 0.0f;
 int iBitRate = 4000; // in kbps
 bool processH264 = false;
+LadybugJpegEncoder jpegEncoder;
+LadybugFileWriter fileWriter;
+LadybugVideoContext videoContext;
+char videoPath[ 256];
+char pszGpsFilePath[ 256];
+int iNumWorkers = 1;
+
+// Frames each worker takes at a time with -j
+const unsigned int SHARD_FRAMES = 16;
+
+// A worker's own contexts and texture buffers. Worker 0 uses the globals.
+struct ProcessWorker
+{
+    ProcessWorker()
+        : context( NULL),
+          readContext( NULL)
+    {
+        for( int i = 0; i < LADYBUG_NUM_CAMERAS; i++)
+        {
+            arpTextureBuffers[ i ] = NULL;
+        }
+    }
+
+    LadybugContext context;
+    LadybugStreamContext readContext;
+    unsigned char* arpTextureBuffers[ LADYBUG_NUM_CAMERAS];
+    std::thread thread;
+};
+
+// What a processed frame leaves to be written in frame order
+struct FrameOutput
+{
+    FrameOutput()
+        : bSkipped( false),
+          image()
+    {
+    }
+
+    // The frame could not be converted and has no output
+    bool bSkipped;
+
+    std::string gpsLine;
+
+    // An encoded JPEG and its file name
+    std::string name;
+    std::vector<unsigned char> jpeg;
+
+    // The rendered image, for the H.264 video. pData points into imageData
+    // once the image has been kept.
+    LadybugProcessedImage image;
+    std::vector<unsigned char> imageData;
+};
+
+// Shared by the workers and the main thread with -j
+std::mutex shardMutex;
+std::condition_variable shardProgress;
+unsigned int uiNextShardFrame = 0;
+unsigned int uiNextCommitFrame = 0;
+unsigned int uiShardWindow = 0;
+bool bShardsStopped = false;
+std::map<unsigned int, FrameOutput> readyFrames;
 
 //=============================================================================
 // Macro Definitions
@@ -204,6 +293,10 @@ display_Usage( const char* pszProgramName )
         "  -x XXX-YYY-ZZZ   Euler rotation angle in degrees when RENDER_TYPE is \"spherical\". Default is %f-%f-%f.\n"
         "  -l CAL_FILE_PATH Path to calibration file to replace.\n"
         "  -e BITRATE  Bitrate in kbps for H.264 video output. Default is %d.\n"
+        "  -j N        Number of workers processing shards of %u frames at once,\n"
+        "              each with its own contexts. Output is written in frame order.\n"
+        "              Use with -s true. Ignored with -z true.\n"
+        "              Default is %d.\n"
         "\n", 
         pszOutputFilePrefix, pszOutputGPSPrefix,
         iOutputImageWidth, iOutputImageHeight,
@@ -219,7 +312,9 @@ display_Usage( const char* pszProgramName )
         fRotX,
         fRotY,
         fRotZ,
-        iBitRate
+        iBitRate,
+        SHARD_FRAMES,
+        iNumWorkers
         );
 
     printf( 
@@ -281,6 +376,107 @@ int strncmpCaseInsensitive(const char* str1, const char* str2, int num)
 #endif
 }
 
+// Set up a context for color processing and rendering with the options
+// given. The context of every worker is set up the same way.
+LadybugError
+configureProcessing( LadybugContext context )
+{
+    LadybugError error;
+
+    //
+    // Set color processing method.
+    //
+    printf("Setting debayering method...\n" );
+    error = ladybugSetColorProcessingMethod( context, colorProcessingMethod);     
+    _CHECK_ERROR;
+
+    // 
+    // Set falloff correction value and flag
+    //
+    error = ladybugSetFalloffCorrectionAttenuation( context, fFalloffCorrectionValue );
+    _CHECK_ERROR;
+    error = ladybugSetFalloffCorrectionFlag( context, bFalloffCorrectionFlagOn );
+    _CHECK_ERROR;
+
+    //
+    // Set blending width
+    //
+    error = ladybugSetBlendingParams( context, iBlendingWidth );
+    _CHECK_ERROR;
+
+    //
+    // Initialize alpha mask size - this can take a long time if the
+    // masks are not present in the current directory.
+    //
+    printf( "Initializing alpha masks (this may take some time)...\n" );
+    error = ladybugInitializeAlphaMasks( context, iTextureWidth, iTextureHeight );
+    _CHECK_ERROR;
+
+    // 
+    // Make the rendering engine use the alpha mask
+    //
+    error = ladybugSetAlphaMasking( context, true );
+    _CHECK_ERROR;
+
+    //
+    // Enable image sampling anti-aliasing
+    //
+    if ( bEnableAntiAliasing )
+    {
+        error = ladybugSetAntiAliasing( context, true );
+        _CHECK_ERROR;
+    }
+
+    //
+    // Use ladybugEnableSoftwareRendering() to enable 
+    // Ladybug library to render the off-screen image using a bitmap buffer 
+    // in system memory. The image rendering process will not be hardware 
+    // accelerated.
+    //
+    if ( bEnableSoftwareRendering )
+    {
+        error = ladybugEnableSoftwareRendering( context, true );
+        _CHECK_ERROR;
+    }
+
+    if ( bEnableStabilization )
+    {
+        error = ladybugEnableImageStabilization( 
+            context, bEnableStabilization, &stabilizationParams);
+        _CHECK_ERROR;
+    }
+
+    //
+    // Configure output images in Ladybug liabrary
+    //
+    printf( "Configure output images in Ladybug library...\n" );
+    error = ladybugConfigureOutputImages( 
+        context, 
+        outputImageType );
+    _CHECK_ERROR;
+
+    printf("Set off-screen panoramic image size:%dx%d image.\n", iOutputImageWidth, iOutputImageHeight );
+    error = ladybugSetOffScreenImageSize(
+        context,
+        outputImageType,  
+        iOutputImageWidth, 
+        iOutputImageHeight );  
+    _CHECK_ERROR;
+
+    error = ladybugSetSphericalViewParams(
+        context,
+        fFOV,
+        fRotX * 3.14159265f / 180.0f,
+        fRotY * 3.14159265f / 180.0f,
+        fRotZ * 3.14159265f / 180.0f,
+        0.0f,
+        0.0f,
+        0.0f);
+    _CHECK_ERROR;
+
+    return LADYBUG_OK;
+}
+
 LadybugError
 initializeLadybug( void )
 {
@@ -351,21 +547,6 @@ initializeLadybug( void )
     printf( "Frame rate : %3.2f\n", frameRateToUse);
     printf( "--------------------------\n");
 
-    //
-    // Set color processing method.
-    //
-    printf("Setting debayering method...\n" );
-    error = ladybugSetColorProcessingMethod( context, colorProcessingMethod);     
-    _CHECK_ERROR;
-
-    // 
-    // Set falloff correction value and flag
-    //
-    error = ladybugSetFalloffCorrectionAttenuation( context, fFalloffCorrectionValue );
-    _CHECK_ERROR;
-    error = ladybugSetFalloffCorrectionFlag( context, bFalloffCorrectionFlagOn );
-    _CHECK_ERROR;
-
     //
     // read one image from the stream
     //
@@ -392,100 +573,352 @@ initializeLadybug( void )
 		arpTextureBuffers[ i ] = new unsigned char[ iTextureWidth * iTextureHeight * 4 * outputBytesPerPixel];
     }
 
+    error = configureProcessing( context );
+    _CHECK_ERROR;
+
+    return LADYBUG_OK;
+}
+
+bool
+cleanupLadybug( void )
+{
+    ladybugDestroyStreamContext( &readContext);
+    ladybugDestroyContext( &context);
+    for( int i = 0; i < LADYBUG_NUM_CAMERAS; i++)
+    {
+        if ( arpTextureBuffers[ i ] != NULL )
+        {
+            delete arpTextureBuffers[ i ];
+            arpTextureBuffers[ i ] = NULL;
+        }
+    }
+    return true;
+}
+
+LadybugError
+initializeWorker( ProcessWorker* pWorker )
+{
+    LadybugError error;
+
+    error = ladybugCreateContextWithCalibration( context, &pWorker->context);
+    _CHECK_ERROR;
+
+    error = ladybugCreateStreamContext( &pWorker->readContext);
+    _CHECK_ERROR;
+
+    error = ladybugInitializeStreamForReading( pWorker->readContext, pszInputStream, true );
+    _CHECK_ERROR;
+
+    const unsigned int outputBytesPerPixel = isHighBitDepth(streamHeaderInfo.dataFormat) ? 2 : 1;
+    for( int i = 0; i < LADYBUG_NUM_CAMERAS; i++)
+    {
+        pWorker->arpTextureBuffers[ i ] = new unsigned char[ iTextureWidth * iTextureHeight * 4 * outputBytesPerPixel];
+    }
+
+    return configureProcessing( pWorker->context );
+}
+
+void
+cleanupWorker( ProcessWorker* pWorker )
+{
+    if ( pWorker->readContext != NULL )
+    {
+        ladybugDestroyStreamContext( &pWorker->readContext);
+    }
+    if ( pWorker->context != NULL )
+    {
+        ladybugDestroyContext( &pWorker->context);
+    }
+    for( int i = 0; i < LADYBUG_NUM_CAMERAS; i++)
+    {
+        delete [] pWorker->arpTextureBuffers[ i ];
+        pWorker->arpTextureBuffers[ i ] = NULL;
+    }
+}
+
+//
+// Read, convert and render the next frame of a stream. A JPEG image is
+// encoded, and other image formats are saved; the rest of the output is left
+// in pOutput to be written in frame order by commitFrame().
+//
+LadybugError
+processFrame(
+    LadybugContext processContext,
+    LadybugStreamContext frameReadContext,
+    unsigned char** arpTextures,
+    unsigned int iFrame,
+    FrameOutput* pOutput )
+{
+    LadybugError error;
+    LadybugImage image;
+
+    printf( "Processing frame %u of %u\n", iFrame, iFrameTo);
+
     //
-    // Set blending width
+    // Read one frame from stream
     //
-    error = ladybugSetBlendingParams( context, iBlendingWidth );
+    LadybugStageTimer readTimer( LADYBUG_STAGE_GRAB);
+    error = ladybugReadImageFromStream( frameReadContext, &image);
+    readTimer.setBytes( image.uiDataSizeBytes);
+    readTimer.stop();
     _CHECK_ERROR;
 
     //
-    // Initialize alpha mask size - this can take a long time if the
-    // masks are not present in the current directory.
+    // Convert the image to BGRU format texture buffers
     //
-    printf( "Initializing alpha masks (this may take some time)...\n" );
-    error = ladybugInitializeAlphaMasks( context, iTextureWidth, iTextureHeight );
-    _CHECK_ERROR;
+    LadybugStageTimer convertTimer( LADYBUG_STAGE_CONVERT);
+    error = ladybugConvertImage( processContext, &image, arpTextures, isHighBitDepth(streamHeaderInfo.dataFormat) ? LADYBUG_BGRU16 : LADYBUG_BGRU);
+    convertTimer.stop();
+    if ( error != LADYBUG_OK )
+    {
+        printf( "Error! Ladybug library reported %s\n", ::ladybugErrorToString( error ) );
+        pOutput->bSkipped = true;
+        return LADYBUG_OK;
+    }
 
-    // 
-    // Make the rendering engine use the alpha mask
     //
-    error = ladybugSetAlphaMasking( context, true );
+    // Update the textures on graphics card
+    //
+    LadybugStageTimer textureTimer( LADYBUG_STAGE_RENDER);
+    error = ladybugUpdateTextures( 
+        processContext, LADYBUG_NUM_CAMERAS, (const unsigned char**)arpTextures, isHighBitDepth(streamHeaderInfo.dataFormat) ? LADYBUG_BGRU16 : LADYBUG_BGRU);
+    textureTimer.stop();
     _CHECK_ERROR;
 
     //
-    // Enable image sampling anti-aliasing
+    // Output GPS information on text file if it exists in the image
     //
-    if ( bEnableAntiAliasing )
+    LadybugNMEAGPGGA gpsData;
+    error = ladybugGetGPSNMEADataFromImage( &image, "GPGGA", &gpsData);
+    if ( error == LADYBUG_OK && gpsData.bValidData)
     {
-        error = ladybugSetAntiAliasing( context, true );
-        _CHECK_ERROR;
+        printf( "GPS INFO: LAT %lf, LONG %lf\n", gpsData.dGGALatitude, gpsData.dGGALongitude);
+        char pszGpsLine[ 128];
+        sprintf( pszGpsLine, "%u, LAT %lf, LONG %lf\n", iFrame, gpsData.dGGALatitude, gpsData.dGGALongitude);
+        pOutput->gpsLine = pszGpsLine;
     }
 
     //
-    // Use ladybugEnableSoftwareRendering() to enable 
-    // Ladybug library to render the off-screen image using a bitmap buffer 
-    // in system memory. The image rendering process will not be hardware 
-    // accelerated.
+    // Render and obtain the image in off-screen buffer
     //
-    if ( bEnableSoftwareRendering )
+    LadybugStageTimer renderTimer( LADYBUG_STAGE_RENDER);
+    error = ladybugRenderOffScreenImage(
+        processContext, outputImageType, LADYBUG_BGR, &pOutput->image);
+    renderTimer.stop();
+    _CHECK_ERROR;
+
+    //
+    // Encode or write the rendered image
+    //
+    if ( processH264)
     {
-        error = ladybugEnableSoftwareRendering( context, true );
-        _CHECK_ERROR;
+        return LADYBUG_OK;
     }
 
-    if ( bEnableStabilization )
+    char pszOutputName[ 256];
+    switch ( outputImageFormat ){
+    case LADYBUG_FILEFORMAT_BMP: 
+        sprintf( pszOutputName, "%s_%06u.bmp", pszOutputFilePrefix, iFrame); 
+        break;
+    case LADYBUG_FILEFORMAT_JPG: 
+        sprintf( pszOutputName, "%s_%06u.jpg", pszOutputFilePrefix, iFrame); 
+        break;
+    case LADYBUG_FILEFORMAT_TIFF: 
+        sprintf( pszOutputName, "%s_%06u.tiff", pszOutputFilePrefix, iFrame); 
+        break;
+    case LADYBUG_FILEFORMAT_PNG: 
+        sprintf( pszOutputName, "%s_%06u.png", pszOutputFilePrefix, iFrame); 
+        break;
+    default: 
+        sprintf( pszOutputName, "%s_%06u", pszOutputFilePrefix, iFrame);
+    }
+    printf("Getting panoramic image and writing it to %s...\n", pszOutputName);
+
+    if ( outputImageFormat == LADYBUG_FILEFORMAT_JPG && pOutput->image.pixelFormat == LADYBUG_BGR)
     {
-        error = ladybugEnableImageStabilization( 
-            context, bEnableStabilization, &stabilizationParams);
+        // Encode in memory and let the writer thread wait for the disk
+        error = jpegEncoder.encodeImage(
+            pOutput->image.pData, pOutput->image.uiCols, pOutput->image.uiRows, LADYBUG_BGR, &pOutput->jpeg);
+        _CHECK_ERROR;
+        pOutput->name = pszOutputName;
+    }
+    else
+    {
+        // ladybugSaveImage() encodes and writes in one call
+        LadybugStageTimer writeTimer( LADYBUG_STAGE_WRITE);
+        error = ladybugSaveImage( 
+            processContext, &pOutput->image, pszOutputName, outputImageFormat, true);
+        writeTimer.stop();
         _CHECK_ERROR;
     }
 
-    //
-    // Configure output images in Ladybug liabrary
-    //
-    printf( "Configure output images in Ladybug library...\n" );
-    error = ladybugConfigureOutputImages( 
-        context, 
-        outputImageType );
-    _CHECK_ERROR;
+    return LADYBUG_OK;
+}
 
-    printf("Set off-screen panoramic image size:%dx%d image.\n", iOutputImageWidth, iOutputImageHeight );
-    error = ladybugSetOffScreenImageSize(
-        context,
-        outputImageType,  
-        iOutputImageWidth, 
-        iOutputImageHeight );  
-    _CHECK_ERROR;
+//
+// Write what processFrame() left of a frame: the GPS line, the JPEG image
+// or the video frame.
+//
+LadybugError
+commitFrame( unsigned int iFrame, FrameOutput* pOutput )
+{
+    LadybugError error = LADYBUG_OK;
 
-    error = ladybugSetSphericalViewParams(
-        context,
-        fFOV,
-        fRotX * 3.14159265f / 180.0f,
-        fRotY * 3.14159265f / 180.0f,
-        fRotZ * 3.14159265f / 180.0f,
-        0.0f,
-        0.0f,
-        0.0f);
-    _CHECK_ERROR;
+    if ( pOutput->bSkipped )
+    {
+        return LADYBUG_OK;
+    }
 
+    if ( !pOutput->gpsLine.empty() )
+    {
+        fileWriter.append( pszGpsFilePath, pOutput->gpsLine.c_str());
+    }
 
-    return LADYBUG_OK;
+    if ( processH264)
+    {
+        printf("Getting panoramic image (%u) and appending it to %s...\n", iFrame, videoPath);
+        LadybugStageTimer encodeTimer( LADYBUG_STAGE_ENCODE);
+        encodeTimer.setBytes( (unsigned long long)pOutput->image.uiCols * pOutput->image.uiRows * 3);
+        error = ladybugAppendVideoFrame( videoContext, &pOutput->image);
+        encodeTimer.stop();
+    }
+    else if ( !pOutput->name.empty() )
+    {
+        error = fileWriter.write( pOutput->name, std::move( pOutput->jpeg));
+    }
+
+    return error;
 }
 
-bool
-cleanupLadybug( void )
+//
+// Worker thread with -j: take shards of frames in order, process them with
+// the worker's own contexts, and leave the output in readyFrames. The
+// rendered image is copied, since the next render overwrites it.
+//
+void
+processShards( ProcessWorker* pWorker )
 {
-    ladybugDestroyStreamContext( &readContext);
-    ladybugDestroyContext( &context);
-    for( int i = 0; i < LADYBUG_NUM_CAMERAS; i++)
+    LadybugPlacedThread placed( LADYBUG_STAGE_RENDER, "shard worker");
+
+    std::unique_lock<std::mutex> lock( shardMutex);
+    while ( !bShardsStopped && uiNextShardFrame <= iFrameTo)
     {
-        if ( arpTextureBuffers[ i ] != NULL )
+        const unsigned int uiShardFrom = uiNextShardFrame;
+        const unsigned int uiShardTo = std::min( iFrameTo, uiShardFrom + ( SHARD_FRAMES - 1 ));
+        uiNextShardFrame = uiShardTo + 1;
+        lock.unlock();
+
+        LadybugError error = ladybugGoToImage( pWorker->readContext, uiShardFrom);
+        for ( unsigned int iFrame = uiShardFrom; iFrame <= uiShardTo && error == LADYBUG_OK; iFrame++)
         {
-            delete arpTextureBuffers[ i ];
-            arpTextureBuffers[ i ] = NULL;
+            // Stay within the frames that may wait to be written
+            lock.lock();
+            shardProgress.wait( lock, [iFrame] { return bShardsStopped || iFrame < uiNextCommitFrame + uiShardWindow; });
+            const bool bStopped = bShardsStopped;
+            lock.unlock();
+            if ( bStopped)
+            {
+                break;
+            }
+
+            FrameOutput output;
+            error = processFrame( pWorker->context, pWorker->readContext, pWorker->arpTextureBuffers, iFrame, &output);
+            if ( error == LADYBUG_OK && processH264 && !output.bSkipped)
+            {
+                const unsigned char* pData = output.image.pData;
+                output.imageData.assign( pData, pData + (size_t)output.image.uiCols * output.image.uiRows * 3);
+                output.image.pData = output.imageData.data();
+            }
+
+            lock.lock();
+            if ( error == LADYBUG_OK)
+            {
+                readyFrames[ iFrame ] = std::move( output);
+            }
+            lock.unlock();
+            shardProgress.notify_all();
+        }
+
+        lock.lock();
+        if ( error != LADYBUG_OK)
+        {
+            printf( "Error! Ladybug library reported %s\n", ::ladybugErrorToString( error ) );
+            bShardsStopped = true;
+            shardProgress.notify_all();
         }
     }
-    return true;
+}
+
+//
+// Process the frame range with iNumWorkers workers, and write their output
+// in frame order as it becomes ready. Worker 0 uses the global contexts.
+//
+LadybugError
+processFramesSharded( void )
+{
+    LadybugError error = LADYBUG_OK;
+
+    std::vector<ProcessWorker> workers( iNumWorkers);
+    workers[ 0 ].context = context;
+    workers[ 0 ].readContext = readContext;
+    std::copy( arpTextureBuffers, arpTextureBuffers + LADYBUG_NUM_CAMERAS, workers[ 0 ].arpTextureBuffers);
+    for ( int i = 1; i < iNumWorkers && error == LADYBUG_OK; i++)
+    {
+        printf( "Setting up worker %d...\n", i);
+        error = initializeWorker( &workers[ i ]);
+    }
+
+    if ( error == LADYBUG_OK)
+    {
+        uiNextShardFrame = iFrameFrom;
+        uiNextCommitFrame = iFrameFrom;
+        uiShardWindow = ( iNumWorkers + 1) * SHARD_FRAMES;
+        bShardsStopped = false;
+        for ( int i = 0; i < iNumWorkers; i++)
+        {
+            workers[ i ].thread = std::thread( processShards, &workers[ i ]);
+        }
+
+        std::unique_lock<std::mutex> lock( shardMutex);
+        while ( uiNextCommitFrame <= iFrameTo)
+        {
+            shardProgress.wait( lock, [] { return bShardsStopped || readyFrames.count( uiNextCommitFrame) > 0; });
+            std::map<unsigned int, FrameOutput>::iterator ready = readyFrames.find( uiNextCommitFrame);
+            if ( ready == readyFrames.end())
+            {
+                break;
+            }
+            FrameOutput output = std::move( ready->second);
+            readyFrames.erase( ready);
+            lock.unlock();
+
+            error = commitFrame( uiNextCommitFrame, &output);
+
+            lock.lock();
+            uiNextCommitFrame++;
+            if ( error != LADYBUG_OK)
+            {
+                printf( "Error! Ladybug library reported %s\n", ::ladybugErrorToString( error ) );
+                bShardsStopped = true;
+            }
+            shardProgress.notify_all();
+        }
+        bShardsStopped = true;
+        shardProgress.notify_all();
+        lock.unlock();
+
+        for ( int i = 0; i < iNumWorkers; i++)
+        {
+            workers[ i ].thread.join();
+        }
+        readyFrames.clear();
+    }
+
+    for ( int i = 1; i < iNumWorkers; i++)
+    {
+        cleanupWorker( &workers[ i ]);
+    }
+    return error;
 }
 
 void processArguments( int argc, char* argv[])
@@ -504,7 +937,7 @@ void processArguments( int argc, char* argv[])
         exit( 0);
     }
 
-    while( ( iOpt = GetOption( argc, argv, "i:r:o:g:w:t:f:c:b:a:v:s:z:n:m:d:h:q:x:l:k:e:?", &pszCurrParam ) ) != 0 )
+    while( ( iOpt = GetOption( argc, argv, "i:r:o:g:w:t:f:c:b:a:v:s:z:n:m:d:h:q:x:l:k:e:j:?", &pszCurrParam ) ) != 0 )
     {
         switch( iOpt )
         {
@@ -742,6 +1175,10 @@ void processArguments( int argc, char* argv[])
             if( sscanf( pszCurrParam, "%d", &iBitRate ) != 1 )
                 bBadArgs = true;
             break;
+        case 'j': // number of workers
+            if( sscanf( pszCurrParam, "%d", &iNumWorkers ) != 1 || iNumWorkers < 1 )
+                bBadArgs = true;
+            break;
         case 'k':
             if( strncmpCaseInsensitive( pszCurrParam, "true", 4 ) == 0 )
             {
@@ -778,13 +1215,13 @@ int
 main( int argc, char* argv[] )
 {
     LadybugError error;
-    LadybugImage image;
-    LadybugVideoContext videoContext;
-    char videoPath[ 256];
-    FILE *fp = NULL;
 
     processArguments( argc, argv);
 
+    LadybugMetrics& metrics = LadybugMetrics::instance();
+    metrics.setName( "processstream");
+    metrics.startPeriodicDumpFromEnvironment();
+
     error = initializeLadybug();
     _ON_ERROR_EXIT;
 
@@ -813,6 +1250,19 @@ main( int argc, char* argv[] )
         return 0;
     }
 
+    sprintf( pszGpsFilePath, "%s%u_%u.txt", pszOutputGPSPrefix, iFrameFrom, iFrameTo);
+
+    //
+    // Rendered images and GPS lines are written on a background thread.
+    // JPEG images are encoded with the same quality ladybugSaveImage() uses.
+    //
+    int iJpegQuality = 85;
+    ladybugGetImageSavingJpegQuality( context, &iJpegQuality);
+    error = jpegEncoder.initialize( 0, iJpegQuality);
+    _ON_ERROR_EXIT;
+    error = fileWriter.start();
+    _ON_ERROR_EXIT;
+
     if ( processH264)
     {
         LadybugH264Option h264Option;
@@ -829,106 +1279,53 @@ main( int argc, char* argv[] )
         _ON_ERROR_EXIT;
     }
 
-    //
-    // fast-forward to the first frame to process in the stream
-    //
-    error = ladybugGoToImage( readContext, iFrameFrom); 
-    _ON_ERROR_EXIT;
+    const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
 
-    //
-    // process frames in the range
-    //
-    for ( unsigned int iFrame = iFrameFrom; iFrame <= iFrameTo; iFrame++)
+    if ( iNumWorkers > 1 && bEnableStabilization)
     {
-        printf( "Processing frame %u of %u\n", iFrame, iFrameTo);
-
-        //
-        // Read one frame from stream
-        //
-        error = ladybugReadImageFromStream( readContext, &image);
-        _ON_ERROR_BREAK;
-
-        //
-        // Convert the image to BGRU format texture buffers
-        //
-		error = ladybugConvertImage( context, &image, arpTextureBuffers, isHighBitDepth(streamHeaderInfo.dataFormat) ? LADYBUG_BGRU16 : LADYBUG_BGRU);
-        _ON_ERROR_CONTINUE;
-
-        //
-        // Update the textures on graphics card
-        //
-        error = ladybugUpdateTextures( 
-            context, LADYBUG_NUM_CAMERAS, (const unsigned char**)arpTextureBuffers, isHighBitDepth(streamHeaderInfo.dataFormat) ? LADYBUG_BGRU16 : LADYBUG_BGRU);
-        _ON_ERROR_BREAK;
+        printf( "Stabilization needs the frames in order; processing with 1 worker instead of %d.\n", iNumWorkers);
+        iNumWorkers = 1;
+    }
 
-        //
-        // Output GPS information on text file if it exists in the image
-        //
-        LadybugNMEAGPGGA gpsData;
-        error = ladybugGetGPSNMEADataFromImage( &image, "GPGGA", &gpsData);
-        if ( error == LADYBUG_OK && gpsData.bValidData)
+    if ( iNumWorkers > 1)
+    {
+        if ( !bEnableSoftwareRendering)
         {
-            printf( "GPS INFO: LAT %lf, LONG %lf\n", gpsData.dGGALatitude, gpsData.dGGALongitude);
-            if ( fp == NULL)
-            {
-                char pszGpsFilePath[ 256];
-                sprintf( pszGpsFilePath, "%s%u_%u.txt", pszOutputGPSPrefix, iFrameFrom, iFrameTo);
-                fp = fopen( pszGpsFilePath, "w");
-            }
-            if ( fp != NULL)
-            {
-                fprintf( fp, "%u, LAT %lf, LONG %lf\n", iFrame, gpsData.dGGALatitude, gpsData.dGGALongitude);
-            }
+            printf( "The workers share the graphics card; use -s true to render in parallel.\n");
         }
-
+        error = processFramesSharded();
+        if ( error != LADYBUG_OK)
+        {
+            printf( "Error! Ladybug library reported %s\n", ::ladybugErrorToString( error));
+        }
+    }
+    else
+    {
         //
-        // Render and obtain the image in off-screen buffer
+        // fast-forward to the first frame to process in the stream
         //
-        LadybugProcessedImage processedImage;
-        error = ladybugRenderOffScreenImage(
-            context, outputImageType, LADYBUG_BGR, &processedImage);
-        _ON_ERROR_BREAK;
+        error = ladybugGoToImage( readContext, iFrameFrom); 
+        _ON_ERROR_EXIT;
 
         //
-        // Write the rendered image to a file
+        // process frames in the range
         //
-        if ( processH264)
+        for ( unsigned int iFrame = iFrameFrom; iFrame <= iFrameTo; iFrame++)
         {
-            printf("Getting panoramic image (%u) and appending it to %s...\n", iFrame, videoPath);
-            error = ladybugAppendVideoFrame( videoContext, &processedImage);
+            FrameOutput output;
+            error = processFrame( context, readContext, arpTextureBuffers, iFrame, &output);
             _ON_ERROR_BREAK;
-        }
-        else
-        {
-            char pszOutputName[ 256];
-            switch ( outputImageFormat ){
-            case LADYBUG_FILEFORMAT_BMP: 
-                sprintf( pszOutputName, "%s_%06u.bmp", pszOutputFilePrefix, iFrame); 
-                break;
-            case LADYBUG_FILEFORMAT_JPG: 
-                sprintf( pszOutputName, "%s_%06u.jpg", pszOutputFilePrefix, iFrame); 
-                break;
-            case LADYBUG_FILEFORMAT_TIFF: 
-                sprintf( pszOutputName, "%s_%06u.tiff", pszOutputFilePrefix, iFrame); 
-                break;
-            case LADYBUG_FILEFORMAT_PNG: 
-                sprintf( pszOutputName, "%s_%06u.png", pszOutputFilePrefix, iFrame); 
-                break;
-            default: 
-                sprintf( pszOutputName, "%s_%06u", pszOutputFilePrefix, iFrame);
-            }
-            printf("Getting panoramic image and writing it to %s...\n", pszOutputName);
-
-            error = ladybugSaveImage( 
-                context, &processedImage, pszOutputName, outputImageFormat, true);
+            error = commitFrame( iFrame, &output);
             _ON_ERROR_BREAK;
         }
     }
 
-    if ( fp != NULL )
-    {
-        fclose( fp);
-    }
+    const std::chrono::duration<double> processed = std::chrono::steady_clock::now() - processStart;
+    printf( "Processed frames %u to %u in %.1fs (%.2f frames/s) with %d worker(s)\n",
+        iFrameFrom, iFrameTo, processed.count(), ( iFrameTo - iFrameFrom + 1) / processed.count(), iNumWorkers);
+
+    fileWriter.stop();
+    jpegEncoder.shutdown();
 
     if ( processH264)
     {
@@ -938,5 +1335,10 @@ main( int argc, char* argv[] )
 
     cleanupLadybug();
 
+    jpegEncoder.printStats( "JPEG encoder");
+    fileWriter.printStats( "File writer");
+    metrics.stopPeriodicDump();
+    metrics.printSummary();
+
     return 0;
 }
\ No newline at end of file
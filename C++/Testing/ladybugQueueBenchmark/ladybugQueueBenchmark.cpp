@@ -0,0 +1,418 @@
+//=============================================================================
+// ladybugQueueBenchmark.cpp
+//
+// Measures the queues in ladybugFrameQueue.h:
+//
+//  - Round trip latency: two threads bounce one item through a pair of SPSC
+//    queues. Half a round trip is the cost of one hop between stages.
+//  - Streaming: one thread pushes as fast as it can and another pops, so the
+//    cost per item is what a stage pays to hand frames on.
+//  - False sharing: the same streaming test on a copy of the SPSC ring with
+//    the producer's and consumer's fields packed into one cache line. The
+//    difference is what the padding in LadybugSpscQueue saves.
+//  - MPMC: several producers and consumers on one LadybugMpmcQueue.
+//
+// Every test checks that each item arrives exactly once, and SPSC tests
+// that items arrive in order.
+//
+// The numbers only mean something with each thread on its own core; use
+// -P and -C to pin the producers and consumers.
+//
+// Usage: LadybugQueueBenchmark [-n ITEMS] [-t THREADS] [-q CAPACITY] [-P CPUS] [-C CPUS]
+//
+//  -n ITEMS     Items per measurement (default 1000000)
+//  -t THREADS   Producers and consumers each in the MPMC test (default 2)
+//  -q CAPACITY  Queue capacity (default 64)
+//  -P CPUS      CPUs for producer threads, e.g. 2 or 2-3
+//  -C CPUS      CPUs for consumer threads
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFrameQueue.h"
+#include "ladybugThreadPlacement.h"
+
+namespace
+{
+// Producers are placed as the grab stage, consumers as the convert stage
+const LadybugStage PRODUCER_STAGE = LADYBUG_STAGE_GRAB;
+const LadybugStage CONSUMER_STAGE = LADYBUG_STAGE_CONVERT;
+
+const char* getModeName( LadybugQueueWaitMode mode )
+{
+    return ( mode == LADYBUG_QUEUE_SPIN ) ? "spin" : "block";
+}
+
+double elapsedSeconds( std::chrono::steady_clock::time_point start )
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+//
+// LadybugSpscQueue's ring with the producer's and consumer's fields in one
+// cache line, for comparison. Spins like LADYBUG_QUEUE_SPIN.
+//
+class PackedSpscRing
+{
+public:
+    explicit PackedSpscRing( unsigned int uiCapacity )
+        : m_slots( ladybugQueueCapacity( uiCapacity ) ),
+          m_mask( m_slots.size() - 1 ),
+          m_tail( 0 ),
+          m_cachedHead( 0 ),
+          m_head( 0 ),
+          m_cachedTail( 0 )
+    {
+    }
+
+    void push( size_t item )
+    {
+        const size_t tail = m_tail.load( std::memory_order_relaxed );
+        for ( unsigned int uiSpins = 0; tail - m_cachedHead > m_mask; uiSpins++ )
+        {
+            m_cachedHead = m_head.load( std::memory_order_acquire );
+            relax( uiSpins );
+        }
+        m_slots[ tail & m_mask ] = item;
+        m_tail.store( tail + 1, std::memory_order_release );
+    }
+
+    size_t pop()
+    {
+        const size_t head = m_head.load( std::memory_order_relaxed );
+        for ( unsigned int uiSpins = 0; head == m_cachedTail; uiSpins++ )
+        {
+            m_cachedTail = m_tail.load( std::memory_order_acquire );
+            relax( uiSpins );
+        }
+        const size_t item = m_slots[ head & m_mask ];
+        m_head.store( head + 1, std::memory_order_release );
+        return item;
+    }
+
+private:
+    static void relax( unsigned int uiSpins )
+    {
+        if ( ( uiSpins & 1023 ) == 1023 )
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            LADYBUG_CPU_RELAX();
+        }
+    }
+
+    std::vector<size_t> m_slots;
+    size_t m_mask;
+
+    // All on one line
+    std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+    std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+};
+
+struct Result
+{
+    double dNsPerItem;
+    bool bCorrect;
+};
+
+// Time a producer and consumer thread. Each is placed first, and the clock
+// starts once both are ready.
+template <typename Producer, typename Consumer>
+double timeThreads( Producer producer, Consumer consumer )
+{
+    std::atomic<int> ready( 0 );
+    std::atomic<bool> go( false );
+    std::chrono::steady_clock::time_point start;
+
+    std::thread consumerThread( [&] {
+        LadybugPlacedThread placed( CONSUMER_STAGE, "consumer" );
+        ready++;
+        while ( !go )
+        {
+            LADYBUG_CPU_RELAX();
+        }
+        consumer();
+    } );
+
+    {
+        LadybugPlacedThread placed( PRODUCER_STAGE, "producer" );
+        while ( ready == 0 )
+        {
+            std::this_thread::yield();
+        }
+        start = std::chrono::steady_clock::now();
+        go = true;
+        producer();
+    }
+
+    consumerThread.join();
+    return elapsedSeconds( start );
+}
+
+Result measureRoundTrip( LadybugQueueWaitMode mode, unsigned int uiCapacity, size_t numItems )
+{
+    LadybugSpscQueue<size_t> there;
+    LadybugSpscQueue<size_t> back;
+    there.initialize( uiCapacity, mode );
+    back.initialize( uiCapacity, mode );
+
+    bool bCorrect = true;
+    const double dSeconds = timeThreads(
+        [&] {
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                size_t reply = 0;
+                there.push( i );
+                back.pop( &reply );
+                bCorrect = bCorrect && reply == i;
+            }
+        },
+        [&] {
+            size_t item;
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                there.pop( &item );
+                back.push( item );
+            }
+        } );
+
+    Result result;
+    result.dNsPerItem = dSeconds * 1e9 / ( 2.0 * numItems );
+    result.bCorrect = bCorrect;
+    return result;
+}
+
+Result measureStream( LadybugQueueWaitMode mode, unsigned int uiCapacity, size_t numItems )
+{
+    LadybugSpscQueue<size_t> queue;
+    queue.initialize( uiCapacity, mode );
+
+    bool bCorrect = true;
+    const double dSeconds = timeThreads(
+        [&] {
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                queue.push( i );
+            }
+        },
+        [&] {
+            size_t item;
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                queue.pop( &item );
+                bCorrect = bCorrect && item == i;
+            }
+        } );
+
+    Result result;
+    result.dNsPerItem = dSeconds * 1e9 / numItems;
+    result.bCorrect = bCorrect;
+    return result;
+}
+
+Result measurePackedStream( unsigned int uiCapacity, size_t numItems )
+{
+    PackedSpscRing ring( uiCapacity );
+
+    bool bCorrect = true;
+    const double dSeconds = timeThreads(
+        [&] {
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                ring.push( i );
+            }
+        },
+        [&] {
+            for ( size_t i = 0; i < numItems; i++ )
+            {
+                bCorrect = ( ring.pop() == i ) && bCorrect;
+            }
+        } );
+
+    Result result;
+    result.dNsPerItem = dSeconds * 1e9 / numItems;
+    result.bCorrect = bCorrect;
+    return result;
+}
+
+Result measureMpmc( LadybugQueueWaitMode mode, unsigned int uiCapacity, size_t numItems, unsigned int uiThreads )
+{
+    LadybugMpmcQueue<size_t> queue;
+    queue.initialize( uiCapacity, mode );
+
+    const size_t itemsPerProducer = numItems / uiThreads;
+    std::atomic<unsigned long long> sum( 0 );
+    std::atomic<unsigned long long> count( 0 );
+    std::vector<std::thread> threads;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for ( unsigned int t = 0; t < uiThreads; t++ )
+    {
+        threads.push_back( std::thread( [&] {
+            LadybugPlacedThread placed( CONSUMER_STAGE, "consumer" );
+            unsigned long long ulSum = 0;
+            unsigned long long ulCount = 0;
+            size_t item;
+            while ( queue.pop( &item ) )
+            {
+                ulSum += item;
+                ulCount++;
+            }
+            sum += ulSum;
+            count += ulCount;
+        } ) );
+    }
+
+    std::vector<std::thread> producers;
+    for ( unsigned int t = 0; t < uiThreads; t++ )
+    {
+        producers.push_back( std::thread( [&] {
+            LadybugPlacedThread placed( PRODUCER_STAGE, "producer" );
+            for ( size_t i = 1; i <= itemsPerProducer; i++ )
+            {
+                queue.push( i );
+            }
+        } ) );
+    }
+
+    for ( size_t t = 0; t < producers.size(); t++ )
+    {
+        producers[ t ].join();
+    }
+    queue.close();
+    for ( size_t t = 0; t < threads.size(); t++ )
+    {
+        threads[ t ].join();
+    }
+    const double dSeconds = elapsedSeconds( start );
+
+    const unsigned long long ulExpected =
+        (unsigned long long)uiThreads * itemsPerProducer * ( itemsPerProducer + 1 ) / 2;
+
+    Result result;
+    result.dNsPerItem = dSeconds * 1e9 / ( itemsPerProducer * uiThreads );
+    result.bCorrect = sum == ulExpected && count == itemsPerProducer * uiThreads;
+    return result;
+}
+
+void printResult( const char* pszTest, const char* pszMode, const Result& result, bool* pbAllCorrect )
+{
+    printf( "%-24s %-6s %10.1f %12.2f%s\n",
+        pszTest,
+        pszMode,
+        result.dNsPerItem,
+        1000.0 / result.dNsPerItem,
+        result.bCorrect ? "" : "  WRONG ITEMS" );
+    *pbAllCorrect = *pbAllCorrect && result.bCorrect;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    size_t numItems = 1000000;
+    unsigned int uiThreads = 2;
+    unsigned int uiCapacity = 64;
+    const char* pszProducerCpus = NULL;
+    const char* pszConsumerCpus = NULL;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( i + 1 < argc && strcmp( argv[ i ], "-n" ) == 0 )
+        {
+            numItems = (size_t)atol( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-t" ) == 0 )
+        {
+            uiThreads = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-q" ) == 0 )
+        {
+            uiCapacity = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-P" ) == 0 )
+        {
+            pszProducerCpus = argv[ ++i ];
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-C" ) == 0 )
+        {
+            pszConsumerCpus = argv[ ++i ];
+        }
+        else
+        {
+            printf( "Usage: %s [-n ITEMS] [-t THREADS] [-q CAPACITY] [-P CPUS] [-C CPUS]\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( numItems == 0 || uiThreads == 0 || uiCapacity == 0 )
+    {
+        printf( "Error: ITEMS, THREADS and CAPACITY must be at least 1\n" );
+        return EXIT_FAILURE;
+    }
+
+    LadybugThreadPlacement& placement = LadybugThreadPlacement::instance();
+    if ( placement.setStageCpus( PRODUCER_STAGE, pszProducerCpus ) != LADYBUG_OK ||
+        placement.setStageCpus( CONSUMER_STAGE, pszConsumerCpus ) != LADYBUG_OK )
+    {
+        printf( "Error: invalid CPU list\n" );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%zu items, capacity %u, producers on CPUs %s, consumers on CPUs %s, %u hardware threads\n\n",
+        numItems,
+        ladybugQueueCapacity( uiCapacity ),
+        pszProducerCpus != NULL ? pszProducerCpus : "any",
+        pszConsumerCpus != NULL ? pszConsumerCpus : "any",
+        std::thread::hardware_concurrency() );
+
+    const LadybugQueueWaitMode modes[] = { LADYBUG_QUEUE_SPIN, LADYBUG_QUEUE_BLOCK };
+    bool bAllCorrect = true;
+
+    printf( "%-24s %-6s %10s %12s\n", "test", "mode", "ns/item", "Mitems/s" );
+    for ( unsigned int m = 0; m < 2; m++ )
+    {
+        printResult( "SPSC round trip (hop)", getModeName( modes[ m ] ),
+            measureRoundTrip( modes[ m ], uiCapacity, numItems / 10 ), &bAllCorrect );
+    }
+    Result spinStream = { 0.0, true };
+    for ( unsigned int m = 0; m < 2; m++ )
+    {
+        const Result stream = measureStream( modes[ m ], uiCapacity, numItems );
+        printResult( "SPSC stream", getModeName( modes[ m ] ), stream, &bAllCorrect );
+        if ( modes[ m ] == LADYBUG_QUEUE_SPIN )
+        {
+            spinStream = stream;
+        }
+    }
+
+    const Result packed = measurePackedStream( uiCapacity, numItems );
+    printResult( "SPSC stream, one line", "spin", packed, &bAllCorrect );
+    printf( "%-24s %-6s %9.2fx\n", "Padding speedup", "spin", packed.dNsPerItem / spinStream.dNsPerItem );
+
+    char szMpmc[ 64 ];
+    snprintf( szMpmc, sizeof( szMpmc ), "MPMC %ux%u stream", uiThreads, uiThreads );
+    for ( unsigned int m = 0; m < 2; m++ )
+    {
+        printResult( szMpmc, getModeName( modes[ m ] ),
+            measureMpmc( modes[ m ], uiCapacity, numItems, uiThreads ), &bAllCorrect );
+    }
+
+    printf( "\nEvery item delivered once, and in order through SPSC: %s\n", bAllCorrect ? "yes" : "NO" );
+
+    return bAllCorrect ? 0 : EXIT_FAILURE;
+}
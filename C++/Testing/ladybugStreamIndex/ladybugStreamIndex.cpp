@@ -0,0 +1,475 @@
+//=============================================================================
+// ladybugStreamIndex.cpp
+//
+// Checks a recorded .pgr stream against its frame index, looks frames up by
+// time, and rebuilds a stream the Ladybug library can no longer read.
+//
+// LadybugStreamWriter keeps <base>.idx and <base>.cal next to every stream
+// it records (see ladybugFrameIndex.h). The index says where every frame
+// was written, so it survives a segment whose header was never completed,
+// as happens when the power fails while recording.
+//
+// Without -o, every frame in the index is checked against its segment: the
+// frame must lie within the segment's size, and the first bytes of its
+// image data must match the check in the index. A summary is printed for
+// each segment, with the number of images the segment's own header
+// reports, or that the header cannot be read.
+//
+// With -o, the frames that passed the check are written to a new stream
+// with a header and calibration of its own. The header comes from the
+// first readable segment, or else from the camera and images in the index.
+//
+// Usage: LadybugStreamIndex [-l] [-t SECONDS] [-o BASE] INDEX
+//
+//  -l          List every frame: segment, offset, length, timestamp and
+//              GPS position
+//  -t SECONDS  Print the first frame at or after a time, in seconds since
+//              the epoch, found by binary search of the index
+//  -o BASE     Rebuild the stream as BASE-000000.pgr, ...
+//
+// Exits with 1 if the index could not be read or the stream could not be
+// rebuilt, and 2 if frames are missing or damaged, or the index stops short
+// of the stream because it could not be written while recording.
+//=============================================================================
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <ladybug.h>
+#include <ladybugstream.h>
+
+#include "ladybugFrameIndex.h"
+
+namespace
+{
+const int EXIT_DAMAGED = 2;
+
+enum FrameState
+{
+    FRAME_INTACT,
+    FRAME_MISSING,
+    FRAME_DAMAGED,
+};
+
+// Frames of one segment, by what the check found
+struct SegmentSummary
+{
+    SegmentSummary()
+        : uiSegment( 0 ),
+          ulFrames( 0 ),
+          ulMissing( 0 ),
+          ulDamaged( 0 )
+    {
+    }
+
+    uint32_t uiSegment;
+    unsigned long long ulFrames;
+    unsigned long long ulMissing;
+    unsigned long long ulDamaged;
+};
+
+// The segments of a stream, opened as frames ask for them
+class SegmentReader
+{
+public:
+    explicit SegmentReader( const std::string& base )
+        : m_base( base ),
+          m_fd( -1 ),
+          m_uiSegment( 0 ),
+          m_ulSize( 0 )
+    {
+    }
+
+    ~SegmentReader()
+    {
+        if ( m_fd >= 0 )
+        {
+            close( m_fd );
+        }
+    }
+
+    std::string getPath( uint32_t uiSegment ) const
+    {
+        char pszNumber[ 16 ];
+        snprintf( pszNumber, sizeof( pszNumber ), "-%06u.pgr", uiSegment );
+        return m_base + pszNumber;
+    }
+
+    // Read bytes of a segment. Returns false if they are not all there.
+    bool read( uint32_t uiSegment, unsigned long long ulOffset, void* pData, size_t bytes )
+    {
+        if ( m_fd < 0 || m_uiSegment != uiSegment )
+        {
+            if ( m_fd >= 0 )
+            {
+                close( m_fd );
+            }
+            m_fd = open( getPath( uiSegment ).c_str(), O_RDONLY );
+            m_uiSegment = uiSegment;
+
+            struct stat status;
+            m_ulSize = m_fd >= 0 && fstat( m_fd, &status ) == 0 ? (unsigned long long)status.st_size : 0;
+        }
+        return m_fd >= 0 &&
+            ulOffset + bytes <= m_ulSize &&
+            pread( m_fd, pData, bytes, (off_t)ulOffset ) == (ssize_t)bytes;
+    }
+
+    // Check that a frame and its image data are in its segment
+    FrameState check( const LadybugFrameIndexRecord& record )
+    {
+        unsigned char lastByte = 0;
+        if ( record.uiLength == 0 || !read( record.uiSegment, record.ulOffset + record.uiLength - 1, &lastByte, 1 ) )
+        {
+            return FRAME_MISSING;
+        }
+        if ( record.uiDataOffset == FRAME_INDEX_UNKNOWN_OFFSET )
+        {
+            return FRAME_INTACT;
+        }
+
+        std::vector<unsigned char> data( std::min( record.image.uiDataSizeBytes, FRAME_INDEX_CHECK_BYTES ) );
+        if ( !read( record.uiSegment, record.ulOffset + record.uiDataOffset, data.data(), data.size() ) )
+        {
+            return FRAME_MISSING;
+        }
+        return ladybugFrameIndexHash( data.data(), data.size() ) == record.uiDataCheck ? FRAME_INTACT : FRAME_DAMAGED;
+    }
+
+private:
+    std::string m_base;
+    int m_fd;
+    uint32_t m_uiSegment;
+    unsigned long long m_ulSize;
+};
+
+void printRecord( const LadybugFrameIndexRecord& record )
+{
+    printf(
+        "%llu: segment %u, offset %llu, %u bytes, sequence %u, %lld.%06u",
+        (unsigned long long)record.ulFrame,
+        record.uiSegment,
+        (unsigned long long)record.ulOffset,
+        record.uiLength,
+        record.image.imageInfo.ulSequenceId,
+        (long long)record.image.timeStamp.ulSeconds,
+        record.image.timeStamp.ulMicroSeconds );
+    if ( record.uiFlags & FRAME_INDEX_GPS )
+    {
+        printf( ", %.6f %.6f %.1fm\n", record.dLatitude, record.dLongitude, record.dAltitude );
+    }
+    else
+    {
+        printf( ", no fix\n" );
+    }
+}
+
+double getSeconds( const LadybugTimestamp& timeStamp )
+{
+    return timeStamp.ulSeconds + timeStamp.ulMicroSeconds / 1e6;
+}
+
+// Print the number of images the header of a segment reports
+void printSegmentHeader( const std::string& path )
+{
+    LadybugStreamContext readContext = NULL;
+    LadybugError error = ladybugCreateStreamContext( &readContext );
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugInitializeStreamForReading( readContext, path.c_str(), false );
+    }
+    LadybugStreamHeadInfo streamHeaderInfo;
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugGetStreamHeader( readContext, &streamHeaderInfo );
+    }
+
+    if ( error == LADYBUG_OK )
+    {
+        printf( ", header reports %u images\n", streamHeaderInfo.ulNumberOfImages );
+    }
+    else
+    {
+        printf( ", header not readable (%s)\n", ladybugErrorToString( error ) );
+    }
+    if ( readContext != NULL )
+    {
+        ladybugDestroyStreamContext( &readContext );
+    }
+}
+
+// The header for a rebuilt stream: a readable segment's if there is one,
+// else what the index knows of the camera and its images
+void getRebuildHeader(
+    const LadybugFrameIndex& index,
+    const SegmentReader& segments,
+    const std::vector<SegmentSummary>& summaries,
+    LadybugStreamHeadInfo* pStreamInfo )
+{
+    for ( size_t i = 0; i < summaries.size(); i++ )
+    {
+        LadybugStreamContext readContext = NULL;
+        bool bRead =
+            ladybugCreateStreamContext( &readContext ) == LADYBUG_OK &&
+            ladybugInitializeStreamForReading( readContext, segments.getPath( summaries[ i ].uiSegment ).c_str(), false ) == LADYBUG_OK &&
+            ladybugGetStreamHeader( readContext, pStreamInfo ) == LADYBUG_OK;
+        if ( readContext != NULL )
+        {
+            ladybugDestroyStreamContext( &readContext );
+        }
+        if ( bRead )
+        {
+            return;
+        }
+    }
+
+    LadybugFrameIndexRecord first;
+    LadybugFrameIndexRecord last;
+    index.readRecord( 0, &first );
+    index.readRecord( index.getFrameCount() - 1, &last );
+
+    memset( pStreamInfo, 0, sizeof( *pStreamInfo ) );
+    pStreamInfo->serialBase = index.getHeader().uiSerialBase;
+    pStreamInfo->serialHead = index.getHeader().uiSerialHead;
+    pStreamInfo->dataFormat = first.image.dataFormat;
+    pStreamInfo->resolution = first.image.resolution;
+    pStreamInfo->stippledFormat = first.image.stippledFormat;
+
+    const double dSeconds = getSeconds( last.image.timeStamp ) - getSeconds( first.image.timeStamp );
+    pStreamInfo->frameRate =
+        dSeconds > 0.0 ? (float)( ( index.getFrameCount() - 1 ) / dSeconds ) : 0.0f;
+    pStreamInfo->ulFrameRate = (unsigned int)lround( pStreamInfo->frameRate );
+}
+
+// Write the intact frames to a new stream. Returns false on an error.
+bool rebuildStream(
+    const LadybugFrameIndex& index,
+    SegmentReader& segments,
+    const std::vector<SegmentSummary>& summaries,
+    const std::string& base,
+    const char* pszOutput )
+{
+    LadybugStreamHeadInfo streamInfo;
+    getRebuildHeader( index, segments, summaries, &streamInfo );
+
+    LadybugStreamContext writeContext = NULL;
+    LadybugError error = ladybugCreateStreamContext( &writeContext );
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugInitializeStreamForWritingEx(
+            writeContext, pszOutput, &streamInfo, ( base + ".cal" ).c_str(), false );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        printf( "%s: %s\n", pszOutput, ladybugErrorToString( error ) );
+        if ( writeContext != NULL )
+        {
+            ladybugDestroyStreamContext( &writeContext );
+        }
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    double dMBWritten = 0.0;
+    unsigned long ulImagesWritten = 0;
+    unsigned long long ulSkipped = 0;
+    for ( unsigned long long ulFrame = 0; ulFrame < index.getFrameCount() && error == LADYBUG_OK; ulFrame++ )
+    {
+        LadybugFrameIndexRecord record;
+        if ( index.readRecord( ulFrame, &record ) != LADYBUG_OK ||
+            record.uiDataOffset == FRAME_INDEX_UNKNOWN_OFFSET ||
+            segments.check( record ) != FRAME_INTACT )
+        {
+            ulSkipped++;
+            continue;
+        }
+
+        data.resize( record.image.uiDataSizeBytes );
+        if ( !segments.read( record.uiSegment, record.ulOffset + record.uiDataOffset, data.data(), data.size() ) )
+        {
+            ulSkipped++;
+            continue;
+        }
+
+        LadybugImage image = record.image;
+        image.pData = data.data();
+        error = ladybugWriteImageToStream( writeContext, &image, &dMBWritten, &ulImagesWritten );
+    }
+
+    const LadybugError stopError = ladybugStopStream( writeContext );
+    ladybugDestroyStreamContext( &writeContext );
+    if ( error == LADYBUG_OK )
+    {
+        error = stopError;
+    }
+
+    printf(
+        "%s: %lu frames written (%.1fMB), %llu skipped%s%s\n",
+        pszOutput,
+        ulImagesWritten,
+        dMBWritten,
+        ulSkipped,
+        error != LADYBUG_OK ? ", stopped by " : "",
+        error != LADYBUG_OK ? ladybugErrorToString( error ) : "" );
+    return error == LADYBUG_OK;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    bool bList = false;
+    double dFindSeconds = -1.0;
+    const char* pszOutput = NULL;
+    const char* pszIndex = NULL;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( strcmp( argv[ i ], "-l" ) == 0 )
+        {
+            bList = true;
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-t" ) == 0 )
+        {
+            dFindSeconds = atof( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-o" ) == 0 )
+        {
+            pszOutput = argv[ ++i ];
+        }
+        else if ( argv[ i ][ 0 ] != '-' && i + 1 == argc )
+        {
+            pszIndex = argv[ i ];
+        }
+        else
+        {
+            pszIndex = NULL;
+            break;
+        }
+    }
+
+    if ( pszIndex == NULL )
+    {
+        printf( "Usage: %s [-l] [-t SECONDS] [-o BASE] INDEX\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    LadybugFrameIndex index;
+    const LadybugError error = index.open( pszIndex );
+    if ( error != LADYBUG_OK )
+    {
+        printf( "%s: %s\n", pszIndex, ladybugErrorToString( error ) );
+        return EXIT_FAILURE;
+    }
+
+    // The segments are <base>-NNNNNN.pgr next to <base>.idx
+    std::string base( pszIndex );
+    const size_t extension = base.rfind( ".idx" );
+    if ( extension != std::string::npos && extension + 4 == base.size() )
+    {
+        base.erase( extension );
+    }
+    SegmentReader segments( base );
+
+    printf(
+        "%s: %llu frames, camera %u, %u header bytes per segment\n",
+        pszIndex,
+        index.getFrameCount(),
+        index.getHeader().uiSerialHead,
+        index.getHeader().uiSegmentHeaderBytes );
+    if ( !index.isComplete() )
+    {
+        printf(
+            "%s: indexing stopped after %llu frames while recording; later frames are not in the index\n",
+            pszIndex,
+            index.getFrameCount() );
+    }
+
+    if ( dFindSeconds >= 0.0 )
+    {
+        const long long llSeconds = (long long)dFindSeconds;
+        const unsigned int uiMicroSeconds = (unsigned int)lround( ( dFindSeconds - llSeconds ) * 1e6 );
+        const unsigned long long ulFrame = index.findFrame( llSeconds, std::min( uiMicroSeconds, 999999u ) );
+
+        LadybugFrameIndexRecord record;
+        if ( ulFrame < index.getFrameCount() && index.readRecord( ulFrame, &record ) == LADYBUG_OK )
+        {
+            printRecord( record );
+        }
+        else
+        {
+            printf( "No frame at or after %.6f\n", dFindSeconds );
+        }
+        return 0;
+    }
+
+    std::vector<SegmentSummary> summaries;
+    unsigned long long ulBadRecords = 0;
+    for ( unsigned long long ulFrame = 0; ulFrame < index.getFrameCount(); ulFrame++ )
+    {
+        LadybugFrameIndexRecord record;
+        if ( index.readRecord( ulFrame, &record ) != LADYBUG_OK )
+        {
+            printf( "%llu: damaged index record\n", ulFrame );
+            ulBadRecords++;
+            continue;
+        }
+        if ( bList )
+        {
+            printRecord( record );
+        }
+
+        if ( summaries.empty() || summaries.back().uiSegment != record.uiSegment )
+        {
+            summaries.push_back( SegmentSummary() );
+            summaries.back().uiSegment = record.uiSegment;
+        }
+        SegmentSummary& summary = summaries.back();
+        summary.ulFrames++;
+
+        const FrameState state = segments.check( record );
+        if ( state == FRAME_MISSING )
+        {
+            summary.ulMissing++;
+        }
+        else if ( state == FRAME_DAMAGED )
+        {
+            summary.ulDamaged++;
+        }
+    }
+
+    unsigned long long ulLost = ulBadRecords;
+    for ( size_t i = 0; i < summaries.size(); i++ )
+    {
+        const SegmentSummary& summary = summaries[ i ];
+        const std::string path = segments.getPath( summary.uiSegment );
+        printf(
+            "%s: %llu frames indexed, %llu missing, %llu damaged",
+            path.c_str(),
+            summary.ulFrames,
+            summary.ulMissing,
+            summary.ulDamaged );
+        printSegmentHeader( path );
+        ulLost += summary.ulMissing + summary.ulDamaged;
+    }
+
+    if ( pszOutput != NULL )
+    {
+        if ( index.getFrameCount() == 0 ||
+            !rebuildStream( index, segments, summaries, base, pszOutput ) )
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return ( ulLost > 0 || !index.isComplete() ) ? EXIT_DAMAGED : 0;
+}
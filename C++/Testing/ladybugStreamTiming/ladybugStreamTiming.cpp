@@ -0,0 +1,265 @@
+//=============================================================================
+// ladybugStreamTiming.cpp
+//
+// Checks recorded .pgr streams for dropped frames and jitter, from the
+// timestamps and sequence IDs the camera put on each image. This is the
+// offline pass of the analyzer in ladybugFrameTiming.h, which the capture
+// tools run live.
+//
+// Each stream is read from start to end and every image is given to a
+// LadybugFrameTimingAnalyzer. The expected frame rate is the one in the
+// stream header, unless -r is given. Drops are printed as they are found,
+// followed by a summary and the distribution of the frame deltas.
+//
+// Usage: LadybugStreamTiming [-r FPS] [-f FACTOR] [-o CSV] STREAM...
+//
+//  -r FPS     Expected frame rate (default from the stream header, or
+//             learnt from the first frames if the header has none)
+//  -f FACTOR  A delta longer than FACTOR frame periods counts as dropped
+//             frames (default 1.5)
+//  -o CSV     Write one line per frame with its sequence ID, camera time,
+//             delta and the frames dropped before it. With several streams
+//             the stream name is added to each line.
+//
+// Exits with 1 if a stream could not be read, and 2 if frames were dropped.
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <ladybug.h>
+#include <ladybugstream.h>
+
+#include "ladybugFrameTiming.h"
+
+namespace
+{
+const int EXIT_DROPPED = 2;
+
+// Prints each event, and keeps the frames dropped before the current frame
+// for the CSV file
+class DropCounter : public LadybugFrameTimingListener
+{
+public:
+    DropCounter()
+        : m_pszStream( "" ),
+          m_uiDropped( 0 )
+    {
+    }
+
+    void setStream( const char* pszStream )
+    {
+        m_pszStream = pszStream;
+    }
+
+    unsigned int takeDropped()
+    {
+        const unsigned int uiDropped = m_uiDropped;
+        m_uiDropped = 0;
+        return uiDropped;
+    }
+
+    virtual void onTimingEvent( const LadybugFrameTimingEvent& event )
+    {
+        if ( event.type == LADYBUG_TIMING_DROP )
+        {
+            printf(
+                "%s: frame %llu (sequence %u, %.3fs): %u frames dropped, %.1fms since the previous frame\n",
+                m_pszStream,
+                event.ulFrame,
+                event.uiSequenceId,
+                event.dSeconds,
+                event.uiDroppedFrames,
+                event.dDeltaMs );
+            m_uiDropped += event.uiDroppedFrames;
+        }
+    }
+
+private:
+    const char* m_pszStream;
+    unsigned int m_uiDropped;
+};
+
+void printDeltaHistogram( const LadybugHistogram& deltas )
+{
+    const double arQuantiles[] = { 0.001, 0.01, 0.5, 0.99, 0.999 };
+    printf( "  delta quantiles:" );
+    for ( size_t i = 0; i < sizeof( arQuantiles ) / sizeof( arQuantiles[ 0 ] ); i++ )
+    {
+        printf( " p%g %.2fms", arQuantiles[ i ] * 100.0, deltas.getQuantile( arQuantiles[ i ] ) / 1e6 );
+    }
+    printf( "\n" );
+}
+
+// Returns 0 if the stream was read, 1 if not, and EXIT_DROPPED if frames
+// were dropped
+int analyzeStream(
+    const char* pszStream,
+    double dFrameRate,
+    double dDropFactor,
+    FILE* pCsv,
+    bool bCsvStreamColumn )
+{
+    LadybugStreamContext readContext = NULL;
+    LadybugError error = ladybugCreateStreamContext( &readContext );
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugInitializeStreamForReading( readContext, pszStream, true );
+    }
+
+    LadybugStreamHeadInfo streamHeaderInfo;
+    unsigned int uiNumImages = 0;
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugGetStreamHeader( readContext, &streamHeaderInfo );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugGetStreamNumOfImages( readContext, &uiNumImages );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugGoToImage( readContext, 0 );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        printf( "%s: %s\n", pszStream, ladybugErrorToString( error ) );
+        if ( readContext != NULL )
+        {
+            ladybugDestroyStreamContext( &readContext );
+        }
+        return 1;
+    }
+
+    LadybugFrameTimingConfig config;
+    config.dFrameRate = ( dFrameRate > 0.0 ) ? dFrameRate : streamHeaderInfo.frameRate;
+    config.dDropFactor = dDropFactor;
+
+    DropCounter dropCounter;
+    dropCounter.setStream( pszStream );
+
+    LadybugFrameTimingAnalyzer timing;
+    timing.initialize( config );
+    timing.setListener( &dropCounter );
+
+    printf( "%s: %u images, %.2ffps expected\n", pszStream, uiNumImages, config.dFrameRate );
+
+    LadybugImage previous;
+    for ( unsigned int uiImage = 0; uiImage < uiNumImages; uiImage++ )
+    {
+        LadybugImage image;
+        error = ladybugReadImageFromStream( readContext, &image );
+        if ( error != LADYBUG_OK )
+        {
+            printf( "%s: image %u: %s\n", pszStream, uiImage, ladybugErrorToString( error ) );
+            break;
+        }
+
+        timing.addRecordedFrame( image );
+
+        if ( pCsv != NULL )
+        {
+            const double dDeltaMs =
+                ( uiImage == 0 ) ? 0.0 : LadybugFrameTimingAnalyzer::getDeltaSeconds( previous.timeStamp, image.timeStamp ) * 1000.0;
+            if ( bCsvStreamColumn )
+            {
+                fprintf( pCsv, "%s,", pszStream );
+            }
+            fprintf(
+                pCsv,
+                "%u,%u,%lld.%06u,%.3f,%u\n",
+                uiImage,
+                image.imageInfo.ulSequenceId,
+                (long long)image.timeStamp.ulSeconds,
+                image.timeStamp.ulMicroSeconds,
+                dDeltaMs,
+                dropCounter.takeDropped() );
+        }
+        previous = image;
+    }
+
+    ladybugDestroyStreamContext( &readContext );
+
+    timing.printStats( pszStream );
+    printDeltaHistogram( timing.getDeltaHistogram() );
+
+    if ( error != LADYBUG_OK )
+    {
+        return 1;
+    }
+
+    LadybugFrameTimingStats stats;
+    timing.getStats( &stats );
+    return ( stats.ulDroppedFrames > 0 ) ? EXIT_DROPPED : 0;
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    double dFrameRate = 0.0;
+    double dDropFactor = 1.5;
+    const char* pszCsvFile = NULL;
+    int iFirstStream = argc;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( i + 1 < argc && strcmp( argv[ i ], "-r" ) == 0 )
+        {
+            dFrameRate = atof( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-f" ) == 0 )
+        {
+            dDropFactor = atof( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-o" ) == 0 )
+        {
+            pszCsvFile = argv[ ++i ];
+        }
+        else if ( argv[ i ][ 0 ] != '-' )
+        {
+            iFirstStream = i;
+            break;
+        }
+        else
+        {
+            iFirstStream = argc;
+            break;
+        }
+    }
+
+    if ( iFirstStream == argc || dDropFactor <= 1.0 )
+    {
+        printf( "Usage: %s [-r FPS] [-f FACTOR] [-o CSV] STREAM...\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    const bool bCsvStreamColumn = argc - iFirstStream > 1;
+    FILE* pCsv = NULL;
+    if ( pszCsvFile != NULL )
+    {
+        pCsv = fopen( pszCsvFile, "w" );
+        if ( pCsv == NULL )
+        {
+            printf( "Could not open %s\n", pszCsvFile );
+            return EXIT_FAILURE;
+        }
+        fprintf( pCsv, "%sframe,sequence_id,time,delta_ms,dropped\n", bCsvStreamColumn ? "stream," : "" );
+    }
+
+    int iResult = 0;
+    for ( int i = iFirstStream; i < argc; i++ )
+    {
+        iResult = std::max( iResult, analyzeStream( argv[ i ], dFrameRate, dDropFactor, pCsv, bCsvStreamColumn ) );
+    }
+
+    if ( pCsv != NULL )
+    {
+        fclose( pCsv );
+    }
+
+    return iResult;
+}
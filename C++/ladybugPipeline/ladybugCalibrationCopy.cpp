@@ -0,0 +1,60 @@
+//=============================================================================
+// ladybugCalibrationCopy.cpp
+//=============================================================================
+
+#include "ladybugCalibrationCopy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <ladybuggeom.h>
+
+LadybugError
+ladybugCreateContextWithCalibration( LadybugContext sourceContext, LadybugContext* pContext )
+{
+    if ( sourceContext == NULL || pContext == NULL )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+    *pContext = NULL;
+
+    const char* pszDirectory = getenv( "TMPDIR" );
+    std::string path = std::string( pszDirectory != NULL && pszDirectory[ 0 ] != '\0' ? pszDirectory : "/tmp" ) +
+        "/ladybugCalibration-XXXXXX";
+    const int fd = mkstemp( &path[ 0 ] );
+    if ( fd < 0 )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    // The SDK writes the file by name
+    close( fd );
+
+    LadybugError error = ladybugWriteConfigurationFile( sourceContext, path.c_str() );
+
+    LadybugContext context = NULL;
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugCreateContext( &context );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugLoadConfig( context, path.c_str() );
+    }
+    remove( path.c_str() );
+
+    if ( error != LADYBUG_OK )
+    {
+        if ( context != NULL )
+        {
+            ladybugDestroyContext( &context );
+        }
+        return error;
+    }
+
+    *pContext = context;
+    return LADYBUG_OK;
+}
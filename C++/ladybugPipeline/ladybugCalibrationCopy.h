@@ -0,0 +1,35 @@
+//=============================================================================
+// ladybugCalibrationCopy.h
+//
+// Creates a context loaded with the calibration of another.
+//
+// A thread that color processes or renders on its own needs a context of
+// its own, with the camera's calibration. The SDK only moves a calibration
+// between contexts through a file: ladybugWriteConfigurationFile() on one
+// context, then ladybugLoadConfig() on the other. The file is made with
+// mkstemp() in $TMPDIR, or /tmp, so programs running at once never share
+// it and the current directory need not be writable. It is removed
+// whether or not the copy worked.
+//
+// Usage:
+//    ladybugLoadConfig( cameraContext, NULL );
+//    LadybugContext context;
+//    ladybugCreateContextWithCalibration( cameraContext, &context );
+//    ...
+//    ladybugDestroyContext( &context );
+//=============================================================================
+
+#ifndef LADYBUGCALIBRATIONCOPY_H
+#define LADYBUGCALIBRATIONCOPY_H
+
+#include <ladybug.h>
+
+/**
+ * Create a context and load the calibration of sourceContext into it.
+ *
+ * @param sourceContext - A context with a calibration loaded.
+ * @param pContext      - Receives the new context, or NULL on failure.
+ */
+LadybugError ladybugCreateContextWithCalibration( LadybugContext sourceContext, LadybugContext* pContext );
+
+#endif // LADYBUGCALIBRATIONCOPY_H
@@ -0,0 +1,708 @@
+//=============================================================================
+// ladybugDemosaic.cpp
+//=============================================================================
+
+#include "ladybugDemosaic.h"
+#include "ladybugMetrics.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define LADYBUG_DEMOSAIC_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// A Bayer image, with the position of red in its first 2x2 quad
+struct BayerSource
+{
+    const unsigned char* pRaw;
+    size_t stride;
+    unsigned int uiCols;
+    unsigned int uiRows;
+    unsigned int uiRedRow;
+    unsigned int uiRedCol;
+};
+
+void getRedPosition( LadybugStippledFormat pattern, unsigned int* puiRow, unsigned int* puiCol )
+{
+    switch ( pattern )
+    {
+    case LADYBUG_BGGR:
+        *puiRow = 1;
+        *puiCol = 1;
+        break;
+    case LADYBUG_GBRG:
+        *puiRow = 1;
+        *puiCol = 0;
+        break;
+    case LADYBUG_GRBG:
+        *puiRow = 0;
+        *puiCol = 1;
+        break;
+    default:
+        *puiRow = 0;
+        *puiCol = 0;
+        break;
+    }
+}
+
+// Mirror an index into [0, n) without repeating the edge, which keeps the Bayer phase
+inline unsigned int reflect( int i, unsigned int n )
+{
+    if ( i < 0 )
+    {
+        return (unsigned int)-i;
+    }
+    if ( i >= (int)n )
+    {
+        return 2 * n - 2 - (unsigned int)i;
+    }
+    return (unsigned int)i;
+}
+
+// Column parity of the red or blue pixels in a row
+inline unsigned int getColorParity( const BayerSource& src, unsigned int y )
+{
+    return ( ( y & 1 ) == src.uiRedRow ) ? src.uiRedCol : src.uiRedCol ^ 1;
+}
+
+inline void storePixel( unsigned char* pDst, unsigned int r, unsigned int g, unsigned int b )
+{
+    pDst[ 0 ] = (unsigned char)b;
+    pDst[ 1 ] = (unsigned char)g;
+    pDst[ 2 ] = (unsigned char)r;
+    pDst[ 3 ] = 0xff;
+}
+
+//
+// Scalar reference. In every row, "main" is the color sampled in that row
+// (red or blue), and "other" is the color sampled in the rows above and below.
+//
+
+// The missing channels come from the same 2x2 quad
+void nearestPixel( const BayerSource& src, unsigned int y, unsigned int x, unsigned char* pDst )
+{
+    const unsigned char* pCur = src.pRaw + y * src.stride;
+    const unsigned char* pPartner = src.pRaw + ( y ^ 1 ) * src.stride;
+    const bool bRedRow = ( y & 1 ) == src.uiRedRow;
+
+    unsigned int main, green, other;
+    if ( ( x & 1 ) == getColorParity( src, y ) )
+    {
+        main = pCur[ x ];
+        green = pCur[ x ^ 1 ];
+        other = pPartner[ x ^ 1 ];
+    }
+    else
+    {
+        main = pCur[ x ^ 1 ];
+        green = pCur[ x ];
+        other = pPartner[ x ];
+    }
+
+    storePixel( pDst, bRedRow ? main : other, green, bRedRow ? other : main );
+}
+
+void bilinearPixel( const BayerSource& src, unsigned int y, unsigned int x, unsigned char* pDst )
+{
+    const unsigned char* pUp = src.pRaw + reflect( (int)y - 1, src.uiRows ) * src.stride;
+    const unsigned char* pCur = src.pRaw + y * src.stride;
+    const unsigned char* pDown = src.pRaw + reflect( (int)y + 1, src.uiRows ) * src.stride;
+    const unsigned int xw = reflect( (int)x - 1, src.uiCols );
+    const unsigned int xe = reflect( (int)x + 1, src.uiCols );
+    const bool bRedRow = ( y & 1 ) == src.uiRedRow;
+
+    const unsigned int c = pCur[ x ];
+    const unsigned int w = pCur[ xw ];
+    const unsigned int e = pCur[ xe ];
+    const unsigned int n = pUp[ x ];
+    const unsigned int s = pDown[ x ];
+
+    const unsigned int horizontal = ( w + e + 1 ) >> 1;
+    const unsigned int vertical = ( n + s + 1 ) >> 1;
+    const unsigned int cross = ( n + s + w + e + 2 ) >> 2;
+    const unsigned int diagonal = ( pUp[ xw ] + pUp[ xe ] + pDown[ xw ] + pDown[ xe ] + 2 ) >> 2;
+
+    unsigned int main, green, other;
+    if ( ( x & 1 ) == getColorParity( src, y ) )
+    {
+        main = c;
+        green = cross;
+        other = diagonal;
+    }
+    else
+    {
+        main = horizontal;
+        green = c;
+        other = vertical;
+    }
+
+    storePixel( pDst, bRedRow ? main : other, green, bRedRow ? other : main );
+}
+
+// One output pixel per 2x2 quad
+void down4Pixel( const BayerSource& src, unsigned int y, unsigned int x, unsigned char* pDst )
+{
+    const unsigned char* pRed = src.pRaw + ( 2 * y + src.uiRedRow ) * src.stride;
+    const unsigned char* pBlue = src.pRaw + ( 2 * y + ( src.uiRedRow ^ 1 ) ) * src.stride;
+    const unsigned int xr = 2 * x + src.uiRedCol;
+    const unsigned int xb = 2 * x + ( src.uiRedCol ^ 1 );
+
+    storePixel( pDst, pRed[ xr ], ( pRed[ xb ] + pBlue[ xr ] + 1 ) >> 1, pBlue[ xb ] );
+}
+
+void nearestRowsScalar( const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        unsigned char* pRow = pDst + (size_t)y * src.uiCols * 4;
+        for ( unsigned int x = 0; x < src.uiCols; x++ )
+        {
+            nearestPixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
+
+void bilinearRowsScalar( const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        unsigned char* pRow = pDst + (size_t)y * src.uiCols * 4;
+        for ( unsigned int x = 0; x < src.uiCols; x++ )
+        {
+            bilinearPixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
+
+void down4RowsScalar( const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    const unsigned int uiOutCols = src.uiCols / 2;
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        unsigned char* pRow = pDst + (size_t)y * uiOutCols * 4;
+        for ( unsigned int x = 0; x < uiOutCols; x++ )
+        {
+            down4Pixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
+
+#ifdef LADYBUG_DEMOSAIC_X86
+
+namespace sse41
+{
+#define KERNEL_TARGET __attribute__( ( target( "sse4.1" ) ) )
+
+typedef __m128i Vec;
+const unsigned int LANES = 8;
+
+KERNEL_TARGET inline Vec load( const unsigned char* p )
+{
+    return _mm_cvtepu8_epi16( _mm_loadl_epi64( (const __m128i*)p ) );
+}
+
+KERNEL_TARGET inline Vec loadWords( const unsigned char* p )
+{
+    return _mm_loadu_si128( (const __m128i*)p );
+}
+
+KERNEL_TARGET inline Vec lowBytes( Vec v )
+{
+    return _mm_and_si128( v, _mm_set1_epi16( 0xff ) );
+}
+
+KERNEL_TARGET inline Vec highBytes( Vec v )
+{
+    return _mm_srli_epi16( v, 8 );
+}
+
+KERNEL_TARGET inline Vec add( Vec a, Vec b )
+{
+    return _mm_add_epi16( a, b );
+}
+
+KERNEL_TARGET inline Vec shiftRight1( Vec v )
+{
+    return _mm_srli_epi16( v, 1 );
+}
+
+KERNEL_TARGET inline Vec shiftRight2( Vec v )
+{
+    return _mm_srli_epi16( v, 2 );
+}
+
+KERNEL_TARGET inline Vec constant( short i )
+{
+    return _mm_set1_epi16( i );
+}
+
+KERNEL_TARGET inline Vec select( Vec even, Vec odd )
+{
+    return _mm_blend_epi16( even, odd, 0xaa );
+}
+
+KERNEL_TARGET inline void storeBGRU( Vec r, Vec g, Vec b, unsigned char* p )
+{
+    const __m128i bg = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), _mm_packus_epi16( g, g ) );
+    const __m128i ru = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), _mm_set1_epi8( (char)0xff ) );
+    _mm_storeu_si128( (__m128i*)p, _mm_unpacklo_epi16( bg, ru ) );
+    _mm_storeu_si128( (__m128i*)( p + 16 ), _mm_unpackhi_epi16( bg, ru ) );
+}
+
+#include "ladybugDemosaicKernels.inl"
+
+#undef KERNEL_TARGET
+} // namespace sse41
+
+namespace avx2
+{
+#define KERNEL_TARGET __attribute__( ( target( "avx2" ) ) )
+
+typedef __m256i Vec;
+const unsigned int LANES = 16;
+
+KERNEL_TARGET inline Vec load( const unsigned char* p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*)p ) );
+}
+
+KERNEL_TARGET inline Vec loadWords( const unsigned char* p )
+{
+    return _mm256_loadu_si256( (const __m256i*)p );
+}
+
+KERNEL_TARGET inline Vec lowBytes( Vec v )
+{
+    return _mm256_and_si256( v, _mm256_set1_epi16( 0xff ) );
+}
+
+KERNEL_TARGET inline Vec highBytes( Vec v )
+{
+    return _mm256_srli_epi16( v, 8 );
+}
+
+KERNEL_TARGET inline Vec add( Vec a, Vec b )
+{
+    return _mm256_add_epi16( a, b );
+}
+
+KERNEL_TARGET inline Vec shiftRight1( Vec v )
+{
+    return _mm256_srli_epi16( v, 1 );
+}
+
+KERNEL_TARGET inline Vec shiftRight2( Vec v )
+{
+    return _mm256_srli_epi16( v, 2 );
+}
+
+KERNEL_TARGET inline Vec constant( short i )
+{
+    return _mm256_set1_epi16( i );
+}
+
+KERNEL_TARGET inline Vec select( Vec even, Vec odd )
+{
+    return _mm256_blend_epi16( even, odd, 0xaa );
+}
+
+// Pack eight 16-bit pixels of each channel into 32 bytes of BGRU
+KERNEL_TARGET inline void storeHalf( __m128i r, __m128i g, __m128i b, unsigned char* p )
+{
+    const __m128i bg = _mm_unpacklo_epi8( _mm_packus_epi16( b, b ), _mm_packus_epi16( g, g ) );
+    const __m128i ru = _mm_unpacklo_epi8( _mm_packus_epi16( r, r ), _mm_set1_epi8( (char)0xff ) );
+    _mm_storeu_si128( (__m128i*)p, _mm_unpacklo_epi16( bg, ru ) );
+    _mm_storeu_si128( (__m128i*)( p + 16 ), _mm_unpackhi_epi16( bg, ru ) );
+}
+
+KERNEL_TARGET inline void storeBGRU( Vec r, Vec g, Vec b, unsigned char* p )
+{
+    storeHalf( _mm256_castsi256_si128( r ), _mm256_castsi256_si128( g ), _mm256_castsi256_si128( b ), p );
+    storeHalf( _mm256_extracti128_si256( r, 1 ), _mm256_extracti128_si256( g, 1 ), _mm256_extracti128_si256( b, 1 ), p + 32 );
+}
+
+#include "ladybugDemosaicKernels.inl"
+
+#undef KERNEL_TARGET
+} // namespace avx2
+
+#endif // LADYBUG_DEMOSAIC_X86
+
+typedef void ( *RowsKernel )( const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow );
+
+RowsKernel getKernel( LadybugDemosaicMethod method, LadybugSimdLevel simdLevel )
+{
+    static const RowsKernel s_kernels[][ 3 ] = {
+        { nearestRowsScalar, bilinearRowsScalar, down4RowsScalar },
+#ifdef LADYBUG_DEMOSAIC_X86
+        { sse41::nearestRows, sse41::bilinearRows, sse41::down4Rows },
+        { avx2::nearestRows, avx2::bilinearRows, avx2::down4Rows },
+#endif
+    };
+
+    return s_kernels[ simdLevel ][ method ];
+}
+
+LadybugError demosaicBayer(
+    const BayerSource& src,
+    LadybugDemosaicMethod method,
+    unsigned char* pDst,
+    LadybugSimdLevel simdLevel )
+{
+    if ( src.pRaw == NULL || pDst == NULL ||
+        src.uiCols < 2 || src.uiRows < 2 || ( src.uiCols & 1 ) != 0 || ( src.uiRows & 1 ) != 0 ||
+        method < LADYBUG_DEMOSAIC_NEAREST || method > LADYBUG_DEMOSAIC_DOWN4 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const LadybugSimdLevel bestLevel = ladybugGetBestSimdLevel();
+    if ( simdLevel > bestLevel || simdLevel < LADYBUG_SIMD_SCALAR )
+    {
+        simdLevel = bestLevel;
+    }
+
+    const unsigned int uiOutRows = ( method == LADYBUG_DEMOSAIC_DOWN4 ) ? src.uiRows / 2 : src.uiRows;
+    getKernel( method, simdLevel )( src, pDst, 0, uiOutRows );
+
+    return LADYBUG_OK;
+}
+
+// Demosaic one camera of a RAW8 image
+LadybugError demosaicCamera(
+    const LadybugImage& image,
+    unsigned int uiCamera,
+    LadybugDemosaicMethod method,
+    unsigned char* pDst,
+    LadybugSimdLevel simdLevel )
+{
+    // The sensor border, if transmitted, surrounds each camera image
+    const unsigned int uiFullCols = ( image.uiFullCols != 0 ) ? image.uiFullCols : image.uiCols;
+    const unsigned int uiFullRows = ( image.uiFullRows != 0 ) ? image.uiFullRows : image.uiRows;
+    const unsigned int uiTop = ( image.uiFullRows != 0 ) ? image.imageBorder.uiTopRows : 0;
+    const unsigned int uiLeft = ( image.uiFullCols != 0 ) ? image.imageBorder.uiLeftCols : 0;
+
+    BayerSource src;
+    src.pRaw = image.pData + (size_t)uiCamera * uiFullCols * uiFullRows + (size_t)uiTop * uiFullCols + uiLeft;
+    src.stride = uiFullCols;
+    src.uiCols = image.uiCols;
+    src.uiRows = image.uiRows;
+
+    // An odd border shifts the Bayer phase of the useful image
+    getRedPosition( image.stippledFormat, &src.uiRedRow, &src.uiRedCol );
+    src.uiRedRow ^= uiTop & 1;
+    src.uiRedCol ^= uiLeft & 1;
+
+    return demosaicBayer( src, method, pDst, simdLevel );
+}
+
+} // namespace
+
+//=============================================================================
+// Single image functions
+//=============================================================================
+
+LadybugError
+ladybugDemosaicImage(
+    const unsigned char* pRaw,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    size_t rawStride,
+    LadybugStippledFormat pattern,
+    LadybugDemosaicMethod method,
+    unsigned char* pDst,
+    LadybugSimdLevel simdLevel )
+{
+    BayerSource src;
+    src.pRaw = pRaw;
+    src.stride = rawStride;
+    src.uiCols = uiCols;
+    src.uiRows = uiRows;
+    getRedPosition( pattern, &src.uiRedRow, &src.uiRedCol );
+
+    return demosaicBayer( src, method, pDst, simdLevel );
+}
+
+void
+ladybugGetDemosaicSize(
+    LadybugDemosaicMethod method,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    unsigned int* puiCols,
+    unsigned int* puiRows )
+{
+    const unsigned int uiScale = ( method == LADYBUG_DEMOSAIC_DOWN4 ) ? 2 : 1;
+    *puiCols = uiCols / uiScale;
+    *puiRows = uiRows / uiScale;
+}
+
+LadybugSimdLevel
+ladybugGetBestSimdLevel()
+{
+#ifdef LADYBUG_DEMOSAIC_X86
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        return LADYBUG_SIMD_AVX2;
+    }
+    if ( __builtin_cpu_supports( "sse4.1" ) )
+    {
+        return LADYBUG_SIMD_SSE41;
+    }
+#endif
+    return LADYBUG_SIMD_SCALAR;
+}
+
+const char*
+ladybugGetDemosaicMethodName( LadybugDemosaicMethod method )
+{
+    switch ( method )
+    {
+    case LADYBUG_DEMOSAIC_NEAREST:
+        return "nearest";
+    case LADYBUG_DEMOSAIC_BILINEAR:
+        return "bilinear";
+    case LADYBUG_DEMOSAIC_DOWN4:
+        return "down4";
+    default:
+        return "unknown";
+    }
+}
+
+const char*
+ladybugGetSimdLevelName( LadybugSimdLevel simdLevel )
+{
+    switch ( simdLevel )
+    {
+    case LADYBUG_SIMD_SCALAR:
+        return "scalar";
+    case LADYBUG_SIMD_SSE41:
+        return "sse4.1";
+    case LADYBUG_SIMD_AVX2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
+
+//=============================================================================
+// LadybugDemosaicer
+//=============================================================================
+
+LadybugDemosaicer::LadybugDemosaicer()
+    : m_bRunning( false ),
+      m_method( LADYBUG_DEMOSAIC_NEAREST ),
+      m_simdLevel( LADYBUG_SIMD_SCALAR ),
+      m_pImage( NULL ),
+      m_arpBuffers( NULL ),
+      m_ulGeneration( 0 ),
+      m_uiPending( 0 ),
+      m_bFailed( false )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugDemosaicer::~LadybugDemosaicer()
+{
+    shutdown();
+}
+
+LadybugError
+LadybugDemosaicer::initialize( LadybugDemosaicMethod method, LadybugSimdLevel simdLevel, bool bPinThreads )
+{
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    if ( method < LADYBUG_DEMOSAIC_NEAREST || method > LADYBUG_DEMOSAIC_DOWN4 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const LadybugSimdLevel bestLevel = ladybugGetBestSimdLevel();
+
+    m_method = method;
+    m_simdLevel = ( simdLevel > bestLevel || simdLevel < LADYBUG_SIMD_SCALAR ) ? bestLevel : simdLevel;
+    m_ulGeneration = 0;
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiNumThreads = LADYBUG_NUM_CAMERAS;
+    m_stats.simdLevel = m_simdLevel;
+
+    m_bRunning = true;
+    for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+    {
+        m_threads.push_back( std::thread( &LadybugDemosaicer::workerLoop, this, uiCamera ) );
+    }
+
+    // Worker i goes on the i-th CPU the process may use, so taskset and
+    // cgroup limits are kept. Pinning more workers than there are CPUs would
+    // only make them share. CPUs given to the convert stage (see
+    // ladybugThreadPlacement.h) win.
+#ifdef __linux__
+    std::vector<int> processCpus;
+    LadybugThreadPlacement::instance().getProcessCpus( &processCpus );
+    if ( bPinThreads && processCpus.size() >= LADYBUG_NUM_CAMERAS &&
+        !LadybugThreadPlacement::instance().hasStageCpus( LADYBUG_STAGE_CONVERT ) )
+    {
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            cpu_set_t cpus;
+            CPU_ZERO( &cpus );
+            CPU_SET( processCpus[ uiCamera ], &cpus );
+            if ( pthread_setaffinity_np( m_threads[ uiCamera ].native_handle(), sizeof( cpus ), &cpus ) == 0 )
+            {
+                m_stats.uiPinnedThreads++;
+            }
+        }
+    }
+#else
+    (void)bPinThreads;
+#endif
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugDemosaicer::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_bRunning )
+        {
+            return;
+        }
+        m_bRunning = false;
+    }
+
+    m_frameReady.notify_all();
+    for ( size_t i = 0; i < m_threads.size(); i++ )
+    {
+        m_threads[ i ].join();
+    }
+    m_threads.clear();
+}
+
+LadybugError
+LadybugDemosaicer::demosaic( const LadybugImage& image, unsigned char** arpBuffers )
+{
+    if ( image.dataFormat != LADYBUG_DATAFORMAT_RAW8 )
+    {
+        return LADYBUG_NOT_SUPPORTED;
+    }
+
+    if ( image.pData == NULL || arpBuffers == NULL )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    LadybugStageTimer convertTimer( LADYBUG_STAGE_CONVERT );
+    convertTimer.setBytes( (unsigned long long)image.uiCols * image.uiRows * LADYBUG_NUM_CAMERAS );
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( !m_bRunning )
+    {
+        convertTimer.cancel();
+        return LADYBUG_NOT_STARTED;
+    }
+
+    m_pImage = &image;
+    m_arpBuffers = arpBuffers;
+    m_uiPending = LADYBUG_NUM_CAMERAS;
+    m_bFailed = false;
+    m_ulGeneration++;
+    m_frameReady.notify_all();
+
+    m_frameDone.wait( lock, [this] { return m_uiPending == 0; } );
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_stats.dTotalMs += elapsed.count();
+
+    if ( m_bFailed )
+    {
+        m_stats.ulErrors++;
+        convertTimer.cancel();
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    m_stats.ulFrames++;
+    return LADYBUG_OK;
+}
+
+void
+LadybugDemosaicer::getOutputSize( const LadybugImage& image, unsigned int* puiCols, unsigned int* puiRows ) const
+{
+    ladybugGetDemosaicSize( m_method, image.uiCols, image.uiRows, puiCols, puiRows );
+}
+
+void
+LadybugDemosaicer::workerLoop( unsigned int uiCamera )
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_CONVERT, "demosaic" );
+    unsigned long long ulGeneration = 0;
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_frameReady.wait( lock, [this, ulGeneration] { return !m_bRunning || m_ulGeneration != ulGeneration; } );
+        if ( !m_bRunning )
+        {
+            break;
+        }
+        ulGeneration = m_ulGeneration;
+
+        const LadybugImage* pImage = m_pImage;
+        unsigned char* pDst = m_arpBuffers[ uiCamera ];
+        lock.unlock();
+
+        const LadybugError error = demosaicCamera( *pImage, uiCamera, m_method, pDst, m_simdLevel );
+
+        lock.lock();
+        if ( error != LADYBUG_OK )
+        {
+            m_bFailed = true;
+        }
+        if ( --m_uiPending == 0 )
+        {
+            m_frameDone.notify_all();
+        }
+    }
+}
+
+void
+LadybugDemosaicer::getStats( LadybugDemosaicerStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugDemosaicer::printStats( const char* pszName ) const
+{
+    LadybugDemosaicerStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu frames (%s, %s), %.2fms per frame, %llu errors, %u of %u workers pinned\n",
+        pszName,
+        stats.ulFrames,
+        ladybugGetDemosaicMethodName( m_method ),
+        ladybugGetSimdLevelName( stats.simdLevel ),
+        ( stats.ulFrames + stats.ulErrors ) > 0 ? stats.dTotalMs / ( stats.ulFrames + stats.ulErrors ) : 0.0,
+        stats.ulErrors,
+        stats.uiPinnedThreads,
+        stats.uiNumThreads );
+}
@@ -0,0 +1,172 @@
+//=============================================================================
+// ladybugDemosaic.h
+//
+// Demosaics LADYBUG_DATAFORMAT_RAW8 images into BGRU without the SDK, so the
+// color processing step can be profiled and run on our own threads.
+//
+// Three methods are provided:
+//  - LADYBUG_DEMOSAIC_NEAREST fills each 2x2 Bayer quad from its own
+//    samples, like LADYBUG_NEAREST_NEIGHBOR_FAST.
+//  - LADYBUG_DEMOSAIC_BILINEAR averages the nearest samples of each missing
+//    channel. Edges are mirrored, which keeps the Bayer phase.
+//  - LADYBUG_DEMOSAIC_DOWN4 makes one pixel per quad, averaging the two
+//    greens, like LADYBUG_DOWNSAMPLE4. The output is half width and height.
+//
+// Each method has a scalar reference and SSE4.1 and AVX2 versions that give
+// bit-identical results; the best one the CPU supports is picked at run time.
+// Only the Bayer pattern is interpolated: unlike ladybugConvertImage() no
+// white balance, gamma or falloff correction is applied.
+//
+// LadybugDemosaicer runs one worker thread per camera, pinned to its own core
+// when the process is allowed enough cores.
+//
+// Usage:
+//    LadybugDemosaicer demosaicer;
+//    demosaicer.initialize( LADYBUG_DEMOSAIC_BILINEAR );
+//    demosaicer.demosaic( image, pBufferSet->arpBuffers );
+//=============================================================================
+
+#ifndef LADYBUGDEMOSAIC_H
+#define LADYBUGDEMOSAIC_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+enum LadybugDemosaicMethod
+{
+    LADYBUG_DEMOSAIC_NEAREST,
+    LADYBUG_DEMOSAIC_BILINEAR,
+    LADYBUG_DEMOSAIC_DOWN4
+};
+
+enum LadybugSimdLevel
+{
+    LADYBUG_SIMD_SCALAR,
+    LADYBUG_SIMD_SSE41,
+    LADYBUG_SIMD_AVX2
+};
+
+/**
+ * Demosaic one RAW8 Bayer image into a BGRU image.
+ *
+ * @param pRaw       - First pixel of the image.
+ * @param uiCols     - Columns of the Bayer image. Must be even.
+ * @param uiRows     - Rows of the Bayer image. Must be even.
+ * @param rawStride  - Bytes between rows of pRaw.
+ * @param pattern    - Bayer pattern of the first 2x2 quad. LADYBUG_DEFAULT
+ *                     is treated as LADYBUG_RGGB.
+ * @param method     - Demosaic method.
+ * @param pDst       - Destination. Rows are packed; the size is given by
+ *                     ladybugGetDemosaicSize().
+ * @param simdLevel  - Kernels to use. Levels the CPU does not support fall
+ *                     back to the best one it does.
+ */
+LadybugError ladybugDemosaicImage(
+    const unsigned char* pRaw,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    size_t rawStride,
+    LadybugStippledFormat pattern,
+    LadybugDemosaicMethod method,
+    unsigned char* pDst,
+    LadybugSimdLevel simdLevel );
+
+/** Size of the image a method produces from a uiCols x uiRows Bayer image. */
+void ladybugGetDemosaicSize(
+    LadybugDemosaicMethod method,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    unsigned int* puiCols,
+    unsigned int* puiRows );
+
+/** The best kernels this CPU supports. */
+LadybugSimdLevel ladybugGetBestSimdLevel();
+
+const char* ladybugGetDemosaicMethodName( LadybugDemosaicMethod method );
+const char* ladybugGetSimdLevelName( LadybugSimdLevel simdLevel );
+
+/** Counters reported by LadybugDemosaicer::getStats(). */
+struct LadybugDemosaicerStats
+{
+    /** Number of frames demosaiced, and the number that failed. */
+    unsigned long long ulFrames;
+    unsigned long long ulErrors;
+
+    /** Total time spent in demosaic(), in milliseconds. */
+    double dTotalMs;
+
+    /** Number of workers, and how many of them are pinned to a core. */
+    unsigned int uiNumThreads;
+    unsigned int uiPinnedThreads;
+
+    LadybugSimdLevel simdLevel;
+};
+
+class LadybugDemosaicer
+{
+public:
+    LadybugDemosaicer();
+    ~LadybugDemosaicer();
+
+    /**
+     * Start one worker per camera.
+     *
+     * @param method     - Demosaic method.
+     * @param simdLevel  - Kernels to use, capped to what the CPU supports.
+     * @param bPinThreads - Pin worker i to the i-th core the process may run
+     *                      on, if it may run on one core per camera.
+     */
+    LadybugError initialize(
+        LadybugDemosaicMethod method,
+        LadybugSimdLevel simdLevel = LADYBUG_SIMD_AVX2,
+        bool bPinThreads = true );
+
+    /** Stop the workers. */
+    void shutdown();
+
+    /**
+     * Demosaic all six cameras of a RAW8 image, one per worker, and wait for
+     * them. Each of arpBuffers must hold the size given by getOutputSize().
+     */
+    LadybugError demosaic( const LadybugImage& image, unsigned char** arpBuffers );
+
+    /** Size of each camera image demosaic() produces for an image. */
+    void getOutputSize( const LadybugImage& image, unsigned int* puiCols, unsigned int* puiRows ) const;
+
+    void getStats( LadybugDemosaicerStats* pStats ) const;
+
+    /** Print the demosaicer counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugDemosaicer( const LadybugDemosaicer& );
+    LadybugDemosaicer& operator=( const LadybugDemosaicer& );
+
+    void workerLoop( unsigned int uiCamera );
+
+    std::vector<std::thread> m_threads;
+    bool m_bRunning;
+
+    LadybugDemosaicMethod m_method;
+    LadybugSimdLevel m_simdLevel;
+
+    // The frame being demosaiced. m_ulGeneration is bumped for every frame;
+    // each worker demosaics its camera once per generation.
+    const LadybugImage* m_pImage;
+    unsigned char** m_arpBuffers;
+    unsigned long long m_ulGeneration;
+    unsigned int m_uiPending;
+    bool m_bFailed;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameReady;
+    std::condition_variable m_frameDone;
+
+    LadybugDemosaicerStats m_stats;
+};
+
+#endif // LADYBUGDEMOSAIC_H
@@ -0,0 +1,173 @@
+//=============================================================================
+// ladybugDemosaicKernels.inl
+//
+// Vector versions of the demosaic kernels in ladybugDemosaic.cpp. This file
+// is included once per instruction set, inside a namespace that defines:
+//
+//    KERNEL_TARGET              - attribute enabling the instruction set
+//    Vec, LANES                 - a vector of LANES 16-bit values
+//    load( p )                  - LANES bytes, widened to 16 bits
+//    loadWords( p )             - 2 * LANES bytes as LANES 16-bit words
+//    lowBytes( v ), highBytes( v ) - the even or odd byte of every word
+//    add( a, b ), shiftRight1( v ), shiftRight2( v ), constant( i )
+//    select( even, odd )        - even lanes from even, odd lanes from odd
+//    storeBGRU( r, g, b, p )    - LANES BGRU pixels
+//
+// Every kernel does the same integer arithmetic as the scalar pixel
+// functions, so the results are bit-identical. The scalar functions handle
+// the columns the vectors cannot reach.
+//=============================================================================
+
+KERNEL_TARGET void nearestRows(
+    const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        const unsigned char* pCur = src.pRaw + y * src.stride;
+        const unsigned char* pPartner = src.pRaw + ( y ^ 1 ) * src.stride;
+        const bool bRedRow = ( y & 1 ) == src.uiRedRow;
+        const bool bColorEven = getColorParity( src, y ) == 0;
+        unsigned char* pRow = pDst + (size_t)y * src.uiCols * 4;
+
+        // Start at an even column so lane parity is column parity
+        unsigned int x = 0;
+        for ( ; x < 2; x++ )
+        {
+            nearestPixel( src, y, x, pRow + x * 4 );
+        }
+
+        for ( ; x + LANES + 1 <= src.uiCols; x += LANES )
+        {
+            const Vec c = load( pCur + x );
+            const Vec same = select( load( pCur + x + 1 ), load( pCur + x - 1 ) );
+            const Vec partner = load( pPartner + x );
+            const Vec partnerSame = select( load( pPartner + x + 1 ), load( pPartner + x - 1 ) );
+
+            Vec main, green, other;
+            if ( bColorEven )
+            {
+                main = select( c, same );
+                green = select( same, c );
+                other = select( partnerSame, partner );
+            }
+            else
+            {
+                main = select( same, c );
+                green = select( c, same );
+                other = select( partner, partnerSame );
+            }
+
+            storeBGRU( bRedRow ? main : other, green, bRedRow ? other : main, pRow + x * 4 );
+        }
+
+        for ( ; x < src.uiCols; x++ )
+        {
+            nearestPixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
+
+KERNEL_TARGET void bilinearRows(
+    const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    const Vec one = constant( 1 );
+    const Vec two = constant( 2 );
+
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        const unsigned char* pUp = src.pRaw + reflect( (int)y - 1, src.uiRows ) * src.stride;
+        const unsigned char* pCur = src.pRaw + y * src.stride;
+        const unsigned char* pDown = src.pRaw + reflect( (int)y + 1, src.uiRows ) * src.stride;
+        const bool bRedRow = ( y & 1 ) == src.uiRedRow;
+        const bool bColorEven = getColorParity( src, y ) == 0;
+        unsigned char* pRow = pDst + (size_t)y * src.uiCols * 4;
+
+        unsigned int x = 0;
+        for ( ; x < 2; x++ )
+        {
+            bilinearPixel( src, y, x, pRow + x * 4 );
+        }
+
+        for ( ; x + LANES + 1 <= src.uiCols; x += LANES )
+        {
+            const Vec c = load( pCur + x );
+            const Vec w = load( pCur + x - 1 );
+            const Vec e = load( pCur + x + 1 );
+            const Vec n = load( pUp + x );
+            const Vec s = load( pDown + x );
+            const Vec diagonalSum = add(
+                add( load( pUp + x - 1 ), load( pUp + x + 1 ) ),
+                add( load( pDown + x - 1 ), load( pDown + x + 1 ) ) );
+
+            const Vec horizontal = shiftRight1( add( add( w, e ), one ) );
+            const Vec vertical = shiftRight1( add( add( n, s ), one ) );
+            const Vec cross = shiftRight2( add( add( add( n, s ), add( w, e ) ), two ) );
+            const Vec diagonal = shiftRight2( add( diagonalSum, two ) );
+
+            Vec main, green, other;
+            if ( bColorEven )
+            {
+                main = select( c, horizontal );
+                green = select( cross, c );
+                other = select( diagonal, vertical );
+            }
+            else
+            {
+                main = select( horizontal, c );
+                green = select( c, cross );
+                other = select( vertical, diagonal );
+            }
+
+            storeBGRU( bRedRow ? main : other, green, bRedRow ? other : main, pRow + x * 4 );
+        }
+
+        for ( ; x < src.uiCols; x++ )
+        {
+            bilinearPixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
+
+KERNEL_TARGET void down4Rows(
+    const BayerSource& src, unsigned char* pDst, unsigned int uiFirstRow, unsigned int uiEndRow )
+{
+    const Vec one = constant( 1 );
+    const unsigned int uiOutCols = src.uiCols / 2;
+
+    for ( unsigned int y = uiFirstRow; y < uiEndRow; y++ )
+    {
+        const unsigned char* pRed = src.pRaw + ( 2 * y + src.uiRedRow ) * src.stride;
+        const unsigned char* pBlue = src.pRaw + ( 2 * y + ( src.uiRedRow ^ 1 ) ) * src.stride;
+        unsigned char* pRow = pDst + (size_t)y * uiOutCols * 4;
+
+        unsigned int x = 0;
+        for ( ; x + LANES <= uiOutCols; x += LANES )
+        {
+            const Vec redRow = loadWords( pRed + 2 * x );
+            const Vec blueRow = loadWords( pBlue + 2 * x );
+
+            Vec r, g1, g2, b;
+            if ( src.uiRedCol == 0 )
+            {
+                r = lowBytes( redRow );
+                g1 = highBytes( redRow );
+                g2 = lowBytes( blueRow );
+                b = highBytes( blueRow );
+            }
+            else
+            {
+                r = highBytes( redRow );
+                g1 = lowBytes( redRow );
+                g2 = highBytes( blueRow );
+                b = lowBytes( blueRow );
+            }
+
+            storeBGRU( r, shiftRight1( add( add( g1, g2 ), one ) ), b, pRow + x * 4 );
+        }
+
+        for ( ; x < uiOutCols; x++ )
+        {
+            down4Pixel( src, y, x, pRow + x * 4 );
+        }
+    }
+}
@@ -0,0 +1,811 @@
+//=============================================================================
+// ladybugFileWriter.cpp
+//=============================================================================
+
+#include "ladybugFileWriter.h"
+#include "ladybugMetrics.h"
+#include "ladybugThreadPlacement.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#include <chrono>
+#include <set>
+
+namespace
+{
+// Most jobs taken from the queue in one batch. The ring has this many entries.
+const unsigned int MAX_BATCH = 64;
+
+// Most buffers merged into one vectored write
+const unsigned int MAX_IOVECS = 64;
+
+// O_DIRECT transfers must be aligned to the logical block size. 4KB covers
+// every common device.
+const size_t DIRECT_ALIGNMENT = 4096;
+const size_t DIRECT_BUFFER_SIZE = 8 * 1024 * 1024;
+
+// Skip the first done bytes of an iovec array
+void advanceIovecs( std::vector<iovec>& iov, size_t* pIndex, size_t done )
+{
+    while ( done > 0 && *pIndex < iov.size() )
+    {
+        iovec& current = iov[ *pIndex ];
+        if ( done >= current.iov_len )
+        {
+            done -= current.iov_len;
+            ( *pIndex )++;
+        }
+        else
+        {
+            current.iov_base = (unsigned char*)current.iov_base + done;
+            current.iov_len -= done;
+            done = 0;
+        }
+    }
+
+    // Drop empty buffers so the loop below never makes a zero-length write
+    while ( *pIndex < iov.size() && iov[ *pIndex ].iov_len == 0 )
+    {
+        ( *pIndex )++;
+    }
+}
+
+// Write every buffer at ulOffset with pwritev(), skipping the first done
+// bytes, which have already been written. Returns the errno of the failure,
+// or 0.
+int writeFully( int fd, const std::vector<iovec>& buffers, unsigned long long ulOffset, size_t done )
+{
+    std::vector<iovec> iov( buffers );
+    size_t index = 0;
+    advanceIovecs( iov, &index, done );
+    ulOffset += done;
+
+    while ( index < iov.size() )
+    {
+        const size_t count = iov.size() - index;
+        const ssize_t written = pwritev( fd, &iov[ index ], (int)( count < IOV_MAX ? count : IOV_MAX ), (off_t)ulOffset );
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            return errno;
+        }
+
+        if ( written == 0 )
+        {
+            return EIO;
+        }
+
+        ulOffset += written;
+        advanceIovecs( iov, &index, (size_t)written );
+    }
+
+    return 0;
+}
+
+// Write a buffer at an offset with pwrite(). Returns the errno of the failure, or 0.
+int writeAll( int fd, const unsigned char* pData, size_t size, unsigned long long ulOffset )
+{
+    std::vector<iovec> iov( 1 );
+    iov[ 0 ].iov_base = (void*)pData;
+    iov[ 0 ].iov_len = size;
+    return writeFully( fd, iov, ulOffset, 0 );
+}
+
+} // namespace
+
+//=============================================================================
+// One vectored write: a whole file, or a run of appends to one file
+//=============================================================================
+struct LadybugFileWriter::Request
+{
+    int fd;
+    std::vector<iovec> iov;
+    unsigned long long ulOffset;
+    size_t size;
+
+    /** True for write() jobs, whose file is closed once written. */
+    bool bCloseFile;
+
+    /** The jobs in the batch this request writes. */
+    unsigned int uiFirstJob;
+    unsigned int uiNumJobs;
+};
+
+//=============================================================================
+// A minimal io_uring submission and completion queue, set up with the raw
+// system calls so that liburing is not needed.
+//=============================================================================
+class LadybugFileWriter::IoUring
+{
+public:
+    IoUring()
+        : m_fd( -1 )
+    {
+    }
+
+    ~IoUring()
+    {
+        destroy();
+    }
+
+#ifdef __linux__
+    bool initialize( unsigned int uiEntries )
+    {
+        io_uring_params params;
+        memset( &params, 0, sizeof( params ) );
+
+        m_fd = (int)syscall( __NR_io_uring_setup, uiEntries, &params );
+        if ( m_fd < 0 )
+        {
+            return false;
+        }
+
+        m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+        m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+        const bool bSingleMap = ( params.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+        if ( bSingleMap )
+        {
+            m_sqRingSize = m_cqRingSize = ( m_sqRingSize > m_cqRingSize ) ? m_sqRingSize : m_cqRingSize;
+        }
+
+        m_pSqRing = mmap( NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+        m_pCqRing = bSingleMap ? m_pSqRing :
+            mmap( NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING );
+        m_sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+        m_pSqes = (io_uring_sqe*)mmap( NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+
+        if ( m_pSqRing == MAP_FAILED || m_pCqRing == MAP_FAILED || m_pSqes == (io_uring_sqe*)MAP_FAILED )
+        {
+            destroy();
+            return false;
+        }
+
+        unsigned char* pSq = (unsigned char*)m_pSqRing;
+        m_pSqTail = (unsigned int*)( pSq + params.sq_off.tail );
+        m_pSqMask = (unsigned int*)( pSq + params.sq_off.ring_mask );
+        m_pSqArray = (unsigned int*)( pSq + params.sq_off.array );
+
+        unsigned char* pCq = (unsigned char*)m_pCqRing;
+        m_pCqHead = (unsigned int*)( pCq + params.cq_off.head );
+        m_pCqTail = (unsigned int*)( pCq + params.cq_off.tail );
+        m_pCqMask = (unsigned int*)( pCq + params.cq_off.ring_mask );
+        m_pCqes = (io_uring_cqe*)( pCq + params.cq_off.cqes );
+
+        return true;
+    }
+
+    void destroy()
+    {
+        if ( m_fd < 0 )
+        {
+            return;
+        }
+
+        if ( m_pSqes != NULL && m_pSqes != (io_uring_sqe*)MAP_FAILED )
+        {
+            munmap( m_pSqes, m_sqesSize );
+        }
+        if ( m_pCqRing != NULL && m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing )
+        {
+            munmap( m_pCqRing, m_cqRingSize );
+        }
+        if ( m_pSqRing != NULL && m_pSqRing != MAP_FAILED )
+        {
+            munmap( m_pSqRing, m_sqRingSize );
+        }
+
+        close( m_fd );
+        m_fd = -1;
+    }
+
+    /**
+     * Submit a writev for every request and wait for all of them.
+     * arResults gets the bytes written or a negative errno for each request.
+     * Returns false if the ring failed; results not filled in are INT_MIN.
+     */
+    bool submitAndWait( Request* arRequests, unsigned int uiNumRequests, int* arResults )
+    {
+        // Only this thread writes the submission tail
+        unsigned int uiTail = *m_pSqTail;
+        const unsigned int uiMask = *m_pSqMask;
+
+        for ( unsigned int i = 0; i < uiNumRequests; i++ )
+        {
+            arResults[ i ] = INT_MIN;
+
+            const unsigned int uiIndex = uiTail & uiMask;
+            io_uring_sqe* pSqe = &m_pSqes[ uiIndex ];
+            memset( pSqe, 0, sizeof( *pSqe ) );
+            pSqe->opcode = IORING_OP_WRITEV;
+            pSqe->fd = arRequests[ i ].fd;
+            pSqe->addr = (unsigned long long)(uintptr_t)arRequests[ i ].iov.data();
+            pSqe->len = (unsigned int)arRequests[ i ].iov.size();
+            pSqe->off = arRequests[ i ].ulOffset;
+            pSqe->user_data = i;
+            m_pSqArray[ uiIndex ] = uiIndex;
+            uiTail++;
+        }
+        __atomic_store_n( m_pSqTail, uiTail, __ATOMIC_RELEASE );
+
+        unsigned int uiToSubmit = uiNumRequests;
+        unsigned int uiCompleted = 0;
+
+        while ( uiCompleted < uiNumRequests )
+        {
+            const int iEntered = (int)syscall( __NR_io_uring_enter, m_fd, uiToSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+            if ( iEntered < 0 )
+            {
+                if ( errno == EINTR || errno == EAGAIN || errno == EBUSY )
+                {
+                    continue;
+                }
+                return false;
+            }
+            uiToSubmit -= ( (unsigned int)iEntered < uiToSubmit ) ? (unsigned int)iEntered : uiToSubmit;
+
+            unsigned int uiHead = *m_pCqHead;
+            const unsigned int uiCqTail = __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE );
+            while ( uiHead != uiCqTail )
+            {
+                const io_uring_cqe& cqe = m_pCqes[ uiHead & *m_pCqMask ];
+                if ( cqe.user_data < uiNumRequests )
+                {
+                    arResults[ cqe.user_data ] = cqe.res;
+                    uiCompleted++;
+                }
+                uiHead++;
+            }
+            __atomic_store_n( m_pCqHead, uiHead, __ATOMIC_RELEASE );
+        }
+
+        return true;
+    }
+
+private:
+    void* m_pSqRing = NULL;
+    void* m_pCqRing = NULL;
+    io_uring_sqe* m_pSqes = NULL;
+    size_t m_sqRingSize = 0;
+    size_t m_cqRingSize = 0;
+    size_t m_sqesSize = 0;
+
+    unsigned int* m_pSqTail = NULL;
+    unsigned int* m_pSqMask = NULL;
+    unsigned int* m_pSqArray = NULL;
+    unsigned int* m_pCqHead = NULL;
+    unsigned int* m_pCqTail = NULL;
+    unsigned int* m_pCqMask = NULL;
+    io_uring_cqe* m_pCqes = NULL;
+#else
+    bool initialize( unsigned int /*uiEntries*/ )
+    {
+        return false;
+    }
+
+    void destroy()
+    {
+    }
+
+    bool submitAndWait( Request* /*arRequests*/, unsigned int /*uiNumRequests*/, int* /*arResults*/ )
+    {
+        return false;
+    }
+#endif
+
+private:
+    int m_fd;
+};
+
+//=============================================================================
+// LadybugFileWriter
+//=============================================================================
+
+LadybugFileWriter::LadybugFileWriter()
+    : m_bWriting( false ),
+      m_bRunning( false ),
+      m_ulMaxOutstandingBytes( DEFAULT_MAX_OUTSTANDING_BYTES ),
+      m_pIoUring( NULL ),
+      m_pDirectBuffer( NULL )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugFileWriter::~LadybugFileWriter()
+{
+    stop();
+    free( m_pDirectBuffer );
+}
+
+LadybugError
+LadybugFileWriter::start( unsigned long long ulMaxOutstandingBytes, bool bUseIoUring )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_ulMaxOutstandingBytes = ulMaxOutstandingBytes;
+
+    if ( bUseIoUring )
+    {
+        m_pIoUring = new IoUring();
+        if ( !m_pIoUring->initialize( MAX_BATCH ) )
+        {
+            delete m_pIoUring;
+            m_pIoUring = NULL;
+        }
+    }
+    m_stats.bIoUring = ( m_pIoUring != NULL );
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugFileWriter::writeLoop, this );
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugFileWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_bRunning )
+        {
+            return;
+        }
+        m_bRunning = false;
+    }
+
+    m_jobQueued.notify_all();
+    m_spaceFreed.notify_all();
+    m_thread.join();
+
+    delete m_pIoUring;
+    m_pIoUring = NULL;
+}
+
+LadybugError
+LadybugFileWriter::write( const std::string& path, std::vector<unsigned char>&& data, bool bDirect )
+{
+    return queueJob( JOB_WRITE, path, data, bDirect );
+}
+
+LadybugError
+LadybugFileWriter::append( const std::string& path, std::vector<unsigned char>&& data )
+{
+    return queueJob( JOB_APPEND, path, data, false );
+}
+
+LadybugError
+LadybugFileWriter::append( const std::string& path, const char* pszText )
+{
+    std::vector<unsigned char> data( pszText, pszText + strlen( pszText ) );
+    return queueJob( JOB_APPEND, path, data, false );
+}
+
+LadybugError
+LadybugFileWriter::queueJob( JobType type, const std::string& path, std::vector<unsigned char>& data, bool bDirect )
+{
+    const unsigned long long ulSize = data.size();
+
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+
+        if ( !m_bRunning )
+        {
+            return LADYBUG_NOT_STARTED;
+        }
+
+        // Hold the caller back while too much is waiting for the disk. A job
+        // larger than the limit goes through once everything before it is written.
+        if ( m_stats.ulOutstandingBytes > 0 &&
+            m_stats.ulOutstandingBytes + ulSize > m_ulMaxOutstandingBytes )
+        {
+            const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+            m_stats.ulBackpressureWaits++;
+
+            m_spaceFreed.wait( lock, [this, ulSize] {
+                return m_stats.ulOutstandingBytes == 0 ||
+                    m_stats.ulOutstandingBytes + ulSize <= m_ulMaxOutstandingBytes ||
+                    !m_bRunning; } );
+
+            const std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - waitStart;
+            m_stats.dBackpressureMs += waited.count();
+
+            if ( !m_bRunning )
+            {
+                return LADYBUG_NOT_STARTED;
+            }
+        }
+
+        m_queue.push_back( Job() );
+        Job& job = m_queue.back();
+        job.type = type;
+        job.path = path;
+        job.data.swap( data );
+        job.bDirect = bDirect;
+
+        m_stats.ulOutstandingBytes += ulSize;
+        if ( m_stats.ulOutstandingBytes > m_stats.ulOutstandingHighWater )
+        {
+            m_stats.ulOutstandingHighWater = m_stats.ulOutstandingBytes;
+        }
+    }
+
+    m_jobQueued.notify_one();
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugFileWriter::flush()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_idle.wait( lock, [this] { return m_queue.empty() && !m_bWriting; } );
+}
+
+void
+LadybugFileWriter::writeLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "file writer" );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    while ( true )
+    {
+        m_jobQueued.wait( lock, [this] { return !m_queue.empty() || !m_bRunning; } );
+
+        // Drain the queue before stopping
+        if ( m_queue.empty() )
+        {
+            break;
+        }
+
+        // Take everything queued, but never two writes of the same file in
+        // one batch: they would be written concurrently.
+        std::deque<Job> batch;
+        std::set<std::string> writePaths;
+        while ( !m_queue.empty() && batch.size() < MAX_BATCH )
+        {
+            Job& job = m_queue.front();
+            if ( job.type == JOB_WRITE && !writePaths.insert( job.path ).second )
+            {
+                break;
+            }
+            batch.push_back( std::move( job ) );
+            m_queue.pop_front();
+        }
+
+        m_bWriting = true;
+        lock.unlock();
+
+        writeBatch( batch );
+
+        lock.lock();
+        m_bWriting = false;
+        m_spaceFreed.notify_all();
+        if ( m_queue.empty() )
+        {
+            m_idle.notify_all();
+        }
+    }
+
+    closeAppendFiles();
+    m_idle.notify_all();
+}
+
+void
+LadybugFileWriter::writeBatch( std::deque<Job>& batch )
+{
+    unsigned long long ulBatchBytes = 0;
+    for ( size_t i = 0; i < batch.size(); i++ )
+    {
+        ulBatchBytes += batch[ i ].data.size();
+    }
+
+    LadybugStageTimer writeTimer( LADYBUG_STAGE_WRITE );
+    writeTimer.setBytes( ulBatchBytes );
+
+    std::vector<bool> jobWritten( batch.size(), false );
+    std::vector<Request> requests;
+    requests.reserve( batch.size() );
+
+    // Open the files and build one request per file
+    for ( unsigned int uiJob = 0; uiJob < batch.size(); uiJob++ )
+    {
+        Job& job = batch[ uiJob ];
+
+        iovec buffer;
+        buffer.iov_base = job.data.data();
+        buffer.iov_len = job.data.size();
+
+        if ( job.type == JOB_WRITE && job.bDirect )
+        {
+            jobWritten[ uiJob ] = writeDirect( job );
+            continue;
+        }
+
+        if ( job.type == JOB_WRITE )
+        {
+            const int fd = open( job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+            if ( fd < 0 )
+            {
+                printf( "Error opening %s - %s\n", job.path.c_str(), strerror( errno ) );
+                continue;
+            }
+
+            requests.push_back( Request() );
+            Request& request = requests.back();
+            request.fd = fd;
+            request.iov.push_back( buffer );
+            request.ulOffset = 0;
+            request.size = buffer.iov_len;
+            request.bCloseFile = true;
+            request.uiFirstJob = uiJob;
+            request.uiNumJobs = 1;
+            continue;
+        }
+
+        unsigned long long* pulOffset = NULL;
+        const int fd = openAppendFile( job.path, &pulOffset );
+        if ( fd < 0 )
+        {
+            continue;
+        }
+
+        // Merge with the previous append to the same file
+        if ( !requests.empty() &&
+            requests.back().fd == fd &&
+            !requests.back().bCloseFile &&
+            requests.back().uiFirstJob + requests.back().uiNumJobs == uiJob &&
+            requests.back().iov.size() < MAX_IOVECS )
+        {
+            Request& request = requests.back();
+            request.iov.push_back( buffer );
+            request.size += buffer.iov_len;
+            request.uiNumJobs++;
+        }
+        else
+        {
+            requests.push_back( Request() );
+            Request& request = requests.back();
+            request.fd = fd;
+            request.iov.push_back( buffer );
+            request.ulOffset = *pulOffset;
+            request.size = buffer.iov_len;
+            request.bCloseFile = false;
+            request.uiFirstJob = uiJob;
+            request.uiNumJobs = 1;
+        }
+        *pulOffset += buffer.iov_len;
+    }
+
+    // Submit every request together, then finish short writes synchronously
+    std::vector<int> results( requests.size(), INT_MIN );
+    if ( m_pIoUring != NULL && !requests.empty() )
+    {
+        if ( !m_pIoUring->submitAndWait( requests.data(), (unsigned int)requests.size(), results.data() ) )
+        {
+            printf( "io_uring failed, writing with pwritev() from now on\n" );
+            delete m_pIoUring;
+            m_pIoUring = NULL;
+        }
+    }
+
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        Request& request = requests[ i ];
+
+        int iError = 0;
+        if ( results[ i ] == INT_MIN )
+        {
+            iError = writeFully( request.fd, request.iov, request.ulOffset, 0 );
+        }
+        else if ( results[ i ] < 0 )
+        {
+            iError = -results[ i ];
+        }
+        else if ( (size_t)results[ i ] < request.size )
+        {
+            iError = writeFully( request.fd, request.iov, request.ulOffset, (size_t)results[ i ] );
+        }
+
+        if ( request.bCloseFile && close( request.fd ) != 0 && iError == 0 )
+        {
+            iError = errno;
+        }
+
+        if ( iError != 0 )
+        {
+            printf( "Error writing %s - %s\n", batch[ request.uiFirstJob ].path.c_str(), strerror( iError ) );
+            continue;
+        }
+
+        for ( unsigned int uiJob = 0; uiJob < request.uiNumJobs; uiJob++ )
+        {
+            jobWritten[ request.uiFirstJob + uiJob ] = true;
+        }
+    }
+
+    writeTimer.stop();
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for ( size_t i = 0; i < batch.size(); i++ )
+    {
+        if ( !jobWritten[ i ] )
+        {
+            m_stats.ulErrors++;
+            continue;
+        }
+
+        if ( batch[ i ].type == JOB_WRITE )
+        {
+            m_stats.ulFilesWritten++;
+        }
+        else
+        {
+            m_stats.ulAppends++;
+        }
+        m_stats.ulBytesWritten += batch[ i ].data.size();
+    }
+
+    m_stats.ulBatches++;
+    if ( batch.size() > m_stats.uiLargestBatch )
+    {
+        m_stats.uiLargestBatch = (unsigned int)batch.size();
+    }
+    m_stats.ulOutstandingBytes -= ulBatchBytes;
+}
+
+bool
+LadybugFileWriter::writeDirect( const Job& job )
+{
+    const size_t size = job.data.size();
+    const size_t alignedSize = size / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+
+    int iError = 0;
+    int fd = -1;
+
+#ifdef O_DIRECT
+    if ( alignedSize > 0 )
+    {
+        fd = open( job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644 );
+    }
+#endif
+
+    if ( fd >= 0 && m_pDirectBuffer == NULL &&
+        posix_memalign( (void**)&m_pDirectBuffer, DIRECT_ALIGNMENT, DIRECT_BUFFER_SIZE ) != 0 )
+    {
+        m_pDirectBuffer = NULL;
+        close( fd );
+        fd = -1;
+    }
+
+    size_t written = 0;
+    if ( fd >= 0 )
+    {
+        // Stage the data through the aligned buffer
+        while ( written < alignedSize && iError == 0 )
+        {
+            const size_t chunk = ( alignedSize - written < DIRECT_BUFFER_SIZE ) ? alignedSize - written : DIRECT_BUFFER_SIZE;
+            memcpy( m_pDirectBuffer, job.data.data() + written, chunk );
+            iError = writeAll( fd, m_pDirectBuffer, chunk, written );
+            written += ( iError == 0 ) ? chunk : 0;
+        }
+        close( fd );
+
+        // The file system may refuse O_DIRECT writes; fall back to the page cache
+        if ( iError == EINVAL )
+        {
+            iError = 0;
+            written = 0;
+        }
+    }
+
+    if ( iError == 0 )
+    {
+        // The unaligned tail, or the whole file if O_DIRECT was not used
+        const int flags = ( written > 0 ) ? ( O_WRONLY | O_CLOEXEC ) : ( O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC );
+        fd = open( job.path.c_str(), flags, 0644 );
+        if ( fd < 0 )
+        {
+            iError = errno;
+        }
+        else
+        {
+            iError = writeAll( fd, job.data.data() + written, size - written, written );
+            if ( close( fd ) != 0 && iError == 0 )
+            {
+                iError = errno;
+            }
+        }
+    }
+
+    if ( iError != 0 )
+    {
+        printf( "Error writing %s - %s\n", job.path.c_str(), strerror( iError ) );
+        return false;
+    }
+
+    return true;
+}
+
+int
+LadybugFileWriter::openAppendFile( const std::string& path, unsigned long long** ppulOffset )
+{
+    std::map<std::string, AppendFile>::iterator it = m_appendFiles.find( path );
+    if ( it == m_appendFiles.end() )
+    {
+        const int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+        if ( fd < 0 )
+        {
+            printf( "Error opening %s - %s\n", path.c_str(), strerror( errno ) );
+            return -1;
+        }
+
+        AppendFile file;
+        file.fd = fd;
+        file.ulOffset = 0;
+        it = m_appendFiles.insert( std::make_pair( path, file ) ).first;
+    }
+
+    *ppulOffset = &it->second.ulOffset;
+    return it->second.fd;
+}
+
+void
+LadybugFileWriter::closeAppendFiles()
+{
+    for ( std::map<std::string, AppendFile>::iterator it = m_appendFiles.begin(); it != m_appendFiles.end(); ++it )
+    {
+        close( it->second.fd );
+    }
+    m_appendFiles.clear();
+}
+
+void
+LadybugFileWriter::getStats( LadybugFileWriterStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugFileWriter::printStats( const char* pszName ) const
+{
+    LadybugFileWriterStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu files and %llu appends (%.1fMB) in %llu batches via %s, %llu errors, "
+        "%llu backpressure waits (%.1fms), outstanding high water %.1fMB\n",
+        pszName,
+        stats.ulFilesWritten,
+        stats.ulAppends,
+        stats.ulBytesWritten / ( 1024.0 * 1024.0 ),
+        stats.ulBatches,
+        stats.bIoUring ? "io_uring" : "pwritev",
+        stats.ulErrors,
+        stats.ulBackpressureWaits,
+        stats.dBackpressureMs,
+        stats.ulOutstandingHighWater / ( 1024.0 * 1024.0 ) );
+}
@@ -0,0 +1,182 @@
+//=============================================================================
+// ladybugFileWriter.h
+//
+// Writes files from memory on a background thread, so the thread that
+// produced the data (a grab loop, a JPEG encoder) never waits for the disk.
+//
+// Callers queue jobs and return immediately:
+//  - write() writes a whole file.
+//  - append() adds to a file that stays open until stop(), for text such as
+//    GPS logs. The first append() to a path creates or truncates the file.
+//
+// The writer thread takes every queued job at once and submits the batch
+// together: through io_uring where the kernel supports it, otherwise with
+// one pwritev() per file. Consecutive appends to the same file in a batch
+// are merged into one vectored write.
+//
+// A write() can ask for O_DIRECT, for large raw dumps that should not fill
+// the page cache. The data is staged through an aligned buffer, and the last
+// partial block goes through the page cache. If the file system does not
+// support O_DIRECT the file is written normally.
+//
+// To bound memory, write() and append() block while the bytes queued and
+// in flight exceed the limit given to start(). A single job larger than the
+// limit is still accepted once the writer is idle.
+//
+// Usage:
+//    LadybugFileWriter writer;
+//    writer.start();
+//    writer.write( "frame0.jpg", std::move( jpegData ) );
+//    writer.append( "gps.txt", "0, LAT 49.1, LONG -123.1\n" );
+//    ...
+//    writer.stop();
+//=============================================================================
+
+#ifndef LADYBUGFILEWRITER_H
+#define LADYBUGFILEWRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+/** Counters reported by LadybugFileWriter::getStats(). */
+struct LadybugFileWriterStats
+{
+    /** Number of files written with write(), and the number of append() calls written. */
+    unsigned long long ulFilesWritten;
+    unsigned long long ulAppends;
+
+    /** Total bytes written. */
+    unsigned long long ulBytesWritten;
+
+    /** Number of batches submitted, and the most jobs in one batch. */
+    unsigned long long ulBatches;
+    unsigned int uiLargestBatch;
+
+    /** Number of jobs that could not be opened or fully written. */
+    unsigned long long ulErrors;
+
+    /** Number of write() and append() calls that blocked on the byte limit, and for how long in total. */
+    unsigned long long ulBackpressureWaits;
+    double dBackpressureMs;
+
+    /** Bytes queued or in flight now, and the most ever at once. */
+    unsigned long long ulOutstandingBytes;
+    unsigned long long ulOutstandingHighWater;
+
+    /** True if batches go through io_uring. */
+    bool bIoUring;
+};
+
+class LadybugFileWriter
+{
+public:
+    static const unsigned long long DEFAULT_MAX_OUTSTANDING_BYTES = 512ULL * 1024 * 1024;
+
+    LadybugFileWriter();
+    ~LadybugFileWriter();
+
+    /**
+     * Start the writer thread.
+     *
+     * @param ulMaxOutstandingBytes - Bytes that can be queued or in flight
+     *                                before write() and append() block.
+     * @param bUseIoUring           - Use io_uring if the kernel supports it.
+     *                                Otherwise pwritev() is used.
+     */
+    LadybugError start(
+        unsigned long long ulMaxOutstandingBytes = DEFAULT_MAX_OUTSTANDING_BYTES,
+        bool bUseIoUring = true );
+
+    /** Write every queued job, close every file, then stop the writer thread. */
+    void stop();
+
+    /**
+     * Queue a whole file to be written. The writer takes ownership of data.
+     * If bDirect is true the file is written with O_DIRECT.
+     */
+    LadybugError write( const std::string& path, std::vector<unsigned char>&& data, bool bDirect = false );
+
+    /** Queue data to be appended to a file. The writer takes ownership of data. */
+    LadybugError append( const std::string& path, std::vector<unsigned char>&& data );
+
+    /** Queue a line of text to be appended to a file. */
+    LadybugError append( const std::string& path, const char* pszText );
+
+    /** Wait until every job queued so far has been written. */
+    void flush();
+
+    void getStats( LadybugFileWriterStats* pStats ) const;
+
+    /** Print the writer counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugFileWriter( const LadybugFileWriter& );
+    LadybugFileWriter& operator=( const LadybugFileWriter& );
+
+    enum JobType
+    {
+        JOB_WRITE,
+        JOB_APPEND
+    };
+
+    struct Job
+    {
+        JobType type;
+        std::string path;
+        std::vector<unsigned char> data;
+        bool bDirect;
+    };
+
+    struct AppendFile
+    {
+        int fd;
+        unsigned long long ulOffset;
+    };
+
+    struct Request;
+    class IoUring;
+
+    LadybugError queueJob( JobType type, const std::string& path, std::vector<unsigned char>& data, bool bDirect );
+
+    void writeLoop();
+
+    // Write one batch of jobs. Called on the writer thread only.
+    void writeBatch( std::deque<Job>& batch );
+
+    // Write a job with O_DIRECT. Returns false on error.
+    bool writeDirect( const Job& job );
+
+    // Open a file for append(), creating it the first time. Returns -1 on error.
+    int openAppendFile( const std::string& path, unsigned long long** ppulOffset );
+
+    void closeAppendFiles();
+
+    std::deque<Job> m_queue;
+    bool m_bWriting;
+    bool m_bRunning;
+    unsigned long long m_ulMaxOutstandingBytes;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_jobQueued;
+    std::condition_variable m_idle;
+    std::condition_variable m_spaceFreed;
+
+    std::thread m_thread;
+
+    // Owned by the writer thread
+    IoUring* m_pIoUring;
+    std::map<std::string, AppendFile> m_appendFiles;
+    unsigned char* m_pDirectBuffer;
+
+    LadybugFileWriterStats m_stats;
+};
+
+#endif // LADYBUGFILEWRITER_H
@@ -0,0 +1,440 @@
+//=============================================================================
+// ladybugFrameIndex.cpp
+//=============================================================================
+
+#include "ladybugFrameIndex.h"
+#include "ladybugThreadPlacement.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace
+{
+const char FRAME_INDEX_MAGIC[ 8 ] = { 'L', 'B', 'F', 'R', 'M', 'I', 'D', 'X' };
+
+// Bytes of a record covered by its checksum
+const size_t CHECKED_RECORD_BYTES = offsetof( LadybugFrameIndexRecord, uiChecksum );
+
+// Times a batch is written to the index before the index is marked incomplete
+const unsigned int BATCH_WRITE_ATTEMPTS = 2;
+
+double toMs( unsigned long long ulNanoseconds )
+{
+    return ulNanoseconds / 1e6;
+}
+
+// Write all of a buffer at an offset, retrying short writes. Returns false on error.
+bool writeAll( int fd, const void* pData, size_t bytes, off_t offset )
+{
+    const unsigned char* pBytes = (const unsigned char*)pData;
+    while ( bytes > 0 )
+    {
+        const ssize_t written = ::pwrite( fd, pBytes, bytes, offset );
+        if ( written < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if ( written <= 0 )
+        {
+            return false;
+        }
+        pBytes += written;
+        bytes -= (size_t)written;
+        offset += written;
+    }
+    return true;
+}
+
+bool isBefore( const LadybugTimestamp& timeStamp, long long llSeconds, unsigned int uiMicroSeconds )
+{
+    return (long long)timeStamp.ulSeconds < llSeconds ||
+        ( (long long)timeStamp.ulSeconds == llSeconds && timeStamp.ulMicroSeconds < uiMicroSeconds );
+}
+
+} // namespace
+
+uint32_t
+ladybugFrameIndexHash( const void* pData, size_t bytes )
+{
+    const unsigned char* pBytes = (const unsigned char*)pData;
+    uint32_t uiHash = 2166136261u;
+    for ( size_t i = 0; i < bytes; i++ )
+    {
+        uiHash = ( uiHash ^ pBytes[ i ] ) * 16777619u;
+    }
+    return uiHash;
+}
+
+LadybugFrameIndexWriter::LadybugFrameIndexWriter()
+    : m_fd( -1 ),
+      m_bRunning( false ),
+      m_segmentFd( -1 ),
+      m_uiSegmentOpen( 0 ),
+      m_ulIndexBytes( 0 )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugFrameIndexWriter::~LadybugFrameIndexWriter()
+{
+    close();
+}
+
+LadybugError
+LadybugFrameIndexWriter::open(
+    const char* pszPath,
+    const char* pszSegmentBase,
+    const LadybugFrameIndexFileHeader& header,
+    const LadybugFrameIndexWriterConfig& config )
+{
+    if ( isOpen() )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    const int fd = ::open( pszPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if ( fd < 0 )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    unsigned char arHeader[ FRAME_INDEX_HEADER_BYTES ];
+    memset( arHeader, 0, sizeof( arHeader ) );
+    LadybugFrameIndexFileHeader* pHeader = (LadybugFrameIndexFileHeader*)arHeader;
+    *pHeader = header;
+    memcpy( pHeader->szMagic, FRAME_INDEX_MAGIC, sizeof( FRAME_INDEX_MAGIC ) );
+    pHeader->uiVersion = FRAME_INDEX_VERSION;
+    pHeader->uiRecordBytes = sizeof( LadybugFrameIndexRecord );
+    pHeader->uiFlags = 0;
+    pHeader->ulGoodRecords = 0;
+    if ( !writeAll( fd, arHeader, sizeof( arHeader ), 0 ) || fdatasync( fd ) != 0 )
+    {
+        ::close( fd );
+        return LADYBUG_FAILED;
+    }
+
+    m_fd = fd;
+    m_header = *pHeader;
+    m_segmentBase = pszSegmentBase;
+    m_config = config;
+    m_config.uiSyncFrames = std::max( m_config.uiSyncFrames, 1u );
+    m_pending.clear();
+    m_segmentFd = -1;
+    m_ulIndexBytes = FRAME_INDEX_HEADER_BYTES;
+    m_syncLatency.reset();
+    memset( &m_stats, 0, sizeof( m_stats ) );
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugFrameIndexWriter::syncLoop, this );
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugFrameIndexWriter::close()
+{
+    if ( !isOpen() )
+    {
+        return LADYBUG_OK;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_bRunning = false;
+    }
+    m_recordAppended.notify_all();
+    m_thread.join();
+
+    if ( m_segmentFd >= 0 )
+    {
+        ::close( m_segmentFd );
+        m_segmentFd = -1;
+    }
+    const bool bClosed = ::close( m_fd ) == 0;
+    m_fd = -1;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return bClosed && !m_stats.bIncomplete ? LADYBUG_OK : LADYBUG_FAILED;
+}
+
+void
+LadybugFrameIndexWriter::append( const LadybugFrameIndexRecord& record )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( !m_bRunning )
+    {
+        return;
+    }
+
+    m_stats.ulRecordsAppended++;
+    if ( m_stats.bIncomplete )
+    {
+        return;
+    }
+
+    m_pending.push_back( record );
+    LadybugFrameIndexRecord& pending = m_pending.back();
+    pending.image.pData = NULL;
+    pending.uiChecksum = ladybugFrameIndexHash( &pending, CHECKED_RECORD_BYTES );
+
+    if ( m_pending.size() >= m_config.uiSyncFrames )
+    {
+        m_recordAppended.notify_one();
+    }
+}
+
+void
+LadybugFrameIndexWriter::syncLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "frame index" );
+
+    std::vector<LadybugFrameIndexRecord> batch;
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_recordAppended.wait_for( lock, std::chrono::milliseconds( m_config.uiSyncMs ), [this] {
+            return !m_bRunning || m_pending.size() >= m_config.uiSyncFrames; } );
+        const bool bStopping = !m_bRunning;
+
+        batch.swap( m_pending );
+        if ( !batch.empty() )
+        {
+            lock.unlock();
+            const std::chrono::steady_clock::time_point syncStart = std::chrono::steady_clock::now();
+
+            // A segment that failed to flush is not retried (see the header)
+            bool bWritten = syncSegments( batch );
+            unsigned int uiFailures = bWritten ? 0 : 1;
+            if ( bWritten )
+            {
+                bWritten = false;
+                for ( unsigned int uiAttempt = 0; uiAttempt < BATCH_WRITE_ATTEMPTS && !bWritten; uiAttempt++ )
+                {
+                    bWritten = writeBatch( batch );
+                    uiFailures += bWritten ? 0 : 1;
+                }
+            }
+            if ( !bWritten )
+            {
+                markIncomplete();
+            }
+            m_syncLatency.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - syncStart ).count() );
+            lock.lock();
+
+            m_stats.ulBatches++;
+            m_stats.ulErrors += uiFailures;
+            if ( bWritten )
+            {
+                m_stats.ulRecordsSynced += batch.size();
+            }
+            else
+            {
+                // Later records would not sit at their frame's position
+                m_stats.bIncomplete = true;
+                m_pending.clear();
+            }
+            batch.clear();
+        }
+
+        if ( bStopping )
+        {
+            break;
+        }
+    }
+}
+
+bool
+LadybugFrameIndexWriter::syncSegments( const std::vector<LadybugFrameIndexRecord>& batch )
+{
+    // The frames must reach the disk before the records that point at them.
+    // A batch rarely spans more than two segments.
+    bool bSynced = true;
+    for ( size_t i = 0; i < batch.size(); i++ )
+    {
+        const uint32_t uiSegment = batch[ i ].uiSegment;
+        const bool bLastInSegment = i + 1 == batch.size() || batch[ i + 1 ].uiSegment != uiSegment;
+        if ( !bLastInSegment )
+        {
+            continue;
+        }
+
+        if ( m_segmentFd < 0 || m_uiSegmentOpen != uiSegment )
+        {
+            if ( m_segmentFd >= 0 )
+            {
+                ::close( m_segmentFd );
+            }
+            char pszNumber[ 16 ];
+            snprintf( pszNumber, sizeof( pszNumber ), "-%06u.pgr", uiSegment );
+            m_segmentFd = ::open( ( m_segmentBase + pszNumber ).c_str(), O_RDONLY | O_CLOEXEC );
+            m_uiSegmentOpen = uiSegment;
+        }
+        bSynced = bSynced && m_segmentFd >= 0 && fdatasync( m_segmentFd ) == 0;
+    }
+    return bSynced;
+}
+
+bool
+LadybugFrameIndexWriter::writeBatch( const std::vector<LadybugFrameIndexRecord>& batch )
+{
+    // Written at the end of the last batch, over whatever a failed attempt left
+    const size_t bytes = batch.size() * sizeof( LadybugFrameIndexRecord );
+    if ( !writeAll( m_fd, batch.data(), bytes, (off_t)m_ulIndexBytes ) || fdatasync( m_fd ) != 0 )
+    {
+        return false;
+    }
+    m_ulIndexBytes += bytes;
+    return true;
+}
+
+void
+LadybugFrameIndexWriter::markIncomplete()
+{
+    // Even if the file cannot be cut back, the header tells readers where
+    // the good records end
+    m_header.uiFlags |= FRAME_INDEX_INCOMPLETE;
+    m_header.ulGoodRecords = ( m_ulIndexBytes - FRAME_INDEX_HEADER_BYTES ) / sizeof( LadybugFrameIndexRecord );
+    if ( ftruncate( m_fd, (off_t)m_ulIndexBytes ) == 0 )
+    {
+        fdatasync( m_fd );
+    }
+    if ( writeAll( m_fd, &m_header, sizeof( m_header ), 0 ) )
+    {
+        fdatasync( m_fd );
+    }
+}
+
+void
+LadybugFrameIndexWriter::getStats( LadybugFrameIndexWriterStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+    pStats->dSyncP99Ms = toMs( m_syncLatency.getQuantile( 0.99 ) );
+    pStats->dSyncMaxMs = toMs( m_syncLatency.getMax() );
+}
+
+LadybugFrameIndex::LadybugFrameIndex()
+    : m_fd( -1 ),
+      m_ulFrames( 0 )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+}
+
+LadybugFrameIndex::~LadybugFrameIndex()
+{
+    close();
+}
+
+LadybugError
+LadybugFrameIndex::open( const char* pszPath )
+{
+    close();
+
+    const int fd = ::open( pszPath, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    struct stat status;
+    const bool bRead =
+        fstat( fd, &status ) == 0 &&
+        (unsigned long long)status.st_size >= FRAME_INDEX_HEADER_BYTES &&
+        pread( fd, &m_header, sizeof( m_header ), 0 ) == (ssize_t)sizeof( m_header );
+    const bool bValid =
+        bRead &&
+        memcmp( m_header.szMagic, FRAME_INDEX_MAGIC, sizeof( FRAME_INDEX_MAGIC ) ) == 0 &&
+        m_header.uiVersion == FRAME_INDEX_VERSION &&
+        m_header.uiRecordBytes == sizeof( LadybugFrameIndexRecord );
+    if ( !bValid )
+    {
+        ::close( fd );
+        memset( &m_header, 0, sizeof( m_header ) );
+        return bRead ? LADYBUG_INVALID_ARGUMENT : LADYBUG_FAILED;
+    }
+
+    m_fd = fd;
+    m_ulFrames = ( (unsigned long long)status.st_size - FRAME_INDEX_HEADER_BYTES ) / sizeof( LadybugFrameIndexRecord );
+    if ( !isComplete() )
+    {
+        m_ulFrames = std::min<unsigned long long>( m_ulFrames, m_header.ulGoodRecords );
+    }
+
+    // A crash can leave the last batch torn, or its blocks allocated but
+    // never written. Records are written in order, so drop them from the end.
+    while ( m_ulFrames > 0 && !isValid( m_ulFrames - 1 ) )
+    {
+        m_ulFrames--;
+    }
+    return LADYBUG_OK;
+}
+
+void
+LadybugFrameIndex::close()
+{
+    if ( m_fd >= 0 )
+    {
+        ::close( m_fd );
+    }
+    m_fd = -1;
+    m_ulFrames = 0;
+}
+
+LadybugError
+LadybugFrameIndex::readRecord( unsigned long long ulFrame, LadybugFrameIndexRecord* pRecord ) const
+{
+    if ( m_fd < 0 || ulFrame >= m_ulFrames )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const off_t offset = FRAME_INDEX_HEADER_BYTES + (off_t)ulFrame * sizeof( LadybugFrameIndexRecord );
+    if ( pread( m_fd, pRecord, sizeof( *pRecord ), offset ) != (ssize_t)sizeof( *pRecord ) )
+    {
+        return LADYBUG_FAILED;
+    }
+    if ( pRecord->uiChecksum != ladybugFrameIndexHash( pRecord, CHECKED_RECORD_BYTES ) ||
+        pRecord->ulFrame != ulFrame )
+    {
+        return LADYBUG_CORRUPTED_PGR_STREAM;
+    }
+    pRecord->image.pData = NULL;
+    return LADYBUG_OK;
+}
+
+unsigned long long
+LadybugFrameIndex::findFrame( long long llSeconds, unsigned int uiMicroSeconds ) const
+{
+    unsigned long long ulLow = 0;
+    unsigned long long ulHigh = m_ulFrames;
+    LadybugFrameIndexRecord record;
+    while ( ulLow < ulHigh )
+    {
+        const unsigned long long ulMiddle = ulLow + ( ulHigh - ulLow ) / 2;
+        if ( readRecord( ulMiddle, &record ) == LADYBUG_OK &&
+            isBefore( record.image.timeStamp, llSeconds, uiMicroSeconds ) )
+        {
+            ulLow = ulMiddle + 1;
+        }
+        else
+        {
+            ulHigh = ulMiddle;
+        }
+    }
+    return ulLow;
+}
+
+bool
+LadybugFrameIndex::isValid( unsigned long long ulFrame ) const
+{
+    LadybugFrameIndexRecord record;
+    return readRecord( ulFrame, &record ) == LADYBUG_OK;
+}
@@ -0,0 +1,318 @@
+//=============================================================================
+// ladybugFrameIndex.h
+//
+// A sidecar index of a PGR stream, with a fixed-size record for every frame
+// written, kept durable while the stream is recorded.
+//
+// The SDK keeps the frame count and a table of key frame offsets in each
+// segment's header, and fills them in when the segment is closed. A
+// segment that was being written when the power failed has no usable
+// header, and the stream cannot be read from that segment on. The index
+// does not depend on the header: for every frame it records the segment,
+// the byte offset and length of the frame in the segment, where the image
+// data starts within it, the image's LadybugImage fields and its GPS
+// position.
+//
+// LadybugFrameIndexWriter appends the records. A thread of its own writes
+// them in batches, every uiSyncFrames frames or uiSyncMs, whichever comes
+// first: it first flushes the segments the batch points into with
+// fdatasync(), then appends the batch to the index and flushes the index.
+// A record on disk therefore always points at image data that is on disk
+// too, and the thread that writes the stream never waits for a flush.
+//
+// A batch that cannot be written or flushed to the index is written again
+// over the same place. Records are found by their position, so if the batch
+// fails again, or a segment cannot be flushed, the index is cut back to the
+// last batch written and nothing more is appended. The header is then marked
+// FRAME_INDEX_INCOMPLETE with the number of records that are good. A segment
+// flush is not retried: after a failed fdatasync() the kernel may drop the
+// pages it could not write, and a second call reports success.
+//
+// LadybugFrameIndex reads an index. Records are fixed size, so frame n is
+// found with one read at a known offset, without scanning the stream. Each
+// record carries a checksum; a torn or unwritten record at the end of an
+// index left by a crash is ignored. An index marked FRAME_INDEX_INCOMPLETE
+// ends at the last good record; the frames recorded after it are found only
+// by reading the stream.
+//
+// File layout (native byte order, so the file is read on the machine type
+// that wrote it):
+//    LadybugFrameIndexFileHeader, padded to FRAME_INDEX_HEADER_BYTES
+//    One LadybugFrameIndexRecord per frame, in the order written
+//
+// The index of a stream named <base>-NNNNNN.pgr is <base>.idx. The
+// camera's calibration is saved next to it as <base>.cal, so the stream
+// can be rebuilt from the index alone (see ladybugStreamIndex in
+// C++/Testing).
+//
+// Usage:
+//    LadybugFrameIndexWriter indexWriter;
+//    indexWriter.open( "ladybugImage.idx", "ladybugImage", header );
+//    indexWriter.append( record );
+//    ...
+//    indexWriter.close();
+//
+//    LadybugFrameIndex index;
+//    index.open( "ladybugImage.idx" );
+//    LadybugFrameIndexRecord record;
+//    index.readRecord( 1200, &record );
+//=============================================================================
+
+#ifndef LADYBUGFRAMEINDEX_H
+#define LADYBUGFRAMEINDEX_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugMetrics.h"
+
+/** Offset of the first record in the index file. */
+const unsigned int FRAME_INDEX_HEADER_BYTES = 64;
+
+const uint32_t FRAME_INDEX_VERSION = 1;
+
+/** Bytes at the start of the image data covered by uiDataCheck. */
+const unsigned int FRAME_INDEX_CHECK_BYTES = 4096;
+
+/** uiDataOffset when the image data could not be found in the frame. */
+const uint32_t FRAME_INDEX_UNKNOWN_OFFSET = 0xFFFFFFFF;
+
+/** Set in uiFlags when the record holds a GPS position. */
+const uint32_t FRAME_INDEX_GPS = 0x1;
+
+/** Set in the header's uiFlags when the writer stopped appending before the stream ended. */
+const uint32_t FRAME_INDEX_INCOMPLETE = 0x1;
+
+struct LadybugFrameIndexFileHeader
+{
+    /** "LBFRMIDX". */
+    char szMagic[ 8 ];
+    uint32_t uiVersion;
+
+    /** sizeof( LadybugFrameIndexRecord ) of the writer, to catch incompatible readers. */
+    uint32_t uiRecordBytes;
+
+    /** Bytes before the first frame of a segment: the SDK's header and the calibration. */
+    uint32_t uiSegmentHeaderBytes;
+
+    /** Camera serial numbers. */
+    uint32_t uiSerialBase;
+    uint32_t uiSerialHead;
+
+    /** FRAME_INDEX_INCOMPLETE, or 0. */
+    uint32_t uiFlags;
+
+    /** With FRAME_INDEX_INCOMPLETE, the records written before appending stopped. */
+    uint64_t ulGoodRecords;
+};
+
+struct LadybugFrameIndexRecord
+{
+    /** Frame number in the stream, counting from 0 across segments. */
+    uint64_t ulFrame;
+
+    /** Byte offset of the frame in its segment, and bytes it takes there. */
+    uint64_t ulOffset;
+    uint32_t uiSegment;
+    uint32_t uiLength;
+
+    /** Offset of the image data from ulOffset, or FRAME_INDEX_UNKNOWN_OFFSET. */
+    uint32_t uiDataOffset;
+
+    /** FNV-1a of the first FRAME_INDEX_CHECK_BYTES of the image data. */
+    uint32_t uiDataCheck;
+
+    uint32_t uiFlags;
+    uint32_t uiReserved;
+
+    /** GPS position, with FRAME_INDEX_GPS. Degrees, south and west negative; meters. */
+    double dLatitude;
+    double dLongitude;
+    double dAltitude;
+
+    /** The image as grabbed. pData and uiBufferIndex are meaningless. */
+    LadybugImage image;
+
+    /** FNV-1a of the record up to here. */
+    uint32_t uiChecksum;
+    uint32_t uiPadding;
+};
+
+struct LadybugFrameIndexWriterConfig
+{
+    LadybugFrameIndexWriterConfig()
+        : uiSyncFrames( 30 ),
+          uiSyncMs( 1000 )
+    {
+    }
+
+    /** Write and flush the records once this many are waiting. */
+    unsigned int uiSyncFrames;
+
+    /** Write and flush the records waiting at least this often. */
+    unsigned int uiSyncMs;
+};
+
+/** Counters reported by LadybugFrameIndexWriter::getStats(). */
+struct LadybugFrameIndexWriterStats
+{
+    /** Records appended, and records written and flushed. */
+    unsigned long long ulRecordsAppended;
+    unsigned long long ulRecordsSynced;
+
+    /** Batches written, and how long flushing the segments and the index took. */
+    unsigned long long ulBatches;
+    double dSyncP99Ms;
+    double dSyncMaxMs;
+
+    /** Attempts at a batch that failed to write or flush. */
+    unsigned long long ulErrors;
+
+    /** True once a batch could not be written; later records were dropped. */
+    bool bIncomplete;
+};
+
+/** FNV-1a hash, for the record and image data checks. */
+uint32_t ladybugFrameIndexHash( const void* pData, size_t bytes );
+
+class LadybugFrameIndexWriter
+{
+public:
+    LadybugFrameIndexWriter();
+    ~LadybugFrameIndexWriter();
+
+    /**
+     * Create the index, replacing any file at the path, and start the thread
+     * that writes it.
+     *
+     * @param pszPath        - The index file.
+     * @param pszSegmentBase - The stream's segments are pszSegmentBase-NNNNNN.pgr.
+     * @param header         - Written at the start of the index. The magic,
+     *                         version, record size and flags are filled in.
+     * @param config         - How often records are flushed.
+     */
+    LadybugError open(
+        const char* pszPath,
+        const char* pszSegmentBase,
+        const LadybugFrameIndexFileHeader& header,
+        const LadybugFrameIndexWriterConfig& config = LadybugFrameIndexWriterConfig() );
+
+    /** Write and flush the records waiting, then close the index. */
+    LadybugError close();
+
+    bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    /**
+     * Queue a record. The checksum is filled in. The frame must already be
+     * written to its segment.
+     */
+    void append( const LadybugFrameIndexRecord& record );
+
+    void getStats( LadybugFrameIndexWriterStats* pStats ) const;
+
+private:
+    LadybugFrameIndexWriter( const LadybugFrameIndexWriter& );
+    LadybugFrameIndexWriter& operator=( const LadybugFrameIndexWriter& );
+
+    void syncLoop();
+
+    // Flush the segments a batch points into
+    bool syncSegments( const std::vector<LadybugFrameIndexRecord>& batch );
+
+    // Write and flush a batch after the last one written
+    bool writeBatch( const std::vector<LadybugFrameIndexRecord>& batch );
+
+    // Cut the index back to the batches written, and mark it incomplete
+    void markIncomplete();
+
+    int m_fd;
+    LadybugFrameIndexFileHeader m_header;
+    std::string m_segmentBase;
+    LadybugFrameIndexWriterConfig m_config;
+
+    std::vector<LadybugFrameIndexRecord> m_pending;
+    bool m_bRunning;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_recordAppended;
+
+    std::thread m_thread;
+
+    // Owned by the sync thread: the last segment flushed, kept open, and
+    // the end of the last batch written
+    int m_segmentFd;
+    uint32_t m_uiSegmentOpen;
+    unsigned long long m_ulIndexBytes;
+
+    LadybugHistogram m_syncLatency;
+
+    LadybugFrameIndexWriterStats m_stats;
+};
+
+class LadybugFrameIndex
+{
+public:
+    LadybugFrameIndex();
+    ~LadybugFrameIndex();
+
+    /**
+     * Open an index. Records at the end that were not completely written
+     * are left out, as are records after the last good one of an index
+     * marked FRAME_INDEX_INCOMPLETE.
+     */
+    LadybugError open( const char* pszPath );
+
+    void close();
+
+    const LadybugFrameIndexFileHeader& getHeader() const
+    {
+        return m_header;
+    }
+
+    /** False if the writer stopped before the stream ended. */
+    bool isComplete() const
+    {
+        return ( m_header.uiFlags & FRAME_INDEX_INCOMPLETE ) == 0;
+    }
+
+    /** Frames in the index. */
+    unsigned long long getFrameCount() const
+    {
+        return m_ulFrames;
+    }
+
+    /**
+     * Read the record of a frame. Returns LADYBUG_CORRUPTED_PGR_STREAM if
+     * its checksum does not match.
+     */
+    LadybugError readRecord( unsigned long long ulFrame, LadybugFrameIndexRecord* pRecord ) const;
+
+    /**
+     * The first frame with a timestamp at or after the given one, by binary
+     * search. Returns getFrameCount() if there is none.
+     */
+    unsigned long long findFrame( long long llSeconds, unsigned int uiMicroSeconds ) const;
+
+private:
+    LadybugFrameIndex( const LadybugFrameIndex& );
+    LadybugFrameIndex& operator=( const LadybugFrameIndex& );
+
+    bool isValid( unsigned long long ulFrame ) const;
+
+    int m_fd;
+    LadybugFrameIndexFileHeader m_header;
+    unsigned long long m_ulFrames;
+};
+
+#endif // LADYBUGFRAMEINDEX_H
@@ -0,0 +1,310 @@
+//=============================================================================
+// ladybugFramePool.cpp
+//=============================================================================
+
+#include "ladybugFramePool.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#endif
+
+namespace
+{
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t getPageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf( _SC_PAGESIZE );
+#endif
+}
+
+size_t roundUp( size_t value, size_t alignment )
+{
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+unsigned int getBytesPerPixel( LadybugPixelFormat pixelFormat )
+{
+    switch ( pixelFormat )
+    {
+    case LADYBUG_BGRU:
+        return 4;
+    case LADYBUG_BGRU16:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Map an anonymous block. Returns NULL on failure.
+unsigned char* mapBlock( size_t size, bool bUseHugePages, bool* pbHugePages )
+{
+    *pbHugePages = false;
+
+#ifdef _WIN32
+    (void)bUseHugePages;
+    return (unsigned char*)VirtualAlloc( NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+#else
+    void* pBlock = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if ( bUseHugePages )
+    {
+        pBlock = mmap( NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        *pbHugePages = ( pBlock != MAP_FAILED );
+    }
+#endif
+
+    if ( pBlock == MAP_FAILED )
+    {
+        pBlock = mmap( NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( pBlock == MAP_FAILED )
+        {
+            return NULL;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if ( bUseHugePages )
+        {
+            madvise( pBlock, size, MADV_HUGEPAGE );
+        }
+#endif
+    }
+
+    return (unsigned char*)pBlock;
+#endif
+}
+
+void unmapBlock( unsigned char* pBlock, size_t size )
+{
+#ifdef _WIN32
+    (void)size;
+    VirtualFree( pBlock, 0, MEM_RELEASE );
+#else
+    munmap( pBlock, size );
+#endif
+}
+
+} // namespace
+
+LadybugFramePool::LadybugFramePool()
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugFramePool::~LadybugFramePool()
+{
+    destroy();
+}
+
+LadybugError
+LadybugFramePool::initialize(
+    unsigned int uiNumSets,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugPixelFormat pixelFormat,
+    bool bUseHugePages )
+{
+    const unsigned int uiBytesPerPixel = getBytesPerPixel( pixelFormat );
+    if ( uiNumSets == 0 || uiCols == 0 || uiRows == 0 || uiBytesPerPixel == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    freeBlocks();
+
+    const size_t bufferSize = (size_t)uiCols * uiRows * uiBytesPerPixel;
+    const size_t stride = roundUp( bufferSize, getPageSize() );
+    const size_t blockSize = roundUp( stride * LADYBUG_NUM_CAMERAS,
+        bUseHugePages ? HUGE_PAGE_SIZE : getPageSize() );
+
+    m_sets.resize( uiNumSets );
+    m_stats.uiNumSets = uiNumSets;
+    m_stats.bHugePages = bUseHugePages;
+
+    // The convert stage fills the buffers, so keep them on its NUMA node
+    LadybugThreadPlacement& placement = LadybugThreadPlacement::instance();
+    m_stats.iNumaNode = placement.getStageNode( LADYBUG_STAGE_CONVERT );
+
+    for ( unsigned int uiSet = 0; uiSet < uiNumSets; uiSet++ )
+    {
+        bool bHugePages = false;
+        unsigned char* pBlock = mapBlock( blockSize, bUseHugePages, &bHugePages );
+        if ( pBlock == NULL )
+        {
+            freeBlocks();
+            return LADYBUG_MEMORY_ALLOC_ERROR;
+        }
+
+        m_stats.ulAllocations++;
+        m_stats.ulBytesAllocated += blockSize;
+        m_stats.bHugePages = m_stats.bHugePages && bHugePages;
+
+        if ( m_stats.iNumaNode >= 0 && !placement.bindMemory( LADYBUG_STAGE_CONVERT, pBlock, blockSize ) )
+        {
+            m_stats.iNumaNode = -1;
+        }
+
+        // Fill the whole block once. This faults in every page and sets the
+        // alpha channel to its maximum value.
+        memset( pBlock, 0xff, blockSize );
+
+        m_blocks.push_back( pBlock );
+        m_blockSizes.push_back( blockSize );
+
+        LadybugBufferSet& set = m_sets[ uiSet ];
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            set.arpBuffers[ uiCamera ] = pBlock + uiCamera * stride;
+        }
+        set.uiCols = uiCols;
+        set.uiRows = uiRows;
+        set.pixelFormat = pixelFormat;
+        set.uiBufferSize = (unsigned int)bufferSize;
+        set.uiIndex = uiSet;
+
+        m_freeList.push_back( uiSet );
+    }
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugFramePool::destroy()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    freeBlocks();
+}
+
+void
+LadybugFramePool::freeBlocks()
+{
+    for ( size_t i = 0; i < m_blocks.size(); i++ )
+    {
+        unmapBlock( m_blocks[ i ], m_blockSizes[ i ] );
+    }
+
+    m_blocks.clear();
+    m_blockSizes.clear();
+    m_sets.clear();
+    m_freeList.clear();
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+bool
+LadybugFramePool::isInitialized() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return !m_sets.empty();
+}
+
+LadybugBufferSet*
+LadybugFramePool::acquire()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( m_sets.empty() )
+    {
+        return NULL;
+    }
+
+    if ( m_freeList.empty() )
+    {
+        m_stats.ulWaits++;
+        m_released.wait( lock, [this] { return !m_freeList.empty(); } );
+    }
+
+    return takeFreeSet();
+}
+
+LadybugBufferSet*
+LadybugFramePool::tryAcquire()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( m_freeList.empty() )
+    {
+        return NULL;
+    }
+
+    return takeFreeSet();
+}
+
+LadybugBufferSet*
+LadybugFramePool::takeFreeSet()
+{
+    const unsigned int uiSet = m_freeList.back();
+    m_freeList.pop_back();
+
+    m_stats.ulAcquires++;
+    m_stats.uiInUse++;
+    if ( m_stats.uiInUse > m_stats.uiHighWater )
+    {
+        m_stats.uiHighWater = m_stats.uiInUse;
+    }
+
+    return &m_sets[ uiSet ];
+}
+
+void
+LadybugFramePool::release( LadybugBufferSet* pSet )
+{
+    if ( pSet == NULL )
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_freeList.push_back( pSet->uiIndex );
+        m_stats.ulReleases++;
+        m_stats.uiInUse--;
+    }
+
+    m_released.notify_one();
+}
+
+void
+LadybugFramePool::getStats( LadybugFramePoolStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugFramePool::printStats( const char* pszName ) const
+{
+    LadybugFramePoolStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %u sets, %llu allocations (%.1fMB%s%s), %llu acquires, %llu waits, high water %u\n",
+        pszName,
+        stats.uiNumSets,
+        stats.ulAllocations,
+        stats.ulBytesAllocated / ( 1024.0 * 1024.0 ),
+        stats.bHugePages ? ", huge pages" : "",
+        ( stats.iNumaNode >= 0 ) ? ", NUMA local" : "",
+        stats.ulAcquires,
+        stats.ulWaits,
+        stats.uiHighWater );
+}
@@ -0,0 +1,134 @@
+//=============================================================================
+// ladybugFramePool.h
+//
+// A fixed pool of color-processed image buffer sets for the capture tools.
+//
+// Each buffer set holds one destination buffer per camera, laid out so it
+// can be handed straight to ladybugConvertImage(). All sets are allocated,
+// page-aligned and pre-faulted when the pool is initialized, and the whole
+// buffer is filled with 0xff once so the alpha channel of a BGRU image is
+// valid without a memset per frame. ladybugConvertImage() only writes the
+// color channels, so the alpha value survives reuse.
+//
+// Note: if alpha masking is enabled with ladybugSetAlphaMasking(), the SDK
+// writes the mask only into the first destination buffers it sees. Call
+// ladybugSetAlphaMasking( true ) again after the pool is initialized.
+//=============================================================================
+
+#ifndef LADYBUGFRAMEPOOL_H
+#define LADYBUGFRAMEPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <ladybug.h>
+
+/** One destination buffer per camera, as passed to ladybugConvertImage(). */
+struct LadybugBufferSet
+{
+    /** Per-camera buffers. Each one is page aligned. */
+    unsigned char* arpBuffers[ LADYBUG_NUM_CAMERAS ];
+
+    /** Size of the image held in each buffer. */
+    unsigned int uiCols;
+    unsigned int uiRows;
+    LadybugPixelFormat pixelFormat;
+
+    /** Size in bytes of the image in each buffer. */
+    unsigned int uiBufferSize;
+
+    /** Index of this set in the pool. */
+    unsigned int uiIndex;
+};
+
+/** Allocator counters reported by LadybugFramePool::getStats(). */
+struct LadybugFramePoolStats
+{
+    /** Number of system allocations made by the pool since it was initialized. */
+    unsigned long long ulAllocations;
+
+    /** Total bytes mapped by the pool. */
+    unsigned long long ulBytesAllocated;
+
+    /** Number of acquire() and release() calls. */
+    unsigned long long ulAcquires;
+    unsigned long long ulReleases;
+
+    /** Number of acquire() calls that had to wait for a set to be released. */
+    unsigned long long ulWaits;
+
+    /** Number of sets in the pool, currently handed out, and the most ever handed out at once. */
+    unsigned int uiNumSets;
+    unsigned int uiInUse;
+    unsigned int uiHighWater;
+
+    /** True if the buffers are backed by explicit huge pages. */
+    bool bHugePages;
+
+    /** NUMA node the buffers were bound to, or -1 if they were not. */
+    int iNumaNode;
+};
+
+class LadybugFramePool
+{
+public:
+    LadybugFramePool();
+    ~LadybugFramePool();
+
+    /**
+     * Allocate uiNumSets buffer sets for uiCols x uiRows images.
+     *
+     * Only LADYBUG_BGRU and LADYBUG_BGRU16 are supported. If bUseHugePages
+     * is true the pool tries MAP_HUGETLB first and falls back to regular
+     * pages with transparent huge page advice.
+     */
+    LadybugError initialize(
+        unsigned int uiNumSets,
+        unsigned int uiCols,
+        unsigned int uiRows,
+        LadybugPixelFormat pixelFormat = LADYBUG_BGRU,
+        bool bUseHugePages = false );
+
+    /** Free every buffer set. All sets must have been released. */
+    void destroy();
+
+    bool isInitialized() const;
+
+    /** Get a free buffer set, waiting until one is released if necessary. */
+    LadybugBufferSet* acquire();
+
+    /** Get a free buffer set, or NULL if none is free. */
+    LadybugBufferSet* tryAcquire();
+
+    /** Return a buffer set to the pool. */
+    void release( LadybugBufferSet* pSet );
+
+    void getStats( LadybugFramePoolStats* pStats ) const;
+
+    /** Print the allocator counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugFramePool( const LadybugFramePool& );
+    LadybugFramePool& operator=( const LadybugFramePool& );
+
+    // Unmap every block. The caller must hold m_mutex.
+    void freeBlocks();
+
+    // Pop a set from the free list and update the counters. The caller must
+    // hold m_mutex and the free list must not be empty.
+    LadybugBufferSet* takeFreeSet();
+
+    std::vector<LadybugBufferSet> m_sets;
+    std::vector<unsigned char*> m_blocks;
+    std::vector<size_t> m_blockSizes;
+    std::vector<unsigned int> m_freeList;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+
+    LadybugFramePoolStats m_stats;
+};
+
+#endif // LADYBUGFRAMEPOOL_H
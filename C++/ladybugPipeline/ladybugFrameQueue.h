@@ -0,0 +1,946 @@
+//=============================================================================
+// ladybugFrameQueue.h
+//
+// Bounded lock-free queues for passing frame handles (pointers or indices)
+// between pipeline stages.
+//
+// LadybugSpscQueue has one producer thread and one consumer thread. A push
+// or pop is a load and a store on the caller's own index; the other side's
+// index is only read when the cached copy says the queue looks full or
+// empty. LadybugMpmcQueue takes any number of producers and consumers; each
+// slot carries a sequence number, so a push or pop is one compare-and-swap
+// on a shared index (D. Vyukov's bounded MPMC queue).
+//
+// Everything one side writes is kept at least a cache line away from what
+// the other side writes, and MPMC slots each get their own cache line, so
+// the producer and consumer never invalidate each other's lines except to
+// hand over an item.
+//
+// A push to a full queue or a pop from an empty one waits in one of two
+// modes:
+//
+//    LADYBUG_QUEUE_BLOCK  Spin briefly, then sleep until the other side
+//                         makes progress. The other side only takes a lock
+//                         to wake it when someone is actually asleep.
+//    LADYBUG_QUEUE_SPIN   Never sleep. Lowest latency, but a waiting thread
+//                         keeps its CPU busy (it only yields every 1024
+//                         spins); give it a CPU of its own with
+//                         LadybugThreadPlacement.
+//
+// push()/pop() wait until they succeed or the queue is closed, pushFor()/
+// popFor() give up after a timeout, and tryPush()/tryPop() never wait.
+// close() wakes every waiter; pushes then fail, and pops return what is
+// left in the queue before failing.
+//
+// The queues are header-only so the compiler can inline the fast paths into
+// each stage.
+//
+// Usage:
+//    LadybugSpscQueue<LadybugLockedFrame*> queue;
+//    queue.initialize( 16, LADYBUG_QUEUE_BLOCK );
+//
+//    // Producer thread                    // Consumer thread
+//    queue.push( pFrame );                 LadybugLockedFrame* pFrame;
+//    ...                                   while ( queue.pop( &pFrame ) )
+//    queue.close();                        {
+//                                              ...
+//                                          }
+//=============================================================================
+
+#ifndef LADYBUGFRAMEQUEUE_H
+#define LADYBUGFRAMEQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#include <immintrin.h>
+#define LADYBUG_CPU_RELAX() _mm_pause()
+#else
+#define LADYBUG_CPU_RELAX() std::this_thread::yield()
+#endif
+
+#include <ladybug.h>
+
+/** Size used to keep the two sides of a queue apart. */
+#define LADYBUG_CACHE_LINE_SIZE 64
+
+/** The queues sample their occupancy once every LADYBUG_QUEUE_SAMPLE_MASK + 1 pushes. */
+#define LADYBUG_QUEUE_SAMPLE_MASK 15
+
+/** How a push to a full queue or a pop from an empty queue waits. */
+enum LadybugQueueWaitMode
+{
+    LADYBUG_QUEUE_BLOCK,
+    LADYBUG_QUEUE_SPIN
+};
+
+/** Counters reported by the queues' getStats(). */
+struct LadybugFrameQueueStats
+{
+    /** Items pushed and popped since initialize(). */
+    unsigned long long ulPushes;
+    unsigned long long ulPops;
+
+    /**
+     * Items in the queue now, and the most seen at once. The high water is
+     * sampled every few pushes and whenever the queue fills.
+     */
+    unsigned int uiSize;
+    unsigned int uiHighWater;
+    unsigned int uiCapacity;
+
+    /** Pushes that found the queue full, and pops that found it empty. */
+    unsigned long long ulFullStalls;
+    unsigned long long ulEmptyStalls;
+
+    /** Number of times a waiting thread went to sleep. */
+    unsigned long long ulSleeps;
+};
+
+/**
+ * Lets threads wait for a queue to change. Used by the queues; not meant to
+ * be used on its own.
+ */
+class LadybugQueueSignal
+{
+public:
+    /** Spins of a LADYBUG_QUEUE_BLOCK wait before it sleeps. */
+    static const unsigned int BLOCK_SPINS = 256;
+
+    LadybugQueueSignal()
+        : m_waiters( 0 ),
+          m_epoch( 0 ),
+          m_sleeps( 0 )
+    {
+    }
+
+    /** Wake the sleeping waiters, if any. Call after changing the queue. */
+    void notify()
+    {
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if ( m_waiters.load( std::memory_order_relaxed ) != 0 )
+        {
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_epoch.fetch_add( 1, std::memory_order_release );
+            }
+            m_cond.notify_all();
+        }
+    }
+
+    /**
+     * Call tryOnce() until it returns true, bClosed is set or the deadline
+     * passes. Returns the last result of tryOnce().
+     */
+    template <typename TryOnce>
+    bool wait(
+        TryOnce tryOnce,
+        const std::atomic<bool>& bClosed,
+        LadybugQueueWaitMode mode,
+        bool bTimed,
+        std::chrono::steady_clock::time_point deadline )
+    {
+        for ( unsigned int uiSpins = 0; ; uiSpins++ )
+        {
+            if ( tryOnce() )
+            {
+                return true;
+            }
+            if ( bClosed.load( std::memory_order_acquire ) )
+            {
+                return tryOnce();
+            }
+            if ( bTimed && ( uiSpins & 63 ) == 63 && std::chrono::steady_clock::now() >= deadline )
+            {
+                return false;
+            }
+            if ( mode == LADYBUG_QUEUE_BLOCK && uiSpins >= BLOCK_SPINS )
+            {
+                break;
+            }
+
+            // A spinning thread still yields now and then, in case the thread
+            // it waits for shares its CPU
+            if ( ( uiSpins & 1023 ) == 1023 )
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                LADYBUG_CPU_RELAX();
+            }
+        }
+
+        // Sleep until notify() moves the epoch on. tryOnce() is called
+        // without the lock held, since it notifies the queue's other signal.
+        m_waiters.fetch_add( 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        bool bDone = false;
+        bool bTimedOut = false;
+        while ( !bTimedOut )
+        {
+            const unsigned int uiEpoch = m_epoch.load( std::memory_order_acquire );
+            if ( ( bDone = tryOnce() ) || bClosed.load( std::memory_order_acquire ) )
+            {
+                break;
+            }
+
+            m_sleeps.fetch_add( 1, std::memory_order_relaxed );
+            std::unique_lock<std::mutex> lock( m_mutex );
+            if ( !bTimed )
+            {
+                m_cond.wait( lock, [this, uiEpoch] { return m_epoch.load( std::memory_order_relaxed ) != uiEpoch; } );
+            }
+            else
+            {
+                bTimedOut = !m_cond.wait_until(
+                    lock,
+                    deadline,
+                    [this, uiEpoch] { return m_epoch.load( std::memory_order_relaxed ) != uiEpoch; } );
+            }
+        }
+
+        m_waiters.fetch_sub( 1, std::memory_order_relaxed );
+
+        return bDone || tryOnce();
+    }
+
+    unsigned long long getSleeps() const
+    {
+        return m_sleeps.load( std::memory_order_relaxed );
+    }
+
+private:
+    LadybugQueueSignal( const LadybugQueueSignal& );
+    LadybugQueueSignal& operator=( const LadybugQueueSignal& );
+
+    std::atomic<unsigned int> m_waiters;
+    std::atomic<unsigned int> m_epoch;
+    std::atomic<unsigned long long> m_sleeps;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/**
+ * Storage for uiCount objects of type T, starting on a cache line boundary,
+ * with a cache line of padding before and after so neighbouring allocations
+ * never share a line with the slots.
+ */
+template <typename T>
+class LadybugQueueSlots
+{
+public:
+    LadybugQueueSlots()
+        : m_pSlots( NULL ),
+          m_uiCount( 0 )
+    {
+    }
+
+    ~LadybugQueueSlots()
+    {
+        release();
+    }
+
+    void allocate( unsigned int uiCount )
+    {
+        release();
+        m_storage.resize( ( (size_t)uiCount + 2 ) * sizeof( T ) + 3 * LADYBUG_CACHE_LINE_SIZE );
+        uintptr_t address = (uintptr_t)m_storage.data() + LADYBUG_CACHE_LINE_SIZE;
+        address = ( address + LADYBUG_CACHE_LINE_SIZE - 1 ) & ~(uintptr_t)( LADYBUG_CACHE_LINE_SIZE - 1 );
+        m_pSlots = (T*)address;
+        m_uiCount = uiCount;
+        for ( unsigned int i = 0; i < m_uiCount; i++ )
+        {
+            new ( &m_pSlots[ i ] ) T();
+        }
+    }
+
+    T& operator[]( size_t index )
+    {
+        return m_pSlots[ index ];
+    }
+
+private:
+    LadybugQueueSlots( const LadybugQueueSlots& );
+    LadybugQueueSlots& operator=( const LadybugQueueSlots& );
+
+    void release()
+    {
+        for ( unsigned int i = 0; i < m_uiCount; i++ )
+        {
+            m_pSlots[ i ].~T();
+        }
+        m_pSlots = NULL;
+        m_uiCount = 0;
+    }
+
+    std::vector<unsigned char> m_storage;
+    T* m_pSlots;
+    unsigned int m_uiCount;
+};
+
+/** Smallest power of two not below uiValue, and at least 2. */
+inline unsigned int
+ladybugQueueCapacity( unsigned int uiValue )
+{
+    unsigned int uiCapacity = 2;
+    while ( uiCapacity < uiValue && uiCapacity < 0x80000000u )
+    {
+        uiCapacity <<= 1;
+    }
+    return uiCapacity;
+}
+
+//=============================================================================
+// Single producer, single consumer
+//=============================================================================
+template <typename T>
+class LadybugSpscQueue
+{
+public:
+    LadybugSpscQueue();
+
+    /**
+     * Size the queue for at least uiCapacity items (rounded up to a power of
+     * two) and empty it. Not thread safe: neither side may be using the
+     * queue.
+     */
+    LadybugError initialize( unsigned int uiCapacity, LadybugQueueWaitMode mode = LADYBUG_QUEUE_BLOCK );
+
+    /** Producer side. See the file comment for how each one waits. */
+    bool tryPush( const T& item );
+    bool push( const T& item );
+    bool pushFor( const T& item, unsigned int uiTimeoutMs );
+
+    /** Consumer side. */
+    bool tryPop( T* pItem );
+    bool pop( T* pItem );
+    bool popFor( T* pItem, unsigned int uiTimeoutMs );
+
+    /** Fail pushes and wake every waiter. Items left can still be popped. */
+    void close();
+    bool isClosed() const;
+
+    unsigned int getSize() const;
+    unsigned int getCapacity() const;
+
+    void getStats( LadybugFrameQueueStats* pStats ) const;
+
+    /** Print the queue counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugSpscQueue( const LadybugSpscQueue& );
+    LadybugSpscQueue& operator=( const LadybugSpscQueue& );
+
+    bool waitPush( const T& item, bool bTimed, unsigned int uiTimeoutMs );
+    bool waitPop( T* pItem, bool bTimed, unsigned int uiTimeoutMs );
+
+    // Read by both sides, written only by initialize() and close()
+    LadybugQueueSlots<T> m_slots;
+    size_t m_mask;
+    LadybugQueueWaitMode m_mode;
+    std::atomic<bool> m_bClosed;
+
+    char m_pad0[ LADYBUG_CACHE_LINE_SIZE ];
+
+    // Producer side
+    std::atomic<size_t> m_tail;
+    size_t m_cachedHead;
+    std::atomic<unsigned int> m_highWater;
+    std::atomic<unsigned long long> m_fullStalls;
+
+    char m_pad1[ LADYBUG_CACHE_LINE_SIZE ];
+
+    // Consumer side
+    std::atomic<size_t> m_head;
+    size_t m_cachedTail;
+    std::atomic<unsigned long long> m_emptyStalls;
+
+    char m_pad2[ LADYBUG_CACHE_LINE_SIZE ];
+
+    // Producers wait on m_notFull, consumers on m_notEmpty
+    LadybugQueueSignal m_notFull;
+    LadybugQueueSignal m_notEmpty;
+};
+
+template <typename T>
+LadybugSpscQueue<T>::LadybugSpscQueue()
+{
+    initialize( 2 );
+}
+
+template <typename T>
+LadybugError
+LadybugSpscQueue<T>::initialize( unsigned int uiCapacity, LadybugQueueWaitMode mode )
+{
+    if ( uiCapacity == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    uiCapacity = ladybugQueueCapacity( uiCapacity );
+    m_slots.allocate( uiCapacity );
+    m_mask = uiCapacity - 1;
+    m_mode = mode;
+    m_bClosed = false;
+
+    m_tail = 0;
+    m_cachedHead = 0;
+    m_highWater = 0;
+    m_fullStalls = 0;
+
+    m_head = 0;
+    m_cachedTail = 0;
+    m_emptyStalls = 0;
+
+    return LADYBUG_OK;
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::tryPush( const T& item )
+{
+    if ( m_bClosed.load( std::memory_order_relaxed ) )
+    {
+        return false;
+    }
+
+    // The consumer's index is read when the queue looks full, and every few
+    // pushes to sample the occupancy
+    const size_t tail = m_tail.load( std::memory_order_relaxed );
+    if ( tail - m_cachedHead > m_mask || ( tail & LADYBUG_QUEUE_SAMPLE_MASK ) == 0 )
+    {
+        m_cachedHead = m_head.load( std::memory_order_acquire );
+        if ( tail - m_cachedHead > m_mask )
+        {
+            m_highWater.store( (unsigned int)( m_mask + 1 ), std::memory_order_relaxed );
+            return false;
+        }
+
+        const unsigned int uiSize = (unsigned int)( tail + 1 - m_cachedHead );
+        if ( uiSize > m_highWater.load( std::memory_order_relaxed ) )
+        {
+            m_highWater.store( uiSize, std::memory_order_relaxed );
+        }
+    }
+
+    m_slots[ tail & m_mask ] = item;
+    m_tail.store( tail + 1, std::memory_order_release );
+
+    if ( m_mode == LADYBUG_QUEUE_BLOCK )
+    {
+        m_notEmpty.notify();
+    }
+    return true;
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::push( const T& item )
+{
+    return tryPush( item ) || waitPush( item, false, 0 );
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::pushFor( const T& item, unsigned int uiTimeoutMs )
+{
+    return tryPush( item ) || waitPush( item, true, uiTimeoutMs );
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::waitPush( const T& item, bool bTimed, unsigned int uiTimeoutMs )
+{
+    if ( m_bClosed.load( std::memory_order_acquire ) )
+    {
+        return false;
+    }
+
+    m_fullStalls.store( m_fullStalls.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    return m_notFull.wait(
+        [this, &item] { return tryPush( item ); },
+        m_bClosed,
+        m_mode,
+        bTimed,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( uiTimeoutMs ) );
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::tryPop( T* pItem )
+{
+    const size_t head = m_head.load( std::memory_order_relaxed );
+    if ( head == m_cachedTail )
+    {
+        m_cachedTail = m_tail.load( std::memory_order_acquire );
+        if ( head == m_cachedTail )
+        {
+            return false;
+        }
+    }
+
+    *pItem = m_slots[ head & m_mask ];
+    m_head.store( head + 1, std::memory_order_release );
+
+    if ( m_mode == LADYBUG_QUEUE_BLOCK )
+    {
+        m_notFull.notify();
+    }
+    return true;
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::pop( T* pItem )
+{
+    return tryPop( pItem ) || waitPop( pItem, false, 0 );
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::popFor( T* pItem, unsigned int uiTimeoutMs )
+{
+    return tryPop( pItem ) || waitPop( pItem, true, uiTimeoutMs );
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::waitPop( T* pItem, bool bTimed, unsigned int uiTimeoutMs )
+{
+    if ( m_bClosed.load( std::memory_order_acquire ) )
+    {
+        return false;
+    }
+
+    m_emptyStalls.store( m_emptyStalls.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    return m_notEmpty.wait(
+        [this, pItem] { return tryPop( pItem ); },
+        m_bClosed,
+        m_mode,
+        bTimed,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( uiTimeoutMs ) );
+}
+
+template <typename T>
+void
+LadybugSpscQueue<T>::close()
+{
+    m_bClosed.store( true, std::memory_order_release );
+    m_notFull.notify();
+    m_notEmpty.notify();
+}
+
+template <typename T>
+bool
+LadybugSpscQueue<T>::isClosed() const
+{
+    return m_bClosed.load( std::memory_order_acquire );
+}
+
+template <typename T>
+unsigned int
+LadybugSpscQueue<T>::getSize() const
+{
+    const size_t head = m_head.load( std::memory_order_acquire );
+    const size_t tail = m_tail.load( std::memory_order_acquire );
+    return ( tail > head ) ? (unsigned int)( tail - head ) : 0;
+}
+
+template <typename T>
+unsigned int
+LadybugSpscQueue<T>::getCapacity() const
+{
+    return (unsigned int)( m_mask + 1 );
+}
+
+template <typename T>
+void
+LadybugSpscQueue<T>::getStats( LadybugFrameQueueStats* pStats ) const
+{
+    pStats->ulPops = m_head.load( std::memory_order_acquire );
+    pStats->ulPushes = m_tail.load( std::memory_order_acquire );
+    pStats->uiSize = ( pStats->ulPushes > pStats->ulPops ) ? (unsigned int)( pStats->ulPushes - pStats->ulPops ) : 0;
+    pStats->uiHighWater = m_highWater.load( std::memory_order_relaxed );
+    pStats->uiCapacity = getCapacity();
+    pStats->ulFullStalls = m_fullStalls.load( std::memory_order_relaxed );
+    pStats->ulEmptyStalls = m_emptyStalls.load( std::memory_order_relaxed );
+    pStats->ulSleeps = m_notFull.getSleeps() + m_notEmpty.getSleeps();
+}
+
+template <typename T>
+void
+LadybugSpscQueue<T>::printStats( const char* pszName ) const
+{
+    LadybugFrameQueueStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu pushed, %llu popped, high water %u of %u, %llu full stalls, %llu empty stalls, %llu sleeps\n",
+        pszName,
+        stats.ulPushes,
+        stats.ulPops,
+        stats.uiHighWater,
+        stats.uiCapacity,
+        stats.ulFullStalls,
+        stats.ulEmptyStalls,
+        stats.ulSleeps );
+}
+
+//=============================================================================
+// Multiple producers, multiple consumers
+//=============================================================================
+template <typename T>
+class LadybugMpmcQueue
+{
+public:
+    LadybugMpmcQueue();
+
+    /**
+     * Size the queue for at least uiCapacity items (rounded up to a power of
+     * two) and empty it. Not thread safe: no thread may be using the queue.
+     */
+    LadybugError initialize( unsigned int uiCapacity, LadybugQueueWaitMode mode = LADYBUG_QUEUE_BLOCK );
+
+    bool tryPush( const T& item );
+    bool push( const T& item );
+    bool pushFor( const T& item, unsigned int uiTimeoutMs );
+
+    bool tryPop( T* pItem );
+    bool pop( T* pItem );
+    bool popFor( T* pItem, unsigned int uiTimeoutMs );
+
+    /** Fail pushes and wake every waiter. Items left can still be popped. */
+    void close();
+    bool isClosed() const;
+
+    unsigned int getSize() const;
+    unsigned int getCapacity() const;
+
+    void getStats( LadybugFrameQueueStats* pStats ) const;
+
+    /** Print the queue counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugMpmcQueue( const LadybugMpmcQueue& );
+    LadybugMpmcQueue& operator=( const LadybugMpmcQueue& );
+
+    // A slot and its sequence number. The sequence is the position the slot
+    // can next be pushed at, or that position + 1 once it holds an item.
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T item;
+        char pad[ LADYBUG_CACHE_LINE_SIZE - ( sizeof( std::atomic<size_t> ) + sizeof( T ) ) % LADYBUG_CACHE_LINE_SIZE ];
+    };
+
+    bool waitPush( const T& item, bool bTimed, unsigned int uiTimeoutMs );
+    bool waitPop( T* pItem, bool bTimed, unsigned int uiTimeoutMs );
+    void updateHighWater( size_t position );
+
+    LadybugQueueSlots<Cell> m_cells;
+    size_t m_mask;
+    LadybugQueueWaitMode m_mode;
+    std::atomic<bool> m_bClosed;
+
+    char m_pad0[ LADYBUG_CACHE_LINE_SIZE ];
+
+    std::atomic<size_t> m_enqueuePosition;
+    std::atomic<unsigned int> m_highWater;
+    std::atomic<unsigned long long> m_fullStalls;
+
+    char m_pad1[ LADYBUG_CACHE_LINE_SIZE ];
+
+    std::atomic<size_t> m_dequeuePosition;
+    std::atomic<unsigned long long> m_emptyStalls;
+
+    char m_pad2[ LADYBUG_CACHE_LINE_SIZE ];
+
+    LadybugQueueSignal m_notFull;
+    LadybugQueueSignal m_notEmpty;
+};
+
+template <typename T>
+LadybugMpmcQueue<T>::LadybugMpmcQueue()
+{
+    initialize( 2 );
+}
+
+template <typename T>
+LadybugError
+LadybugMpmcQueue<T>::initialize( unsigned int uiCapacity, LadybugQueueWaitMode mode )
+{
+    if ( uiCapacity == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    uiCapacity = ladybugQueueCapacity( uiCapacity );
+    m_cells.allocate( uiCapacity );
+    for ( unsigned int i = 0; i < uiCapacity; i++ )
+    {
+        m_cells[ i ].sequence.store( i, std::memory_order_relaxed );
+    }
+    m_mask = uiCapacity - 1;
+    m_mode = mode;
+    m_bClosed = false;
+
+    m_enqueuePosition = 0;
+    m_highWater = 0;
+    m_fullStalls = 0;
+
+    m_dequeuePosition = 0;
+    m_emptyStalls = 0;
+
+    return LADYBUG_OK;
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::tryPush( const T& item )
+{
+    if ( m_bClosed.load( std::memory_order_relaxed ) )
+    {
+        return false;
+    }
+
+    size_t position = m_enqueuePosition.load( std::memory_order_relaxed );
+    Cell* pCell;
+    while ( true )
+    {
+        pCell = &m_cells[ position & m_mask ];
+        const size_t sequence = pCell->sequence.load( std::memory_order_acquire );
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if ( difference == 0 )
+        {
+            if ( m_enqueuePosition.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        else if ( difference < 0 )
+        {
+            // The slot still holds the item pushed one lap ago
+            updateHighWater( position - 1 );
+            return false;
+        }
+        else
+        {
+            position = m_enqueuePosition.load( std::memory_order_relaxed );
+        }
+    }
+
+    pCell->item = item;
+    pCell->sequence.store( position + 1, std::memory_order_release );
+
+    if ( ( position & LADYBUG_QUEUE_SAMPLE_MASK ) == 0 )
+    {
+        updateHighWater( position );
+    }
+    if ( m_mode == LADYBUG_QUEUE_BLOCK )
+    {
+        m_notEmpty.notify();
+    }
+    return true;
+}
+
+template <typename T>
+void
+LadybugMpmcQueue<T>::updateHighWater( size_t position )
+{
+    const size_t dequeuePosition = m_dequeuePosition.load( std::memory_order_relaxed );
+    if ( position + 1 <= dequeuePosition )
+    {
+        return;
+    }
+
+    const unsigned int uiSize = (unsigned int)( position + 1 - dequeuePosition );
+    unsigned int uiHighWater = m_highWater.load( std::memory_order_relaxed );
+    while ( uiSize > uiHighWater &&
+        !m_highWater.compare_exchange_weak( uiHighWater, uiSize, std::memory_order_relaxed ) )
+    {
+    }
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::push( const T& item )
+{
+    return tryPush( item ) || waitPush( item, false, 0 );
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::pushFor( const T& item, unsigned int uiTimeoutMs )
+{
+    return tryPush( item ) || waitPush( item, true, uiTimeoutMs );
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::waitPush( const T& item, bool bTimed, unsigned int uiTimeoutMs )
+{
+    if ( m_bClosed.load( std::memory_order_acquire ) )
+    {
+        return false;
+    }
+
+    m_fullStalls.fetch_add( 1, std::memory_order_relaxed );
+    return m_notFull.wait(
+        [this, &item] { return tryPush( item ); },
+        m_bClosed,
+        m_mode,
+        bTimed,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( uiTimeoutMs ) );
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::tryPop( T* pItem )
+{
+    size_t position = m_dequeuePosition.load( std::memory_order_relaxed );
+    Cell* pCell;
+    while ( true )
+    {
+        pCell = &m_cells[ position & m_mask ];
+        const size_t sequence = pCell->sequence.load( std::memory_order_acquire );
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)( position + 1 );
+        if ( difference == 0 )
+        {
+            if ( m_dequeuePosition.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        else if ( difference < 0 )
+        {
+            // Nothing has been pushed at this position yet
+            return false;
+        }
+        else
+        {
+            position = m_dequeuePosition.load( std::memory_order_relaxed );
+        }
+    }
+
+    *pItem = pCell->item;
+    pCell->sequence.store( position + m_mask + 1, std::memory_order_release );
+
+    if ( m_mode == LADYBUG_QUEUE_BLOCK )
+    {
+        m_notFull.notify();
+    }
+    return true;
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::pop( T* pItem )
+{
+    return tryPop( pItem ) || waitPop( pItem, false, 0 );
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::popFor( T* pItem, unsigned int uiTimeoutMs )
+{
+    return tryPop( pItem ) || waitPop( pItem, true, uiTimeoutMs );
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::waitPop( T* pItem, bool bTimed, unsigned int uiTimeoutMs )
+{
+    if ( m_bClosed.load( std::memory_order_acquire ) )
+    {
+        return false;
+    }
+
+    m_emptyStalls.fetch_add( 1, std::memory_order_relaxed );
+    return m_notEmpty.wait(
+        [this, pItem] { return tryPop( pItem ); },
+        m_bClosed,
+        m_mode,
+        bTimed,
+        std::chrono::steady_clock::now() + std::chrono::milliseconds( uiTimeoutMs ) );
+}
+
+template <typename T>
+void
+LadybugMpmcQueue<T>::close()
+{
+    m_bClosed.store( true, std::memory_order_release );
+    m_notFull.notify();
+    m_notEmpty.notify();
+}
+
+template <typename T>
+bool
+LadybugMpmcQueue<T>::isClosed() const
+{
+    return m_bClosed.load( std::memory_order_acquire );
+}
+
+template <typename T>
+unsigned int
+LadybugMpmcQueue<T>::getSize() const
+{
+    const size_t dequeuePosition = m_dequeuePosition.load( std::memory_order_acquire );
+    const size_t enqueuePosition = m_enqueuePosition.load( std::memory_order_acquire );
+    return ( enqueuePosition > dequeuePosition ) ? (unsigned int)( enqueuePosition - dequeuePosition ) : 0;
+}
+
+template <typename T>
+unsigned int
+LadybugMpmcQueue<T>::getCapacity() const
+{
+    return (unsigned int)( m_mask + 1 );
+}
+
+template <typename T>
+void
+LadybugMpmcQueue<T>::getStats( LadybugFrameQueueStats* pStats ) const
+{
+    pStats->ulPops = m_dequeuePosition.load( std::memory_order_acquire );
+    pStats->ulPushes = m_enqueuePosition.load( std::memory_order_acquire );
+    pStats->uiSize = ( pStats->ulPushes > pStats->ulPops ) ? (unsigned int)( pStats->ulPushes - pStats->ulPops ) : 0;
+    pStats->uiHighWater = m_highWater.load( std::memory_order_relaxed );
+    pStats->uiCapacity = getCapacity();
+    pStats->ulFullStalls = m_fullStalls.load( std::memory_order_relaxed );
+    pStats->ulEmptyStalls = m_emptyStalls.load( std::memory_order_relaxed );
+    pStats->ulSleeps = m_notFull.getSleeps() + m_notEmpty.getSleeps();
+}
+
+template <typename T>
+void
+LadybugMpmcQueue<T>::printStats( const char* pszName ) const
+{
+    LadybugFrameQueueStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu pushed, %llu popped, high water %u of %u, %llu full stalls, %llu empty stalls, %llu sleeps\n",
+        pszName,
+        stats.ulPushes,
+        stats.ulPops,
+        stats.uiHighWater,
+        stats.uiCapacity,
+        stats.ulFullStalls,
+        stats.ulEmptyStalls,
+        stats.ulSleeps );
+}
+
+#endif // LADYBUGFRAMEQUEUE_H
@@ -0,0 +1,92 @@
+//=============================================================================
+// ladybugFrameSource.h
+//
+// The grab, lock and unlock calls the capture tools make, behind an
+// interface, so a tool can capture from a camera or from
+// LadybugSyntheticSource (see ladybugSyntheticSource.h) with the same code.
+//
+// LadybugCameraSource forwards every call to the SDK on a context the
+// caller has initialized and started.
+//
+// Usage:
+//    LadybugCameraSource cameraSource( context );
+//    LadybugFrameSource* pSource = &cameraSource;
+//    pSource->grabImage( &image );
+//=============================================================================
+
+#ifndef LADYBUGFRAMESOURCE_H
+#define LADYBUGFRAMESOURCE_H
+
+#include <ladybug.h>
+
+class LadybugFrameSource
+{
+public:
+    virtual ~LadybugFrameSource()
+    {
+    }
+
+    /** Like ladybugGrabImage(). pData stays valid until the next grab. */
+    virtual LadybugError grabImage( LadybugImage* pImage ) = 0;
+
+    /** Like ladybugLockNext(). pData stays valid until the buffer is unlocked. */
+    virtual LadybugError lockNext( LadybugImage* pImage ) = 0;
+
+    /** Like ladybugUnlock(). */
+    virtual LadybugError unlock( unsigned int uiBufferIndex ) = 0;
+
+    /** Like ladybugUnlockAll(). */
+    virtual LadybugError unlockAll() = 0;
+
+    /** Like ladybugSetGrabTimeout(). */
+    virtual LadybugError setGrabTimeout( unsigned int uiTimeoutMs ) = 0;
+};
+
+class LadybugCameraSource : public LadybugFrameSource
+{
+public:
+    explicit LadybugCameraSource( LadybugContext context = NULL )
+        : m_context( context )
+    {
+    }
+
+    void setContext( LadybugContext context )
+    {
+        m_context = context;
+    }
+
+    LadybugContext getContext() const
+    {
+        return m_context;
+    }
+
+    LadybugError grabImage( LadybugImage* pImage )
+    {
+        return ::ladybugGrabImage( m_context, pImage );
+    }
+
+    LadybugError lockNext( LadybugImage* pImage )
+    {
+        return ::ladybugLockNext( m_context, pImage );
+    }
+
+    LadybugError unlock( unsigned int uiBufferIndex )
+    {
+        return ::ladybugUnlock( m_context, uiBufferIndex );
+    }
+
+    LadybugError unlockAll()
+    {
+        return ::ladybugUnlockAll( m_context );
+    }
+
+    LadybugError setGrabTimeout( unsigned int uiTimeoutMs )
+    {
+        return ::ladybugSetGrabTimeout( m_context, uiTimeoutMs );
+    }
+
+private:
+    LadybugContext m_context;
+};
+
+#endif // LADYBUGFRAMESOURCE_H
@@ -0,0 +1,366 @@
+//=============================================================================
+// ladybugFrameTiming.cpp
+//=============================================================================
+
+#include "ladybugFrameTiming.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+const double CYCLE_COUNTS_PER_SECOND = 8000.0;
+const double CYCLE_OFFSETS_PER_COUNT = 3072.0;
+const double CYCLE_WRAP_SECONDS = 128.0;
+
+// Deltas used to learn the frame period when no frame rate is configured
+const size_t LEARNING_FRAMES = 15;
+
+// How fast the lag baseline may drift, in seconds per second
+const double LAG_DRIFT = 0.001;
+
+double toMs( unsigned long long ulNanoseconds )
+{
+    return ulNanoseconds / 1e6;
+}
+
+} // namespace
+
+LadybugFrameTimingAnalyzer::LadybugFrameTimingAnalyzer()
+    : m_pListener( NULL )
+{
+    initialize( LadybugFrameTimingConfig() );
+}
+
+void
+LadybugFrameTimingAnalyzer::initialize( const LadybugFrameTimingConfig& config )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_config = config;
+    m_dPeriod = ( config.dFrameRate > 0.0 ) ? 1.0 / config.dFrameRate : 0.0;
+    m_learningDeltas.clear();
+
+    m_bHavePrevious = false;
+    memset( &m_previous, 0, sizeof( m_previous ) );
+    m_uiPreviousSequenceId = 0;
+    m_dLastDelta = 0.0;
+    m_dSeconds = 0.0;
+
+    m_bHaveLagBase = false;
+    m_dLagBase = 0.0;
+
+    m_deltas.reset();
+    m_jitter.reset();
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.dFrameRate = config.dFrameRate;
+}
+
+void
+LadybugFrameTimingAnalyzer::setListener( LadybugFrameTimingListener* pListener )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_pListener = pListener;
+}
+
+void
+LadybugFrameTimingAnalyzer::addFrame( const LadybugImage& image )
+{
+    analyze( image, true, std::chrono::steady_clock::now() );
+}
+
+void
+LadybugFrameTimingAnalyzer::addRecordedFrame( const LadybugImage& image )
+{
+    analyze( image, false, std::chrono::steady_clock::time_point() );
+}
+
+double
+LadybugFrameTimingAnalyzer::getCycleTime( const LadybugTimestamp& timeStamp )
+{
+    return timeStamp.ulCycleSeconds * CYCLE_COUNTS_PER_SECOND +
+        timeStamp.ulCycleCount +
+        timeStamp.ulCycleOffset / CYCLE_OFFSETS_PER_COUNT;
+}
+
+double
+LadybugFrameTimingAnalyzer::getDeltaSeconds( const LadybugTimestamp& previous, const LadybugTimestamp& current )
+{
+    // A wrap sends the cycle time back by most of the 128 seconds; a small
+    // step back is a frame out of order and gives a negative delta
+    const double dWrapCycles = CYCLE_WRAP_SECONDS * CYCLE_COUNTS_PER_SECOND;
+    double dCycles = getCycleTime( current ) - getCycleTime( previous );
+    if ( dCycles < -dWrapCycles / 2 )
+    {
+        dCycles += dWrapCycles;
+    }
+    double dDelta = dCycles / CYCLE_COUNTS_PER_SECOND;
+
+    // The cycle time cannot tell how many times it wrapped in between; the
+    // wall clock can, if both images have it
+    if ( previous.ulSeconds != 0 && current.ulSeconds != 0 )
+    {
+        const double dWall =
+            (double)( current.ulSeconds - previous.ulSeconds ) +
+            ( (double)current.ulMicroSeconds - (double)previous.ulMicroSeconds ) / 1e6;
+        if ( dWall > CYCLE_WRAP_SECONDS / 2 )
+        {
+            dDelta += floor( ( dWall - dDelta ) / CYCLE_WRAP_SECONDS + 0.5 ) * CYCLE_WRAP_SECONDS;
+        }
+    }
+
+    return dDelta;
+}
+
+void
+LadybugFrameTimingAnalyzer::analyze( const LadybugImage& image, bool bLive, std::chrono::steady_clock::time_point arrival )
+{
+    std::vector<LadybugFrameTimingEvent> events;
+    LadybugFrameTimingListener* pListener;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        pListener = m_pListener;
+
+        const unsigned int uiSequenceId = image.imageInfo.ulSequenceId;
+        const bool bHavePrevious = m_bHavePrevious;
+        double dDelta = 0.0;
+        unsigned int uiSequenceGap = 0;
+        if ( bHavePrevious )
+        {
+            dDelta = getDeltaSeconds( m_previous, image.timeStamp );
+            if ( uiSequenceId > m_uiPreviousSequenceId + 1 )
+            {
+                uiSequenceGap = uiSequenceId - m_uiPreviousSequenceId - 1;
+            }
+        }
+
+        // Events are about this frame, so it becomes the previous one first
+        m_stats.ulFrames++;
+        m_previous = image.timeStamp;
+        m_uiPreviousSequenceId = uiSequenceId;
+        m_bHavePrevious = true;
+
+        if ( bHavePrevious )
+        {
+            m_dLastDelta = dDelta;
+            m_dSeconds += dDelta;
+            m_stats.ulSequenceGaps += uiSequenceGap;
+
+            if ( dDelta > 0.0 )
+            {
+                const double dDeltaMs = dDelta * 1000.0;
+                if ( m_deltas.getCount() == 0 || dDeltaMs < m_stats.dMinDeltaMs )
+                {
+                    m_stats.dMinDeltaMs = dDeltaMs;
+                }
+                if ( dDeltaMs > m_stats.dMaxDeltaMs )
+                {
+                    m_stats.dMaxDeltaMs = dDeltaMs;
+                }
+                m_deltas.record( (unsigned long long)( dDelta * 1e9 ) );
+            }
+
+            checkDelta( dDelta, uiSequenceGap, &events );
+        }
+        m_stats.dSeconds = m_dSeconds;
+
+        if ( bLive )
+        {
+            if ( !m_bHaveLagBase )
+            {
+                m_firstArrival = arrival;
+                m_dLagBase = 0.0;
+                m_bHaveLagBase = true;
+            }
+
+            // How much later than the first frame this one arrived, beyond
+            // what the camera clock accounts for
+            const std::chrono::duration<double> sinceFirst = arrival - m_firstArrival;
+            const double dLag = sinceFirst.count() - m_dSeconds;
+            m_dLagBase = std::min( dLag, m_dLagBase + LAG_DRIFT * m_dLastDelta );
+            checkLag( ( dLag - m_dLagBase ) * 1000.0, &events );
+        }
+    }
+
+    for ( size_t i = 0; i < events.size(); i++ )
+    {
+        if ( pListener != NULL )
+        {
+            pListener->onTimingEvent( events[ i ] );
+        }
+        else
+        {
+            raise( events[ i ] );
+        }
+    }
+}
+
+void
+LadybugFrameTimingAnalyzer::checkDelta( double dDelta, unsigned int uiSequenceGap, std::vector<LadybugFrameTimingEvent>* pEvents )
+{
+    if ( m_dPeriod == 0.0 && dDelta > 0.0 )
+    {
+        // Learn the period from the median of the first deltas, which
+        // ignores the odd late or dropped frame
+        m_learningDeltas.push_back( dDelta );
+        if ( m_learningDeltas.size() >= LEARNING_FRAMES )
+        {
+            std::vector<double> sorted( m_learningDeltas );
+            std::sort( sorted.begin(), sorted.end() );
+            m_dPeriod = sorted[ sorted.size() / 2 ];
+            m_stats.dFrameRate = 1.0 / m_dPeriod;
+            m_learningDeltas.clear();
+        }
+    }
+
+    unsigned int uiDropped = uiSequenceGap;
+    if ( m_dPeriod > 0.0 && dDelta > 0.0 )
+    {
+        // Jitter is measured against the nearest whole number of periods,
+        // so a drop does not also count as jitter
+        const double dPeriods = floor( dDelta / m_dPeriod + 0.5 );
+        const double dExpected = std::max( dPeriods, 1.0 ) * m_dPeriod;
+        m_jitter.record( (unsigned long long)( fabs( dDelta - dExpected ) * 1e9 ) );
+
+        if ( dDelta > m_config.dDropFactor * m_dPeriod )
+        {
+            const unsigned int uiTimingDropped = ( dPeriods > 1.0 ) ? (unsigned int)( dPeriods - 1.0 ) : 1;
+            uiDropped = std::max( uiDropped, uiTimingDropped );
+        }
+    }
+
+    if ( uiDropped > 0 )
+    {
+        m_stats.ulDroppedFrames += uiDropped;
+        m_stats.ulDropEvents++;
+
+        LadybugFrameTimingEvent event = makeEvent( LADYBUG_TIMING_DROP );
+        event.uiDroppedFrames = uiDropped;
+        event.dDeltaMs = dDelta * 1000.0;
+        pEvents->push_back( event );
+    }
+}
+
+void
+LadybugFrameTimingAnalyzer::checkLag( double dLagMs, std::vector<LadybugFrameTimingEvent>* pEvents )
+{
+    m_stats.dLagMs = dLagMs;
+    m_stats.dMaxLagMs = std::max( m_stats.dMaxLagMs, dLagMs );
+
+    const double dBehindMs = ( m_config.dBehindMs > 0.0 ) ? m_config.dBehindMs : 4000.0 * m_dPeriod;
+    if ( dBehindMs <= 0.0 )
+    {
+        return;
+    }
+
+    if ( !m_stats.bBehind && dLagMs > dBehindMs )
+    {
+        m_stats.bBehind = true;
+        m_stats.ulBehindEvents++;
+
+        LadybugFrameTimingEvent event = makeEvent( LADYBUG_TIMING_BEHIND );
+        event.dLagMs = dLagMs;
+        pEvents->push_back( event );
+    }
+    else if ( m_stats.bBehind && dLagMs < dBehindMs / 2 )
+    {
+        m_stats.bBehind = false;
+
+        LadybugFrameTimingEvent event = makeEvent( LADYBUG_TIMING_CAUGHT_UP );
+        event.dLagMs = dLagMs;
+        pEvents->push_back( event );
+    }
+}
+
+LadybugFrameTimingEvent
+LadybugFrameTimingAnalyzer::makeEvent( LadybugFrameTimingEventType type ) const
+{
+    LadybugFrameTimingEvent event;
+    memset( &event, 0, sizeof( event ) );
+    event.type = type;
+    event.ulFrame = m_stats.ulFrames - 1;
+    event.uiSequenceId = m_uiPreviousSequenceId;
+    event.dSeconds = m_dSeconds;
+    return event;
+}
+
+void
+LadybugFrameTimingAnalyzer::raise( const LadybugFrameTimingEvent& event )
+{
+    switch ( event.type )
+    {
+    case LADYBUG_TIMING_DROP:
+        printf( "Frame %llu (sequence %u, %.3fs): %u frames dropped, %.1fms since the previous frame\n",
+            event.ulFrame, event.uiSequenceId, event.dSeconds, event.uiDroppedFrames, event.dDeltaMs );
+        break;
+    case LADYBUG_TIMING_BEHIND:
+        printf( "Frame %llu (sequence %u, %.3fs): falling behind, frames arrive %.1fms late\n",
+            event.ulFrame, event.uiSequenceId, event.dSeconds, event.dLagMs );
+        break;
+    case LADYBUG_TIMING_CAUGHT_UP:
+        printf( "Frame %llu (sequence %u, %.3fs): caught up, frames arrive %.1fms late\n",
+            event.ulFrame, event.uiSequenceId, event.dSeconds, event.dLagMs );
+        break;
+    }
+}
+
+double
+LadybugFrameTimingAnalyzer::getLastFrameRate() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return ( m_dLastDelta > 0.0 ) ? 1.0 / m_dLastDelta : 0.0;
+}
+
+void
+LadybugFrameTimingAnalyzer::getStats( LadybugFrameTimingStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+    pStats->dMeasuredFrameRate = ( m_dSeconds > 0.0 ) ? ( m_stats.ulFrames - 1 ) / m_dSeconds : 0.0;
+    pStats->dJitterP50Ms = toMs( m_jitter.getQuantile( 0.5 ) );
+    pStats->dJitterP99Ms = toMs( m_jitter.getQuantile( 0.99 ) );
+    pStats->dJitterMaxMs = toMs( m_jitter.getMax() );
+}
+
+const LadybugHistogram&
+LadybugFrameTimingAnalyzer::getDeltaHistogram() const
+{
+    return m_deltas;
+}
+
+const LadybugHistogram&
+LadybugFrameTimingAnalyzer::getJitterHistogram() const
+{
+    return m_jitter;
+}
+
+void
+LadybugFrameTimingAnalyzer::printStats( const char* pszName ) const
+{
+    LadybugFrameTimingStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu frames in %.1fs at %.2ffps (expected %.2f), %llu dropped in %llu events (%llu missing sequence IDs), "
+        "delta %.1f - %.1fms, jitter p50 %.2fms p99 %.2fms max %.2fms, max lag %.1fms, behind %llu times\n",
+        pszName,
+        stats.ulFrames,
+        stats.dSeconds,
+        stats.dMeasuredFrameRate,
+        stats.dFrameRate,
+        stats.ulDroppedFrames,
+        stats.ulDropEvents,
+        stats.ulSequenceGaps,
+        stats.dMinDeltaMs,
+        stats.dMaxDeltaMs,
+        stats.dJitterP50Ms,
+        stats.dJitterP99Ms,
+        stats.dJitterMaxMs,
+        stats.dMaxLagMs,
+        stats.ulBehindEvents );
+}
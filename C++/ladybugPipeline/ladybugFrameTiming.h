@@ -0,0 +1,228 @@
+//=============================================================================
+// ladybugFrameTiming.h
+//
+// Checks that a capture keeps up with the camera, from the timestamps and
+// sequence IDs of the images.
+//
+// The time between frames is taken from the cycle time (ulCycleSeconds and
+// ulCycleCount, in 1/8000 s), which comes from the camera rather than the
+// host. The cycle time wraps every 128 seconds; a delta that goes back by
+// more than 64 seconds is unwrapped, and when the wall clock timestamps are
+// more than 64 seconds apart the whole number of wraps in between is added
+// back. A small step back means a frame out of order and is not counted.
+//
+// Each delta is compared with the frame period. A delta longer than
+// dDropFactor periods means frames were lost; so does a gap in the sequence
+// IDs. Deltas and their deviation from the period (the jitter) are kept in
+// LadybugHistograms.
+//
+// Frames fed live with addFrame() are also compared with the host clock.
+// The lag is how much later a frame arrived than its camera time says it
+// should have, relative to the earliest arrival seen. It grows when frames
+// wait in the driver's buffers because the pipeline is not keeping up. The
+// baseline follows a drift of up to 1000 ppm between the two clocks.
+// Recorded frames read back from a stream are fed with addRecordedFrame(),
+// which skips the lag.
+//
+// Drops, and the pipeline falling behind or catching up, are reported to a
+// LadybugFrameTimingListener as they are detected, or printed to stdout if
+// there is no listener.
+//
+// Usage:
+//    LadybugFrameTimingConfig config;
+//    config.dFrameRate = 10.0;
+//    LadybugFrameTimingAnalyzer timing;
+//    timing.initialize( config );
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        timing.addFrame( image );
+//        ...
+//    }
+//    timing.printStats( "Timing" );
+//=============================================================================
+
+#ifndef LADYBUGFRAMETIMING_H
+#define LADYBUGFRAMETIMING_H
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugMetrics.h"
+
+struct LadybugFrameTimingConfig
+{
+    /** Expected frames per second. 0 takes the median of the first frames. */
+    double dFrameRate;
+
+    /** A delta longer than this many frame periods counts as dropped frames. */
+    double dDropFactor;
+
+    /** Lag that counts as falling behind. 0 uses four frame periods. */
+    double dBehindMs;
+
+    LadybugFrameTimingConfig()
+        : dFrameRate( 0.0 ),
+          dDropFactor( 1.5 ),
+          dBehindMs( 0.0 )
+    {
+    }
+};
+
+enum LadybugFrameTimingEventType
+{
+    /** Frames were lost before this one. */
+    LADYBUG_TIMING_DROP,
+
+    /** The lag went above dBehindMs. */
+    LADYBUG_TIMING_BEHIND,
+
+    /** The lag went back below half of dBehindMs. */
+    LADYBUG_TIMING_CAUGHT_UP
+};
+
+struct LadybugFrameTimingEvent
+{
+    LadybugFrameTimingEventType type;
+
+    /** Index of the frame that raised the event, counting from 0. */
+    unsigned long long ulFrame;
+    unsigned int uiSequenceId;
+
+    /** Camera time of the frame since the first frame. */
+    double dSeconds;
+
+    /** For LADYBUG_TIMING_DROP: frames lost, and the delta that gave them away. */
+    unsigned int uiDroppedFrames;
+    double dDeltaMs;
+
+    /** For LADYBUG_TIMING_BEHIND and LADYBUG_TIMING_CAUGHT_UP. */
+    double dLagMs;
+};
+
+class LadybugFrameTimingListener
+{
+public:
+    virtual ~LadybugFrameTimingListener() {}
+
+    /** Called on the thread that added the frame. */
+    virtual void onTimingEvent( const LadybugFrameTimingEvent& event ) = 0;
+};
+
+/** Counters reported by LadybugFrameTimingAnalyzer::getStats(). */
+struct LadybugFrameTimingStats
+{
+    unsigned long long ulFrames;
+
+    /** Frames lost, as the larger of the timestamp and sequence ID evidence. */
+    unsigned long long ulDroppedFrames;
+
+    /** Frames missing from the sequence IDs alone. */
+    unsigned long long ulSequenceGaps;
+
+    unsigned long long ulDropEvents;
+    unsigned long long ulBehindEvents;
+
+    /** Expected rate, and the rate measured over the whole capture. */
+    double dFrameRate;
+    double dMeasuredFrameRate;
+
+    /** Camera time from the first frame to the last. */
+    double dSeconds;
+
+    double dMinDeltaMs;
+    double dMaxDeltaMs;
+
+    /** Deviation of the deltas from the frame period. */
+    double dJitterP50Ms;
+    double dJitterP99Ms;
+    double dJitterMaxMs;
+
+    /** Lag now, and the largest seen. Live frames only. */
+    double dLagMs;
+    double dMaxLagMs;
+    bool bBehind;
+};
+
+class LadybugFrameTimingAnalyzer
+{
+public:
+    LadybugFrameTimingAnalyzer();
+
+    /** Set the configuration and forget every frame seen so far. */
+    void initialize( const LadybugFrameTimingConfig& config );
+
+    /** The listener must outlive the analyzer. NULL prints events to stdout. */
+    void setListener( LadybugFrameTimingListener* pListener );
+
+    /** Add a frame that has just been grabbed. */
+    void addFrame( const LadybugImage& image );
+
+    /** Add a frame read back from a recording. */
+    void addRecordedFrame( const LadybugImage& image );
+
+    /** Frame rate from the last two frames, for display. */
+    double getLastFrameRate() const;
+
+    void getStats( LadybugFrameTimingStats* pStats ) const;
+
+    /** Deltas between frames, and their deviation from the period, in nanoseconds. */
+    const LadybugHistogram& getDeltaHistogram() const;
+    const LadybugHistogram& getJitterHistogram() const;
+
+    /** Print the counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+    /** Camera time of an image in cycle counts, 0 - 1024000. */
+    static double getCycleTime( const LadybugTimestamp& timeStamp );
+
+    /** Seconds from one timestamp to the next, unwrapping the cycle time. */
+    static double getDeltaSeconds( const LadybugTimestamp& previous, const LadybugTimestamp& current );
+
+private:
+    LadybugFrameTimingAnalyzer( const LadybugFrameTimingAnalyzer& );
+    LadybugFrameTimingAnalyzer& operator=( const LadybugFrameTimingAnalyzer& );
+
+    void analyze( const LadybugImage& image, bool bLive, std::chrono::steady_clock::time_point arrival );
+
+    // Check a delta against the period. Called with m_mutex held; events
+    // are queued in pEvents and raised after it is released.
+    void checkDelta( double dDelta, unsigned int uiSequenceGap, std::vector<LadybugFrameTimingEvent>* pEvents );
+
+    void checkLag( double dLagMs, std::vector<LadybugFrameTimingEvent>* pEvents );
+
+    LadybugFrameTimingEvent makeEvent( LadybugFrameTimingEventType type ) const;
+
+    void raise( const LadybugFrameTimingEvent& event );
+
+    mutable std::mutex m_mutex;
+    LadybugFrameTimingConfig m_config;
+    LadybugFrameTimingListener* m_pListener;
+
+    // Frame period in seconds, 0 until it is known
+    double m_dPeriod;
+
+    // Deltas kept until the period is learnt
+    std::vector<double> m_learningDeltas;
+
+    bool m_bHavePrevious;
+    LadybugTimestamp m_previous;
+    unsigned int m_uiPreviousSequenceId;
+    double m_dLastDelta;
+    double m_dSeconds;
+
+    // Lag baseline: arrival time minus camera time, in seconds
+    bool m_bHaveLagBase;
+    std::chrono::steady_clock::time_point m_firstArrival;
+    double m_dLagBase;
+
+    LadybugHistogram m_deltas;
+    LadybugHistogram m_jitter;
+
+    LadybugFrameTimingStats m_stats;
+};
+
+#endif // LADYBUGFRAMETIMING_H
@@ -0,0 +1,669 @@
+//=============================================================================
+// ladybugJpegEncoder.cpp
+//=============================================================================
+
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugThreadPlacement.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+namespace
+{
+// The encoder uses 4:2:0 sampling, so an MCU is 16x16 pixels
+const unsigned int MCU_SIZE = 16;
+
+// A restart interval is a 16-bit count of MCUs
+const unsigned int MAX_RESTART_INTERVAL = 65535;
+
+const unsigned char MARKER_SOF0 = 0xc0;
+const unsigned char MARKER_SOF2 = 0xc2;
+const unsigned char MARKER_RST0 = 0xd0;
+const unsigned char MARKER_EOI = 0xd9;
+const unsigned char MARKER_SOS = 0xda;
+const unsigned char MARKER_DRI = 0xdd;
+
+unsigned int getBytesPerPixel( LadybugPixelFormat pixelFormat )
+{
+    switch ( pixelFormat )
+    {
+    case LADYBUG_BGR:
+        return 3;
+    case LADYBUG_BGRU:
+        return 4;
+    case LADYBUG_BGRU16:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+//
+// libjpeg error handling. The default handler calls exit(), so errors jump
+// back to encodeRows() instead.
+//
+struct ErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void onError( j_common_ptr cinfo )
+{
+    ErrorManager* pError = (ErrorManager*)cinfo->err;
+    longjmp( pError->jump, 1 );
+}
+
+void onMessage( j_common_ptr /*cinfo*/ )
+{
+}
+
+//
+// libjpeg destination that appends to a std::vector
+//
+struct VectorDestination
+{
+    jpeg_destination_mgr pub;
+    std::vector<unsigned char>* pBuffer;
+};
+
+void initDestination( j_compress_ptr cinfo )
+{
+    VectorDestination* pDest = (VectorDestination*)cinfo->dest;
+    if ( pDest->pBuffer->size() < 64 * 1024 )
+    {
+        pDest->pBuffer->resize( 64 * 1024 );
+    }
+    pDest->pub.next_output_byte = pDest->pBuffer->data();
+    pDest->pub.free_in_buffer = pDest->pBuffer->size();
+}
+
+boolean emptyOutputBuffer( j_compress_ptr cinfo )
+{
+    VectorDestination* pDest = (VectorDestination*)cinfo->dest;
+    const size_t used = pDest->pBuffer->size();
+    pDest->pBuffer->resize( used * 2 );
+    pDest->pub.next_output_byte = pDest->pBuffer->data() + used;
+    pDest->pub.free_in_buffer = pDest->pBuffer->size() - used;
+    return TRUE;
+}
+
+void termDestination( j_compress_ptr cinfo )
+{
+    VectorDestination* pDest = (VectorDestination*)cinfo->dest;
+    pDest->pBuffer->resize( pDest->pBuffer->size() - pDest->pub.free_in_buffer );
+}
+
+// Convert one BGR, BGRU or BGRU16 row to what libjpeg is given as input
+void convertRow(
+    const unsigned char* pSrc,
+    unsigned int uiCols,
+    LadybugPixelFormat pixelFormat,
+    unsigned char* pDst )
+{
+    const unsigned int uiBytesPerPixel = getBytesPerPixel( pixelFormat );
+
+    // 16-bit channels are little endian, so the high byte is the second one
+    const unsigned int uiOffset = ( pixelFormat == LADYBUG_BGRU16 ) ? 1 : 0;
+    const unsigned int uiChannelSize = ( pixelFormat == LADYBUG_BGRU16 ) ? 2 : 1;
+
+    for ( unsigned int uiCol = 0; uiCol < uiCols; uiCol++ )
+    {
+        const unsigned char* pPixel = pSrc + uiCol * uiBytesPerPixel + uiOffset;
+#ifdef JCS_EXTENSIONS
+        pDst[ 0 ] = pPixel[ 0 ];
+        pDst[ 1 ] = pPixel[ uiChannelSize ];
+        pDst[ 2 ] = pPixel[ 2 * uiChannelSize ];
+        pDst[ 3 ] = 0xff;
+        pDst += 4;
+#else
+        pDst[ 0 ] = pPixel[ 2 * uiChannelSize ];
+        pDst[ 1 ] = pPixel[ uiChannelSize ];
+        pDst[ 2 ] = pPixel[ 0 ];
+        pDst += 3;
+#endif
+    }
+}
+
+// Encode uiRows rows starting at pRows into a standalone JPEG. Returns false
+// on error. Only plain data lives in this frame, so longjmp() out of libjpeg
+// is safe.
+bool encodeRows(
+    const unsigned char* pRows,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugPixelFormat pixelFormat,
+    int iQuality,
+    unsigned char* pRowBuffer,
+    std::vector<unsigned char>* pOutput )
+{
+    jpeg_compress_struct cinfo;
+    ErrorManager error;
+    VectorDestination dest;
+
+    cinfo.err = jpeg_std_error( &error.pub );
+    error.pub.error_exit = onError;
+    error.pub.output_message = onMessage;
+
+    if ( setjmp( error.jump ) )
+    {
+        jpeg_destroy_compress( &cinfo );
+        return false;
+    }
+
+    jpeg_create_compress( &cinfo );
+
+    dest.pub.init_destination = initDestination;
+    dest.pub.empty_output_buffer = emptyOutputBuffer;
+    dest.pub.term_destination = termDestination;
+    dest.pBuffer = pOutput;
+    cinfo.dest = &dest.pub;
+
+    cinfo.image_width = uiCols;
+    cinfo.image_height = uiRows;
+
+    // BGR and BGRU rows go to libjpeg-turbo as they are. Anything else is
+    // converted a row at a time.
+#ifdef JCS_EXTENSIONS
+    const bool bDirect = ( pixelFormat == LADYBUG_BGRU || pixelFormat == LADYBUG_BGR );
+    cinfo.input_components = ( pixelFormat == LADYBUG_BGR ) ? 3 : 4;
+    cinfo.in_color_space = ( pixelFormat == LADYBUG_BGR ) ? JCS_EXT_BGR : JCS_EXT_BGRX;
+#else
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    const bool bDirect = false;
+#endif
+
+    jpeg_set_defaults( &cinfo );
+    jpeg_set_quality( &cinfo, iQuality, TRUE );
+
+    // Every strip of an image must use the same tables and sampling so the
+    // strips can be joined. Standard Huffman tables are fixed; optimized
+    // ones would differ between strips.
+    cinfo.optimize_coding = FALSE;
+    cinfo.comp_info[ 0 ].h_samp_factor = 2;
+    cinfo.comp_info[ 0 ].v_samp_factor = 2;
+    cinfo.comp_info[ 1 ].h_samp_factor = 1;
+    cinfo.comp_info[ 1 ].v_samp_factor = 1;
+    cinfo.comp_info[ 2 ].h_samp_factor = 1;
+    cinfo.comp_info[ 2 ].v_samp_factor = 1;
+
+    jpeg_start_compress( &cinfo, TRUE );
+
+    const unsigned int uiStride = uiCols * getBytesPerPixel( pixelFormat );
+    while ( cinfo.next_scanline < cinfo.image_height )
+    {
+        const unsigned char* pSrc = pRows + (size_t)cinfo.next_scanline * uiStride;
+        JSAMPROW row;
+        if ( bDirect )
+        {
+            row = (JSAMPROW)pSrc;
+        }
+        else
+        {
+            convertRow( pSrc, uiCols, pixelFormat, pRowBuffer );
+            row = pRowBuffer;
+        }
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+
+    return true;
+}
+
+unsigned int readShort( const unsigned char* pData )
+{
+    return ( pData[ 0 ] << 8 ) | pData[ 1 ];
+}
+
+void writeShort( unsigned char* pData, unsigned int uiValue )
+{
+    pData[ 0 ] = (unsigned char)( uiValue >> 8 );
+    pData[ 1 ] = (unsigned char)( uiValue & 0xff );
+}
+
+// Find the SOS marker of a JPEG, and the SOF marker if pSofOffset is given.
+// Returns false if the headers are malformed.
+bool findScan( const std::vector<unsigned char>& jpeg, size_t* pSosOffset, size_t* pSofOffset )
+{
+    size_t offset = 2;
+    bool bFoundSof = false;
+
+    while ( offset + 4 <= jpeg.size() )
+    {
+        if ( jpeg[ offset ] != 0xff )
+        {
+            return false;
+        }
+
+        const unsigned char marker = jpeg[ offset + 1 ];
+        if ( marker == MARKER_SOS )
+        {
+            *pSosOffset = offset;
+            return pSofOffset == NULL || bFoundSof;
+        }
+
+        if ( marker >= MARKER_SOF0 && marker <= MARKER_SOF2 && pSofOffset != NULL )
+        {
+            *pSofOffset = offset;
+            bFoundSof = true;
+        }
+
+        offset += 2 + readShort( &jpeg[ offset + 2 ] );
+    }
+
+    return false;
+}
+
+bool endsWithEoi( const std::vector<unsigned char>& jpeg )
+{
+    const size_t size = jpeg.size();
+    return size >= 4 && jpeg[ size - 2 ] == 0xff && jpeg[ size - 1 ] == MARKER_EOI;
+}
+
+} // namespace
+
+struct LadybugJpegEncoder::Batch
+{
+    /** Strips not encoded yet. */
+    std::atomic<unsigned int> uiRemaining;
+    std::atomic<bool> bFailed;
+};
+
+struct LadybugJpegEncoder::Strip
+{
+    Batch* pBatch;
+    const unsigned char* pRows;
+    unsigned int uiCols;
+    unsigned int uiRows;
+    LadybugPixelFormat pixelFormat;
+    int iQuality;
+    std::vector<unsigned char>* pOutput;
+};
+
+LadybugJpegEncoder::LadybugJpegEncoder()
+    : m_bRunning( false ),
+      m_iQuality( 85 ),
+      m_uiStripsPerImage( 0 )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugJpegEncoder::~LadybugJpegEncoder()
+{
+    shutdown();
+}
+
+LadybugError
+LadybugJpegEncoder::initialize(
+    unsigned int uiNumThreads,
+    int iQuality,
+    unsigned int uiStripsPerImage )
+{
+    if ( iQuality < 1 || iQuality > 100 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    shutdown();
+
+    if ( uiNumThreads == 0 )
+    {
+        uiNumThreads = std::thread::hardware_concurrency();
+        if ( uiNumThreads == 0 )
+        {
+            uiNumThreads = LADYBUG_NUM_CAMERAS;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_iQuality = iQuality;
+    m_uiStripsPerImage = uiStripsPerImage;
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiNumThreads = uiNumThreads;
+
+    // Room for a few calls' worth of strips; encodeImages() waits if the
+    // queue fills
+    m_strips.initialize( 4 * uiNumThreads + LADYBUG_NUM_CAMERAS );
+
+    m_bRunning = true;
+    for ( unsigned int i = 0; i < uiNumThreads; i++ )
+    {
+        m_threads.push_back( std::thread( &LadybugJpegEncoder::workerLoop, this ) );
+    }
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugJpegEncoder::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_bRunning )
+        {
+            return;
+        }
+        m_bRunning = false;
+    }
+
+    m_strips.close();
+    for ( size_t i = 0; i < m_threads.size(); i++ )
+    {
+        m_threads[ i ].join();
+    }
+    m_threads.clear();
+}
+
+void
+LadybugJpegEncoder::setQuality( int iQuality )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( iQuality >= 1 && iQuality <= 100 )
+    {
+        m_iQuality = iQuality;
+    }
+}
+
+int
+LadybugJpegEncoder::getQuality() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_iQuality;
+}
+
+LadybugError
+LadybugJpegEncoder::encodeImage(
+    const unsigned char* pImage,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugPixelFormat pixelFormat,
+    std::vector<unsigned char>* pOutput )
+{
+    return encodeImages( &pImage, 1, uiCols, uiRows, pixelFormat, pOutput );
+}
+
+LadybugError
+LadybugJpegEncoder::encodeImages(
+    const unsigned char* const* arpImages,
+    unsigned int uiNumImages,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugPixelFormat pixelFormat,
+    std::vector<unsigned char>* arOutputs )
+{
+    const unsigned int uiBytesPerPixel = getBytesPerPixel( pixelFormat );
+    if ( uiBytesPerPixel == 0 )
+    {
+        return LADYBUG_NOT_SUPPORTED;
+    }
+
+    if ( uiNumImages == 0 || uiCols == 0 || uiRows == 0 || arpImages == NULL || arOutputs == NULL )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    LadybugStageTimer encodeTimer( LADYBUG_STAGE_ENCODE );
+
+    Batch batch;
+    std::vector<Strip> strips;
+    std::vector<std::vector<unsigned char> > stripOutputs;
+    unsigned int uiStrips = 1;
+    unsigned int uiRestartInterval = 0;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        if ( !m_bRunning )
+        {
+            return LADYBUG_NOT_INITIALIZED;
+        }
+
+        // Plan the strips. Every strip but the last is a whole number of MCU
+        // rows, and a strip is one restart interval, so it must not hold
+        // more than MAX_RESTART_INTERVAL MCUs.
+        const unsigned int uiNumThreads = (unsigned int)m_threads.size();
+        uiStrips = m_uiStripsPerImage;
+        if ( uiStrips == 0 )
+        {
+            uiStrips = ( uiNumThreads + uiNumImages - 1 ) / uiNumImages;
+        }
+
+        const unsigned int uiMcuCols = ( uiCols + MCU_SIZE - 1 ) / MCU_SIZE;
+        const unsigned int uiMcuRows = ( uiRows + MCU_SIZE - 1 ) / MCU_SIZE;
+        unsigned int uiStripMcuRows = ( uiMcuRows + uiStrips - 1 ) / uiStrips;
+        if ( uiStrips > 1 && uiStripMcuRows * uiMcuCols > MAX_RESTART_INTERVAL )
+        {
+            uiStripMcuRows = MAX_RESTART_INTERVAL / uiMcuCols;
+            if ( uiStripMcuRows == 0 )
+            {
+                uiStripMcuRows = uiMcuRows;
+            }
+        }
+        uiStrips = ( uiMcuRows + uiStripMcuRows - 1 ) / uiStripMcuRows;
+        uiRestartInterval = uiStripMcuRows * uiMcuCols;
+
+        const unsigned int uiStripRows = uiStripMcuRows * MCU_SIZE;
+        const size_t stride = (size_t)uiCols * uiBytesPerPixel;
+
+        strips.resize( uiNumImages * uiStrips );
+        if ( uiStrips > 1 )
+        {
+            stripOutputs.resize( uiNumImages * uiStrips );
+        }
+
+        for ( unsigned int uiImage = 0; uiImage < uiNumImages; uiImage++ )
+        {
+            for ( unsigned int uiStrip = 0; uiStrip < uiStrips; uiStrip++ )
+            {
+                const unsigned int uiFirstRow = uiStrip * uiStripRows;
+                const unsigned int uiIndex = uiImage * uiStrips + uiStrip;
+
+                Strip& strip = strips[ uiIndex ];
+                strip.pBatch = &batch;
+                strip.pRows = arpImages[ uiImage ] + uiFirstRow * stride;
+                strip.uiCols = uiCols;
+                strip.uiRows = ( uiFirstRow + uiStripRows <= uiRows ) ? uiStripRows : uiRows - uiFirstRow;
+                strip.pixelFormat = pixelFormat;
+                strip.iQuality = m_iQuality;
+                strip.pOutput = ( uiStrips > 1 ) ? &stripOutputs[ uiIndex ] : &arOutputs[ uiImage ];
+                strip.pOutput->clear();
+            }
+        }
+    }
+
+    batch.uiRemaining = (unsigned int)strips.size();
+    batch.bFailed = false;
+
+    for ( size_t i = 0; i < strips.size(); i++ )
+    {
+        if ( !m_strips.push( &strips[ i ] ) )
+        {
+            // Shut down while queueing; the rest are never encoded
+            batch.bFailed = true;
+            batch.uiRemaining -= (unsigned int)( strips.size() - i );
+            break;
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_stripDone.wait( lock, [&batch] { return batch.uiRemaining == 0; } );
+    }
+
+    bool bFailed = batch.bFailed;
+    if ( !bFailed && uiStrips > 1 )
+    {
+        for ( unsigned int uiImage = 0; uiImage < uiNumImages && !bFailed; uiImage++ )
+        {
+            bFailed = !joinStrips(
+                &stripOutputs[ uiImage * uiStrips ],
+                uiStrips,
+                uiRows,
+                uiRestartInterval,
+                &arOutputs[ uiImage ] );
+        }
+    }
+
+    unsigned long long ulBytesOut = 0;
+    for ( unsigned int uiImage = 0; uiImage < uiNumImages; uiImage++ )
+    {
+        ulBytesOut += arOutputs[ uiImage ].size();
+    }
+    encodeTimer.setBytes( ulBytesOut );
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( bFailed )
+        {
+            m_stats.ulErrors += uiNumImages;
+        }
+        else
+        {
+            m_stats.ulImages += uiNumImages;
+            m_stats.ulStrips += strips.size();
+            m_stats.ulBytesIn += (unsigned long long)uiNumImages * uiCols * uiRows * uiBytesPerPixel;
+            m_stats.ulBytesOut += ulBytesOut;
+        }
+    }
+
+    return bFailed ? LADYBUG_JPEG_ERROR : LADYBUG_OK;
+}
+
+void
+LadybugJpegEncoder::workerLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_ENCODE, "jpeg encoder" );
+    std::vector<unsigned char> scratch;
+
+    Strip* pStrip;
+    while ( m_strips.pop( &pStrip ) )
+    {
+        Batch* pBatch = pStrip->pBatch;
+        if ( !encodeStrip( pStrip, &scratch ) )
+        {
+            pBatch->bFailed = true;
+        }
+
+        // The batch may be gone once the count reaches zero
+        if ( pBatch->uiRemaining.fetch_sub( 1 ) == 1 )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stripDone.notify_all();
+        }
+    }
+}
+
+bool
+LadybugJpegEncoder::encodeStrip( Strip* pStrip, std::vector<unsigned char>* pScratch )
+{
+    // Room for one converted row, 4 bytes per pixel at most
+    if ( pScratch->size() < pStrip->uiCols * 4 )
+    {
+        pScratch->resize( pStrip->uiCols * 4 );
+    }
+
+    return encodeRows(
+        pStrip->pRows,
+        pStrip->uiCols,
+        pStrip->uiRows,
+        pStrip->pixelFormat,
+        pStrip->iQuality,
+        pScratch->data(),
+        pStrip->pOutput );
+}
+
+bool
+LadybugJpegEncoder::joinStrips(
+    std::vector<unsigned char>* arStrips,
+    unsigned int uiNumStrips,
+    unsigned int uiRows,
+    unsigned int uiRestartInterval,
+    std::vector<unsigned char>* pOutput )
+{
+    const std::vector<unsigned char>& first = arStrips[ 0 ];
+    size_t sosOffset = 0;
+    size_t sofOffset = 0;
+    if ( !endsWithEoi( first ) || !findScan( first, &sosOffset, &sofOffset ) )
+    {
+        return false;
+    }
+
+    size_t totalSize = first.size() + 6;
+    for ( unsigned int uiStrip = 1; uiStrip < uiNumStrips; uiStrip++ )
+    {
+        totalSize += arStrips[ uiStrip ].size() + 2;
+    }
+
+    pOutput->clear();
+    pOutput->reserve( totalSize );
+
+    // Headers of the first strip, with the full image height and a restart
+    // interval of one strip
+    pOutput->insert( pOutput->end(), first.begin(), first.begin() + sosOffset );
+    writeShort( &( *pOutput )[ sofOffset + 5 ], uiRows );
+
+    const unsigned char dri[] = { 0xff, MARKER_DRI, 0x00, 0x04,
+        (unsigned char)( uiRestartInterval >> 8 ), (unsigned char)( uiRestartInterval & 0xff ) };
+    pOutput->insert( pOutput->end(), dri, dri + sizeof( dri ) );
+
+    // Scan header and entropy-coded data of the first strip, without its EOI
+    pOutput->insert( pOutput->end(), first.begin() + sosOffset, first.end() - 2 );
+
+    for ( unsigned int uiStrip = 1; uiStrip < uiNumStrips; uiStrip++ )
+    {
+        const std::vector<unsigned char>& strip = arStrips[ uiStrip ];
+        size_t stripSosOffset = 0;
+        if ( !endsWithEoi( strip ) || !findScan( strip, &stripSosOffset, NULL ) )
+        {
+            return false;
+        }
+
+        // Each strip starts with its DC predictors reset, exactly as a decoder
+        // resets them after a restart marker
+        pOutput->push_back( 0xff );
+        pOutput->push_back( (unsigned char)( MARKER_RST0 + ( ( uiStrip - 1 ) & 7 ) ) );
+
+        const size_t dataOffset = stripSosOffset + 2 + readShort( &strip[ stripSosOffset + 2 ] );
+        pOutput->insert( pOutput->end(), strip.begin() + dataOffset, strip.end() - 2 );
+    }
+
+    pOutput->push_back( 0xff );
+    pOutput->push_back( MARKER_EOI );
+
+    return true;
+}
+
+void
+LadybugJpegEncoder::getStats( LadybugJpegEncoderStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+    m_strips.getStats( &pStats->stripQueue );
+}
+
+void
+LadybugJpegEncoder::printStats( const char* pszName ) const
+{
+    LadybugJpegEncoderStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %u threads, %llu images in %llu strips, %.1fMB to %.1fMB, %llu errors, strip queue high water %u of %u\n",
+        pszName,
+        stats.uiNumThreads,
+        stats.ulImages,
+        stats.ulStrips,
+        stats.ulBytesIn / ( 1024.0 * 1024.0 ),
+        stats.ulBytesOut / ( 1024.0 * 1024.0 ),
+        stats.ulErrors,
+        stats.stripQueue.uiHighWater,
+        stats.stripQueue.uiCapacity );
+}
@@ -0,0 +1,146 @@
+//=============================================================================
+// ladybugJpegEncoder.h
+//
+// Encodes color-processed images to JPEG in memory on a pool of threads.
+//
+// encodeImages() encodes the six camera images of a frame at the same time,
+// so saving a frame takes about as long as encoding one image. An image can
+// also be split into horizontal strips that are encoded on different
+// threads. The strips are joined into one baseline JPEG using restart
+// markers: each strip is one restart interval, and since every strip is
+// encoded with the same quantization and standard Huffman tables, the
+// entropy-coded data can be concatenated with an RSTn marker between
+// strips. Any JPEG decoder can read the result.
+//
+// The encoded data is returned in memory; hand it to a LadybugFileWriter to
+// write it without waiting for the disk.
+//
+// Usage:
+//    encoder.initialize( 0, 85 );
+//    std::vector<unsigned char> arJpegs[ LADYBUG_NUM_CAMERAS ];
+//    encoder.encodeImages( pBufferSet->arpBuffers, LADYBUG_NUM_CAMERAS,
+//        uiCols, uiRows, LADYBUG_BGRU, arJpegs );
+//    writer.write( "camera0.jpg", std::move( arJpegs[ 0 ] ) );
+//=============================================================================
+
+#ifndef LADYBUGJPEGENCODER_H
+#define LADYBUGJPEGENCODER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFrameQueue.h"
+
+/** Counters reported by LadybugJpegEncoder::getStats(). */
+struct LadybugJpegEncoderStats
+{
+    /** Number of images encoded, and the number of strips they were split into. */
+    unsigned long long ulImages;
+    unsigned long long ulStrips;
+
+    /** Bytes of image data read and JPEG data produced. */
+    unsigned long long ulBytesIn;
+    unsigned long long ulBytesOut;
+
+    /** Number of images that failed to encode. */
+    unsigned long long ulErrors;
+
+    unsigned int uiNumThreads;
+
+    /** The queue of strips waiting for an encoder thread. */
+    LadybugFrameQueueStats stripQueue;
+};
+
+class LadybugJpegEncoder
+{
+public:
+    LadybugJpegEncoder();
+    ~LadybugJpegEncoder();
+
+    /**
+     * Start the encoder threads.
+     *
+     * @param uiNumThreads      - Number of encoder threads. 0 uses one per
+     *                            hardware thread.
+     * @param iQuality          - JPEG quality, 1 - 100.
+     * @param uiStripsPerImage  - Number of strips each image is split into.
+     *                            0 picks enough strips to keep every thread
+     *                            busy for the images given in one call.
+     */
+    LadybugError initialize(
+        unsigned int uiNumThreads,
+        int iQuality = 85,
+        unsigned int uiStripsPerImage = 0 );
+
+    /** Stop the encoder threads. */
+    void shutdown();
+
+    void setQuality( int iQuality );
+    int getQuality() const;
+
+    /**
+     * Encode uiNumImages images of the same size concurrently and wait for
+     * all of them. arOutputs must hold uiNumImages vectors.
+     *
+     * Only LADYBUG_BGR, LADYBUG_BGRU and LADYBUG_BGRU16 images are
+     * supported. 16-bit images are encoded from their most significant byte.
+     */
+    LadybugError encodeImages(
+        const unsigned char* const* arpImages,
+        unsigned int uiNumImages,
+        unsigned int uiCols,
+        unsigned int uiRows,
+        LadybugPixelFormat pixelFormat,
+        std::vector<unsigned char>* arOutputs );
+
+    /** Encode one image, split into strips across the pool. */
+    LadybugError encodeImage(
+        const unsigned char* pImage,
+        unsigned int uiCols,
+        unsigned int uiRows,
+        LadybugPixelFormat pixelFormat,
+        std::vector<unsigned char>* pOutput );
+
+    void getStats( LadybugJpegEncoderStats* pStats ) const;
+
+    /** Print the encoder counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugJpegEncoder( const LadybugJpegEncoder& );
+    LadybugJpegEncoder& operator=( const LadybugJpegEncoder& );
+
+    struct Batch;
+    struct Strip;
+
+    void workerLoop();
+
+    // Encode one strip into its own standalone JPEG. Returns false on error.
+    bool encodeStrip( Strip* pStrip, std::vector<unsigned char>* pScratch );
+
+    // Join the strips of an image into pOutput. Returns false on error.
+    static bool joinStrips(
+        std::vector<unsigned char>* arStrips,
+        unsigned int uiNumStrips,
+        unsigned int uiRows,
+        unsigned int uiRestartInterval,
+        std::vector<unsigned char>* pOutput );
+
+    std::vector<std::thread> m_threads;
+    LadybugMpmcQueue<Strip*> m_strips;
+    bool m_bRunning;
+
+    int m_iQuality;
+    unsigned int m_uiStripsPerImage;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_stripDone;
+
+    LadybugJpegEncoderStats m_stats;
+};
+
+#endif // LADYBUGJPEGENCODER_H
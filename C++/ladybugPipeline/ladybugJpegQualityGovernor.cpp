@@ -0,0 +1,179 @@
+//=============================================================================
+// ladybugJpegQualityGovernor.cpp
+//=============================================================================
+
+#include "ladybugJpegQualityGovernor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+const int MIN_JPEG_QUALITY = 1;
+const int MAX_JPEG_QUALITY = 100;
+
+// Most the quiet intervals needed to step up grow by after failed steps up
+const unsigned int MAX_SETTLE_BACKOFF = 8;
+
+} // namespace
+
+LadybugJpegQualityGovernor::LadybugJpegQualityGovernor()
+{
+    initialize( LadybugJpegGovernorConfig() );
+}
+
+void
+LadybugJpegQualityGovernor::initialize( const LadybugJpegGovernorConfig& config )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_config = config;
+    m_config.iMinQuality = std::max( m_config.iMinQuality, MIN_JPEG_QUALITY );
+    m_config.iMaxQuality = std::min( std::max( m_config.iMaxQuality, m_config.iMinQuality ), MAX_JPEG_QUALITY );
+    m_config.iStepDown = std::max( m_config.iStepDown, 1 );
+    m_config.iStepUp = std::max( m_config.iStepUp, 1 );
+    m_config.uiIntervalFrames = std::max( m_config.uiIntervalFrames, 1u );
+    m_config.uiSettleIntervals = std::max( m_config.uiSettleIntervals, 1u );
+
+    m_ulNextFrame = m_config.uiIntervalFrames;
+    m_uiQuietIntervals = 0;
+    m_uiSettleIntervals = m_config.uiSettleIntervals;
+    m_uiIntervalsSinceUp = 0;
+    m_bSteppedUp = false;
+    m_dLastBacklog = 0.0;
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.iQuality = std::min( std::max( config.iInitialQuality, m_config.iMinQuality ), m_config.iMaxQuality );
+    m_stats.iLowestQuality = m_stats.iQuality;
+}
+
+int
+LadybugJpegQualityGovernor::getQuality() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats.iQuality;
+}
+
+bool
+LadybugJpegQualityGovernor::isDue( unsigned long long ulFrame ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return ulFrame >= m_ulNextFrame;
+}
+
+bool
+LadybugJpegQualityGovernor::update( unsigned long long ulFrame, const LadybugJpegLoad& load )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_ulNextFrame = ulFrame + m_config.uiIntervalFrames;
+    m_stats.ulIntervals++;
+    m_uiIntervalsSinceUp++;
+
+    const bool bBusFull = load.dBusUsage >= m_config.dBusUsageHigh;
+    const bool bRateLow =
+        load.dTargetFrameRate > 0.0 && load.dFrameRate < load.dTargetFrameRate * m_config.dMinFrameRateRatio;
+
+    // A high backlog that is already draining needs no further step down
+    const bool bBacklogGrowing = load.dBacklog >= m_config.dBacklogHigh && load.dBacklog >= m_dLastBacklog;
+    m_dLastBacklog = load.dBacklog;
+
+    if ( bBusFull || bRateLow || bBacklogGrowing )
+    {
+        m_uiQuietIntervals = 0;
+        if ( m_stats.iQuality <= m_config.iMinQuality )
+        {
+            m_stats.ulOverloadedAtMin++;
+            return false;
+        }
+
+        // Overload soon after a step up means that quality is too high for
+        // now; wait longer before trying it again
+        if ( m_bSteppedUp && m_uiIntervalsSinceUp <= m_uiSettleIntervals )
+        {
+            m_uiSettleIntervals = std::min( m_uiSettleIntervals * 2, m_config.uiSettleIntervals * MAX_SETTLE_BACKOFF );
+        }
+        m_bSteppedUp = false;
+
+        const char* pszReason = bBusFull ? "bus buffer full" : ( bRateLow ? "frame rate low" : "backlog growing" );
+        m_stats.ulStepsDown++;
+        return setQuality( m_stats.iQuality - m_config.iStepDown, ulFrame, load, pszReason );
+    }
+
+    const bool bQuiet =
+        load.dBacklog <= m_config.dBacklogLow &&
+        load.dBusUsage <= m_config.dBusUsageLow;
+    if ( !bQuiet )
+    {
+        m_uiQuietIntervals = 0;
+        return false;
+    }
+
+    if ( ++m_uiQuietIntervals < m_uiSettleIntervals || m_stats.iQuality >= m_config.iMaxQuality )
+    {
+        return false;
+    }
+
+    m_uiQuietIntervals = 0;
+    m_uiIntervalsSinceUp = 0;
+    m_bSteppedUp = true;
+    m_stats.ulStepsUp++;
+    return setQuality( m_stats.iQuality + m_config.iStepUp, ulFrame, load, "load low" );
+}
+
+bool
+LadybugJpegQualityGovernor::setQuality( int iQuality, unsigned long long ulFrame, const LadybugJpegLoad& load, const char* pszReason )
+{
+    iQuality = std::min( std::max( iQuality, m_config.iMinQuality ), m_config.iMaxQuality );
+    if ( iQuality == m_stats.iQuality )
+    {
+        return false;
+    }
+
+    char pszBusUsage[ 32 ] = "unknown";
+    if ( load.dBusUsage >= 0.0 )
+    {
+        snprintf( pszBusUsage, sizeof( pszBusUsage ), "%.0f%%", load.dBusUsage * 100.0 );
+    }
+
+    printf(
+        "Frame %llu: JPEG quality %d -> %d, %s (backlog %.0f%%, bus buffer %s, %.1f of %.1ffps)\n",
+        ulFrame,
+        m_stats.iQuality,
+        iQuality,
+        pszReason,
+        load.dBacklog * 100.0,
+        pszBusUsage,
+        load.dFrameRate,
+        load.dTargetFrameRate );
+
+    m_stats.iQuality = iQuality;
+    m_stats.iLowestQuality = std::min( m_stats.iLowestQuality, iQuality );
+    return true;
+}
+
+void
+LadybugJpegQualityGovernor::getStats( LadybugJpegGovernorStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugJpegQualityGovernor::printStats( const char* pszName ) const
+{
+    LadybugJpegGovernorStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: quality %d (lowest %d), %llu steps down and %llu up in %llu intervals, %llu intervals overloaded at the minimum\n",
+        pszName,
+        stats.iQuality,
+        stats.iLowestQuality,
+        stats.ulStepsDown,
+        stats.ulStepsUp,
+        stats.ulIntervals,
+        stats.ulOverloadedAtMin );
+}
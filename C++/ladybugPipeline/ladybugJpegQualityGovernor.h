@@ -0,0 +1,185 @@
+//=============================================================================
+// ladybugJpegQualityGovernor.h
+//
+// Closed-loop control of the camera's JPEG quality for the JPEG data
+// formats, so a recording keeps its frame rate when the disk or the bus
+// cannot keep up, at the cost of image quality.
+//
+// Every uiIntervalFrames frames the caller measures the load and passes it
+// to update():
+//
+//  - dBacklog: the fraction of the image buffers holding frames that have
+//    not been written yet. A backlog that keeps growing means the writer is
+//    slower than the camera.
+//  - dBusUsage: the JPEG buffer usage reported by the camera
+//    (ladybugGetAutoJPEGBufferUsage()), as a fraction. Near 1 the images no
+//    longer fit the bandwidth and the camera starts dropping them.
+//  - dFrameRate and dTargetFrameRate: the rate achieved over the interval
+//    and the rate the camera runs at.
+//
+// The quality steps down by iStepDown when any of these is over its high
+// mark, and again at each following interval while the backlog is not
+// shrinking. It steps back up by iStepUp once every measure has been under
+// its low mark for uiSettleIntervals intervals in a row; a step up that is
+// followed by overload within that many intervals doubles the wait, up to
+// eight times. It always stays within iMinQuality and iMaxQuality. Between
+// the marks it holds. Every change is printed with the frame index and the
+// load that caused it.
+//
+// The governor only decides; the caller sets the quality on the camera.
+//
+// Usage:
+//    LadybugJpegQualityGovernor governor;
+//    governor.initialize( config );
+//    ladybugSetJPEGQuality( context, governor.getQuality() );
+//    while ( ... )
+//    {
+//        ... grab and write frame ulFrame ...
+//        if ( governor.isDue( ulFrame ) )
+//        {
+//            LadybugJpegLoad load;
+//            ... measure ...
+//            if ( governor.update( ulFrame, load ) )
+//            {
+//                ladybugSetJPEGQuality( context, governor.getQuality() );
+//            }
+//        }
+//    }
+//=============================================================================
+
+#ifndef LADYBUGJPEGQUALITYGOVERNOR_H
+#define LADYBUGJPEGQUALITYGOVERNOR_H
+
+#include <mutex>
+
+struct LadybugJpegGovernorConfig
+{
+    LadybugJpegGovernorConfig()
+        : iInitialQuality( 80 ),
+          iMinQuality( 50 ),
+          iMaxQuality( 90 ),
+          iStepDown( 10 ),
+          iStepUp( 5 ),
+          uiIntervalFrames( 10 ),
+          uiSettleIntervals( 5 ),
+          dBacklogHigh( 0.5 ),
+          dBacklogLow( 0.1 ),
+          dBusUsageHigh( 0.95 ),
+          dBusUsageLow( 0.85 ),
+          dMinFrameRateRatio( 0.98 )
+    {
+    }
+
+    /** Quality to start at, 1 - 100. */
+    int iInitialQuality;
+
+    int iMinQuality;
+    int iMaxQuality;
+
+    int iStepDown;
+    int iStepUp;
+
+    /** Frames between measurements. */
+    unsigned int uiIntervalFrames;
+
+    /** Quiet intervals in a row before stepping up. */
+    unsigned int uiSettleIntervals;
+
+    /** Marks for the fraction of buffers waiting to be written. */
+    double dBacklogHigh;
+    double dBacklogLow;
+
+    /** Marks for the camera's JPEG buffer usage. */
+    double dBusUsageHigh;
+    double dBusUsageLow;
+
+    /** An achieved frame rate below this fraction of the target is overload. */
+    double dMinFrameRateRatio;
+};
+
+/** Load measured over one interval. */
+struct LadybugJpegLoad
+{
+    LadybugJpegLoad()
+        : dBacklog( 0.0 ),
+          dBusUsage( -1.0 ),
+          dFrameRate( 0.0 ),
+          dTargetFrameRate( 0.0 )
+    {
+    }
+
+    /** Fraction of the image buffers waiting to be written, 0 - 1. */
+    double dBacklog;
+
+    /** JPEG buffer usage of the camera, 0 - 1. Negative if unknown. */
+    double dBusUsage;
+
+    /** Achieved and expected frame rate. A target of 0 skips the check. */
+    double dFrameRate;
+    double dTargetFrameRate;
+};
+
+/** Counters reported by LadybugJpegQualityGovernor::getStats(). */
+struct LadybugJpegGovernorStats
+{
+    unsigned long long ulIntervals;
+    unsigned long long ulStepsDown;
+    unsigned long long ulStepsUp;
+
+    /** Intervals that were overloaded with the quality already at iMinQuality. */
+    unsigned long long ulOverloadedAtMin;
+
+    int iQuality;
+    int iLowestQuality;
+};
+
+class LadybugJpegQualityGovernor
+{
+public:
+    LadybugJpegQualityGovernor();
+
+    /** Set the configuration and go back to the initial quality. */
+    void initialize( const LadybugJpegGovernorConfig& config );
+
+    /** Quality to set on the camera. */
+    int getQuality() const;
+
+    /** Whether the load should be measured and passed to update() for this frame. */
+    bool isDue( unsigned long long ulFrame ) const;
+
+    /**
+     * Take the load measured up to ulFrame and adjust the quality. Returns
+     * true if the quality changed.
+     */
+    bool update( unsigned long long ulFrame, const LadybugJpegLoad& load );
+
+    void getStats( LadybugJpegGovernorStats* pStats ) const;
+
+    /** Print the counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugJpegQualityGovernor( const LadybugJpegQualityGovernor& );
+    LadybugJpegQualityGovernor& operator=( const LadybugJpegQualityGovernor& );
+
+    // Move to iQuality, clamped, and log the change
+    bool setQuality( int iQuality, unsigned long long ulFrame, const LadybugJpegLoad& load, const char* pszReason );
+
+    mutable std::mutex m_mutex;
+    LadybugJpegGovernorConfig m_config;
+
+    unsigned long long m_ulNextFrame;
+    unsigned int m_uiQuietIntervals;
+
+    // Quiet intervals needed to step up, after backing off
+    unsigned int m_uiSettleIntervals;
+    unsigned int m_uiIntervalsSinceUp;
+    bool m_bSteppedUp;
+
+    // Backlog at the previous interval, to tell a draining backlog from a growing one
+    double m_dLastBacklog;
+
+    LadybugJpegGovernorStats m_stats;
+};
+
+#endif // LADYBUGJPEGQUALITYGOVERNOR_H
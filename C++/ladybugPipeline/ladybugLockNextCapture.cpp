@@ -0,0 +1,429 @@
+//=============================================================================
+// ladybugLockNextCapture.cpp
+//=============================================================================
+
+#include "ladybugLockNextCapture.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+LadybugLockNextCapture::LadybugLockNextCapture()
+    : m_pSource( NULL ),
+      m_uiTimeoutMs( 100 ),
+      m_pTiming( NULL ),
+      m_bRunning( false ),
+      m_bHaveSequenceId( false ),
+      m_uiLastSequenceId( 0 ),
+      m_error( LADYBUG_OK )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugLockNextCapture::~LadybugLockNextCapture()
+{
+    stop();
+}
+
+LadybugError
+LadybugLockNextCapture::initialize(
+    LadybugContext context,
+    unsigned int uiMaxHeld,
+    unsigned int uiTimeoutMs )
+{
+    if ( context == NULL )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    m_cameraSource.setContext( context );
+    return initialize( &m_cameraSource, uiMaxHeld, uiTimeoutMs );
+}
+
+LadybugError
+LadybugLockNextCapture::initialize(
+    LadybugFrameSource* pSource,
+    unsigned int uiMaxHeld,
+    unsigned int uiTimeoutMs )
+{
+    if ( pSource == NULL || uiMaxHeld == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    m_pSource = pSource;
+    m_uiTimeoutMs = uiTimeoutMs;
+
+    std::vector<LadybugLockedFrame> frames( uiMaxHeld );
+    m_frames.swap( frames );
+    m_consumerQueues.clear();
+    m_latestOnly.clear();
+    m_deliver.clear();
+    resetQueues();
+    m_bHaveSequenceId = false;
+    m_error = LADYBUG_OK;
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiMaxHeld = uiMaxHeld;
+
+    return m_pSource->setGrabTimeout( m_uiTimeoutMs );
+}
+
+unsigned int
+LadybugLockNextCapture::addConsumer( bool bLatestOnly )
+{
+    // A consumer never has more than every held frame queued
+    std::unique_ptr<ConsumerQueue> pQueue( new ConsumerQueue() );
+    pQueue->initialize( m_frames.empty() ? 1 : (unsigned int)m_frames.size() );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_consumerQueues.push_back( std::move( pQueue ) );
+    m_latestOnly.push_back( bLatestOnly );
+    m_deliver.push_back( false );
+    return (unsigned int)m_consumerQueues.size() - 1;
+}
+
+void
+LadybugLockNextCapture::setTimingAnalyzer( LadybugFrameTimingAnalyzer* pTiming )
+{
+    m_pTiming = pTiming;
+}
+
+void
+LadybugLockNextCapture::resetQueues()
+{
+    const unsigned int uiMaxHeld = (unsigned int)m_frames.size();
+
+    m_freeFrames.clear();
+    for ( unsigned int i = 0; i < uiMaxHeld; i++ )
+    {
+        m_frames[ i ].refCount = 0;
+        m_freeFrames.push_back( uiMaxHeld - 1 - i );
+    }
+
+    for ( size_t i = 0; i < m_consumerQueues.size(); i++ )
+    {
+        m_consumerQueues[ i ]->initialize( uiMaxHeld );
+    }
+    m_released.initialize( uiMaxHeld );
+}
+
+LadybugError
+LadybugLockNextCapture::start()
+{
+    if ( m_pSource == NULL )
+    {
+        return LADYBUG_NOT_INITIALIZED;
+    }
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    // Unlock what a capture thread stopped by lock errors left held
+    if ( m_thread.joinable() )
+    {
+        stop();
+    }
+
+    // Reopen the queues closed by a previous stop()
+    if ( m_released.isClosed() )
+    {
+        resetQueues();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_error = LADYBUG_OK;
+    }
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugLockNextCapture::captureLoop, this );
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugLockNextCapture::stop()
+{
+    // Closing the queues wakes the capture thread and any consumer waiting
+    // in nextFrame()
+    m_released.close();
+    for ( size_t i = 0; i < m_consumerQueues.size(); i++ )
+    {
+        m_consumerQueues[ i ]->close();
+    }
+
+    // The capture thread may have stopped on its own after lock errors
+    m_bRunning = false;
+    if ( m_thread.joinable() )
+    {
+        m_thread.join();
+    }
+
+    if ( m_pSource == NULL )
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stats.uiHeld = 0;
+    }
+
+    m_pSource->unlockAll();
+}
+
+LadybugError
+LadybugLockNextCapture::getError() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_error;
+}
+
+LadybugLockedFrame*
+LadybugLockNextCapture::nextFrame( unsigned int uiConsumer, unsigned int uiTimeoutMs )
+{
+    if ( uiConsumer >= m_consumerQueues.size() )
+    {
+        return NULL;
+    }
+
+    // Frames left in a closed queue were unlocked by stop()
+    ConsumerQueue& queue = *m_consumerQueues[ uiConsumer ];
+    LadybugLockedFrame* pFrame = NULL;
+    if ( !queue.popFor( &pFrame, uiTimeoutMs ) || queue.isClosed() )
+    {
+        return NULL;
+    }
+
+    return pFrame;
+}
+
+void
+LadybugLockNextCapture::release( LadybugLockedFrame* pFrame )
+{
+    if ( pFrame == NULL || --pFrame->refCount > 0 )
+    {
+        return;
+    }
+
+    // There is room for every held frame. This only fails after stop(),
+    // which has unlocked everything already.
+    m_released.tryPush( pFrame );
+}
+
+void
+LadybugLockNextCapture::recycle( LadybugLockedFrame* pFrame )
+{
+    m_pSource->unlock( pFrame->image.uiBufferIndex );
+    m_freeFrames.push_back( (unsigned int)( pFrame - &m_frames[ 0 ] ) );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats.uiHeld--;
+}
+
+void
+LadybugLockNextCapture::unlockReleased()
+{
+    LadybugLockedFrame* pFrame;
+    while ( m_released.tryPop( &pFrame ) )
+    {
+        recycle( pFrame );
+    }
+}
+
+LadybugError
+LadybugLockNextCapture::captureOne()
+{
+    unlockReleased();
+
+    // Do not lock another buffer until a consumer releases one
+    if ( m_freeFrames.empty() )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stats.ulHeldFullStalls++;
+        }
+
+        LadybugLockedFrame* pFrame;
+        if ( !m_released.popFor( &pFrame, m_uiTimeoutMs ) )
+        {
+            return LADYBUG_TIMEOUT;
+        }
+        recycle( pFrame );
+    }
+
+    LadybugImage image;
+    LadybugError error = m_pSource->lockNext( &image );
+    if ( error != LADYBUG_OK )
+    {
+        if ( error != LADYBUG_TIMEOUT )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stats.ulLockErrors++;
+        }
+        return error;
+    }
+
+    if ( m_pTiming != NULL )
+    {
+        m_pTiming->addFrame( image );
+    }
+
+    // Latest-only consumers with a frame still waiting skip this one
+    unsigned int uiReceivers = 0;
+    unsigned int uiSkipped = 0;
+    for ( size_t i = 0; i < m_consumerQueues.size(); i++ )
+    {
+        m_deliver[ i ] = !m_latestOnly[ i ] || m_consumerQueues[ i ]->getSize() == 0;
+        if ( m_deliver[ i ] )
+        {
+            uiReceivers++;
+        }
+        else
+        {
+            uiSkipped++;
+        }
+    }
+
+    const bool bHaveConsumers = uiReceivers > 0;
+    unsigned long long ulFrameIndex;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        // Images the camera sent that were overwritten before we locked them
+        const unsigned int uiSequenceId = image.imageInfo.ulSequenceId;
+        if ( m_bHaveSequenceId && uiSequenceId > m_uiLastSequenceId + 1 )
+        {
+            m_stats.ulFramesDropped += uiSequenceId - m_uiLastSequenceId - 1;
+        }
+        m_uiLastSequenceId = uiSequenceId;
+        m_bHaveSequenceId = true;
+
+        ulFrameIndex = m_stats.ulFramesLocked++;
+        m_stats.ulLatestOnlySkips += uiSkipped;
+        if ( bHaveConsumers )
+        {
+            m_stats.uiHeld++;
+            if ( m_stats.uiHeld > m_stats.uiHeldHighWater )
+            {
+                m_stats.uiHeldHighWater = m_stats.uiHeld;
+            }
+        }
+    }
+
+    if ( !bHaveConsumers )
+    {
+        m_pSource->unlock( image.uiBufferIndex );
+        return LADYBUG_OK;
+    }
+
+    LadybugLockedFrame& frame = m_frames[ m_freeFrames.back() ];
+    m_freeFrames.pop_back();
+
+    frame.image = image;
+    frame.ulFrameIndex = ulFrameIndex;
+    frame.refCount = (int)uiReceivers;
+
+    // A consumer's queue only refuses the frame once it is closed; release
+    // the frame on its behalf
+    for ( size_t i = 0; i < m_consumerQueues.size(); i++ )
+    {
+        if ( m_deliver[ i ] && !m_consumerQueues[ i ]->tryPush( &frame ) )
+        {
+            release( &frame );
+        }
+    }
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugLockNextCapture::captureLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_GRAB, "capture" );
+
+    unsigned int uiErrors = 0;
+    unsigned int uiBackoffMs = 1;
+    while ( m_bRunning )
+    {
+        const LadybugError error = captureOne();
+        if ( error == LADYBUG_OK )
+        {
+            uiErrors = 0;
+            uiBackoffMs = 1;
+            continue;
+        }
+
+        // A timeout has waited already
+        if ( error == LADYBUG_TIMEOUT )
+        {
+            continue;
+        }
+
+        if ( ++uiErrors >= LOCKNEXT_ERROR_LIMIT )
+        {
+            printf(
+                "Capture stopped after %u lock errors in a row: %s\n",
+                uiErrors,
+                ladybugErrorToString( error ) );
+
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_error = error;
+            }
+
+            // Wake the consumers; nextFrame() returns NULL from now on
+            for ( size_t i = 0; i < m_consumerQueues.size(); i++ )
+            {
+                m_consumerQueues[ i ]->close();
+            }
+            m_bRunning = false;
+            break;
+        }
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( uiBackoffMs ) );
+        uiBackoffMs = std::min( uiBackoffMs * 2, LOCKNEXT_ERROR_BACKOFF_MAX_MS );
+    }
+}
+
+void
+LadybugLockNextCapture::getStats( LadybugCaptureStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugLockNextCapture::printStats( const char* pszName ) const
+{
+    LadybugCaptureStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu frames locked, %llu dropped, held high water %u of %u, %llu stalls on held buffers, %llu lock errors, "
+        "%llu skipped by latest-only consumers\n",
+        pszName,
+        stats.ulFramesLocked,
+        stats.ulFramesDropped,
+        stats.uiHeldHighWater,
+        stats.uiMaxHeld,
+        stats.ulHeldFullStalls,
+        stats.ulLockErrors,
+        stats.ulLatestOnlySkips );
+}
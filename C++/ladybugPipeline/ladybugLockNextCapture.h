@@ -0,0 +1,232 @@
+//=============================================================================
+// ladybugLockNextCapture.h
+//
+// Capture with ladybugLockNext()/ladybugUnlock() instead of the blocking
+// ladybugGrabImage() loop.
+//
+// A capture thread locks each new image and hands it to every registered
+// consumer. The image stays locked in the driver's buffer, so there is no
+// copy, and it is unlocked only after every consumer has released it. Up to
+// uiMaxHeld frames can be held at once; uiMaxHeld must be smaller than the
+// number of buffers given to ladybugInitializePlus() so the driver always
+// has a free buffer to fill.
+//
+// All ladybugLockNext() and ladybugUnlock() calls are made on the capture
+// thread. Each consumer gets frames through its own LadybugSpscQueue, and
+// release() passes the last reference back through a LadybugMpmcQueue, so
+// neither side takes a lock per frame.
+//
+// A consumer added as latest-only, such as a preview, is only given a frame
+// when it has none waiting, and skips the rest. It never holds more than
+// two frames, the one it is working on and the next, so a slow latest-only
+// consumer does not hold up capture or the other consumers.
+//
+// If ladybugLockNext() keeps failing with something other than a timeout,
+// as when the camera is unplugged, the capture thread backs off between
+// attempts, up to LOCKNEXT_ERROR_BACKOFF_MAX_MS. After
+// LOCKNEXT_ERROR_LIMIT failures in a row it stops, closes the consumer
+// queues so nextFrame() returns NULL, and getError() reports the error.
+//
+// A LadybugFrameTimingAnalyzer set with setTimingAnalyzer() sees every
+// locked image as soon as it is locked, on the capture thread.
+//
+// Capture can also run on any LadybugFrameSource, such as
+// LadybugSyntheticSource, by passing it to initialize() instead of a context.
+//
+// Usage:
+//    ladybugInitializePlus( context, 0, iNumberOfBuffers, NULL, 0 );
+//    ladybugStartLockNext( context, format );
+//    capture.initialize( context, iNumberOfBuffers - 2 );
+//    unsigned int uiConsumer = capture.addConsumer();
+//    capture.start();
+//    while ( ... )
+//    {
+//        LadybugLockedFrame* pFrame = capture.nextFrame( uiConsumer, 1000 );
+//        ... use pFrame->image ...
+//        capture.release( pFrame );
+//    }
+//    capture.stop();
+//=============================================================================
+
+#ifndef LADYBUGLOCKNEXTCAPTURE_H
+#define LADYBUGLOCKNEXTCAPTURE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFrameQueue.h"
+#include "ladybugFrameSource.h"
+#include "ladybugFrameTiming.h"
+
+/** Longest wait between ladybugLockNext() calls that keep failing. */
+const unsigned int LOCKNEXT_ERROR_BACKOFF_MAX_MS = 100;
+
+/** ladybugLockNext() failures in a row after which the capture thread stops. */
+const unsigned int LOCKNEXT_ERROR_LIMIT = 50;
+
+/** A frame locked by the capture thread. */
+struct LadybugLockedFrame
+{
+    /** The locked image. pData points into the driver's buffer. */
+    LadybugImage image;
+
+    /** Index of the frame in capture order, starting at 0. */
+    unsigned long long ulFrameIndex;
+
+    /** Number of consumers that have not released the frame yet. */
+    std::atomic<int> refCount;
+};
+
+/** Counters reported by LadybugLockNextCapture::getStats(). */
+struct LadybugCaptureStats
+{
+    /** Number of images locked. */
+    unsigned long long ulFramesLocked;
+
+    /** Images the camera produced that were never locked, from gaps in the sequence ID. */
+    unsigned long long ulFramesDropped;
+
+    /** Number of times the capture thread could not lock because uiMaxHeld frames were held. */
+    unsigned long long ulHeldFullStalls;
+
+    /** Number of ladybugLockNext() calls that failed with something other than a timeout. */
+    unsigned long long ulLockErrors;
+
+    /** Frames not given to latest-only consumers because they were still busy. */
+    unsigned long long ulLatestOnlySkips;
+
+    /** Frames held now, and the most ever held at once. */
+    unsigned int uiHeld;
+    unsigned int uiHeldHighWater;
+    unsigned int uiMaxHeld;
+};
+
+class LadybugLockNextCapture
+{
+public:
+    LadybugLockNextCapture();
+    ~LadybugLockNextCapture();
+
+    /**
+     * Set up capture on a context started with ladybugStartLockNext().
+     *
+     * @param uiMaxHeld     - Maximum number of frames locked at once.
+     * @param uiTimeoutMs   - Grab timeout used by ladybugLockNext(). This
+     *                        bounds how long stop() waits for the capture
+     *                        thread.
+     */
+    LadybugError initialize(
+        LadybugContext context,
+        unsigned int uiMaxHeld,
+        unsigned int uiTimeoutMs = 100 );
+
+    /** Set up capture on a frame source. The source must outlive the capture. */
+    LadybugError initialize(
+        LadybugFrameSource* pSource,
+        unsigned int uiMaxHeld,
+        unsigned int uiTimeoutMs = 100 );
+
+    /**
+     * Register a consumer. Every frame is delivered to every consumer,
+     * except that a bLatestOnly consumer only gets frames while it has
+     * none waiting. Consumers are added after initialize() and before
+     * start().
+     */
+    unsigned int addConsumer( bool bLatestOnly = false );
+
+    /**
+     * Feed every locked image to a timing analyzer, or stop with NULL. The
+     * analyzer must outlive the capture. Set before start().
+     */
+    void setTimingAnalyzer( LadybugFrameTimingAnalyzer* pTiming );
+
+    /** Start the capture thread. */
+    LadybugError start();
+
+    /**
+     * Stop the capture thread and unlock every frame. Consumers must not
+     * use frames after this returns.
+     */
+    void stop();
+
+    /**
+     * The error that stopped the capture thread, or LADYBUG_OK while it
+     * runs or if it was stopped by stop().
+     */
+    LadybugError getError() const;
+
+    /**
+     * Wait for the next frame for a consumer. Returns NULL if no frame
+     * arrived within uiTimeoutMs or capture has stopped. Each consumer
+     * must be read by one thread at a time.
+     */
+    LadybugLockedFrame* nextFrame( unsigned int uiConsumer, unsigned int uiTimeoutMs );
+
+    /** Release a frame. It is unlocked once every consumer has released it. */
+    void release( LadybugLockedFrame* pFrame );
+
+    /**
+     * Lock one image and deliver it. This is what the capture thread runs;
+     * it can also be called from the caller's own loop instead of start().
+     */
+    LadybugError captureOne();
+
+    void getStats( LadybugCaptureStats* pStats ) const;
+
+    /** Print the capture counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugLockNextCapture( const LadybugLockNextCapture& );
+    LadybugLockNextCapture& operator=( const LadybugLockNextCapture& );
+
+    typedef LadybugSpscQueue<LadybugLockedFrame*> ConsumerQueue;
+
+    void captureLoop();
+
+    // Empty and reopen the queues, and make every frame free.
+    void resetQueues();
+
+    // Unlock a frame released by every consumer and make it free again.
+    void recycle( LadybugLockedFrame* pFrame );
+
+    // Recycle every frame released so far.
+    void unlockReleased();
+
+    LadybugCameraSource m_cameraSource;
+    LadybugFrameSource* m_pSource;
+    unsigned int m_uiTimeoutMs;
+    LadybugFrameTimingAnalyzer* m_pTiming;
+
+    std::vector<LadybugLockedFrame> m_frames;
+
+    // Frames not held by any consumer. Only used by the capturing thread.
+    std::vector<unsigned int> m_freeFrames;
+
+    std::vector<std::unique_ptr<ConsumerQueue> > m_consumerQueues;
+    std::vector<bool> m_latestOnly;
+
+    // Which consumers get the frame being delivered. Capture thread only.
+    std::vector<bool> m_deliver;
+    LadybugMpmcQueue<LadybugLockedFrame*> m_released;
+
+    // Guards m_stats, m_error and m_consumerQueues while consumers are added
+    mutable std::mutex m_mutex;
+
+    std::thread m_thread;
+    std::atomic<bool> m_bRunning;
+
+    bool m_bHaveSequenceId;
+    unsigned int m_uiLastSequenceId;
+
+    LadybugError m_error;
+
+    LadybugCaptureStats m_stats;
+};
+
+#endif // LADYBUGLOCKNEXTCAPTURE_H
@@ -0,0 +1,434 @@
+//=============================================================================
+// ladybugMetrics.cpp
+//=============================================================================
+
+#include "ladybugMetrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+const char* QUANTILE_NAMES[] = { "0.5", "0.9", "0.99", "0.999" };
+const unsigned int NUM_QUANTILES = sizeof( QUANTILES ) / sizeof( QUANTILES[ 0 ] );
+
+const char* STAGE_NAMES[ LADYBUG_NUM_STAGES ] = { "grab", "convert", "render", "encode", "write" };
+
+unsigned int getHighestBit( unsigned long long ulValue )
+{
+#if defined( __GNUC__ )
+    return 63 - __builtin_clzll( ulValue );
+#else
+    unsigned int uiBit = 0;
+    while ( ulValue >>= 1 )
+    {
+        uiBit++;
+    }
+    return uiBit;
+#endif
+}
+
+void appendFormat( std::string& text, const char* pszFormat, ... )
+{
+    char szLine[ 512 ];
+    va_list args;
+    va_start( args, pszFormat );
+    vsnprintf( szLine, sizeof( szLine ), pszFormat, args );
+    va_end( args );
+    text += szLine;
+}
+
+} // namespace
+
+//=============================================================================
+// LadybugHistogram
+//=============================================================================
+
+LadybugHistogram::LadybugHistogram()
+{
+    reset();
+}
+
+void
+LadybugHistogram::reset()
+{
+    for ( unsigned int i = 0; i < NUM_BUCKETS; i++ )
+    {
+        m_buckets[ i ].store( 0, std::memory_order_relaxed );
+    }
+    m_count.store( 0, std::memory_order_relaxed );
+    m_sum.store( 0, std::memory_order_relaxed );
+    m_max.store( 0, std::memory_order_relaxed );
+}
+
+unsigned int
+LadybugHistogram::getBucketIndex( unsigned long long ulValue )
+{
+    // Values below SUB_BUCKETS get a bucket each. Above that, every power of
+    // two is split into SUB_BUCKETS equal buckets.
+    if ( ulValue < SUB_BUCKETS )
+    {
+        return (unsigned int)ulValue;
+    }
+
+    const unsigned int uiShift = getHighestBit( ulValue ) - SUB_BUCKET_BITS;
+    const unsigned int uiSubBucket = (unsigned int)( ulValue >> uiShift ) & ( SUB_BUCKETS - 1 );
+    return ( uiShift + 1 ) * SUB_BUCKETS + uiSubBucket;
+}
+
+unsigned long long
+LadybugHistogram::getBucketValue( unsigned int uiIndex )
+{
+    if ( uiIndex < SUB_BUCKETS )
+    {
+        return uiIndex;
+    }
+
+    // Report the middle of the bucket
+    const unsigned int uiShift = uiIndex / SUB_BUCKETS - 1;
+    const unsigned long long ulLowest = (unsigned long long)( SUB_BUCKETS + uiIndex % SUB_BUCKETS ) << uiShift;
+    return ulLowest + ( ( 1ULL << uiShift ) >> 1 );
+}
+
+void
+LadybugHistogram::record( unsigned long long ulValue )
+{
+    m_buckets[ getBucketIndex( ulValue ) ].fetch_add( 1, std::memory_order_relaxed );
+    m_count.fetch_add( 1, std::memory_order_relaxed );
+    m_sum.fetch_add( ulValue, std::memory_order_relaxed );
+
+    unsigned long long ulMax = m_max.load( std::memory_order_relaxed );
+    while ( ulValue > ulMax &&
+        !m_max.compare_exchange_weak( ulMax, ulValue, std::memory_order_relaxed ) )
+    {
+    }
+}
+
+unsigned long long
+LadybugHistogram::getCount() const
+{
+    return m_count.load( std::memory_order_relaxed );
+}
+
+unsigned long long
+LadybugHistogram::getSum() const
+{
+    return m_sum.load( std::memory_order_relaxed );
+}
+
+unsigned long long
+LadybugHistogram::getMax() const
+{
+    return m_max.load( std::memory_order_relaxed );
+}
+
+unsigned long long
+LadybugHistogram::getQuantile( double dQuantile ) const
+{
+    // Take the total from the buckets themselves so a concurrent record()
+    // cannot leave the walk short of the target.
+    unsigned long long ulTotal = 0;
+    for ( unsigned int i = 0; i < NUM_BUCKETS; i++ )
+    {
+        ulTotal += m_buckets[ i ].load( std::memory_order_relaxed );
+    }
+
+    if ( ulTotal == 0 )
+    {
+        return 0;
+    }
+
+    unsigned long long ulTarget = (unsigned long long)( dQuantile * ulTotal + 0.5 );
+    if ( ulTarget < 1 )
+    {
+        ulTarget = 1;
+    }
+
+    unsigned long long ulSeen = 0;
+    for ( unsigned int i = 0; i < NUM_BUCKETS; i++ )
+    {
+        ulSeen += m_buckets[ i ].load( std::memory_order_relaxed );
+        if ( ulSeen >= ulTarget )
+        {
+            // The bucket midpoint can overshoot the largest value recorded
+            const unsigned long long ulValue = getBucketValue( i );
+            const unsigned long long ulMax = getMax();
+            return ulValue < ulMax ? ulValue : ulMax;
+        }
+    }
+
+    return getMax();
+}
+
+//=============================================================================
+// LadybugMetrics
+//=============================================================================
+
+LadybugMetrics&
+LadybugMetrics::instance()
+{
+    static LadybugMetrics metrics;
+    return metrics;
+}
+
+LadybugMetrics::LadybugMetrics()
+    : m_name( "ladybug" ),
+      m_startTime( std::chrono::steady_clock::now() ),
+      m_dumpFormat( LADYBUG_METRICS_PROMETHEUS ),
+      m_uiDumpIntervalMs( 1000 ),
+      m_bDumping( false )
+{
+    for ( unsigned int i = 0; i < LADYBUG_NUM_STAGES; i++ )
+    {
+        m_bytes[ i ].store( 0, std::memory_order_relaxed );
+    }
+}
+
+LadybugMetrics::~LadybugMetrics()
+{
+    stopPeriodicDump();
+}
+
+void
+LadybugMetrics::setName( const char* pszName )
+{
+    m_name = pszName;
+}
+
+const char*
+LadybugMetrics::getStageName( LadybugStage stage )
+{
+    return stage < LADYBUG_NUM_STAGES ? STAGE_NAMES[ stage ] : "unknown";
+}
+
+void
+LadybugMetrics::record( LadybugStage stage, unsigned long long ulNanoseconds, unsigned long long ulBytes )
+{
+    m_histograms[ stage ].record( ulNanoseconds );
+    if ( ulBytes != 0 )
+    {
+        m_bytes[ stage ].fetch_add( ulBytes, std::memory_order_relaxed );
+    }
+}
+
+void
+LadybugMetrics::addBytes( LadybugStage stage, unsigned long long ulBytes )
+{
+    m_bytes[ stage ].fetch_add( ulBytes, std::memory_order_relaxed );
+}
+
+const LadybugHistogram&
+LadybugMetrics::getHistogram( LadybugStage stage ) const
+{
+    return m_histograms[ stage ];
+}
+
+unsigned long long
+LadybugMetrics::getBytes( LadybugStage stage ) const
+{
+    return m_bytes[ stage ].load( std::memory_order_relaxed );
+}
+
+std::string
+LadybugMetrics::formatPrometheus() const
+{
+    const char* pszName = m_name.c_str();
+    std::string text;
+
+    text += "# HELP ladybug_stage_latency_seconds Time spent in each pipeline stage.\n";
+    text += "# TYPE ladybug_stage_latency_seconds summary\n";
+    for ( unsigned int uiStage = 0; uiStage < LADYBUG_NUM_STAGES; uiStage++ )
+    {
+        const LadybugHistogram& histogram = m_histograms[ uiStage ];
+        for ( unsigned int q = 0; q < NUM_QUANTILES; q++ )
+        {
+            appendFormat( text,
+                "ladybug_stage_latency_seconds{tool=\"%s\",stage=\"%s\",quantile=\"%s\"} %.9f\n",
+                pszName, STAGE_NAMES[ uiStage ], QUANTILE_NAMES[ q ],
+                histogram.getQuantile( QUANTILES[ q ] ) / 1e9 );
+        }
+        appendFormat( text, "ladybug_stage_latency_seconds_sum{tool=\"%s\",stage=\"%s\"} %.9f\n",
+            pszName, STAGE_NAMES[ uiStage ], histogram.getSum() / 1e9 );
+        appendFormat( text, "ladybug_stage_latency_seconds_count{tool=\"%s\",stage=\"%s\"} %llu\n",
+            pszName, STAGE_NAMES[ uiStage ], histogram.getCount() );
+    }
+
+    text += "# HELP ladybug_stage_latency_max_seconds Longest time spent in each pipeline stage.\n";
+    text += "# TYPE ladybug_stage_latency_max_seconds gauge\n";
+    for ( unsigned int uiStage = 0; uiStage < LADYBUG_NUM_STAGES; uiStage++ )
+    {
+        appendFormat( text, "ladybug_stage_latency_max_seconds{tool=\"%s\",stage=\"%s\"} %.9f\n",
+            pszName, STAGE_NAMES[ uiStage ], m_histograms[ uiStage ].getMax() / 1e9 );
+    }
+
+    text += "# HELP ladybug_stage_bytes_total Bytes passed through each pipeline stage.\n";
+    text += "# TYPE ladybug_stage_bytes_total counter\n";
+    for ( unsigned int uiStage = 0; uiStage < LADYBUG_NUM_STAGES; uiStage++ )
+    {
+        appendFormat( text, "ladybug_stage_bytes_total{tool=\"%s\",stage=\"%s\"} %llu\n",
+            pszName, STAGE_NAMES[ uiStage ], getBytes( (LadybugStage)uiStage ) );
+    }
+
+    const std::chrono::duration<double> uptime = std::chrono::steady_clock::now() - m_startTime;
+    text += "# HELP ladybug_uptime_seconds Time since the metrics were created.\n";
+    text += "# TYPE ladybug_uptime_seconds gauge\n";
+    appendFormat( text, "ladybug_uptime_seconds{tool=\"%s\"} %.3f\n", pszName, uptime.count() );
+
+    return text;
+}
+
+std::string
+LadybugMetrics::formatJson() const
+{
+    const std::chrono::duration<double> uptime = std::chrono::steady_clock::now() - m_startTime;
+    std::string text;
+
+    appendFormat( text, "{\n  \"tool\": \"%s\",\n  \"uptime_s\": %.3f,\n  \"stages\": {\n",
+        m_name.c_str(), uptime.count() );
+
+    for ( unsigned int uiStage = 0; uiStage < LADYBUG_NUM_STAGES; uiStage++ )
+    {
+        const LadybugHistogram& histogram = m_histograms[ uiStage ];
+        const unsigned long long ulCount = histogram.getCount();
+
+        appendFormat( text,
+            "    \"%s\": { \"count\": %llu, \"bytes\": %llu, \"mean_us\": %.3f, "
+            "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f }%s\n",
+            STAGE_NAMES[ uiStage ],
+            ulCount,
+            getBytes( (LadybugStage)uiStage ),
+            ulCount == 0 ? 0.0 : histogram.getSum() / 1e3 / ulCount,
+            histogram.getQuantile( 0.5 ) / 1e3,
+            histogram.getQuantile( 0.9 ) / 1e3,
+            histogram.getQuantile( 0.99 ) / 1e3,
+            histogram.getQuantile( 0.999 ) / 1e3,
+            histogram.getMax() / 1e3,
+            uiStage + 1 < LADYBUG_NUM_STAGES ? "," : "" );
+    }
+
+    text += "  }\n}\n";
+    return text;
+}
+
+bool
+LadybugMetrics::writeFile( const char* pszPath, LadybugMetricsFormat format ) const
+{
+    const std::string text = format == LADYBUG_METRICS_JSON ? formatJson() : formatPrometheus();
+
+    // Write next to the target and rename so a scraper never sees a partial file
+    const std::string tempPath = std::string( pszPath ) + ".tmp";
+    FILE* pFile = fopen( tempPath.c_str(), "w" );
+    if ( pFile == NULL )
+    {
+        return false;
+    }
+
+    const bool bWritten = fwrite( text.data(), 1, text.size(), pFile ) == text.size();
+    if ( fclose( pFile ) != 0 || !bWritten )
+    {
+        remove( tempPath.c_str() );
+        return false;
+    }
+
+    return rename( tempPath.c_str(), pszPath ) == 0;
+}
+
+void
+LadybugMetrics::startPeriodicDump( const char* pszPath, LadybugMetricsFormat format, unsigned int uiIntervalMs )
+{
+    stopPeriodicDump();
+
+    m_dumpPath = pszPath;
+    m_dumpFormat = format;
+    m_uiDumpIntervalMs = uiIntervalMs > 0 ? uiIntervalMs : 1000;
+    m_bDumping = true;
+    m_dumpThread = std::thread( &LadybugMetrics::dumpLoop, this );
+}
+
+bool
+LadybugMetrics::startPeriodicDumpFromEnvironment()
+{
+    const char* pszPath = getenv( "LADYBUG_METRICS_FILE" );
+    if ( pszPath == NULL || pszPath[ 0 ] == '\0' )
+    {
+        return false;
+    }
+
+    unsigned int uiIntervalMs = 1000;
+    const char* pszInterval = getenv( "LADYBUG_METRICS_INTERVAL_MS" );
+    if ( pszInterval != NULL && atoi( pszInterval ) > 0 )
+    {
+        uiIntervalMs = (unsigned int)atoi( pszInterval );
+    }
+
+    const size_t length = strlen( pszPath );
+    const LadybugMetricsFormat format =
+        ( length >= 5 && strcmp( pszPath + length - 5, ".json" ) == 0 ) ? LADYBUG_METRICS_JSON : LADYBUG_METRICS_PROMETHEUS;
+
+    startPeriodicDump( pszPath, format, uiIntervalMs );
+    return true;
+}
+
+void
+LadybugMetrics::stopPeriodicDump()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_dumpMutex );
+        if ( !m_bDumping )
+        {
+            return;
+        }
+        m_bDumping = false;
+    }
+
+    m_dumpWake.notify_all();
+    m_dumpThread.join();
+
+    writeFile( m_dumpPath.c_str(), m_dumpFormat );
+}
+
+void
+LadybugMetrics::dumpLoop()
+{
+    std::unique_lock<std::mutex> lock( m_dumpMutex );
+    while ( m_bDumping )
+    {
+        m_dumpWake.wait_for( lock, std::chrono::milliseconds( m_uiDumpIntervalMs ), [this] { return !m_bDumping; } );
+        if ( m_bDumping )
+        {
+            lock.unlock();
+            if ( !writeFile( m_dumpPath.c_str(), m_dumpFormat ) )
+            {
+                printf( "Error writing metrics to %s\n", m_dumpPath.c_str() );
+            }
+            lock.lock();
+        }
+    }
+}
+
+void
+LadybugMetrics::printSummary() const
+{
+    for ( unsigned int uiStage = 0; uiStage < LADYBUG_NUM_STAGES; uiStage++ )
+    {
+        const LadybugHistogram& histogram = m_histograms[ uiStage ];
+        const unsigned long long ulCount = histogram.getCount();
+        if ( ulCount == 0 )
+        {
+            continue;
+        }
+
+        printf(
+            "%-8s %6llu calls, mean %.2fms, p50 %.2fms, p99 %.2fms, max %.2fms, %.1fMB\n",
+            STAGE_NAMES[ uiStage ],
+            ulCount,
+            histogram.getSum() / 1e6 / ulCount,
+            histogram.getQuantile( 0.5 ) / 1e6,
+            histogram.getQuantile( 0.99 ) / 1e6,
+            histogram.getMax() / 1e6,
+            getBytes( (LadybugStage)uiStage ) / ( 1024.0 * 1024.0 ) );
+    }
+}
@@ -0,0 +1,200 @@
+//=============================================================================
+// ladybugMetrics.h
+//
+// Per-stage latency histograms and byte/frame counters for the capture and
+// processing tools.
+//
+// Each stage (grab, convert, render, encode, write) has a histogram of
+// latencies in nanoseconds. Buckets are log-linear, in the style of an HDR
+// histogram: 32 sub-buckets per power of two, so any recorded value is
+// reported within about 3%. Recording is a handful of relaxed atomic
+// operations and never takes a lock, so any thread can record.
+//
+// The counters can be dumped to a file periodically, as Prometheus text
+// exposition format or as JSON. The tools enable this with environment
+// variables:
+//
+//    LADYBUG_METRICS_FILE         Path to write. A name ending in ".json"
+//                                 selects JSON, anything else Prometheus
+//                                 text (e.g. for node_exporter's textfile
+//                                 collector).
+//    LADYBUG_METRICS_INTERVAL_MS  Dump interval. Default is 1000.
+//
+// Usage:
+//    {
+//        LadybugStageTimer timer( LADYBUG_STAGE_CONVERT );
+//        ladybugConvertImage( ... );
+//    }
+//=============================================================================
+
+#ifndef LADYBUGMETRICS_H
+#define LADYBUGMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/** Pipeline stages that are timed. */
+enum LadybugStage
+{
+    LADYBUG_STAGE_GRAB,
+    LADYBUG_STAGE_CONVERT,
+    LADYBUG_STAGE_RENDER,
+    LADYBUG_STAGE_ENCODE,
+    LADYBUG_STAGE_WRITE,
+    LADYBUG_NUM_STAGES
+};
+
+/** Output format for LadybugMetrics::writeFile(). */
+enum LadybugMetricsFormat
+{
+    LADYBUG_METRICS_PROMETHEUS,
+    LADYBUG_METRICS_JSON
+};
+
+/** Lock-free log-linear histogram of nanosecond values. */
+class LadybugHistogram
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 5;
+    static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const unsigned int NUM_BUCKETS = ( 64 - SUB_BUCKET_BITS + 1 ) * SUB_BUCKETS;
+
+    LadybugHistogram();
+
+    void record( unsigned long long ulValue );
+    void reset();
+
+    unsigned long long getCount() const;
+    unsigned long long getSum() const;
+    unsigned long long getMax() const;
+
+    /** Value at quantile dQuantile (0.0 - 1.0). Returns 0 if nothing was recorded. */
+    unsigned long long getQuantile( double dQuantile ) const;
+
+private:
+    static unsigned int getBucketIndex( unsigned long long ulValue );
+    static unsigned long long getBucketValue( unsigned int uiIndex );
+
+    std::atomic<unsigned long long> m_buckets[ NUM_BUCKETS ];
+    std::atomic<unsigned long long> m_count;
+    std::atomic<unsigned long long> m_sum;
+    std::atomic<unsigned long long> m_max;
+};
+
+class LadybugMetrics
+{
+public:
+    /** The process-wide metrics used by LadybugStageTimer. */
+    static LadybugMetrics& instance();
+
+    LadybugMetrics();
+    ~LadybugMetrics();
+
+    /** Name reported as the "tool" label. */
+    void setName( const char* pszName );
+
+    /** Record one pass through a stage that took ulNanoseconds and moved ulBytes. */
+    void record( LadybugStage stage, unsigned long long ulNanoseconds, unsigned long long ulBytes = 0 );
+
+    /** Count bytes for a stage without timing it. */
+    void addBytes( LadybugStage stage, unsigned long long ulBytes );
+
+    const LadybugHistogram& getHistogram( LadybugStage stage ) const;
+    unsigned long long getBytes( LadybugStage stage ) const;
+
+    /** Write all counters to pszPath. The file is replaced atomically. */
+    bool writeFile( const char* pszPath, LadybugMetricsFormat format ) const;
+
+    /** Write the counters to pszPath every uiIntervalMs on a background thread. */
+    void startPeriodicDump( const char* pszPath, LadybugMetricsFormat format, unsigned int uiIntervalMs );
+
+    /**
+     * Start a periodic dump if LADYBUG_METRICS_FILE is set.
+     * Returns true if a dump was started.
+     */
+    bool startPeriodicDumpFromEnvironment();
+
+    /** Stop the periodic dump and write the file one last time. */
+    void stopPeriodicDump();
+
+    /** Print a one-line summary per stage to stdout. */
+    void printSummary() const;
+
+    static const char* getStageName( LadybugStage stage );
+
+private:
+    LadybugMetrics( const LadybugMetrics& );
+    LadybugMetrics& operator=( const LadybugMetrics& );
+
+    std::string formatPrometheus() const;
+    std::string formatJson() const;
+    void dumpLoop();
+
+    std::string m_name;
+    LadybugHistogram m_histograms[ LADYBUG_NUM_STAGES ];
+    std::atomic<unsigned long long> m_bytes[ LADYBUG_NUM_STAGES ];
+    std::chrono::steady_clock::time_point m_startTime;
+
+    std::string m_dumpPath;
+    LadybugMetricsFormat m_dumpFormat;
+    unsigned int m_uiDumpIntervalMs;
+    std::thread m_dumpThread;
+    std::mutex m_dumpMutex;
+    std::condition_variable m_dumpWake;
+    bool m_bDumping;
+};
+
+/** Times a scope and records it against a stage when it goes out of scope. */
+class LadybugStageTimer
+{
+public:
+    explicit LadybugStageTimer( LadybugStage stage, LadybugMetrics& metrics = LadybugMetrics::instance() )
+        : m_metrics( metrics ),
+          m_stage( stage ),
+          m_ulBytes( 0 ),
+          m_bStopped( false ),
+          m_start( std::chrono::steady_clock::now() )
+    {
+    }
+
+    ~LadybugStageTimer()
+    {
+        stop();
+    }
+
+    /** Bytes to count against the stage when the timer stops. */
+    void setBytes( unsigned long long ulBytes )
+    {
+        m_ulBytes = ulBytes;
+    }
+
+    /** Do not record anything, e.g. when the call timed out. */
+    void cancel()
+    {
+        m_bStopped = true;
+    }
+
+    /** Record now instead of at the end of the scope. */
+    void stop()
+    {
+        if ( !m_bStopped )
+        {
+            const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - m_start;
+            m_metrics.record( m_stage, (unsigned long long)elapsed.count(), m_ulBytes );
+            m_bStopped = true;
+        }
+    }
+
+private:
+    LadybugMetrics& m_metrics;
+    LadybugStage m_stage;
+    unsigned long long m_ulBytes;
+    bool m_bStopped;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // LADYBUGMETRICS_H
@@ -0,0 +1,479 @@
+//=============================================================================
+// ladybugMultiHeadCapture.cpp
+//=============================================================================
+
+#include "ladybugMultiHeadCapture.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+// Entries passed to ladybugBusEnumerateCameras()
+const unsigned int MAX_BUS_CAMERAS = 32;
+
+// Frames a head can be ahead of the others before its oldest is unmatched
+const size_t MAX_PENDING_FRAMES = 64;
+
+// Groups kept for nextGroup() before the oldest is dropped
+const size_t MAX_QUEUED_GROUPS = 256;
+
+// How long a sink thread waits for a frame before checking for stop()
+const unsigned int SINK_POLL_MS = 100;
+
+unsigned long long
+timestampToUs( const LadybugTimestamp& timeStamp )
+{
+    return (unsigned long long)timeStamp.ulSeconds * 1000000 + timeStamp.ulMicroSeconds;
+}
+
+} // namespace
+
+LadybugMultiHeadCapture::LadybugMultiHeadCapture()
+    : m_bRunning( false )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugMultiHeadCapture::~LadybugMultiHeadCapture()
+{
+    stop();
+}
+
+LadybugError
+LadybugMultiHeadCapture::initialize( const LadybugMultiHeadConfig& config )
+{
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    if ( config.uiMaxHeld == 0 || config.uiMaxHeld >= config.uiNumBuffers )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    destroyContexts();
+    m_heads.clear();
+    m_config = config;
+
+    // Enumerating needs a context of its own
+    LadybugContext busContext = NULL;
+    LadybugError error = ::ladybugCreateContext( &busContext );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    LadybugCameraInfo arInfo[ MAX_BUS_CAMERAS ];
+    unsigned int uiNumCameras = MAX_BUS_CAMERAS;
+    error = ::ladybugBusEnumerateCameras( busContext, arInfo, &uiNumCameras );
+    ::ladybugDestroyContext( &busContext );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    const unsigned int uiMaxHeads =
+        ( config.uiMaxHeads == 0 ) ? LADYBUG_MAX_HEADS : std::min( config.uiMaxHeads, LADYBUG_MAX_HEADS );
+
+    for ( unsigned int uiBusIndex = 0; uiBusIndex < uiNumCameras && m_heads.size() < uiMaxHeads; uiBusIndex++ )
+    {
+        // Other cameras on the bus are listed as unknown devices
+        if ( arInfo[ uiBusIndex ].deviceType == LADYBUG_DEVICE_UNKNOWN )
+        {
+            continue;
+        }
+
+        std::unique_ptr<Head> pHead( new Head() );
+        pHead->cameraInfo = arInfo[ uiBusIndex ];
+
+        error = ::ladybugCreateContext( &pHead->context );
+        if ( error == LADYBUG_OK )
+        {
+            error = ::ladybugInitializePlus( pHead->context, uiBusIndex, config.uiNumBuffers, NULL, 0 );
+        }
+        if ( error == LADYBUG_OK )
+        {
+            error = ::ladybugStartLockNext( pHead->context, config.dataFormat );
+        }
+        if ( error != LADYBUG_OK )
+        {
+            if ( pHead->context != NULL )
+            {
+                ::ladybugDestroyContext( &pHead->context );
+            }
+            destroyContexts();
+            m_heads.clear();
+            return error;
+        }
+
+        pHead->cameraSource.setContext( pHead->context );
+        pHead->pSource = &pHead->cameraSource;
+        m_heads.push_back( std::move( pHead ) );
+    }
+
+    if ( m_heads.empty() )
+    {
+        return LADYBUG_NOT_INITIALIZED;
+    }
+
+    return initializeHeads();
+}
+
+LadybugError
+LadybugMultiHeadCapture::initialize( const LadybugMultiHeadConfig& config, const std::vector<LadybugFrameSource*>& sources )
+{
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    if ( sources.empty() || sources.size() > LADYBUG_MAX_HEADS || config.uiMaxHeld == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    destroyContexts();
+    m_heads.clear();
+    m_config = config;
+
+    for ( size_t i = 0; i < sources.size(); i++ )
+    {
+        if ( sources[ i ] == NULL )
+        {
+            m_heads.clear();
+            return LADYBUG_INVALID_ARGUMENT;
+        }
+
+        std::unique_ptr<Head> pHead( new Head() );
+        pHead->pSource = sources[ i ];
+        m_heads.push_back( std::move( pHead ) );
+    }
+
+    return initializeHeads();
+}
+
+LadybugError
+LadybugMultiHeadCapture::initializeHeads()
+{
+    for ( size_t i = 0; i < m_heads.size(); i++ )
+    {
+        Head& head = *m_heads[ i ];
+        head.pSink = NULL;
+        head.pending.clear();
+
+        LadybugError error = head.capture.initialize( head.pSource, m_config.uiMaxHeld );
+        if ( error != LADYBUG_OK )
+        {
+            destroyContexts();
+            m_heads.clear();
+            return error;
+        }
+        head.uiConsumer = head.capture.addConsumer();
+
+        LadybugFrameTimingConfig timingConfig;
+        timingConfig.dFrameRate = m_config.dFrameRate;
+        head.timing.initialize( timingConfig );
+        head.capture.setTimingAnalyzer( &head.timing );
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_groups.clear();
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiNumHeads = (unsigned int)m_heads.size();
+
+    return LADYBUG_OK;
+}
+
+unsigned int
+LadybugMultiHeadCapture::getNumHeads() const
+{
+    return (unsigned int)m_heads.size();
+}
+
+LadybugContext
+LadybugMultiHeadCapture::getContext( unsigned int uiHead ) const
+{
+    return ( uiHead < m_heads.size() ) ? m_heads[ uiHead ]->context : NULL;
+}
+
+const LadybugCameraInfo&
+LadybugMultiHeadCapture::getCameraInfo( unsigned int uiHead ) const
+{
+    return m_heads[ uiHead ]->cameraInfo;
+}
+
+void
+LadybugMultiHeadCapture::setSink( unsigned int uiHead, LadybugHeadSink* pSink )
+{
+    if ( uiHead < m_heads.size() && !m_bRunning )
+    {
+        m_heads[ uiHead ]->pSink = pSink;
+    }
+}
+
+LadybugError
+LadybugMultiHeadCapture::start()
+{
+    if ( m_heads.empty() )
+    {
+        return LADYBUG_NOT_INITIALIZED;
+    }
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    m_bRunning = true;
+    for ( unsigned int i = 0; i < m_heads.size(); i++ )
+    {
+        LadybugError error = m_heads[ i ]->capture.start();
+        if ( error != LADYBUG_OK )
+        {
+            stop();
+            return error;
+        }
+        m_heads[ i ]->sinkThread = std::thread( &LadybugMultiHeadCapture::sinkLoop, this, i );
+    }
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugMultiHeadCapture::stop()
+{
+    m_bRunning = false;
+
+    // The sink threads release every frame they hold before they exit
+    for ( size_t i = 0; i < m_heads.size(); i++ )
+    {
+        if ( m_heads[ i ]->sinkThread.joinable() )
+        {
+            m_heads[ i ]->sinkThread.join();
+        }
+    }
+
+    for ( size_t i = 0; i < m_heads.size(); i++ )
+    {
+        m_heads[ i ]->capture.stop();
+    }
+
+    m_groupReady.notify_all();
+
+    destroyContexts();
+}
+
+void
+LadybugMultiHeadCapture::destroyContexts()
+{
+    for ( size_t i = 0; i < m_heads.size(); i++ )
+    {
+        Head& head = *m_heads[ i ];
+        if ( head.context != NULL )
+        {
+            ::ladybugStop( head.context );
+            ::ladybugDestroyContext( &head.context );
+            head.context = NULL;
+            head.cameraSource.setContext( NULL );
+        }
+    }
+}
+
+void
+LadybugMultiHeadCapture::sinkLoop( unsigned int uiHead )
+{
+    Head& head = *m_heads[ uiHead ];
+
+    // The sinks convert the frames
+    LadybugPlacedThread placed( LADYBUG_STAGE_CONVERT, "head sink" );
+
+    while ( m_bRunning )
+    {
+        LadybugLockedFrame* pFrame = head.capture.nextFrame( head.uiConsumer, SINK_POLL_MS );
+        if ( pFrame == NULL )
+        {
+            // The head's capture gave up after lock errors
+            if ( head.capture.getError() != LADYBUG_OK )
+            {
+                break;
+            }
+            continue;
+        }
+
+        if ( head.pSink != NULL )
+        {
+            head.pSink->processFrame( uiHead, *pFrame );
+        }
+
+        matchFrame( uiHead, *pFrame );
+        head.capture.release( pFrame );
+    }
+}
+
+void
+LadybugMultiHeadCapture::matchFrame( unsigned int uiHead, const LadybugLockedFrame& frame )
+{
+    const unsigned long long ulToleranceUs = (unsigned long long)( m_config.dMatchToleranceMs * 1000.0 );
+    bool bGroupMade = false;
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        m_stats.arulFramesProcessed[ uiHead ]++;
+
+        std::deque<std::pair<unsigned long long, unsigned long long> >& pending = m_heads[ uiHead ]->pending;
+        pending.push_back( std::make_pair( frame.ulFrameIndex, timestampToUs( frame.image.timeStamp ) ) );
+        if ( pending.size() > MAX_PENDING_FRAMES )
+        {
+            pending.pop_front();
+            m_stats.arulFramesUnmatched[ uiHead ]++;
+        }
+
+        for ( ;; )
+        {
+            // A group needs a frame from every head; the latest oldest frame sets its time
+            unsigned long long ulLatestUs = 0;
+            for ( size_t i = 0; i < m_heads.size(); i++ )
+            {
+                if ( m_heads[ i ]->pending.empty() )
+                {
+                    break;
+                }
+                ulLatestUs = std::max( ulLatestUs, m_heads[ i ]->pending.front().second );
+            }
+
+            // Frames too old to match that time never will be
+            bool bAllReady = true;
+            bool bDropped = false;
+            for ( size_t i = 0; i < m_heads.size(); i++ )
+            {
+                std::deque<std::pair<unsigned long long, unsigned long long> >& headPending = m_heads[ i ]->pending;
+                while ( !headPending.empty() && headPending.front().second + ulToleranceUs < ulLatestUs )
+                {
+                    headPending.pop_front();
+                    m_stats.arulFramesUnmatched[ i ]++;
+                    bDropped = true;
+                }
+                bAllReady = bAllReady && !headPending.empty();
+            }
+
+            if ( !bAllReady )
+            {
+                break;
+            }
+
+            if ( bDropped )
+            {
+                // The next frames may be later than ulLatestUs; look again
+                continue;
+            }
+
+            LadybugFrameGroup group;
+            memset( &group, 0, sizeof( group ) );
+            group.ulGroupIndex = m_stats.ulGroups++;
+
+            unsigned long long ulEarliestUs = ulLatestUs;
+            for ( size_t i = 0; i < m_heads.size(); i++ )
+            {
+                std::deque<std::pair<unsigned long long, unsigned long long> >& headPending = m_heads[ i ]->pending;
+                group.arulFrameIndex[ i ] = headPending.front().first;
+                group.arulTimeUs[ i ] = headPending.front().second;
+                ulEarliestUs = std::min( ulEarliestUs, headPending.front().second );
+                headPending.pop_front();
+            }
+            group.dSpreadMs = ( ulLatestUs - ulEarliestUs ) / 1000.0;
+            m_stats.dMaxSpreadMs = std::max( m_stats.dMaxSpreadMs, group.dSpreadMs );
+
+            if ( m_groups.size() >= MAX_QUEUED_GROUPS )
+            {
+                m_groups.pop_front();
+                m_stats.ulGroupsDropped++;
+            }
+            m_groups.push_back( group );
+            bGroupMade = true;
+        }
+    }
+
+    if ( bGroupMade )
+    {
+        m_groupReady.notify_all();
+    }
+}
+
+bool
+LadybugMultiHeadCapture::nextGroup( LadybugFrameGroup* pGroup, unsigned int uiTimeoutMs )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    m_groupReady.wait_for(
+        lock,
+        std::chrono::milliseconds( uiTimeoutMs ),
+        [this] { return !m_groups.empty() || !m_bRunning; } );
+
+    if ( m_groups.empty() )
+    {
+        return false;
+    }
+
+    *pGroup = m_groups.front();
+    m_groups.pop_front();
+    return true;
+}
+
+void
+LadybugMultiHeadCapture::getCaptureStats( unsigned int uiHead, LadybugCaptureStats* pStats ) const
+{
+    m_heads[ uiHead ]->capture.getStats( pStats );
+}
+
+void
+LadybugMultiHeadCapture::getTimingStats( unsigned int uiHead, LadybugFrameTimingStats* pStats ) const
+{
+    m_heads[ uiHead ]->timing.getStats( pStats );
+}
+
+void
+LadybugMultiHeadCapture::getStats( LadybugMultiHeadStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugMultiHeadCapture::printStats( const char* pszName ) const
+{
+    LadybugMultiHeadStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %u heads, %llu groups, max spread %.2fms, %llu groups dropped\n",
+        pszName,
+        stats.uiNumHeads,
+        stats.ulGroups,
+        stats.dMaxSpreadMs,
+        stats.ulGroupsDropped );
+
+    for ( unsigned int i = 0; i < stats.uiNumHeads; i++ )
+    {
+        char pszHeadName[ 128 ];
+        snprintf(
+            pszHeadName,
+            sizeof( pszHeadName ),
+            "%s head %u (%u), %llu frames processed, %llu unmatched, capture",
+            pszName,
+            i,
+            m_heads[ i ]->cameraInfo.serialHead,
+            stats.arulFramesProcessed[ i ],
+            stats.arulFramesUnmatched[ i ] );
+        m_heads[ i ]->capture.printStats( pszHeadName );
+
+        snprintf( pszHeadName, sizeof( pszHeadName ), "%s head %u timing", pszName, i );
+        m_heads[ i ]->timing.printStats( pszHeadName );
+    }
+}
@@ -0,0 +1,235 @@
+//=============================================================================
+// ladybugMultiHeadCapture.h
+//
+// Capture from every Ladybug on the bus at once.
+//
+// initialize() enumerates the cameras with ladybugBusEnumerateCameras() and
+// gives each head its own context, started with ladybugStartLockNext(), and
+// its own LadybugLockNextCapture thread. Each head also has a sink thread
+// that hands its frames to the LadybugHeadSink set for that head, so one
+// head converting or writing slowly does not hold up the others, and
+// throughput grows with the number of heads.
+//
+// Frames are matched across heads by their LadybugTimestamp: a group is
+// made when every head has a frame within the match tolerance of the others.
+// Frames with no partner on some head are counted as unmatched. Groups are
+// read with nextGroup(); reading them is optional.
+//
+// Each head has a LadybugFrameTimingAnalyzer that checks its images for
+// dropped frames, jitter and its capture thread falling behind.
+//
+// The heads can also be LadybugFrameSource objects, such as several
+// LadybugSyntheticSource, to run without cameras.
+//
+// Usage:
+//    LadybugMultiHeadCapture capture;
+//    capture.initialize( config );
+//    for ( unsigned int i = 0; i < capture.getNumHeads(); i++ )
+//    {
+//        capture.setSink( i, &sinks[ i ] );  // sinks[ i ] may use capture.getContext( i )
+//    }
+//    capture.start();
+//    while ( capture.nextGroup( &group, 1000 ) ) { ... }
+//    capture.stop();
+//=============================================================================
+
+#ifndef LADYBUGMULTIHEADCAPTURE_H
+#define LADYBUGMULTIHEADCAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFrameSource.h"
+#include "ladybugFrameTiming.h"
+#include "ladybugLockNextCapture.h"
+
+/** Most heads a LadybugMultiHeadCapture drives. */
+const unsigned int LADYBUG_MAX_HEADS = 8;
+
+struct LadybugMultiHeadConfig
+{
+    LadybugMultiHeadConfig()
+        : dataFormat( LADYBUG_DATAFORMAT_RAW8 ),
+          uiNumBuffers( 10 ),
+          uiMaxHeld( 8 ),
+          uiMaxHeads( 0 ),
+          dMatchToleranceMs( 10.0 ),
+          dFrameRate( 0.0 )
+    {
+    }
+
+    LadybugDataFormat dataFormat;
+
+    /** Driver buffers per head, for ladybugInitializePlus(). */
+    unsigned int uiNumBuffers;
+
+    /** Frames each head can hold locked at once. Must be less than uiNumBuffers. */
+    unsigned int uiMaxHeld;
+
+    /** Use at most this many heads. 0 uses every Ladybug found. */
+    unsigned int uiMaxHeads;
+
+    /** Largest difference between timestamps of frames in one group. */
+    double dMatchToleranceMs;
+
+    /** Expected frames per second of every head. 0 learns it from the first frames. */
+    double dFrameRate;
+};
+
+/** Receives the frames of one head. */
+class LadybugHeadSink
+{
+public:
+    virtual ~LadybugHeadSink()
+    {
+    }
+
+    /**
+     * Called on the head's sink thread for every frame of the head, in
+     * capture order. The image stays locked until this returns.
+     */
+    virtual void processFrame( unsigned int uiHead, const LadybugLockedFrame& frame ) = 0;
+};
+
+/** Frames of every head taken at the same time. */
+struct LadybugFrameGroup
+{
+    /** Index of the group, starting at 0. */
+    unsigned long long ulGroupIndex;
+
+    /** LadybugLockedFrame::ulFrameIndex of each head's frame. */
+    unsigned long long arulFrameIndex[ LADYBUG_MAX_HEADS ];
+
+    /** Timestamp of each head's frame, in microseconds since the epoch. */
+    unsigned long long arulTimeUs[ LADYBUG_MAX_HEADS ];
+
+    /** Difference between the earliest and latest frame in the group. */
+    double dSpreadMs;
+};
+
+/** Counters reported by LadybugMultiHeadCapture::getStats(). */
+struct LadybugMultiHeadStats
+{
+    unsigned long long ulGroups;
+
+    /** Frames given to each head's sink. */
+    unsigned long long arulFramesProcessed[ LADYBUG_MAX_HEADS ];
+
+    /** Frames of each head that were not matched with frames of every other head. */
+    unsigned long long arulFramesUnmatched[ LADYBUG_MAX_HEADS ];
+
+    /** Groups not read with nextGroup() before the queue filled. */
+    unsigned long long ulGroupsDropped;
+
+    /** Largest spread of a group. */
+    double dMaxSpreadMs;
+
+    unsigned int uiNumHeads;
+};
+
+class LadybugMultiHeadCapture
+{
+public:
+    LadybugMultiHeadCapture();
+    ~LadybugMultiHeadCapture();
+
+    /**
+     * Create, initialize and start a context for every Ladybug on the bus.
+     * Fails with LADYBUG_NOT_INITIALIZED if none is found.
+     */
+    LadybugError initialize( const LadybugMultiHeadConfig& config );
+
+    /**
+     * Capture from frame sources instead of cameras, one head per source.
+     * The sources must outlive the capture. getContext() returns NULL for
+     * these heads.
+     */
+    LadybugError initialize( const LadybugMultiHeadConfig& config, const std::vector<LadybugFrameSource*>& sources );
+
+    unsigned int getNumHeads() const;
+
+    /** The head's context, for ladybugConvertImage() and the like. */
+    LadybugContext getContext( unsigned int uiHead ) const;
+
+    /** Camera information from enumeration. Zeroed for frame sources. */
+    const LadybugCameraInfo& getCameraInfo( unsigned int uiHead ) const;
+
+    /** Set the sink of a head. Heads without a sink release frames straight away. */
+    void setSink( unsigned int uiHead, LadybugHeadSink* pSink );
+
+    /** Start the capture and sink threads of every head. */
+    LadybugError start();
+
+    /**
+     * Stop every head, and stop and destroy the contexts made by
+     * initialize(). The sinks are not called after this returns.
+     */
+    void stop();
+
+    /**
+     * Wait for the next group of frames. Returns false if none was made
+     * within uiTimeoutMs or capture has stopped.
+     */
+    bool nextGroup( LadybugFrameGroup* pGroup, unsigned int uiTimeoutMs );
+
+    /** Capture counters of one head. */
+    void getCaptureStats( unsigned int uiHead, LadybugCaptureStats* pStats ) const;
+
+    /** Frame timing of one head. */
+    void getTimingStats( unsigned int uiHead, LadybugFrameTimingStats* pStats ) const;
+
+    void getStats( LadybugMultiHeadStats* pStats ) const;
+
+    /** Print the counters of the capture and of every head to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugMultiHeadCapture( const LadybugMultiHeadCapture& );
+    LadybugMultiHeadCapture& operator=( const LadybugMultiHeadCapture& );
+
+    struct Head
+    {
+        LadybugContext context;
+        LadybugCameraInfo cameraInfo;
+        LadybugCameraSource cameraSource;
+        LadybugFrameSource* pSource;
+        LadybugLockNextCapture capture;
+        LadybugFrameTimingAnalyzer timing;
+        unsigned int uiConsumer;
+        LadybugHeadSink* pSink;
+        std::thread sinkThread;
+
+        // Frames waiting to be matched, as ( frame index, time in us )
+        std::deque<std::pair<unsigned long long, unsigned long long> > pending;
+    };
+
+    LadybugError initializeHeads();
+
+    // Stop and destroy the contexts made by initialize()
+    void destroyContexts();
+
+    void sinkLoop( unsigned int uiHead );
+
+    // Queue a processed frame for matching and make any complete groups
+    void matchFrame( unsigned int uiHead, const LadybugLockedFrame& frame );
+
+    LadybugMultiHeadConfig m_config;
+    std::vector<std::unique_ptr<Head> > m_heads;
+
+    std::atomic<bool> m_bRunning;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_groupReady;
+    std::deque<LadybugFrameGroup> m_groups;
+
+    LadybugMultiHeadStats m_stats;
+};
+
+#endif // LADYBUGMULTIHEADCAPTURE_H
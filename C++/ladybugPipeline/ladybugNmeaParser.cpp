@@ -0,0 +1,488 @@
+//=============================================================================
+// ladybugNmeaParser.cpp
+//=============================================================================
+
+#include "ladybugNmeaParser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+// Longest run of digits a number may have; more would overflow
+const int MAX_DIGITS = 18;
+
+// NMEA sentences are at most 82 characters, "$" to "\r\n"
+const ptrdiff_t MAX_SENTENCE_BYTES = 82;
+
+// Multiplying by these is much faster than dividing by powers of ten
+const double NEGATIVE_POWERS_OF_TEN[ MAX_DIGITS + 1 ] = {
+    1e0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9,
+    1e-10, 1e-11, 1e-12, 1e-13, 1e-14, 1e-15, 1e-16, 1e-17, 1e-18 };
+
+// One comma separated field of a sentence, [pBegin, pEnd)
+struct Field
+{
+    const char* pBegin;
+    const char* pEnd;
+};
+
+// Reads the fields of a sentence in order. Past the last field, every
+// field is empty.
+class FieldReader
+{
+public:
+    FieldReader( const char* pBegin, const char* pEnd )
+        : m_p( pBegin ),
+          m_pEnd( pEnd )
+    {
+    }
+
+    Field next()
+    {
+        Field field;
+        field.pBegin = m_p;
+        while ( m_p < m_pEnd && *m_p != ',' )
+        {
+            m_p++;
+        }
+        field.pEnd = m_p;
+        if ( m_p < m_pEnd )
+        {
+            m_p++;
+        }
+        return field;
+    }
+
+private:
+    const char* m_p;
+    const char* m_pEnd;
+};
+
+// XOR of the bytes in [pBegin, pEnd), eight at a time
+unsigned char getChecksum( const char* pBegin, const char* pEnd )
+{
+    uint64_t ulSum = 0;
+    const char* p = pBegin;
+    for ( ; pEnd - p >= 8; p += 8 )
+    {
+        uint64_t ulWord;
+        memcpy( &ulWord, p, sizeof( ulWord ) );
+        ulSum ^= ulWord;
+    }
+    ulSum ^= ulSum >> 32;
+    ulSum ^= ulSum >> 16;
+    ulSum ^= ulSum >> 8;
+
+    unsigned char ucSum = (unsigned char)ulSum;
+    for ( ; p < pEnd; p++ )
+    {
+        ucSum ^= (unsigned char)*p;
+    }
+    return ucSum;
+}
+
+int hexValue( char c )
+{
+    if ( c >= '0' && c <= '9' )
+    {
+        return c - '0';
+    }
+    if ( c >= 'A' && c <= 'F' )
+    {
+        return c - 'A' + 10;
+    }
+    if ( c >= 'a' && c <= 'f' )
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Parse an unsigned decimal such as "4807.038" into its whole part, and its
+// fraction as digits and a count of them. Returns false if the field is
+// empty or not a number.
+bool parseDecimal( const Field& field, unsigned long long* pulWhole, unsigned long long* pulFraction, int* piFractionDigits )
+{
+    const char* p = field.pBegin;
+    unsigned long long ulWhole = 0;
+    for ( ; p < field.pEnd && *p >= '0' && *p <= '9'; p++ )
+    {
+        ulWhole = ulWhole * 10 + ( *p - '0' );
+    }
+    const int iWholeDigits = (int)( p - field.pBegin );
+
+    unsigned long long ulFraction = 0;
+    int iFractionDigits = 0;
+    if ( p < field.pEnd && *p == '.' )
+    {
+        const char* const pFraction = ++p;
+        for ( ; p < field.pEnd && *p >= '0' && *p <= '9'; p++ )
+        {
+            ulFraction = ulFraction * 10 + ( *p - '0' );
+        }
+        iFractionDigits = (int)( p - pFraction );
+    }
+
+    if ( p != field.pEnd || iWholeDigits + iFractionDigits == 0 ||
+        iWholeDigits > MAX_DIGITS || iFractionDigits > MAX_DIGITS )
+    {
+        return false;
+    }
+
+    *pulWhole = ulWhole;
+    *pulFraction = ulFraction;
+    *piFractionDigits = iFractionDigits;
+    return true;
+}
+
+// Parse a decimal such as "545.4" or "-12.5". Returns false if the field is
+// empty or not a number.
+bool parseNumber( const Field& field, double* pdValue )
+{
+    Field digits = field;
+    const bool bNegative = digits.pBegin < digits.pEnd && *digits.pBegin == '-';
+    if ( digits.pBegin < digits.pEnd && ( *digits.pBegin == '-' || *digits.pBegin == '+' ) )
+    {
+        digits.pBegin++;
+    }
+
+    unsigned long long ulWhole = 0;
+    unsigned long long ulFraction = 0;
+    int iFractionDigits = 0;
+    if ( !parseDecimal( digits, &ulWhole, &ulFraction, &iFractionDigits ) )
+    {
+        return false;
+    }
+
+    const double dValue = ulWhole + ulFraction * NEGATIVE_POWERS_OF_TEN[ iFractionDigits ];
+    *pdValue = bNegative ? -dValue : dValue;
+    return true;
+}
+
+// Parse "ddmm.mmmm" or "dddmm.mmmm" and its hemisphere into degrees
+bool parseCoordinate( const Field& value, const Field& hemisphere, double* pdDegrees )
+{
+    unsigned long long ulWhole = 0;
+    unsigned long long ulFraction = 0;
+    int iFractionDigits = 0;
+    if ( !parseDecimal( value, &ulWhole, &ulFraction, &iFractionDigits ) ||
+        hemisphere.pEnd - hemisphere.pBegin != 1 )
+    {
+        return false;
+    }
+
+    const double dMinutes = ulWhole % 100 + ulFraction * NEGATIVE_POWERS_OF_TEN[ iFractionDigits ];
+    const double dDegrees = ulWhole / 100 + dMinutes * ( 1.0 / 60.0 );
+    switch ( *hemisphere.pBegin )
+    {
+    case 'N':
+    case 'E':
+        *pdDegrees = dDegrees;
+        return true;
+    case 'S':
+    case 'W':
+        *pdDegrees = -dDegrees;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Parse "hhmmss.sss" into milliseconds since midnight. Leaves *puiMs alone
+// if the field is empty or wrong.
+void parseTime( const Field& field, unsigned int* puiMs )
+{
+    unsigned long long ulTime = 0;
+    unsigned long long ulFraction = 0;
+    int iFractionDigits = 0;
+    if ( !parseDecimal( field, &ulTime, &ulFraction, &iFractionDigits ) || ulTime >= 240000 )
+    {
+        return;
+    }
+
+    const unsigned int uiTime = (unsigned int)ulTime;
+    const unsigned int uiHours = uiTime / 10000;
+    const unsigned int uiMinutes = uiTime / 100 % 100;
+    const unsigned int uiSeconds = uiTime % 100;
+    if ( uiMinutes >= 60 || uiSeconds >= 61 )
+    {
+        return;
+    }
+
+    // Milliseconds are the first three digits of the fraction
+    unsigned long long ulMs = ulFraction;
+    for ( int i = iFractionDigits; i < 3; i++ )
+    {
+        ulMs *= 10;
+    }
+    for ( int i = 3; i < iFractionDigits; i++ )
+    {
+        ulMs /= 10;
+    }
+    *puiMs = ( ( uiHours * 60 + uiMinutes ) * 60 + uiSeconds ) * 1000 + (unsigned int)ulMs;
+}
+
+bool isStatusActive( const Field& field )
+{
+    return field.pEnd - field.pBegin == 1 && *field.pBegin == 'A';
+}
+
+// GGA: time, latitude, N/S, longitude, E/W, quality, satellites, HDOP, altitude, ...
+void parseGga( FieldReader fields, LadybugGpsFix* pFix )
+{
+    const Field time = fields.next();
+    const Field latitude = fields.next();
+    const Field northSouth = fields.next();
+    const Field longitude = fields.next();
+    const Field eastWest = fields.next();
+    const Field quality = fields.next();
+    const Field satellites = fields.next();
+    fields.next();
+    const Field altitude = fields.next();
+
+    double dQuality = 0.0;
+    if ( !parseNumber( quality, &dQuality ) || dQuality < 1.0 ||
+        !parseCoordinate( latitude, northSouth, &pFix->dLatitude ) ||
+        !parseCoordinate( longitude, eastWest, &pFix->dLongitude ) )
+    {
+        return;
+    }
+
+    double dSatellites = 0.0;
+    parseNumber( satellites, &dSatellites );
+    parseNumber( altitude, &pFix->dAltitude );
+    parseTime( time, &pFix->uiUtcMs );
+    pFix->ucQuality = (unsigned char)dQuality;
+    pFix->ucSatellites = (unsigned char)dSatellites;
+    pFix->source = LADYBUG_GPS_FIX_GGA;
+    pFix->bValid = true;
+}
+
+// RMC: time, status, latitude, N/S, longitude, E/W, speed, course, ...
+void parseRmc( FieldReader fields, LadybugGpsFix* pFix )
+{
+    const Field time = fields.next();
+    const Field status = fields.next();
+    const Field latitude = fields.next();
+    const Field northSouth = fields.next();
+    const Field longitude = fields.next();
+    const Field eastWest = fields.next();
+    const Field speed = fields.next();
+    const Field course = fields.next();
+
+    if ( !isStatusActive( status ) ||
+        !parseCoordinate( latitude, northSouth, &pFix->dLatitude ) ||
+        !parseCoordinate( longitude, eastWest, &pFix->dLongitude ) )
+    {
+        return;
+    }
+
+    double dValue = 0.0;
+    if ( parseNumber( speed, &dValue ) )
+    {
+        pFix->fSpeedKnots = (float)dValue;
+    }
+    if ( parseNumber( course, &dValue ) )
+    {
+        pFix->fCourse = (float)dValue;
+    }
+    parseTime( time, &pFix->uiUtcMs );
+    pFix->source = LADYBUG_GPS_FIX_RMC;
+    pFix->bValid = true;
+}
+
+// GLL: latitude, N/S, longitude, E/W, time, status, ...
+void parseGll( FieldReader fields, LadybugGpsFix* pFix )
+{
+    const Field latitude = fields.next();
+    const Field northSouth = fields.next();
+    const Field longitude = fields.next();
+    const Field eastWest = fields.next();
+    const Field time = fields.next();
+    const Field status = fields.next();
+
+    if ( !isStatusActive( status ) ||
+        !parseCoordinate( latitude, northSouth, &pFix->dLatitude ) ||
+        !parseCoordinate( longitude, eastWest, &pFix->dLongitude ) )
+    {
+        return;
+    }
+
+    parseTime( time, &pFix->uiUtcMs );
+    pFix->source = LADYBUG_GPS_FIX_GLL;
+    pFix->bValid = true;
+}
+
+} // namespace
+
+LadybugNmeaParser::LadybugNmeaParser()
+    : m_uiLastLength( 0 ),
+      m_bHaveLast( false )
+{
+    memset( &m_lastFix, 0, sizeof( m_lastFix ) );
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+bool
+LadybugNmeaParser::parse( const char* pszSentences, unsigned int uiLength, LadybugGpsFix* pFix )
+{
+    m_stats.ulBlocks++;
+
+    if ( m_bHaveLast && uiLength == m_uiLastLength && memcmp( pszSentences, m_last, uiLength ) == 0 )
+    {
+        m_stats.ulUnchanged++;
+        *pFix = m_lastFix;
+    }
+    else
+    {
+        parseBlock( pszSentences, uiLength, pFix );
+
+        // A block too large to keep is parsed every time
+        m_bHaveLast = uiLength <= LADYBUG_NMEA_MAX_BYTES;
+        if ( m_bHaveLast )
+        {
+            memcpy( m_last, pszSentences, uiLength );
+            m_uiLastLength = uiLength;
+            m_lastFix = *pFix;
+        }
+    }
+
+    if ( pFix->bValid )
+    {
+        m_stats.ulFixes++;
+    }
+    return pFix->bValid;
+}
+
+void
+LadybugNmeaParser::reset()
+{
+    m_bHaveLast = false;
+}
+
+void
+LadybugNmeaParser::parseBlock( const char* pszSentences, unsigned int uiLength, LadybugGpsFix* pFix )
+{
+    LadybugGpsFix gga;
+    LadybugGpsFix rmc;
+    LadybugGpsFix gll;
+    memset( &gga, 0, sizeof( gga ) );
+    memset( &rmc, 0, sizeof( rmc ) );
+    memset( &gll, 0, sizeof( gll ) );
+
+    const char* p = pszSentences;
+    const char* const pEnd = pszSentences + uiLength;
+    while ( p < pEnd )
+    {
+        p = (const char*)memchr( p, '$', pEnd - p );
+        if ( p == NULL )
+        {
+            break;
+        }
+        const char* const pBody = ++p;
+        m_stats.ulSentences++;
+
+        // Two letters of talker, three of sentence type, then the fields.
+        // Other sentence types are skipped without reading further.
+        if ( pEnd - pBody < 6 || pBody[ 5 ] != ',' )
+        {
+            continue;
+        }
+        const char* const pszType = pBody + 2;
+        LadybugGpsFixSource source = LADYBUG_GPS_FIX_NONE;
+        if ( memcmp( pszType, "GGA", 3 ) == 0 )
+        {
+            source = LADYBUG_GPS_FIX_GGA;
+        }
+        else if ( memcmp( pszType, "RMC", 3 ) == 0 )
+        {
+            source = LADYBUG_GPS_FIX_RMC;
+        }
+        else if ( memcmp( pszType, "GLL", 3 ) == 0 )
+        {
+            source = LADYBUG_GPS_FIX_GLL;
+        }
+        else
+        {
+            continue;
+        }
+
+        // The checksum covers the body up to the '*'. A sentence without
+        // one, within the longest sentence NMEA allows and on one line, is
+        // rejected.
+        const char* const pStar = (const char*)memchr( pBody, '*', std::min<ptrdiff_t>( pEnd - pBody, MAX_SENTENCE_BYTES ) );
+        if ( pStar == NULL || pEnd - pStar < 3 ||
+            memchr( pBody, '$', pStar - pBody ) != NULL || memchr( pBody, '\n', pStar - pBody ) != NULL )
+        {
+            m_stats.ulChecksumErrors++;
+            continue;
+        }
+        const int iHigh = hexValue( pStar[ 1 ] );
+        const int iLow = hexValue( pStar[ 2 ] );
+        if ( iHigh < 0 || iLow < 0 || ( iHigh << 4 | iLow ) != getChecksum( pBody, pStar ) )
+        {
+            m_stats.ulChecksumErrors++;
+            continue;
+        }
+        p = pStar + 3;
+
+        const FieldReader fields( pBody + 6, pStar );
+        switch ( source )
+        {
+        case LADYBUG_GPS_FIX_GGA:
+            parseGga( fields, &gga );
+            break;
+        case LADYBUG_GPS_FIX_RMC:
+            parseRmc( fields, &rmc );
+            break;
+        default:
+            parseGll( fields, &gll );
+            break;
+        }
+    }
+
+    if ( gga.bValid )
+    {
+        *pFix = gga;
+        if ( rmc.bValid )
+        {
+            pFix->fSpeedKnots = rmc.fSpeedKnots;
+            pFix->fCourse = rmc.fCourse;
+        }
+    }
+    else if ( rmc.bValid )
+    {
+        *pFix = rmc;
+    }
+    else if ( gll.bValid )
+    {
+        *pFix = gll;
+    }
+    else
+    {
+        memset( pFix, 0, sizeof( *pFix ) );
+    }
+}
+
+void
+LadybugNmeaParser::getStats( LadybugNmeaParserStats* pStats ) const
+{
+    *pStats = m_stats;
+}
+
+void
+LadybugNmeaParser::printStats( const char* pszName ) const
+{
+    printf( "%s: %llu blocks (%llu unchanged), %llu sentences, %llu checksum errors, %llu with a fix\n",
+        pszName,
+        m_stats.ulBlocks,
+        m_stats.ulUnchanged,
+        m_stats.ulSentences,
+        m_stats.ulChecksumErrors,
+        m_stats.ulFixes );
+}
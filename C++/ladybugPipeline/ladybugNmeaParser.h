@@ -0,0 +1,127 @@
+//=============================================================================
+// ladybugNmeaParser.h
+//
+// Extracts a GPS fix from the NMEA sentences recorded with an image, in one
+// pass.
+//
+// ladybugGetGPSNMEADataFromImage() finds and parses one sentence type per
+// call, so getting a position from GGA, RMC or GLL can scan the image's GPS
+// data three times. Instead, get the sentences once with
+// ladybugGetGPSNMEASentencesFromImage() and pass them to parse(). It goes
+// through the sentences in a single pass, skipping any other than GGA, RMC
+// and GLL by their type, checks the checksum of those three, and fills a
+// LadybugGpsFix from the best one with a valid fix: GGA, then RMC, then
+// GLL. Sentences from any talker are used, e.g. $GNGGA as well as $GPGGA.
+//
+// The GPS updates a few times a second and the camera grabs faster, so
+// most images carry the same sentences as the one before. parse() compares
+// the sentences with the last ones it parsed and returns the same fix
+// without parsing again when they match.
+//
+// The parser does not use the Ladybug library and is not thread safe; use
+// one per thread.
+//
+// Usage:
+//    LadybugNmeaParser parser;
+//    unsigned char sentences[ LADYBUG_NMEA_MAX_BYTES ];
+//    unsigned int uiLength = 0;
+//    ladybugGetGPSNMEASentencesFromImage( &image, sentences, sizeof( sentences ), &uiLength );
+//    LadybugGpsFix fix;
+//    if ( parser.parse( (const char*)sentences, uiLength, &fix ) )
+//    {
+//        ... fix.dLatitude, fix.dLongitude ...
+//    }
+//=============================================================================
+
+#ifndef LADYBUGNMEAPARSER_H
+#define LADYBUGNMEAPARSER_H
+
+/** Largest block of sentences kept for comparison with the next image. */
+const unsigned int LADYBUG_NMEA_MAX_BYTES = 1024;
+
+enum LadybugGpsFixSource
+{
+    LADYBUG_GPS_FIX_NONE,
+    LADYBUG_GPS_FIX_GGA,
+    LADYBUG_GPS_FIX_RMC,
+    LADYBUG_GPS_FIX_GLL,
+};
+
+/** A position, and what else the sentences said about it. */
+struct LadybugGpsFix
+{
+    /** True if a sentence reported a valid position. */
+    bool bValid;
+
+    /** The sentence the position came from. */
+    LadybugGpsFixSource source;
+
+    /** Degrees. South and west are negative. */
+    double dLatitude;
+    double dLongitude;
+
+    /** Meters above mean sea level. From GGA only; 0 otherwise. */
+    double dAltitude;
+
+    /** Speed over ground in knots, and true course in degrees. From RMC only. */
+    float fSpeedKnots;
+    float fCourse;
+
+    /** GGA fix quality and satellites used, 0 without GGA. */
+    unsigned char ucQuality;
+    unsigned char ucSatellites;
+
+    /** Milliseconds since midnight UTC, from the position's sentence. */
+    unsigned int uiUtcMs;
+};
+
+/** Counters reported by LadybugNmeaParser::getStats(). */
+struct LadybugNmeaParserStats
+{
+    /** Blocks passed to parse(), and blocks that matched the one before. */
+    unsigned long long ulBlocks;
+    unsigned long long ulUnchanged;
+
+    /** Sentences seen, and GGA, RMC or GLL sentences with a missing or wrong checksum. */
+    unsigned long long ulSentences;
+    unsigned long long ulChecksumErrors;
+
+    /** Blocks that gave a valid position. */
+    unsigned long long ulFixes;
+};
+
+class LadybugNmeaParser
+{
+public:
+    LadybugNmeaParser();
+
+    /**
+     * Parse a block of NMEA sentences. Returns pFix->bValid.
+     *
+     * @param pszSentences - The sentences, not necessarily NUL terminated.
+     * @param uiLength     - Bytes in pszSentences.
+     * @param pFix         - Receives the fix. bValid is false if no sentence
+     *                       had a valid position.
+     */
+    bool parse( const char* pszSentences, unsigned int uiLength, LadybugGpsFix* pFix );
+
+    /** Forget the last block, so the next one is parsed. */
+    void reset();
+
+    void getStats( LadybugNmeaParserStats* pStats ) const;
+
+    /** Print the parser counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    void parseBlock( const char* pszSentences, unsigned int uiLength, LadybugGpsFix* pFix );
+
+    char m_last[ LADYBUG_NMEA_MAX_BYTES ];
+    unsigned int m_uiLastLength;
+    bool m_bHaveLast;
+    LadybugGpsFix m_lastFix;
+
+    LadybugNmeaParserStats m_stats;
+};
+
+#endif // LADYBUGNMEAPARSER_H
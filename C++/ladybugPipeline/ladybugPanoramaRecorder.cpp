@@ -0,0 +1,554 @@
+//=============================================================================
+// ladybugPanoramaRecorder.cpp
+//=============================================================================
+
+#include "ladybugPanoramaRecorder.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugThreadPlacement.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <ladybuggeom.h>
+#include <ladybugGPS.h>
+#include <ladybugrenderer.h>
+
+namespace
+{
+// The panorama thread renders one image at a time
+const unsigned int NUM_BUFFER_SETS = 1;
+
+// Bytes the file writer may hold before the panorama thread waits for it
+const unsigned long long MAX_QUEUED_BYTES = 64ULL * 1024 * 1024;
+
+double toMs( unsigned long long ulNanoseconds )
+{
+    return ulNanoseconds / 1e6;
+}
+
+// CPU time used by the calling thread
+unsigned long long getThreadCpuNs()
+{
+    struct timespec now;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now ) != 0 )
+    {
+        return 0;
+    }
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+double getTimestampSeconds( const LadybugImage& image )
+{
+    return image.timeStamp.ulSeconds + image.timeStamp.ulMicroSeconds / 1e6;
+}
+
+// Size of an image converted with a color processing method. The
+// downsampling methods halve each side of the raw image, once or twice.
+void getProcessedSize(
+    const LadybugImage& image, LadybugColorProcessingMethod method, unsigned int* puiCols, unsigned int* puiRows )
+{
+    unsigned int uiShift = 0;
+    if ( method == LADYBUG_DOWNSAMPLE16 )
+    {
+        uiShift = 2;
+    }
+    else if ( method == LADYBUG_DOWNSAMPLE4 || method == LADYBUG_MONO )
+    {
+        uiShift = 1;
+    }
+    *puiCols = image.uiCols >> uiShift;
+    *puiRows = image.uiRows >> uiShift;
+}
+
+//
+// A JPEG APP1 segment holding EXIF GPS tags, in big-endian TIFF layout: a
+// first IFD with only the GPS IFD pointer, the GPS IFD, then the rationals
+// its entries point to.
+//
+class ExifGpsSegment
+{
+public:
+    explicit ExifGpsSegment( const LadybugGpsFix& fix )
+    {
+        const unsigned int uiNumEntries = 8;
+        const unsigned int uiGpsIfd = 8 + 2 + 12 + 4;
+        const unsigned int uiValues = uiGpsIfd + 2 + uiNumEntries * 12 + 4;
+
+        const unsigned char arMarker[] = { 0xFF, 0xE1, 0, 0, 'E', 'x', 'i', 'f', 0, 0 };
+        m_data.assign( arMarker, arMarker + sizeof( arMarker ) );
+
+        // TIFF header, then the first IFD
+        put( "MM\0\x2A", 4 );
+        put32( 8 );
+        put16( 1 );
+        putEntry( 0x8825, 4, 1, uiGpsIfd );
+        put32( 0 );
+
+        // GPS IFD. Values of up to four bytes are kept in the entry, left aligned.
+        const unsigned int uiUtcSeconds = fix.uiUtcMs / 1000;
+        put16( uiNumEntries );
+        putEntry( 0x0000, 1, 4, 0x02030000 );
+        putEntry( 0x0001, 2, 2, ( fix.dLatitude < 0.0 ? 'S' : 'N' ) << 24 );
+        putEntry( 0x0002, 5, 3, uiValues );
+        putEntry( 0x0003, 2, 2, ( fix.dLongitude < 0.0 ? 'W' : 'E' ) << 24 );
+        putEntry( 0x0004, 5, 3, uiValues + 24 );
+        putEntry( 0x0005, 1, 1, ( fix.dAltitude < 0.0 ? 1u : 0u ) << 24 );
+        putEntry( 0x0006, 5, 1, uiValues + 48 );
+        putEntry( 0x0007, 5, 3, uiValues + 56 );
+        put32( 0 );
+
+        putDegrees( fabs( fix.dLatitude ) );
+        putDegrees( fabs( fix.dLongitude ) );
+        putRational( (unsigned int)( fabs( fix.dAltitude ) * 100.0 + 0.5 ), 100 );
+        putRational( uiUtcSeconds / 3600, 1 );
+        putRational( uiUtcSeconds / 60 % 60, 1 );
+        putRational( fix.uiUtcMs % 60000, 1000 );
+
+        // The segment length counts itself but not the marker
+        const size_t length = m_data.size() - 2;
+        m_data[ 2 ] = (unsigned char)( length >> 8 );
+        m_data[ 3 ] = (unsigned char)length;
+    }
+
+    // Insert the segment after the JPEG's start of image marker
+    void insertInto( std::vector<unsigned char>* pJpeg ) const
+    {
+        if ( pJpeg->size() >= 2 )
+        {
+            pJpeg->insert( pJpeg->begin() + 2, m_data.begin(), m_data.end() );
+        }
+    }
+
+private:
+    void put( const char* pData, unsigned int uiBytes )
+    {
+        m_data.insert( m_data.end(), pData, pData + uiBytes );
+    }
+
+    void put16( unsigned int uiValue )
+    {
+        m_data.push_back( (unsigned char)( uiValue >> 8 ) );
+        m_data.push_back( (unsigned char)uiValue );
+    }
+
+    void put32( unsigned int uiValue )
+    {
+        put16( uiValue >> 16 );
+        put16( uiValue & 0xFFFF );
+    }
+
+    void putEntry( unsigned int uiTag, unsigned int uiType, unsigned int uiCount, unsigned int uiValue )
+    {
+        put16( uiTag );
+        put16( uiType );
+        put32( uiCount );
+        put32( uiValue );
+    }
+
+    void putRational( unsigned int uiNumerator, unsigned int uiDenominator )
+    {
+        put32( uiNumerator );
+        put32( uiDenominator );
+    }
+
+    // Degrees, minutes and seconds to a ten thousandth of a second
+    void putDegrees( double dDegrees )
+    {
+        const unsigned long long ulTenThousandths = (unsigned long long)( dDegrees * 3600.0 * 10000.0 + 0.5 );
+        putRational( (unsigned int)( ulTenThousandths / 36000000 ), 1 );
+        putRational( (unsigned int)( ulTenThousandths / 600000 % 60 ), 1 );
+        putRational( (unsigned int)( ulTenThousandths % 600000 ), 10000 );
+    }
+
+    std::vector<unsigned char> m_data;
+};
+
+} // namespace
+
+LadybugPanoramaRecorder::LadybugPanoramaRecorder()
+    : m_context( NULL ),
+      m_uiNextPanorama( 0 ),
+      m_bStarted( false ),
+      m_dNextDue( -1.0 ),
+      m_bBusy( false ),
+      m_bPending( false ),
+      m_bRunning( false ),
+      m_ulCpuNs( 0 )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugPanoramaRecorder::~LadybugPanoramaRecorder()
+{
+    shutdown();
+}
+
+LadybugError
+LadybugPanoramaRecorder::initialize( LadybugContext cameraContext, const LadybugPanoramaRecorderConfig& config )
+{
+    if ( isInitialized() )
+    {
+        return LADYBUG_ALREADY_INITIALIZED;
+    }
+    if ( config.dIntervalSeconds <= 0.0 || config.dMaxCpuPercent <= 0.0 || config.uiCols == 0 || config.uiRows == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    // The panoramas are rendered on their own thread, so they need their
+    // own context
+    LadybugContext context = NULL;
+    LadybugError error = ladybugCreateContextWithCalibration( cameraContext, &context );
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugSetColorProcessingMethod( context, config.colorProcessingMethod );
+    }
+
+    // One encoder thread, so encoding stays within the thread's CPU share
+    if ( error == LADYBUG_OK )
+    {
+        error = m_encoder.initialize( 1, config.iJpegQuality, 1 );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = m_fileWriter.start( MAX_QUEUED_BYTES );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        m_encoder.shutdown();
+        if ( context != NULL )
+        {
+            ladybugDestroyContext( &context );
+        }
+        return error;
+    }
+
+    m_context = context;
+    m_config = config;
+    m_config.dMaxCpuPercent = std::min( m_config.dMaxCpuPercent, 100.0 );
+    m_bStarted = false;
+    m_bBusy = false;
+    m_bPending = false;
+    m_ulCpuNs = 0;
+    m_nmeaParser.reset();
+    m_panoramaLatency.reset();
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_started = std::chrono::steady_clock::now();
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugPanoramaRecorder::panoramaLoop, this );
+    return LADYBUG_OK;
+}
+
+void
+LadybugPanoramaRecorder::shutdown()
+{
+    if ( !isInitialized() )
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_bRunning = false;
+        m_bStarted = false;
+    }
+    m_frameTaken.notify_all();
+    m_thread.join();
+
+    m_encoder.shutdown();
+    m_fileWriter.stop();
+
+    m_framePool.destroy();
+    ladybugDestroyContext( &m_context );
+    m_context = NULL;
+
+    std::vector<unsigned char>().swap( m_data );
+}
+
+void
+LadybugPanoramaRecorder::start( const char* pszPrefix )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_prefix = pszPrefix;
+    m_uiNextPanorama = 0;
+    m_dNextDue = -1.0;
+    m_bStarted = true;
+}
+
+void
+LadybugPanoramaRecorder::stop()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_bStarted = false;
+}
+
+void
+LadybugPanoramaRecorder::offer( const LadybugImage& image )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    if ( !m_bRunning || !m_bStarted )
+    {
+        return;
+    }
+    m_stats.ulFramesOffered++;
+
+    const double dTimestamp = getTimestampSeconds( image );
+    if ( m_dNextDue < 0.0 || dTimestamp < m_dNextDue - m_config.dIntervalSeconds )
+    {
+        // The first image of a sequence, or the clock went back
+        m_dNextDue = dTimestamp;
+    }
+    if ( dTimestamp < m_dNextDue || m_bBusy )
+    {
+        return;
+    }
+
+    // Panoramas that fell due while the thread was busy are not made
+    const double dLate = floor( ( dTimestamp - m_dNextDue ) / m_config.dIntervalSeconds );
+    m_stats.ulPanoramasSkipped += (unsigned long long)dLate;
+    m_dNextDue += ( dLate + 1.0 ) * m_config.dIntervalSeconds;
+
+    char pszNumber[ 32 ];
+    snprintf( pszNumber, sizeof( pszNumber ), "-pano-%06u", m_uiNextPanorama++ );
+    m_name = m_prefix + pszNumber;
+    m_gpsLog = m_prefix + "-pano.txt";
+
+    // The panorama thread leaves the copy alone until it is pending
+    m_bBusy = true;
+    lock.unlock();
+
+    const std::chrono::steady_clock::time_point copyStart = std::chrono::steady_clock::now();
+    m_data.assign( image.pData, image.pData + image.uiDataSizeBytes );
+    m_image = image;
+    m_image.pData = m_data.data();
+    const std::chrono::duration<double, std::milli> copied = std::chrono::steady_clock::now() - copyStart;
+
+    lock.lock();
+    m_stats.ulFramesTaken++;
+    m_stats.dCopyMs += copied.count();
+    m_bPending = true;
+    m_frameTaken.notify_one();
+}
+
+LadybugError
+LadybugPanoramaRecorder::prepare( const LadybugImage& image )
+{
+    unsigned int uiCols = 0;
+    unsigned int uiRows = 0;
+    getProcessedSize( image, m_config.colorProcessingMethod, &uiCols, &uiRows );
+    LadybugError error = m_framePool.initialize( NUM_BUFFER_SETS, uiCols, uiRows, m_config.pixelFormat );
+
+    //
+    // The same set up as ladybugProcessStream. The alpha masks can take a
+    // long time to make if they are not in the current directory.
+    //
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugInitializeAlphaMasks( m_context, uiCols, uiRows );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugSetAlphaMasking( m_context, true );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugEnableSoftwareRendering( m_context, true );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugConfigureOutputImages( m_context, LADYBUG_PANORAMIC );
+    }
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugSetOffScreenImageSize( m_context, LADYBUG_PANORAMIC, m_config.uiCols, m_config.uiRows );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        printf( "Panoramas: cannot render %ux%u images, %s\n", uiCols, uiRows, ladybugErrorToString( error ) );
+    }
+    return error;
+}
+
+LadybugError
+LadybugPanoramaRecorder::makePanorama( bool* pbWithGps )
+{
+    *pbWithGps = false;
+
+    LadybugBufferSet* pSet = m_framePool.acquire();
+    LadybugStageTimer convertTimer( LADYBUG_STAGE_CONVERT );
+    convertTimer.setBytes( (unsigned long long)pSet->uiBufferSize * LADYBUG_NUM_CAMERAS );
+    LadybugError error = ladybugConvertImage( m_context, &m_image, pSet->arpBuffers, m_config.pixelFormat );
+    convertTimer.stop();
+
+    LadybugProcessedImage processedImage;
+    if ( error == LADYBUG_OK )
+    {
+        LadybugStageTimer renderTimer( LADYBUG_STAGE_RENDER );
+        error = ladybugUpdateTextures(
+            m_context, LADYBUG_NUM_CAMERAS, (const unsigned char**)pSet->arpBuffers, m_config.pixelFormat );
+        if ( error == LADYBUG_OK )
+        {
+            error = ladybugRenderOffScreenImage( m_context, LADYBUG_PANORAMIC, LADYBUG_BGR, &processedImage );
+        }
+        renderTimer.stop();
+    }
+    m_framePool.release( pSet );
+
+    std::vector<unsigned char> jpeg;
+    if ( error == LADYBUG_OK )
+    {
+        error = m_encoder.encodeImage(
+            processedImage.pData, processedImage.uiCols, processedImage.uiRows, LADYBUG_BGR, &jpeg );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    unsigned char sentences[ LADYBUG_NMEA_MAX_BYTES ];
+    unsigned int uiLength = 0;
+    LadybugGpsFix fix;
+    *pbWithGps =
+        ladybugGetGPSNMEASentencesFromImage( &m_image, sentences, sizeof( sentences ), &uiLength ) == LADYBUG_OK &&
+        m_nmeaParser.parse( (const char*)sentences, uiLength, &fix );
+    if ( *pbWithGps )
+    {
+        ExifGpsSegment( fix ).insertInto( &jpeg );
+    }
+
+    const std::string fileName = m_name + ".jpg";
+    error = m_fileWriter.write( fileName, std::move( jpeg ) );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    const size_t slash = fileName.rfind( '/' );
+    std::string line = fileName.substr( slash == std::string::npos ? 0 : slash + 1 );
+    char pszFields[ 128 ];
+    snprintf(
+        pszFields, sizeof( pszFields ), ", %u, %lld.%06u, ",
+        m_image.imageInfo.ulSequenceId,
+        (long long)m_image.timeStamp.ulSeconds,
+        m_image.timeStamp.ulMicroSeconds );
+    line += pszFields;
+    if ( *pbWithGps )
+    {
+        snprintf( pszFields, sizeof( pszFields ), "%.8f, %.8f, %.2f\n", fix.dLatitude, fix.dLongitude, fix.dAltitude );
+        line += pszFields;
+    }
+    else
+    {
+        line += "no fix\n";
+    }
+    return m_fileWriter.append( m_gpsLog, line.c_str() );
+}
+
+void
+LadybugPanoramaRecorder::panoramaLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_ENCODE, "panorama" );
+
+    bool bPrepared = false;
+    LadybugError prepareError = LADYBUG_OK;
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_frameTaken.wait( lock, [this] { return m_bPending || !m_bRunning; } );
+        if ( !m_bRunning )
+        {
+            break;
+        }
+        lock.unlock();
+
+        // The buffers and the renderer are sized from the first image
+        if ( !bPrepared )
+        {
+            prepareError = prepare( m_image );
+            bPrepared = true;
+        }
+
+        const std::chrono::steady_clock::time_point panoramaStart = std::chrono::steady_clock::now();
+        bool bWithGps = false;
+        const LadybugError error = prepareError != LADYBUG_OK ? prepareError : makePanorama( &bWithGps );
+        const std::chrono::steady_clock::duration busy = std::chrono::steady_clock::now() - panoramaStart;
+        m_panoramaLatency.record( std::chrono::duration_cast<std::chrono::nanoseconds>( busy ).count() );
+        const unsigned long long ulCpuNs = getThreadCpuNs();
+
+        // Rest so the work just done is at most dMaxCpuPercent of the time.
+        // Images offered meanwhile are not taken.
+        const std::chrono::duration<double> rest =
+            std::chrono::duration<double>( busy ) * ( 100.0 / m_config.dMaxCpuPercent - 1.0 );
+
+        lock.lock();
+        m_bPending = false;
+        m_ulCpuNs = ulCpuNs;
+        if ( error == LADYBUG_OK )
+        {
+            m_stats.ulPanoramasWritten++;
+            m_stats.ulPanoramasWithGps += bWithGps ? 1 : 0;
+        }
+        else
+        {
+            m_stats.ulErrors++;
+        }
+
+        const std::chrono::steady_clock::time_point restStart = std::chrono::steady_clock::now();
+        m_frameTaken.wait_for( lock, rest, [this] { return !m_bRunning; } );
+        m_stats.dRestSeconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - restStart ).count();
+        m_bBusy = false;
+    }
+}
+
+void
+LadybugPanoramaRecorder::getStats( LadybugPanoramaRecorderStats* pStats ) const
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        *pStats = m_stats;
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_started;
+        pStats->dCpuSeconds = m_ulCpuNs / 1e9;
+        pStats->dCpuPercent = elapsed.count() > 0.0 ? 100.0 * pStats->dCpuSeconds / elapsed.count() : 0.0;
+        pStats->dPanoramaP50Ms = toMs( m_panoramaLatency.getQuantile( 0.5 ) );
+        pStats->dPanoramaP99Ms = toMs( m_panoramaLatency.getQuantile( 0.99 ) );
+    }
+    m_fileWriter.getStats( &pStats->writer );
+}
+
+void
+LadybugPanoramaRecorder::printStats( const char* pszName ) const
+{
+    LadybugPanoramaRecorderStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu written at %ux%u (%llu with GPS, %llu errors, %llu skipped while busy), "
+        "%llu of %llu frames taken, panorama p50 %.1fms p99 %.1fms, rested %.1fs, "
+        "thread CPU %.1fs (%.1f%% of a CPU), copies on the recording thread %.1fms, "
+        "%.1fMB written (%llu write errors)\n",
+        pszName,
+        stats.ulPanoramasWritten,
+        m_config.uiCols,
+        m_config.uiRows,
+        stats.ulPanoramasWithGps,
+        stats.ulErrors,
+        stats.ulPanoramasSkipped,
+        stats.ulFramesTaken,
+        stats.ulFramesOffered,
+        stats.dPanoramaP50Ms,
+        stats.dPanoramaP99Ms,
+        stats.dRestSeconds,
+        stats.dCpuSeconds,
+        stats.dCpuPercent,
+        stats.dCopyMs,
+        stats.writer.ulBytesWritten / ( 1024.0 * 1024.0 ),
+        stats.writer.ulErrors );
+}
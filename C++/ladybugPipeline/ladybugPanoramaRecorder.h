@@ -0,0 +1,241 @@
+//=============================================================================
+// ladybugPanoramaRecorder.h
+//
+// Saves a stitched panorama of the recording every few seconds, next to the
+// stream, so the drive can be checked without processing the stream first.
+//
+// offer() is called with every image written to the stream, after it has
+// been queued for the writer. Once every dIntervalSeconds of image
+// timestamps it copies the raw image and returns; the copy is the only work
+// done on the recording thread. If the panorama thread is still busy, no
+// image is taken until it is free, so a slow panorama is skipped rather than
+// queued, and recording never waits for it.
+//
+// The panorama thread renders each image the way ladybugProcessStream does:
+// it color processes the image with its own context, loaded with the
+// camera's calibration, updates the textures and renders an equirectangular
+// LADYBUG_PANORAMIC image off screen, with the software renderer since the
+// thread has no OpenGL context. The panorama is JPEG encoded on one thread
+// and written by a LadybugFileWriter of its own, as
+//
+//    <prefix>-pano-000000.jpg
+//    <prefix>-pano-000001.jpg
+//    ...
+//
+// Each JPEG carries the GPS position of its image, if it has one, as EXIF
+// GPS tags. The same positions are appended to <prefix>-pano.txt, one line
+// per panorama: the file name, the image's sequence number and timestamp,
+// then latitude, longitude and altitude, or "no fix".
+//
+// The thread's share of the CPU is bounded by dMaxCpuPercent: after each
+// panorama it rests long enough that rendering, encoding and writing take
+// at most that share of the time. It runs on the ENCODE CPUs of
+// LadybugThreadPlacement, so keep those apart from the grab and write CPUs.
+//
+// Usage:
+//    LadybugPanoramaRecorderConfig config;
+//    LadybugPanoramaRecorder panoramas;
+//    panoramas.initialize( context, config );
+//    panoramas.start( "/home/user/ladybugImage" );
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        writer.write( image );
+//        panoramas.offer( image );
+//        ladybugUnlock( context, image.uiBufferIndex );
+//    }
+//    panoramas.stop();
+//    panoramas.shutdown();
+//=============================================================================
+
+#ifndef LADYBUGPANORAMARECORDER_H
+#define LADYBUGPANORAMARECORDER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugNmeaParser.h"
+
+struct LadybugPanoramaRecorderConfig
+{
+    LadybugPanoramaRecorderConfig()
+        : dIntervalSeconds( 1.0 ),
+          uiCols( 2048 ),
+          uiRows( 1024 ),
+          dMaxCpuPercent( 25.0 ),
+          colorProcessingMethod( LADYBUG_DOWNSAMPLE4 ),
+          pixelFormat( LADYBUG_BGRU ),
+          iJpegQuality( 85 )
+    {
+    }
+
+    /** Seconds of image timestamps between panoramas. */
+    double dIntervalSeconds;
+
+    /** Size of each panorama. */
+    unsigned int uiCols;
+    unsigned int uiRows;
+
+    /** Most of one CPU the panorama thread may use, 1 - 100. */
+    double dMaxCpuPercent;
+
+    /** Color processing of the images the panoramas are rendered from. */
+    LadybugColorProcessingMethod colorProcessingMethod;
+
+    /** LADYBUG_BGRU, or LADYBUG_BGRU16 for high bit depth data formats. */
+    LadybugPixelFormat pixelFormat;
+
+    int iJpegQuality;
+};
+
+/** Counters reported by LadybugPanoramaRecorder::getStats(). */
+struct LadybugPanoramaRecorderStats
+{
+    /** Images offered while started, and images copied for the panorama thread. */
+    unsigned long long ulFramesOffered;
+    unsigned long long ulFramesTaken;
+
+    /** Panoramas due while the thread was busy or resting, and not made. */
+    unsigned long long ulPanoramasSkipped;
+
+    /** Panoramas written, those with a GPS position, and those that failed. */
+    unsigned long long ulPanoramasWritten;
+    unsigned long long ulPanoramasWithGps;
+    unsigned long long ulErrors;
+
+    /** Time spent copying images on the recording thread. */
+    double dCopyMs;
+
+    /** Time to make one panorama, from color processing to queueing the file. */
+    double dPanoramaP50Ms;
+    double dPanoramaP99Ms;
+
+    /** Time the thread rested to stay within dMaxCpuPercent. */
+    double dRestSeconds;
+
+    /** CPU time of the panorama thread, and as a share of one CPU since initialize(). */
+    double dCpuSeconds;
+    double dCpuPercent;
+
+    /** The JPEG files and GPS lines written. */
+    LadybugFileWriterStats writer;
+};
+
+class LadybugPanoramaRecorder
+{
+public:
+    LadybugPanoramaRecorder();
+    ~LadybugPanoramaRecorder();
+
+    /**
+     * Create the panorama context from the camera's calibration and start
+     * the panorama thread, the JPEG encoder and the file writer. The alpha
+     * masks are made on the panorama thread with the first image.
+     *
+     * @param cameraContext - A context with the camera's calibration loaded.
+     * @param config        - Interval, size and CPU share of the panoramas.
+     */
+    LadybugError initialize( LadybugContext cameraContext, const LadybugPanoramaRecorderConfig& config );
+
+    /**
+     * Finish the panorama being made, write every file queued, and free the
+     * context and buffers.
+     */
+    void shutdown();
+
+    bool isInitialized() const
+    {
+        return m_context != NULL;
+    }
+
+    /**
+     * Start a sequence of panoramas, numbered from 0.
+     *
+     * @param pszPrefix - Path the file names start with, usually the stream's.
+     */
+    void start( const char* pszPrefix );
+
+    /** Take no more images. A panorama being made is still written. */
+    void stop();
+
+    /** Take the image for a panorama if one is due and the thread is free. */
+    void offer( const LadybugImage& image );
+
+    void getStats( LadybugPanoramaRecorderStats* pStats ) const;
+
+    /** Print the panorama counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugPanoramaRecorder( const LadybugPanoramaRecorder& );
+    LadybugPanoramaRecorder& operator=( const LadybugPanoramaRecorder& );
+
+    void panoramaLoop();
+
+    // Set up the buffers and the renderer for images the size of the first one
+    LadybugError prepare( const LadybugImage& image );
+
+    // Render, encode and queue the panorama of m_image. Sets *pbWithGps if
+    // the image had a GPS position.
+    LadybugError makePanorama( bool* pbWithGps );
+
+    LadybugPanoramaRecorderConfig m_config;
+    LadybugContext m_context;
+
+    // The image waiting to be rendered, with pData pointing into m_data
+    LadybugImage m_image;
+    std::vector<unsigned char> m_data;
+
+    // Name of the panorama of m_image, without the extension, and of the
+    // file its GPS line goes to
+    std::string m_name;
+    std::string m_gpsLog;
+
+    // Prefix of the current sequence, and the number of the next panorama
+    std::string m_prefix;
+    unsigned int m_uiNextPanorama;
+    bool m_bStarted;
+
+    // Image timestamp the next panorama is due at, in seconds. Negative
+    // before the first image of a sequence.
+    double m_dNextDue;
+
+    // An image is waiting in m_image, being rendered, or the thread is resting
+    bool m_bBusy;
+    bool m_bPending;
+
+    bool m_bRunning;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameTaken;
+
+    std::thread m_thread;
+
+    // Owned by the panorama thread
+    LadybugFramePool m_framePool;
+    LadybugJpegEncoder m_encoder;
+    LadybugNmeaParser m_nmeaParser;
+
+    LadybugFileWriter m_fileWriter;
+
+    std::chrono::steady_clock::time_point m_started;
+
+    // CPU time of the panorama thread, in nanoseconds
+    unsigned long long m_ulCpuNs;
+
+    LadybugHistogram m_panoramaLatency;
+
+    LadybugPanoramaRecorderStats m_stats;
+};
+
+#endif // LADYBUGPANORAMARECORDER_H
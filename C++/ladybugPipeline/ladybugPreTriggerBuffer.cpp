@@ -0,0 +1,416 @@
+//=============================================================================
+// ladybugPreTriggerBuffer.cpp
+//=============================================================================
+
+#include "ladybugPreTriggerBuffer.h"
+#include "ladybugStreamSink.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace
+{
+// Images start on cache line boundaries
+const unsigned long long IMAGE_ALIGNMENT = 64;
+
+const double BYTES_PER_MB = 1024.0 * 1024.0;
+
+unsigned long long roundUp( unsigned long long value, unsigned long long alignment )
+{
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+} // namespace
+
+LadybugPreTriggerBuffer::LadybugPreTriggerBuffer()
+    : m_pBuffer( NULL ),
+      m_ulCapacity( 0 ),
+      m_ulTail( 0 ),
+      m_state( IDLE ),
+      m_bAdding( false ),
+      m_pWriter( NULL )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugPreTriggerBuffer::~LadybugPreTriggerBuffer()
+{
+    shutdown();
+}
+
+LadybugError
+LadybugPreTriggerBuffer::initialize( const LadybugPreTriggerConfig& config )
+{
+    if ( isInitialized() )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+    if ( config.dSeconds <= 0.0 || config.ulBytes == 0 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const unsigned long long ulCapacity = roundUp( config.ulBytes, (unsigned long long)sysconf( _SC_PAGESIZE ) );
+    void* pBuffer = mmap( NULL, ulCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( pBuffer == MAP_FAILED )
+    {
+        return LADYBUG_MEMORY_ALLOC_ERROR;
+    }
+
+    // The recording thread fills the buffer, so keep it on the grab stage's
+    // NUMA node, then fault in every page before the first image
+    LadybugThreadPlacement::instance().bindMemory( LADYBUG_STAGE_GRAB, pBuffer, ulCapacity );
+    memset( pBuffer, 0, ulCapacity );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_config = config;
+    m_pBuffer = (unsigned char*)pBuffer;
+    m_ulCapacity = ulCapacity;
+    m_entries.clear();
+    m_ulTail = 0;
+    m_state = IDLE;
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.ulCapacityBytes = ulCapacity;
+    m_stats.error = LADYBUG_OK;
+    return LADYBUG_OK;
+}
+
+void
+LadybugPreTriggerBuffer::shutdown()
+{
+    if ( !isInitialized() )
+    {
+        return;
+    }
+
+    stop();
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    munmap( m_pBuffer, m_ulCapacity );
+    m_pBuffer = NULL;
+    m_ulCapacity = 0;
+}
+
+LadybugError
+LadybugPreTriggerBuffer::arm()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( m_pBuffer == NULL )
+    {
+        return LADYBUG_NOT_INITIALIZED;
+    }
+    if ( m_state == FLUSHING || m_state == DRAINED )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    m_state = ARMED;
+    return LADYBUG_OK;
+}
+
+bool
+LadybugPreTriggerBuffer::isArmed() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_state == ARMED;
+}
+
+LadybugError
+LadybugPreTriggerBuffer::trigger( LadybugStreamSink* pWriter )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( m_state != ARMED )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+    if ( pWriter == NULL )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    m_stats.uiTriggers++;
+    m_stats.uiFramesAtTrigger = m_stats.uiFramesHeld;
+    m_stats.dSecondsAtTrigger = m_stats.dSecondsHeld;
+    m_stats.error = LADYBUG_OK;
+
+    m_pWriter = pWriter;
+    m_state = FLUSHING;
+    m_thread = std::thread( &LadybugPreTriggerBuffer::flushLoop, this );
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugPreTriggerBuffer::stop()
+{
+    // Nothing is being added, so the flush ends once it has written
+    // everything held
+    if ( m_thread.joinable() )
+    {
+        m_thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_state == ARMED )
+    {
+        m_stats.ulFramesDropped += m_entries.size();
+        m_entries.clear();
+        m_stats.ulBytesHeld = 0;
+        updateHeld();
+    }
+    m_state = IDLE;
+    m_pWriter = NULL;
+    return m_stats.error;
+}
+
+LadybugError
+LadybugPreTriggerBuffer::add( const LadybugImage& image, bool* pbTaken )
+{
+    *pbTaken = false;
+
+    const unsigned long long ulSize = image.uiDataSizeBytes;
+    const unsigned long long ulBytes = roundUp( std::max( ulSize, 1ULL ), IMAGE_ALIGNMENT );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( m_state == IDLE || m_state == DRAINED )
+    {
+        return LADYBUG_OK;
+    }
+
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    unsigned long long ulOffset = 0;
+
+    if ( ulBytes > m_ulCapacity )
+    {
+        if ( m_state == ARMED )
+        {
+            m_stats.ulFramesTooLarge++;
+            *pbTaken = true;
+            return LADYBUG_OK;
+        }
+
+        // Let everything before it be written, then the caller writes it
+        m_stats.ulFramesTooLarge++;
+        m_spaceFreed.wait( lock, [this] { return m_state != FLUSHING; } );
+        return LADYBUG_OK;
+    }
+
+    if ( m_state == ARMED )
+    {
+        // Keep dSeconds back from this image, and make room for it
+        const std::chrono::duration<double> keep( m_config.dSeconds );
+        while ( !m_entries.empty() && now - m_entries.front().added > keep )
+        {
+            dropOldest();
+        }
+        while ( !findSpace( ulBytes, &ulOffset ) )
+        {
+            dropOldest();
+        }
+    }
+    else if ( !findSpace( ulBytes, &ulOffset ) )
+    {
+        // Wait for the flush to write out enough of the older images
+        const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        m_stats.ulWaits++;
+
+        m_spaceFreed.wait( lock, [this, ulBytes, &ulOffset] {
+            return m_state != FLUSHING || findSpace( ulBytes, &ulOffset ); } );
+
+        const std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - waitStart;
+        m_stats.dWaitMs += waited.count();
+
+        // Writing out failed; the stream writer reports why
+        if ( m_state != FLUSHING )
+        {
+            return LADYBUG_OK;
+        }
+    }
+
+    // Copy without the lock. The flush only reads images already added.
+    m_bAdding = true;
+    lock.unlock();
+
+    memcpy( m_pBuffer + ulOffset, image.pData, ulSize );
+
+    lock.lock();
+    m_bAdding = false;
+    *pbTaken = true;
+
+    // A write that failed while copying has emptied the buffer
+    if ( m_state == DRAINED )
+    {
+        m_stats.ulFramesLost++;
+        m_frameAdded.notify_one();
+        return m_stats.error;
+    }
+
+    Entry entry;
+    entry.image = image;
+    entry.image.pData = m_pBuffer + ulOffset;
+    entry.ulOffset = ulOffset;
+    entry.ulBytes = ulBytes;
+    entry.added = now;
+    m_entries.push_back( entry );
+    m_ulTail = ulOffset + ulBytes;
+
+    m_stats.ulFramesAdded++;
+    m_stats.ulBytesHeld += ulBytes;
+    m_stats.ulBytesHighWater = std::max( m_stats.ulBytesHighWater, m_stats.ulBytesHeld );
+    updateHeld();
+
+    m_frameAdded.notify_one();
+    return LADYBUG_OK;
+}
+
+void
+LadybugPreTriggerBuffer::flushLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "pre-trigger flush" );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    while ( true )
+    {
+        m_frameAdded.wait( lock, [this] { return !m_entries.empty() || !m_bAdding; } );
+
+        // Everything added has been written; from here the caller writes directly
+        if ( m_entries.empty() )
+        {
+            m_state = DRAINED;
+            break;
+        }
+
+        // Images are only taken from the front, so the reference stays
+        // valid while add() adds to the back
+        const Entry& entry = m_entries.front();
+        lock.unlock();
+
+        const LadybugError error = m_pWriter->write( entry.image );
+
+        lock.lock();
+        m_stats.ulBytesHeld -= entry.ulBytes;
+        m_entries.pop_front();
+
+        if ( error != LADYBUG_OK )
+        {
+            printf( "Pre-trigger buffer: %s after %llu frames, %zu frames lost\n",
+                ladybugErrorToString( error ), m_stats.ulFramesFlushed, m_entries.size() + 1 );
+            m_stats.error = error;
+            m_stats.ulFramesLost += m_entries.size() + 1;
+            m_stats.ulBytesHeld = 0;
+            m_entries.clear();
+            updateHeld();
+            m_state = DRAINED;
+            break;
+        }
+
+        m_stats.ulFramesFlushed++;
+        updateHeld();
+        m_spaceFreed.notify_all();
+    }
+
+    m_spaceFreed.notify_all();
+}
+
+bool
+LadybugPreTriggerBuffer::findSpace( unsigned long long ulBytes, unsigned long long* pulOffset ) const
+{
+    if ( m_entries.empty() )
+    {
+        *pulOffset = 0;
+        return ulBytes <= m_ulCapacity;
+    }
+
+    const unsigned long long ulHead = m_entries.front().ulOffset;
+    if ( m_ulTail > ulHead )
+    {
+        // The images held run from ulHead to m_ulTail; use the end of the
+        // buffer, or wrap to the start
+        if ( m_ulCapacity - m_ulTail >= ulBytes )
+        {
+            *pulOffset = m_ulTail;
+            return true;
+        }
+        if ( ulHead >= ulBytes )
+        {
+            *pulOffset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Wrapped; the only room is between the newest and the oldest image
+    if ( ulHead - m_ulTail >= ulBytes )
+    {
+        *pulOffset = m_ulTail;
+        return true;
+    }
+    return false;
+}
+
+void
+LadybugPreTriggerBuffer::dropOldest()
+{
+    m_stats.ulBytesHeld -= m_entries.front().ulBytes;
+    m_entries.pop_front();
+    m_stats.ulFramesDropped++;
+    updateHeld();
+}
+
+void
+LadybugPreTriggerBuffer::updateHeld()
+{
+    m_stats.uiFramesHeld = (unsigned int)m_entries.size();
+
+    if ( m_entries.size() > 1 )
+    {
+        const std::chrono::duration<double> held = m_entries.back().added - m_entries.front().added;
+        m_stats.dSecondsHeld = held.count();
+    }
+    else
+    {
+        m_stats.dSecondsHeld = 0.0;
+    }
+}
+
+void
+LadybugPreTriggerBuffer::getStats( LadybugPreTriggerStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugPreTriggerBuffer::printStats( const char* pszName ) const
+{
+    LadybugPreTriggerStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %u triggers, %u frames (%.1fs) held at the last, %llu frames added, %llu written, "
+        "%llu dropped, %llu too large, %llu lost, high water %.1fMB of %.1fMB, %llu waits (%.1fms)%s%s\n",
+        pszName,
+        stats.uiTriggers,
+        stats.uiFramesAtTrigger,
+        stats.dSecondsAtTrigger,
+        stats.ulFramesAdded,
+        stats.ulFramesFlushed,
+        stats.ulFramesDropped,
+        stats.ulFramesTooLarge,
+        stats.ulFramesLost,
+        stats.ulBytesHighWater / BYTES_PER_MB,
+        stats.ulCapacityBytes / BYTES_PER_MB,
+        stats.ulWaits,
+        stats.dWaitMs,
+        stats.error != LADYBUG_OK ? ", stopped by " : "",
+        stats.error != LADYBUG_OK ? ladybugErrorToString( stats.error ) : "" );
+}
@@ -0,0 +1,219 @@
+//=============================================================================
+// ladybugPreTriggerBuffer.h
+//
+// Keeps the last few seconds of grabbed images in memory before recording
+// starts, so the stream begins before the event that started it.
+//
+// While armed, add() copies each image, compressed or raw as grabbed and
+// without conversion, into a fixed block of memory allocated by
+// initialize(). Images older than dSeconds, counted back from the newest,
+// are dropped, and so are the oldest images when the next one does not fit
+// in ulBytes. The memory is mapped and every page touched by initialize(),
+// so copying an image in never faults a page.
+//
+// trigger() starts a thread that writes the images held to a
+// LadybugStreamSink, oldest first. Images added while it does so are
+// queued behind them in the same memory, so the stream stays in order and
+// the caller only waits if the memory fills before the writer catches up.
+// Once everything held is written, add() returns with *pbTaken false and
+// the caller writes to the stream writer directly. Make ulBytes larger than
+// dSeconds of images to leave room for the images that arrive while the
+// buffer is written out.
+//
+// add(), trigger() and stop() are called from one thread, the one that
+// records.
+//
+// Usage:
+//    LadybugPreTriggerBuffer preTrigger;
+//    preTrigger.initialize( config );
+//    preTrigger.arm();
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        if ( event && !writer.isRunning() )
+//        {
+//            writer.start( context, "ladybugImage" );
+//            preTrigger.trigger( &writer );
+//        }
+//        bool bTaken = false;
+//        preTrigger.add( image, &bTaken );
+//        if ( !bTaken && writer.isRunning() ) writer.write( image );
+//        ladybugUnlock( context, image.uiBufferIndex );
+//    }
+//    preTrigger.stop();
+//    writer.stop();
+//=============================================================================
+
+#ifndef LADYBUGPRETRIGGERBUFFER_H
+#define LADYBUGPRETRIGGERBUFFER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <ladybug.h>
+
+class LadybugStreamSink;
+
+struct LadybugPreTriggerConfig
+{
+    LadybugPreTriggerConfig()
+        : dSeconds( 10.0 ),
+          ulBytes( 1024ULL * 1024 * 1024 )
+    {
+    }
+
+    /** Seconds of images to keep before a trigger. */
+    double dSeconds;
+
+    /** Memory for the images held, allocated once. */
+    unsigned long long ulBytes;
+};
+
+/** Counters reported by LadybugPreTriggerBuffer::getStats(). */
+struct LadybugPreTriggerStats
+{
+    /** Images copied in, and images written out after a trigger. */
+    unsigned long long ulFramesAdded;
+    unsigned long long ulFramesFlushed;
+
+    /** Images dropped before a trigger because they were too old or did not fit. */
+    unsigned long long ulFramesDropped;
+
+    /** Images larger than the whole buffer, never held. */
+    unsigned long long ulFramesTooLarge;
+
+    /** Images held but not written because the stream writer failed. */
+    unsigned long long ulFramesLost;
+
+    /** Images and bytes held now, and the seconds between the oldest and newest. */
+    unsigned int uiFramesHeld;
+    unsigned long long ulBytesHeld;
+    double dSecondsHeld;
+
+    /** Most bytes ever held at once, and the size of the buffer. */
+    unsigned long long ulBytesHighWater;
+    unsigned long long ulCapacityBytes;
+
+    /** Images held when the last trigger came, and the seconds they covered. */
+    unsigned int uiFramesAtTrigger;
+    double dSecondsAtTrigger;
+
+    unsigned int uiTriggers;
+
+    /** Number of add() calls that waited for space while writing out, and for how long in total. */
+    unsigned long long ulWaits;
+    double dWaitMs;
+
+    /** The error that stopped writing out, or LADYBUG_OK. */
+    LadybugError error;
+};
+
+class LadybugPreTriggerBuffer
+{
+public:
+    LadybugPreTriggerBuffer();
+    ~LadybugPreTriggerBuffer();
+
+    /** Allocate the buffer. */
+    LadybugError initialize( const LadybugPreTriggerConfig& config );
+
+    /** Stop writing out and free the buffer. */
+    void shutdown();
+
+    bool isInitialized() const
+    {
+        return m_pBuffer != NULL;
+    }
+
+    /** Start keeping images. */
+    LadybugError arm();
+
+    bool isArmed() const;
+
+    /**
+     * Start writing the images held, then the images added after them, to
+     * a writer that has been started. Returns LADYBUG_NOT_STARTED if the
+     * buffer is not armed.
+     */
+    LadybugError trigger( LadybugStreamSink* pWriter );
+
+    /**
+     * Wait for every image added since the trigger to be written, or drop
+     * the images held if there was no trigger. The buffer is no longer
+     * armed. Returns the error that stopped writing out, if any.
+     */
+    LadybugError stop();
+
+    /**
+     * Copy an image into the buffer if it is armed, or writing out after a
+     * trigger. *pbTaken is false when the image was not copied and should
+     * be written directly, if at all.
+     */
+    LadybugError add( const LadybugImage& image, bool* pbTaken );
+
+    void getStats( LadybugPreTriggerStats* pStats ) const;
+
+    /** Print the buffer counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugPreTriggerBuffer( const LadybugPreTriggerBuffer& );
+    LadybugPreTriggerBuffer& operator=( const LadybugPreTriggerBuffer& );
+
+    enum State
+    {
+        IDLE,
+        ARMED,
+        FLUSHING,
+        DRAINED,
+    };
+
+    struct Entry
+    {
+        LadybugImage image;
+        unsigned long long ulOffset;
+        unsigned long long ulBytes;
+        std::chrono::steady_clock::time_point added;
+    };
+
+    void flushLoop();
+
+    // Find room for ulBytes after the newest image. Returns false if it
+    // does not fit without dropping or writing out older images.
+    bool findSpace( unsigned long long ulBytes, unsigned long long* pulOffset ) const;
+
+    // Drop the oldest image. Only while armed.
+    void dropOldest();
+
+    void updateHeld();
+
+    LadybugPreTriggerConfig m_config;
+
+    // Mapped and filled once by initialize()
+    unsigned char* m_pBuffer;
+    unsigned long long m_ulCapacity;
+
+    // Oldest first. The newest image ends at m_ulTail.
+    std::deque<Entry> m_entries;
+    unsigned long long m_ulTail;
+
+    State m_state;
+
+    // add() has reserved space and is copying into it
+    bool m_bAdding;
+
+    LadybugStreamSink* m_pWriter;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameAdded;
+    std::condition_variable m_spaceFreed;
+
+    std::thread m_thread;
+
+    LadybugPreTriggerStats m_stats;
+};
+
+#endif // LADYBUGPRETRIGGERBUFFER_H
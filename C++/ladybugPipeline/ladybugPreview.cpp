@@ -0,0 +1,320 @@
+//=============================================================================
+// ladybugPreview.cpp
+//=============================================================================
+
+#include "ladybugPreview.h"
+#include "ladybugCalibrationCopy.h"
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <ladybuggeom.h>
+
+namespace
+{
+// One set being converted, the newest converted and one being displayed
+const unsigned int NUM_BUFFER_SETS = 3;
+
+double toMs( unsigned long long ulNanoseconds )
+{
+    return ulNanoseconds / 1e6;
+}
+
+// CPU time used by the calling thread
+unsigned long long getThreadCpuNs()
+{
+    struct timespec now;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now ) != 0 )
+    {
+        return 0;
+    }
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Size of an image converted with a color processing method. The
+// downsampling methods halve each side of the raw image, once or twice.
+void getProcessedSize(
+    const LadybugImage& image, LadybugColorProcessingMethod method, unsigned int* puiCols, unsigned int* puiRows )
+{
+    unsigned int uiShift = 0;
+    if ( method == LADYBUG_DOWNSAMPLE16 )
+    {
+        uiShift = 2;
+    }
+    else if ( method == LADYBUG_DOWNSAMPLE4 || method == LADYBUG_MONO )
+    {
+        uiShift = 1;
+    }
+    *puiCols = image.uiCols >> uiShift;
+    *puiRows = image.uiRows >> uiShift;
+}
+
+} // namespace
+
+LadybugPreview::LadybugPreview()
+    : m_context( NULL ),
+      m_bBusy( false ),
+      m_bPending( false ),
+      m_pReady( NULL ),
+      m_bRunning( false ),
+      m_ulCpuNs( 0 )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugPreview::~LadybugPreview()
+{
+    shutdown();
+}
+
+LadybugError
+LadybugPreview::initialize( LadybugContext cameraContext, const LadybugPreviewConfig& config )
+{
+    if ( isInitialized() )
+    {
+        return LADYBUG_ALREADY_INITIALIZED;
+    }
+
+    // The preview converts on its own thread, so it needs its own context
+    LadybugContext context = NULL;
+    LadybugError error = ladybugCreateContextWithCalibration( cameraContext, &context );
+    if ( error == LADYBUG_OK )
+    {
+        error = ladybugSetColorProcessingMethod( context, config.colorProcessingMethod );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        if ( context != NULL )
+        {
+            ladybugDestroyContext( &context );
+        }
+        return error;
+    }
+
+    m_context = context;
+    m_config = config;
+    m_config.uiFrameInterval = std::max( m_config.uiFrameInterval, 1u );
+    m_bBusy = false;
+    m_bPending = false;
+    m_pReady = NULL;
+    m_ulCpuNs = 0;
+    m_convertLatency.reset();
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_started = std::chrono::steady_clock::now();
+    m_nextTake = m_started;
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugPreview::previewLoop, this );
+    return LADYBUG_OK;
+}
+
+void
+LadybugPreview::shutdown()
+{
+    if ( !isInitialized() )
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_bRunning = false;
+    }
+    m_frameTaken.notify_all();
+    m_thread.join();
+
+    if ( m_pReady != NULL )
+    {
+        m_framePool.release( m_pReady );
+        m_pReady = NULL;
+    }
+    m_framePool.destroy();
+    ladybugDestroyContext( &m_context );
+    m_context = NULL;
+
+    std::vector<unsigned char>().swap( m_data );
+}
+
+void
+LadybugPreview::offer( const LadybugImage& image )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    const unsigned long long ulFrame = m_stats.ulFramesOffered++;
+    if ( !m_bRunning || ulFrame % m_config.uiFrameInterval != 0 )
+    {
+        return;
+    }
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( m_config.uiIntervalMs > 0 && now < m_nextTake )
+    {
+        return;
+    }
+    if ( m_bBusy )
+    {
+        m_stats.ulFramesDropped++;
+        return;
+    }
+    m_nextTake = now + std::chrono::milliseconds( m_config.uiIntervalMs );
+
+    // The preview thread leaves the copy alone until it is pending
+    m_bBusy = true;
+    lock.unlock();
+
+    const std::chrono::steady_clock::time_point copyStart = std::chrono::steady_clock::now();
+    m_data.assign( image.pData, image.pData + image.uiDataSizeBytes );
+    m_image = image;
+    m_image.pData = m_data.data();
+    const std::chrono::duration<double, std::milli> copied = std::chrono::steady_clock::now() - copyStart;
+
+    lock.lock();
+    m_stats.ulFramesTaken++;
+    m_stats.dCopyMs += copied.count();
+    m_bPending = true;
+    m_frameTaken.notify_one();
+}
+
+LadybugBufferSet*
+LadybugPreview::acquireLatest()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    LadybugBufferSet* pSet = m_pReady;
+    m_pReady = NULL;
+    if ( pSet != NULL )
+    {
+        m_stats.ulFramesShown++;
+    }
+    return pSet;
+}
+
+void
+LadybugPreview::release( LadybugBufferSet* pSet )
+{
+    m_framePool.release( pSet );
+}
+
+void
+LadybugPreview::previewLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_CONVERT, "preview" );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( true )
+    {
+        m_frameTaken.wait( lock, [this] { return m_bPending || !m_bRunning; } );
+        if ( !m_bRunning )
+        {
+            break;
+        }
+        lock.unlock();
+
+        // The buffers are sized from the first image
+        LadybugError error = LADYBUG_OK;
+        if ( !m_framePool.isInitialized() )
+        {
+            unsigned int uiCols = 0;
+            unsigned int uiRows = 0;
+            getProcessedSize( m_image, m_config.colorProcessingMethod, &uiCols, &uiRows );
+            error = m_framePool.initialize( NUM_BUFFER_SETS, uiCols, uiRows, m_config.pixelFormat );
+            if ( error == LADYBUG_OK )
+            {
+                // The SDK writes the masks into the first buffers it sees, so
+                // set them up once the buffers exist
+                error = ladybugInitializeAlphaMasks( m_context, uiCols, uiRows );
+            }
+            if ( error == LADYBUG_OK )
+            {
+                ladybugSetAlphaMasking( m_context, true );
+            }
+            if ( error != LADYBUG_OK )
+            {
+                printf( "Preview: no buffers for %ux%u images, %s\n", uiCols, uiRows, ladybugErrorToString( error ) );
+            }
+        }
+
+        LadybugBufferSet* pSet = NULL;
+        if ( error == LADYBUG_OK )
+        {
+            pSet = m_framePool.acquire();
+
+            const std::chrono::steady_clock::time_point convertStart = std::chrono::steady_clock::now();
+            LadybugStageTimer convertTimer( LADYBUG_STAGE_CONVERT );
+            convertTimer.setBytes( (unsigned long long)pSet->uiBufferSize * LADYBUG_NUM_CAMERAS );
+            error = ladybugConvertImage( m_context, &m_image, pSet->arpBuffers, m_config.pixelFormat );
+            convertTimer.stop();
+            m_convertLatency.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - convertStart ).count() );
+        }
+        const unsigned long long ulCpuNs = getThreadCpuNs();
+
+        lock.lock();
+        m_bPending = false;
+        m_bBusy = false;
+        m_ulCpuNs = ulCpuNs;
+        if ( error == LADYBUG_OK )
+        {
+            m_stats.ulFramesConverted++;
+            if ( m_pReady != NULL )
+            {
+                m_framePool.release( m_pReady );
+                m_stats.ulFramesNotShown++;
+            }
+            m_pReady = pSet;
+            m_stats.uiCols = pSet->uiCols;
+            m_stats.uiRows = pSet->uiRows;
+        }
+        else
+        {
+            if ( pSet != NULL )
+            {
+                m_framePool.release( pSet );
+            }
+            m_stats.ulConvertErrors++;
+        }
+    }
+}
+
+void
+LadybugPreview::getStats( LadybugPreviewStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_started;
+    pStats->dCpuSeconds = m_ulCpuNs / 1e9;
+    pStats->dCpuPercent = elapsed.count() > 0.0 ? 100.0 * pStats->dCpuSeconds / elapsed.count() : 0.0;
+    pStats->dConvertP50Ms = toMs( m_convertLatency.getQuantile( 0.5 ) );
+    pStats->dConvertP99Ms = toMs( m_convertLatency.getQuantile( 0.99 ) );
+}
+
+void
+LadybugPreview::printStats( const char* pszName ) const
+{
+    LadybugPreviewStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu of %llu frames converted at %ux%u (%llu dropped while busy, %llu errors), "
+        "%llu shown, %llu replaced before shown, convert p50 %.2fms p99 %.2fms, "
+        "thread CPU %.1fs (%.1f%% of a CPU), copies on the grab thread %.1fms\n",
+        pszName,
+        stats.ulFramesConverted,
+        stats.ulFramesOffered,
+        stats.uiCols,
+        stats.uiRows,
+        stats.ulFramesDropped,
+        stats.ulConvertErrors,
+        stats.ulFramesShown,
+        stats.ulFramesNotShown,
+        stats.dConvertP50Ms,
+        stats.dConvertP99Ms,
+        stats.dCpuSeconds,
+        stats.dCpuPercent,
+        stats.dCopyMs );
+}
@@ -0,0 +1,204 @@
+//=============================================================================
+// ladybugPreview.h
+//
+// Color processes a few of the grabbed images for display, on a thread of
+// its own, so showing the camera never holds up grabbing and recording.
+//
+// offer() is called with every grabbed image, on the thread that grabs. Of
+// every uiFrameInterval images it takes one, and with uiIntervalMs set at
+// most one in that time; it copies the raw image and returns. The copy is
+// the only work done on the grabbing thread. If the preview thread is still
+// busy with the last image, the image is dropped instead, so a slow preview
+// shows fewer images rather than queueing them.
+//
+// The preview thread converts the copy with its own context, loaded with
+// the camera's calibration, at the context's color processing method; a
+// downsampling method such as LADYBUG_DOWNSAMPLE16 keeps both the work and
+// the textures small. Converted images go to a LadybugFramePool of three
+// sets: one being converted, the newest converted and one being displayed.
+// A converted image replaced by a newer one before it was displayed is
+// counted and dropped.
+//
+// The thread that displays calls acquireLatest() and passes the buffers to
+// ladybugUpdateTextures() on a context with the same color processing
+// method, so the textures are the size of the preview images. Without a
+// display, the buffers can be saved as JPEG files instead.
+//
+// The preview's own costs are counted apart from recording: the copies on
+// the grabbing thread, and the CPU time of the preview thread.
+//
+// Usage:
+//    LadybugPreview preview;
+//    preview.initialize( context, config );
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        preview.offer( image );
+//        ... record the image ...
+//        ladybugUnlock( context, image.uiBufferIndex );
+//
+//        LadybugBufferSet* pSet = preview.acquireLatest();
+//        if ( pSet != NULL )
+//        {
+//            ladybugUpdateTextures( context, LADYBUG_NUM_CAMERAS, (const unsigned char**)pSet->arpBuffers, pSet->pixelFormat );
+//            preview.release( pSet );
+//        }
+//    }
+//    preview.shutdown();
+//=============================================================================
+
+#ifndef LADYBUGPREVIEW_H
+#define LADYBUGPREVIEW_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFramePool.h"
+#include "ladybugMetrics.h"
+
+struct LadybugPreviewConfig
+{
+    LadybugPreviewConfig()
+        : uiFrameInterval( 10 ),
+          uiIntervalMs( 0 ),
+          colorProcessingMethod( LADYBUG_DOWNSAMPLE16 ),
+          pixelFormat( LADYBUG_BGRU )
+    {
+    }
+
+    /** Convert one of every uiFrameInterval images offered. */
+    unsigned int uiFrameInterval;
+
+    /** If not 0, convert at most one image in this many milliseconds. */
+    unsigned int uiIntervalMs;
+
+    /** Color processing of the preview, which sets the size of its images. */
+    LadybugColorProcessingMethod colorProcessingMethod;
+
+    /** LADYBUG_BGRU, or LADYBUG_BGRU16 for high bit depth data formats. */
+    LadybugPixelFormat pixelFormat;
+};
+
+/** Counters reported by LadybugPreview::getStats(). */
+struct LadybugPreviewStats
+{
+    /** Images offered, and images copied for the preview thread. */
+    unsigned long long ulFramesOffered;
+    unsigned long long ulFramesTaken;
+
+    /** Images due for the preview but dropped because the thread was busy. */
+    unsigned long long ulFramesDropped;
+
+    /** Images converted, displayed, and replaced before they were displayed. */
+    unsigned long long ulFramesConverted;
+    unsigned long long ulFramesShown;
+    unsigned long long ulFramesNotShown;
+
+    unsigned long long ulConvertErrors;
+
+    /** Time spent copying images on the grabbing thread. */
+    double dCopyMs;
+
+    /** Time spent in ladybugConvertImage(). */
+    double dConvertP50Ms;
+    double dConvertP99Ms;
+
+    /** CPU time of the preview thread, and as a share of one CPU since initialize(). */
+    double dCpuSeconds;
+    double dCpuPercent;
+
+    /** Size of each preview image, 0 before the first one. */
+    unsigned int uiCols;
+    unsigned int uiRows;
+};
+
+class LadybugPreview
+{
+public:
+    LadybugPreview();
+    ~LadybugPreview();
+
+    /**
+     * Create the preview's context from the camera's calibration and start
+     * the preview thread.
+     *
+     * @param cameraContext - A context with the camera's calibration loaded.
+     * @param config        - Frame interval and color processing.
+     */
+    LadybugError initialize( LadybugContext cameraContext, const LadybugPreviewConfig& config );
+
+    /**
+     * Stop the preview thread and free the context and buffers. A set from
+     * acquireLatest() must have been released.
+     */
+    void shutdown();
+
+    bool isInitialized() const
+    {
+        return m_context != NULL;
+    }
+
+    /** Take the image for the preview if it is due and the preview is free. */
+    void offer( const LadybugImage& image );
+
+    /**
+     * The newest converted images not displayed yet, or NULL if there are
+     * none. Release the set once the images have been displayed.
+     */
+    LadybugBufferSet* acquireLatest();
+
+    void release( LadybugBufferSet* pSet );
+
+    void getStats( LadybugPreviewStats* pStats ) const;
+
+    /** Print the preview counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugPreview( const LadybugPreview& );
+    LadybugPreview& operator=( const LadybugPreview& );
+
+    void previewLoop();
+
+    LadybugPreviewConfig m_config;
+    LadybugContext m_context;
+
+    // The image waiting to be converted, with pData pointing into m_data
+    LadybugImage m_image;
+    std::vector<unsigned char> m_data;
+
+    // An image is waiting in m_image, or being converted from it
+    bool m_bBusy;
+    bool m_bPending;
+
+    LadybugFramePool m_framePool;
+
+    // The newest converted set, not displayed yet
+    LadybugBufferSet* m_pReady;
+
+    bool m_bRunning;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameTaken;
+
+    std::thread m_thread;
+
+    std::chrono::steady_clock::time_point m_started;
+
+    // With uiIntervalMs, no image is taken before this
+    std::chrono::steady_clock::time_point m_nextTake;
+
+    // CPU time of the preview thread, in nanoseconds
+    unsigned long long m_ulCpuNs;
+
+    LadybugHistogram m_convertLatency;
+
+    LadybugPreviewStats m_stats;
+};
+
+#endif // LADYBUGPREVIEW_H
@@ -0,0 +1,329 @@
+//=============================================================================
+// ladybugRawRing.cpp
+//=============================================================================
+
+#include "ladybugRawRing.h"
+#include "ladybugMetrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char RAW_RING_MAGIC[ 8 ] = { 'L', 'B', 'R', 'A', 'W', 'R', 'N', 'G' };
+
+const uint64_t FRAME_IN_PROGRESS = ~(uint64_t)0;
+
+unsigned long long roundUp( unsigned long long value, unsigned long long alignment )
+{
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+const unsigned long long FILE_HEADER_BYTES = roundUp( sizeof( LadybugRawRingFileHeader ), RAW_RING_ALIGNMENT );
+const unsigned long long FRAME_HEADER_BYTES = roundUp( sizeof( LadybugRawRingFrameHeader ), RAW_RING_ALIGNMENT );
+
+LadybugRawRingFrameHeader* getFrameHeader( unsigned char* pMap, uint64_t ulSlotBytes, uint64_t ulSlot )
+{
+    return (LadybugRawRingFrameHeader*)( pMap + FILE_HEADER_BYTES + ulSlot * ulSlotBytes );
+}
+
+} // namespace
+
+LadybugRawRingWriter::LadybugRawRingWriter()
+    : m_fd( -1 ),
+      m_pMap( NULL ),
+      m_ulMapBytes( 0 ),
+      m_pHeader( NULL )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugRawRingWriter::~LadybugRawRingWriter()
+{
+    close();
+}
+
+LadybugError
+LadybugRawRingWriter::open( const char* pszPath, unsigned long long ulRingBytes, unsigned long long ulMaxFrameBytes )
+{
+    if ( isOpen() )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    const unsigned long long ulSlotBytes = roundUp( FRAME_HEADER_BYTES + ulMaxFrameBytes, RAW_RING_ALIGNMENT );
+    if ( pszPath == NULL || ulMaxFrameBytes == 0 || ulRingBytes < FILE_HEADER_BYTES + ulSlotBytes )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const unsigned long long ulNumSlots = ( ulRingBytes - FILE_HEADER_BYTES ) / ulSlotBytes;
+    const unsigned long long ulFileBytes = FILE_HEADER_BYTES + ulNumSlots * ulSlotBytes;
+
+    m_fd = ::open( pszPath, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( m_fd < 0 )
+    {
+        printf( "Error: could not create %s - %s\n", pszPath, strerror( errno ) );
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    // Allocate every block now, so the disk cannot fill up during capture
+    int result = posix_fallocate( m_fd, 0, (off_t)ulFileBytes );
+    if ( result == EOPNOTSUPP || result == EINVAL )
+    {
+        result = ( ftruncate( m_fd, (off_t)ulFileBytes ) == 0 ) ? 0 : errno;
+    }
+
+    if ( result != 0 )
+    {
+        printf( "Error: could not allocate %llu bytes for %s - %s\n", ulFileBytes, pszPath, strerror( result ) );
+        ::close( m_fd );
+        m_fd = -1;
+        return LADYBUG_FAILED;
+    }
+
+    void* pMap = mmap( NULL, (size_t)ulFileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 );
+    if ( pMap == MAP_FAILED )
+    {
+        printf( "Error: could not map %s - %s\n", pszPath, strerror( errno ) );
+        ::close( m_fd );
+        m_fd = -1;
+        return LADYBUG_MEMORY_ALLOC_ERROR;
+    }
+
+    m_pMap = (unsigned char*)pMap;
+    m_ulMapBytes = ulFileBytes;
+
+    m_pHeader = (LadybugRawRingFileHeader*)m_pMap;
+    memcpy( m_pHeader->szMagic, RAW_RING_MAGIC, sizeof( RAW_RING_MAGIC ) );
+    m_pHeader->uiVersion = RAW_RING_VERSION;
+    m_pHeader->uiImageStructBytes = sizeof( LadybugImage );
+    m_pHeader->ulSlotBytes = ulSlotBytes;
+    m_pHeader->ulNumSlots = ulNumSlots;
+    m_pHeader->ulFramesWritten = 0;
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiNumSlots = (unsigned int)ulNumSlots;
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugRawRingWriter::write( const LadybugImage& image )
+{
+    if ( !isOpen() )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+
+    const uint64_t ulDataBytes = image.uiDataSizeBytes;
+    if ( FRAME_HEADER_BYTES + ulDataBytes > m_pHeader->ulSlotBytes || image.pData == NULL )
+    {
+        m_stats.ulFramesTooLarge++;
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    LadybugStageTimer writeTimer( LADYBUG_STAGE_WRITE );
+    writeTimer.setBytes( ulDataBytes );
+
+    const uint64_t ulFrameNumber = m_pHeader->ulFramesWritten;
+    const uint64_t ulSlot = ulFrameNumber % m_pHeader->ulNumSlots;
+    LadybugRawRingFrameHeader* pFrame = getFrameHeader( m_pMap, m_pHeader->ulSlotBytes, ulSlot );
+
+    // Invalidate the slot, then fill it, then publish it
+    __atomic_store_n( &pFrame->ulFrameNumber, FRAME_IN_PROGRESS, __ATOMIC_RELEASE );
+    memcpy( (unsigned char*)pFrame + FRAME_HEADER_BYTES, image.pData, (size_t)ulDataBytes );
+    pFrame->ulDataBytes = ulDataBytes;
+    pFrame->image = image;
+    pFrame->image.pData = NULL;
+    __atomic_store_n( &pFrame->ulFrameNumber, ulFrameNumber, __ATOMIC_RELEASE );
+    __atomic_store_n( &m_pHeader->ulFramesWritten, ulFrameNumber + 1, __ATOMIC_RELEASE );
+
+#ifdef __linux__
+    // Start writing the slot back now rather than letting dirty pages pile up
+    sync_file_range(
+        m_fd,
+        (off64_t)( FILE_HEADER_BYTES + ulSlot * m_pHeader->ulSlotBytes ),
+        (off64_t)( FRAME_HEADER_BYTES + ulDataBytes ),
+        SYNC_FILE_RANGE_WRITE );
+#endif
+
+    if ( ulFrameNumber >= m_pHeader->ulNumSlots )
+    {
+        m_stats.ulFramesOverwritten++;
+    }
+    m_stats.ulFramesWritten++;
+    m_stats.ulBytesWritten += ulDataBytes;
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugRawRingWriter::close()
+{
+    if ( !isOpen() )
+    {
+        return LADYBUG_OK;
+    }
+
+    LadybugError error = LADYBUG_OK;
+    if ( msync( m_pMap, (size_t)m_ulMapBytes, MS_SYNC ) != 0 )
+    {
+        error = LADYBUG_FAILED;
+    }
+
+    munmap( m_pMap, (size_t)m_ulMapBytes );
+    if ( ::close( m_fd ) != 0 )
+    {
+        error = LADYBUG_FAILED;
+    }
+
+    m_fd = -1;
+    m_pMap = NULL;
+    m_ulMapBytes = 0;
+    m_pHeader = NULL;
+
+    return error;
+}
+
+void
+LadybugRawRingWriter::getStats( LadybugRawRingStats* pStats ) const
+{
+    *pStats = m_stats;
+}
+
+void
+LadybugRawRingWriter::printStats( const char* pszName ) const
+{
+    printf(
+        "%s: %llu frames (%.1fMB) in %u slots, %llu overwritten, %llu too large\n",
+        pszName,
+        m_stats.ulFramesWritten,
+        m_stats.ulBytesWritten / ( 1024.0 * 1024.0 ),
+        m_stats.uiNumSlots,
+        m_stats.ulFramesOverwritten,
+        m_stats.ulFramesTooLarge );
+}
+
+LadybugRawRingReader::LadybugRawRingReader()
+    : m_pMap( NULL ),
+      m_ulMapBytes( 0 ),
+      m_pHeader( NULL )
+{
+}
+
+LadybugRawRingReader::~LadybugRawRingReader()
+{
+    close();
+}
+
+LadybugError
+LadybugRawRingReader::open( const char* pszPath )
+{
+    close();
+
+    const int fd = ::open( pszPath, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    struct stat status;
+    if ( fstat( fd, &status ) != 0 || (unsigned long long)status.st_size < FILE_HEADER_BYTES )
+    {
+        ::close( fd );
+        return LADYBUG_FAILED;
+    }
+
+    void* pMap = mmap( NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( pMap == MAP_FAILED )
+    {
+        return LADYBUG_MEMORY_ALLOC_ERROR;
+    }
+
+    m_pMap = (unsigned char*)pMap;
+    m_ulMapBytes = (unsigned long long)status.st_size;
+    m_pHeader = (const LadybugRawRingFileHeader*)m_pMap;
+
+    const bool bValid =
+        memcmp( m_pHeader->szMagic, RAW_RING_MAGIC, sizeof( RAW_RING_MAGIC ) ) == 0 &&
+        m_pHeader->uiVersion == RAW_RING_VERSION &&
+        m_pHeader->uiImageStructBytes == sizeof( LadybugImage ) &&
+        m_pHeader->ulNumSlots > 0 &&
+        m_pHeader->ulSlotBytes > FRAME_HEADER_BYTES &&
+        FILE_HEADER_BYTES + m_pHeader->ulNumSlots * m_pHeader->ulSlotBytes <= m_ulMapBytes;
+    if ( !bValid )
+    {
+        close();
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    madvise( m_pMap, (size_t)m_ulMapBytes, MADV_SEQUENTIAL );
+
+    return LADYBUG_OK;
+}
+
+void
+LadybugRawRingReader::close()
+{
+    if ( m_pMap != NULL )
+    {
+        munmap( m_pMap, (size_t)m_ulMapBytes );
+    }
+
+    m_pMap = NULL;
+    m_ulMapBytes = 0;
+    m_pHeader = NULL;
+}
+
+unsigned long long
+LadybugRawRingReader::getFramesWritten() const
+{
+    return ( m_pHeader != NULL ) ? __atomic_load_n( &m_pHeader->ulFramesWritten, __ATOMIC_ACQUIRE ) : 0;
+}
+
+unsigned long long
+LadybugRawRingReader::getNumFrames() const
+{
+    const unsigned long long ulFramesWritten = getFramesWritten();
+    return ( m_pHeader == NULL || ulFramesWritten < m_pHeader->ulNumSlots ) ? ulFramesWritten : m_pHeader->ulNumSlots;
+}
+
+LadybugError
+LadybugRawRingReader::readFrame( unsigned long long ulIndex, LadybugImage* pImage ) const
+{
+    if ( m_pHeader == NULL )
+    {
+        return LADYBUG_NOT_INITIALIZED;
+    }
+
+    const unsigned long long ulNumFrames = getNumFrames();
+    if ( ulIndex >= ulNumFrames )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    const uint64_t ulFrameNumber = getFramesWritten() - ulNumFrames + ulIndex;
+    const LadybugRawRingFrameHeader* pFrame =
+        getFrameHeader( m_pMap, m_pHeader->ulSlotBytes, ulFrameNumber % m_pHeader->ulNumSlots );
+
+    // The slot is being rewritten, or was never finished
+    if ( __atomic_load_n( &pFrame->ulFrameNumber, __ATOMIC_ACQUIRE ) != ulFrameNumber ||
+         FRAME_HEADER_BYTES + pFrame->ulDataBytes > m_pHeader->ulSlotBytes )
+    {
+        return LADYBUG_FAILED;
+    }
+
+    *pImage = pFrame->image;
+    pImage->pData = (unsigned char*)pFrame + FRAME_HEADER_BYTES;
+    pImage->uiDataSizeBytes = (unsigned int)pFrame->ulDataBytes;
+    pImage->uiBufferIndex = (unsigned int)ulFrameNumber;
+
+    return LADYBUG_OK;
+}
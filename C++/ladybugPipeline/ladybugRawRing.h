@@ -0,0 +1,180 @@
+//=============================================================================
+// ladybugRawRing.h
+//
+// Records raw LadybugImage data into a ring file, and reads it back.
+//
+// LadybugRawRingWriter creates the file at its full size up front and maps
+// it. write() copies pData from the grabbed image into the next slot of the
+// mapping, with the image's LadybugImage fields in front of it as a header.
+// There is no conversion and no intermediate buffer; the kernel writes the
+// pages back while the next frame is grabbed. Once the ring is full the
+// oldest frame is overwritten, so the file always holds the most recent
+// frames.
+//
+// LadybugRawRingReader maps a ring file read-only and returns its frames,
+// oldest first, as LadybugImage structures whose pData points into the
+// mapping. They can be passed to ladybugConvertImage() on a context loaded
+// with the camera's calibration.
+//
+// File layout (native byte order, so the file is read on the machine type
+// that wrote it):
+//    LadybugRawRingFileHeader, padded to RAW_RING_ALIGNMENT
+//    uiNumSlots slots of ulSlotBytes each. A slot is a
+//    LadybugRawRingFrameHeader, padded to RAW_RING_ALIGNMENT, followed by
+//    the image data.
+//
+// A frame's ulFrameNumber is written after its data, and the file header's
+// ulFramesWritten after that, so a reader never returns a frame that was
+// half written when the recording stopped.
+//
+// Usage:
+//    LadybugRawRingWriter writer;
+//    writer.open( "capture.lbraw", 4096ULL << 20, image.uiDataSizeBytes );
+//    writer.write( image );
+//    ...
+//    writer.close();
+//
+//    LadybugRawRingReader reader;
+//    reader.open( "capture.lbraw" );
+//    for ( unsigned long long i = 0; i < reader.getNumFrames(); i++ )
+//    {
+//        reader.readFrame( i, &image );
+//    }
+//=============================================================================
+
+#ifndef LADYBUGRAWRING_H
+#define LADYBUGRAWRING_H
+
+#include <stdint.h>
+
+#include <string>
+
+#include <ladybug.h>
+
+/** Alignment of the file header, frame headers and image data. */
+const unsigned int RAW_RING_ALIGNMENT = 4096;
+
+const uint32_t RAW_RING_VERSION = 1;
+
+struct LadybugRawRingFileHeader
+{
+    /** "LBRAWRNG". */
+    char szMagic[ 8 ];
+    uint32_t uiVersion;
+
+    /** sizeof( LadybugImage ) of the writer, to catch incompatible readers. */
+    uint32_t uiImageStructBytes;
+
+    uint64_t ulSlotBytes;
+    uint64_t ulNumSlots;
+
+    /** Frames written since the ring was created. Frame n is in slot n % ulNumSlots. */
+    uint64_t ulFramesWritten;
+};
+
+struct LadybugRawRingFrameHeader
+{
+    /** Number of the frame in recording order, or ~0 while the slot is being written. */
+    uint64_t ulFrameNumber;
+
+    /** Bytes of image data that follow the padded header. */
+    uint64_t ulDataBytes;
+
+    /** The image as grabbed. pData and uiBufferIndex are meaningless. */
+    LadybugImage image;
+};
+
+/** Counters reported by LadybugRawRingWriter::getStats(). */
+struct LadybugRawRingStats
+{
+    unsigned long long ulFramesWritten;
+
+    /** Frames overwritten by newer ones once the ring was full. */
+    unsigned long long ulFramesOverwritten;
+
+    unsigned long long ulBytesWritten;
+
+    /** Frames dropped because they did not fit in a slot. */
+    unsigned long long ulFramesTooLarge;
+
+    unsigned int uiNumSlots;
+};
+
+class LadybugRawRingWriter
+{
+public:
+    LadybugRawRingWriter();
+    ~LadybugRawRingWriter();
+
+    /**
+     * Create and map a ring file, replacing any file at the path.
+     *
+     * @param ulRingBytes     - Size of the file. It holds as many slots as fit.
+     * @param ulMaxFrameBytes - Largest uiDataSizeBytes to be written. Use the
+     *                          uiDataSizeBytes of a grabbed RAW image; for
+     *                          JPEG data, leave room for the largest frame.
+     */
+    LadybugError open( const char* pszPath, unsigned long long ulRingBytes, unsigned long long ulMaxFrameBytes );
+
+    /** Copy an image into the next slot. */
+    LadybugError write( const LadybugImage& image );
+
+    /** Flush the file to disk and unmap it. */
+    LadybugError close();
+
+    bool isOpen() const
+    {
+        return m_pMap != NULL;
+    }
+
+    void getStats( LadybugRawRingStats* pStats ) const;
+
+    /** Print the writer counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugRawRingWriter( const LadybugRawRingWriter& );
+    LadybugRawRingWriter& operator=( const LadybugRawRingWriter& );
+
+    int m_fd;
+    unsigned char* m_pMap;
+    unsigned long long m_ulMapBytes;
+    LadybugRawRingFileHeader* m_pHeader;
+
+    LadybugRawRingStats m_stats;
+};
+
+class LadybugRawRingReader
+{
+public:
+    LadybugRawRingReader();
+    ~LadybugRawRingReader();
+
+    /** Map a ring file read-only. */
+    LadybugError open( const char* pszPath );
+
+    void close();
+
+    /** Number of complete frames in the file. */
+    unsigned long long getNumFrames() const;
+
+    /** Number of frames recorded, including ones since overwritten. */
+    unsigned long long getFramesWritten() const;
+
+    /**
+     * Get a frame, 0 being the oldest in the file. pImage->pData points into
+     * the mapping and stays valid until close(). pImage->uiBufferIndex is the
+     * frame's number in recording order.
+     */
+    LadybugError readFrame( unsigned long long ulIndex, LadybugImage* pImage ) const;
+
+private:
+    LadybugRawRingReader( const LadybugRawRingReader& );
+    LadybugRawRingReader& operator=( const LadybugRawRingReader& );
+
+    unsigned char* m_pMap;
+    unsigned long long m_ulMapBytes;
+    const LadybugRawRingFileHeader* m_pHeader;
+};
+
+#endif // LADYBUGRAWRING_H
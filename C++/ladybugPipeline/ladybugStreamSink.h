@@ -0,0 +1,55 @@
+//=============================================================================
+// ladybugStreamSink.h
+//
+// The calls a recorder makes on a stream writer once it is started, behind
+// an interface, so the same recording code can write one stream with
+// LadybugStreamWriter (see ladybugStreamWriter.h) or stripe it across disks
+// with LadybugStripedStreamWriter (see ladybugStripedStreamWriter.h).
+//
+// Starting differs between the two and is done on the writer itself.
+//
+// Usage:
+//    LadybugStreamSink* pSink = bStriped ? &stripedWriter : &writer;
+//    pSink->write( image );
+//    pSink->stop();
+//=============================================================================
+
+#ifndef LADYBUGSTREAMSINK_H
+#define LADYBUGSTREAMSINK_H
+
+#include <ladybug.h>
+
+struct LadybugStreamWriterStats;
+
+class LadybugStreamSink
+{
+public:
+    virtual ~LadybugStreamSink()
+    {
+    }
+
+    /**
+     * Queue a copy of an image. The image can be unlocked as soon as this
+     * returns.
+     */
+    virtual LadybugError write( const LadybugImage& image ) = 0;
+
+    /**
+     * Write every queued frame and close the stream. Returns the error that
+     * stopped writing, or LADYBUG_OK.
+     */
+    virtual LadybugError stop() = 0;
+
+    virtual bool isRunning() const = 0;
+
+    /** Frames in flight as a fraction of the budget, 0 - 1. */
+    virtual double getBacklog() const = 0;
+
+    /** Counters for everything written since the stream was started. */
+    virtual void getStats( LadybugStreamWriterStats* pStats ) const = 0;
+
+    /** Print the writer counters to stdout. */
+    virtual void printStats( const char* pszName ) const = 0;
+};
+
+#endif // LADYBUGSTREAMSINK_H
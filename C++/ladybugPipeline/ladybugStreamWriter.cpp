@@ -0,0 +1,765 @@
+//=============================================================================
+// ladybugStreamWriter.cpp
+//=============================================================================
+
+#include "ladybugStreamWriter.h"
+#include "ladybugThreadPlacement.h"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <ladybugGPS.h>
+
+namespace
+{
+// Time between checks of the free disk space
+const std::chrono::milliseconds DISK_CHECK_INTERVAL( 1000 );
+
+const double BYTES_PER_MB = 1024.0 * 1024.0;
+
+// The SDK refuses to write with less than this free
+const unsigned long long SDK_MIN_FREE_BYTES = 2ULL * 1024 * 1024 * 1024;
+
+// Segment files end in -NNNNNN.pgr
+const char* const SEGMENT_SUFFIX = ".pgr";
+const size_t SEGMENT_DIGITS = 6;
+
+// Bytes at the start of the image data looked for in a written frame, and
+// bytes of the frame searched, to find where the SDK puts the data
+const size_t DATA_PROBE_BYTES = 64;
+const size_t DATA_SEARCH_BYTES = 64 * 1024;
+
+// Frames to look for the image data in before giving up
+const unsigned long long DATA_SEARCH_FRAMES = 16;
+
+double toMs( unsigned long long ulNanoseconds )
+{
+    return ulNanoseconds / 1e6;
+}
+
+// Directory part of a file name, "." if there is none
+std::string getDirectory( const char* pszFileName )
+{
+    const char* pszSlash = strrchr( pszFileName, '/' );
+    if ( pszSlash == NULL )
+    {
+        return ".";
+    }
+    if ( pszSlash == pszFileName )
+    {
+        return "/";
+    }
+    return std::string( pszFileName, pszSlash - pszFileName );
+}
+
+// Free space for unprivileged users on the file system of a directory, 0 if unknown
+unsigned long long getFreeBytes( const std::string& directory )
+{
+    struct statvfs fs;
+    if ( statvfs( directory.c_str(), &fs ) != 0 )
+    {
+        return 0;
+    }
+    return (unsigned long long)fs.f_bavail * fs.f_frsize;
+}
+
+// Split "name-000012.pgr" into "name" and 12. Returns false for any other name.
+bool parseSegmentName( const char* pszFileName, std::string* pBase, unsigned int* puiSegment )
+{
+    const size_t length = strlen( pszFileName );
+    const size_t suffixLength = strlen( SEGMENT_SUFFIX );
+    if ( length < SEGMENT_DIGITS + suffixLength + 1 ||
+        strcmp( pszFileName + length - suffixLength, SEGMENT_SUFFIX ) != 0 )
+    {
+        return false;
+    }
+
+    const char* pszDigits = pszFileName + length - suffixLength - SEGMENT_DIGITS;
+    if ( pszDigits[ -1 ] != '-' )
+    {
+        return false;
+    }
+    for ( size_t i = 0; i < SEGMENT_DIGITS; i++ )
+    {
+        if ( pszDigits[ i ] < '0' || pszDigits[ i ] > '9' )
+        {
+            return false;
+        }
+    }
+
+    pBase->assign( pszFileName, pszDigits - 1 - pszFileName );
+    *puiSegment = (unsigned int)strtoul( std::string( pszDigits, SEGMENT_DIGITS ).c_str(), NULL, 10 );
+    return true;
+}
+
+} // namespace
+
+LadybugStreamWriter::LadybugStreamWriter()
+    : m_streamContext( NULL ),
+      m_bRunning( false ),
+      m_bDiskFull( false ),
+      m_uiCopying( 0 ),
+      m_ulBytesAtDiskCheck( 0 ),
+      m_ulReservedAtDiskCheck( 0 ),
+      m_ulReserveEnd( 0 ),
+      m_uiFirstSegment( 0 ),
+      m_bPreparing( false ),
+      m_uiSegmentHeaderBytes( 0 ),
+      m_uiIndexSegment( 0 ),
+      m_indexSegmentFd( -1 ),
+      m_ulIndexedFrames( 0 ),
+      m_uiDataOffset( FRAME_INDEX_UNKNOWN_OFFSET )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugStreamWriter::~LadybugStreamWriter()
+{
+    stop();
+}
+
+LadybugError
+LadybugStreamWriter::start(
+    LadybugContext cameraContext,
+    const char* pszBaseFileName,
+    const LadybugStreamWriterConfig& config,
+    char* pszFileNameOpened )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( m_bRunning )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+
+    LadybugError error = ladybugCreateStreamContext( &m_streamContext );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    char pszOpened[ 4096 ] = { 0 };
+    {
+        // The SDK's threads for the stream belong to the write stage
+        LadybugScopedPlacement writePlacement( LADYBUG_STAGE_WRITE );
+        error = ladybugInitializeStreamForWriting(
+            m_streamContext, pszBaseFileName, cameraContext, pszOpened, false );
+    }
+    if ( error != LADYBUG_OK )
+    {
+        ladybugDestroyStreamContext( &m_streamContext );
+        m_streamContext = NULL;
+        return error;
+    }
+    if ( pszFileNameOpened != NULL )
+    {
+        strcpy( pszFileNameOpened, pszOpened );
+    }
+
+    m_directory = getDirectory( pszOpened );
+    m_config = config;
+    m_config.uiMaxInFlightFrames = std::max( m_config.uiMaxInFlightFrames, 1u );
+    m_bDiskFull = false;
+    m_writeLatency.reset();
+    m_queueLatency.reset();
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+    m_stats.uiMaxInFlightFrames = m_config.uiMaxInFlightFrames;
+    m_stats.error = LADYBUG_OK;
+    m_stats.ulDiskFreeBytes = getFreeBytes( m_directory );
+    m_ulBytesAtDiskCheck = 0;
+    m_ulReservedAtDiskCheck = 0;
+    m_ulReserveEnd = 0;
+    m_lastDiskCheck = std::chrono::steady_clock::now();
+
+    const bool bSegmented = parseSegmentName( pszOpened, &m_segmentBase, &m_uiFirstSegment );
+    if ( m_config.bWriteFrameIndex && bSegmented )
+    {
+        // Recording goes on without an index
+        error = openIndex( cameraContext, pszOpened );
+        if ( error != LADYBUG_OK )
+        {
+            printf( "Stream writer: no frame index for %s, %s\n", pszOpened, ladybugErrorToString( error ) );
+        }
+    }
+
+    m_bRunning = true;
+    m_thread = std::thread( &LadybugStreamWriter::writeLoop, this );
+
+    m_bPreparing = m_config.bPreallocateSegments && bSegmented;
+    if ( m_bPreparing )
+    {
+        m_segmentThread = std::thread( &LadybugStreamWriter::segmentLoop, this );
+    }
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugStreamWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_bRunning )
+        {
+            return m_stats.error;
+        }
+        m_bRunning = false;
+    }
+
+    m_frameQueued.notify_all();
+    m_spaceFreed.notify_all();
+    m_thread.join();
+
+    // Closing flushes the stream; its error counts as much as a write's
+    const LadybugError stopError = ladybugStopStream( m_streamContext );
+    ladybugDestroyStreamContext( &m_streamContext );
+    m_streamContext = NULL;
+
+    // Every frame is in its segment now; flush the last records
+    if ( m_index.isOpen() )
+    {
+        m_index.close();
+        ::close( m_indexSegmentFd );
+        m_indexSegmentFd = -1;
+    }
+
+    // The last segment is complete once the SDK has closed it
+    if ( m_segmentThread.joinable() )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_bPreparing = false;
+        }
+        m_segmentWake.notify_all();
+        m_segmentThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_stats.error == LADYBUG_OK )
+    {
+        m_stats.error = stopError;
+    }
+    m_spareBuffers.clear();
+    return m_stats.error;
+}
+
+bool
+LadybugStreamWriter::isRunning() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_bRunning;
+}
+
+LadybugError
+LadybugStreamWriter::write( const LadybugImage& image )
+{
+    const unsigned long long ulSize = image.uiDataSizeBytes;
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( !m_bRunning )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+    if ( m_stats.error != LADYBUG_OK )
+    {
+        m_stats.ulFramesRefused++;
+        return m_stats.error;
+    }
+
+    // Keep enough space for every frame already accepted, and for the SDK
+    // to keep writing. The free space was last measured before the bytes
+    // written since. Frames fill the segment's reservation first, which
+    // the free space leaves out.
+    if ( m_config.ulDiskReserveBytes > 0 && m_stats.ulDiskFreeBytes > 0 && !m_bDiskFull )
+    {
+        const unsigned long long ulWrittenSinceCheck = m_stats.ulBytesWritten - m_ulBytesAtDiskCheck;
+        const unsigned long long ulAvailable = m_stats.ulDiskFreeBytes + m_ulReservedAtDiskCheck;
+        const unsigned long long ulFree =
+            ulAvailable > ulWrittenSinceCheck ? ulAvailable - ulWrittenSinceCheck : 0;
+        if ( ulFree < m_stats.ulInFlightBytes + ulSize + SDK_MIN_FREE_BYTES + m_config.ulDiskReserveBytes )
+        {
+            printf( "Stream writer: %.1fMB free on %s, refusing new frames\n",
+                ulFree / BYTES_PER_MB, m_directory.c_str() );
+            m_bDiskFull = true;
+        }
+    }
+    if ( m_bDiskFull )
+    {
+        m_stats.ulFramesRefused++;
+        return LADYBUG_ERROR_DISK_NOT_ENOUGH_SPACE;
+    }
+
+    // Hold the caller back while the budget is used up. A frame larger
+    // than the byte budget goes through once everything before it is written.
+    if ( m_stats.uiInFlightFrames >= m_config.uiMaxInFlightFrames ||
+        ( m_stats.ulInFlightBytes > 0 && m_stats.ulInFlightBytes + ulSize > m_config.ulMaxInFlightBytes ) )
+    {
+        const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        m_stats.ulBackpressureWaits++;
+
+        m_spaceFreed.wait( lock, [this, ulSize] {
+            return !m_bRunning || m_stats.error != LADYBUG_OK ||
+                ( m_stats.uiInFlightFrames < m_config.uiMaxInFlightFrames &&
+                  ( m_stats.ulInFlightBytes == 0 || m_stats.ulInFlightBytes + ulSize <= m_config.ulMaxInFlightBytes ) ); } );
+
+        const std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - waitStart;
+        m_stats.dBackpressureMs += waited.count();
+
+        if ( !m_bRunning )
+        {
+            return LADYBUG_NOT_STARTED;
+        }
+        if ( m_stats.error != LADYBUG_OK )
+        {
+            m_stats.ulFramesRefused++;
+            return m_stats.error;
+        }
+    }
+
+    // Take the frame's place in the budget, then copy it without the lock
+    Frame frame;
+    if ( !m_spareBuffers.empty() )
+    {
+        frame.data.swap( m_spareBuffers.back() );
+        m_spareBuffers.pop_back();
+    }
+
+    m_stats.uiInFlightFrames++;
+    m_stats.ulInFlightBytes += ulSize;
+    m_stats.uiInFlightHighWater = std::max( m_stats.uiInFlightHighWater, m_stats.uiInFlightFrames );
+    m_stats.ulInFlightBytesHighWater = std::max( m_stats.ulInFlightBytesHighWater, m_stats.ulInFlightBytes );
+    m_stats.ulFramesQueued++;
+    m_uiCopying++;
+    lock.unlock();
+
+    frame.image = image;
+    frame.data.assign( image.pData, image.pData + ulSize );
+    frame.image.pData = frame.data.data();
+    frame.queued = std::chrono::steady_clock::now();
+
+    lock.lock();
+    m_uiCopying--;
+
+    // A write that failed while copying has emptied the queue and the
+    // budget; this frame can no longer be written
+    LadybugError error = m_stats.error;
+    if ( error == LADYBUG_OK )
+    {
+        m_queue.push_back( std::move( frame ) );
+    }
+    else
+    {
+        m_stats.ulFramesLost++;
+    }
+    m_frameQueued.notify_one();
+
+    return error;
+}
+
+double
+LadybugStreamWriter::getBacklog() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_config.uiMaxInFlightFrames == 0 )
+    {
+        return 0.0;
+    }
+    return std::min( (double)m_stats.uiInFlightFrames / m_config.uiMaxInFlightFrames, 1.0 );
+}
+
+void
+LadybugStreamWriter::writeLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "stream writer" );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    while ( true )
+    {
+        m_frameQueued.wait( lock, [this] { return !m_queue.empty() || ( !m_bRunning && m_uiCopying == 0 ); } );
+
+        // Write everything queued before stopping
+        if ( m_queue.empty() )
+        {
+            break;
+        }
+
+        // Frames are only taken from the front, so the reference stays valid
+        // while write() adds to the back
+        Frame& frame = m_queue.front();
+        const unsigned long long ulSize = frame.image.uiDataSizeBytes;
+
+        double dMBWritten = m_stats.dMBWritten;
+        unsigned long ulImagesWritten = (unsigned long)m_stats.ulFramesWritten;
+        lock.unlock();
+
+        const unsigned long long ulSegmentSize = m_index.isOpen() ? getSegmentSize() : 0;
+
+        const std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+        LadybugStageTimer writeTimer( LADYBUG_STAGE_WRITE );
+        writeTimer.setBytes( ulSize );
+        const LadybugError error = ladybugWriteImageToStream(
+            m_streamContext, &frame.image, &dMBWritten, &ulImagesWritten );
+        writeTimer.stop();
+        const std::chrono::steady_clock::time_point writeEnd = std::chrono::steady_clock::now();
+
+        m_writeLatency.record( std::chrono::duration_cast<std::chrono::nanoseconds>( writeEnd - writeStart ).count() );
+        m_queueLatency.record( std::chrono::duration_cast<std::chrono::nanoseconds>( writeEnd - frame.queued ).count() );
+
+        if ( error == LADYBUG_OK && m_index.isOpen() )
+        {
+            indexFrame( frame.image, ulSegmentSize );
+        }
+
+        unsigned long long ulDiskFreeBytes = 0;
+        if ( writeEnd - m_lastDiskCheck >= DISK_CHECK_INTERVAL )
+        {
+            m_lastDiskCheck = writeEnd;
+            ulDiskFreeBytes = getFreeBytes( m_directory );
+        }
+
+        lock.lock();
+
+        if ( m_stats.ulFramesWritten == 0 )
+        {
+            m_firstWrite = writeStart;
+        }
+        m_lastWrite = writeEnd;
+
+        m_stats.uiInFlightFrames--;
+        m_stats.ulInFlightBytes -= ulSize;
+        m_spareBuffers.push_back( std::vector<unsigned char>() );
+        m_spareBuffers.back().swap( frame.data );
+        m_queue.pop_front();
+
+        if ( error == LADYBUG_OK )
+        {
+            m_stats.ulFramesWritten++;
+            m_stats.ulBytesWritten += ulSize;
+            m_stats.dMBWritten = dMBWritten;
+        }
+        else
+        {
+            // Nothing more will reach the stream. The frame that failed and
+            // every frame behind it are lost.
+            printf( "Stream writer: %s after %llu frames, %zu frames lost\n",
+                ladybugErrorToString( error ), m_stats.ulFramesWritten, m_queue.size() + 1 );
+            m_stats.error = error;
+            m_stats.ulFramesLost += m_queue.size() + 1;
+            m_stats.uiInFlightFrames = 0;
+            m_stats.ulInFlightBytes = 0;
+            m_queue.clear();
+        }
+
+        if ( ulDiskFreeBytes > 0 )
+        {
+            m_stats.ulDiskFreeBytes = ulDiskFreeBytes;
+            m_ulBytesAtDiskCheck = m_stats.ulBytesWritten;
+            m_ulReservedAtDiskCheck =
+                m_ulReserveEnd > m_stats.ulBytesWritten ? m_ulReserveEnd - m_stats.ulBytesWritten : 0;
+        }
+
+        m_spaceFreed.notify_all();
+    }
+}
+
+void
+LadybugStreamWriter::segmentLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "segment preparer" );
+
+    unsigned int uiSegment = m_uiFirstSegment;
+    int fd = openSegment( uiSegment );
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( m_bPreparing )
+    {
+        m_segmentWake.wait_for( lock, std::chrono::milliseconds( m_config.uiSegmentCheckMs ), [this] { return !m_bPreparing; } );
+        if ( !m_bPreparing )
+        {
+            break;
+        }
+        lock.unlock();
+
+        // The SDK only opens the next segment once it is done with this one
+        const int nextFd = openSegment( uiSegment + 1 );
+        if ( nextFd >= 0 )
+        {
+            closeSegment( fd );
+            fd = nextFd;
+            uiSegment++;
+        }
+
+        lock.lock();
+    }
+    lock.unlock();
+
+    closeSegment( fd );
+}
+
+int
+LadybugStreamWriter::openSegment( unsigned int uiSegment )
+{
+    const int fd = open( getSegmentPath( uiSegment ).c_str(), O_WRONLY | O_CLOEXEC );
+    if ( fd < 0 )
+    {
+        return -1;
+    }
+
+    // The SDK has written to the segment since creating it; reserve the rest
+    struct stat segment;
+    const unsigned long long ulSize = fstat( fd, &segment ) == 0 ? (unsigned long long)segment.st_size : 0;
+    unsigned long long ulReserve = m_config.ulSegmentBytes > ulSize ? m_config.ulSegmentBytes - ulSize : 0;
+
+    // The reservation comes out of the free space the SDK checks, so leave
+    // it the 2GB it needs and the disk reserve
+    const unsigned long long ulFree = getFreeBytes( m_directory );
+    const unsigned long long ulKeepFree = SDK_MIN_FREE_BYTES + m_config.ulDiskReserveBytes;
+    const bool bShortened = ulFree < ulKeepFree + ulReserve;
+    if ( bShortened )
+    {
+        ulReserve = ulFree > ulKeepFree ? ulFree - ulKeepFree : 0;
+    }
+
+    // Allocate without changing the size, so readers and the SDK see only
+    // what has been written
+    const bool bReserved =
+        ulReserve > 0 && fallocate( fd, FALLOC_FL_KEEP_SIZE, (off_t)ulSize, (off_t)ulReserve ) == 0;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats.uiSegments++;
+    if ( bReserved )
+    {
+        m_stats.uiSegmentsPreallocated++;
+        m_ulReserveEnd = m_stats.ulBytesWritten + ulReserve;
+    }
+    if ( bShortened )
+    {
+        m_stats.uiReservationsShortened++;
+    }
+    else if ( !bReserved )
+    {
+        m_stats.uiPreallocFailures++;
+    }
+    return fd;
+}
+
+void
+LadybugStreamWriter::closeSegment( int fd )
+{
+    if ( fd < 0 )
+    {
+        return;
+    }
+
+    struct stat before;
+    struct stat after;
+    if ( fstat( fd, &before ) == 0 )
+    {
+        // Truncating to the written size frees the blocks past it on ext4.
+        // XFS keeps them, so punch them out as well.
+        if ( ftruncate( fd, before.st_size ) == 0 && fstat( fd, &after ) == 0 &&
+            (unsigned long long)after.st_blocks * 512 > (unsigned long long)before.st_size + after.st_blksize )
+        {
+            const off_t end = ( before.st_size + after.st_blksize - 1 ) / after.st_blksize * after.st_blksize;
+            fallocate( fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, end, (off_t)after.st_blocks * 512 - end );
+        }
+
+        if ( fstat( fd, &after ) == 0 && after.st_blocks < before.st_blocks )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stats.ulBytesReleased += (unsigned long long)( before.st_blocks - after.st_blocks ) * 512;
+        }
+    }
+    close( fd );
+}
+
+std::string
+LadybugStreamWriter::getSegmentPath( unsigned int uiSegment ) const
+{
+    char pszNumber[ 16 ];
+    snprintf( pszNumber, sizeof( pszNumber ), "-%06u", uiSegment );
+    return m_segmentBase + pszNumber + SEGMENT_SUFFIX;
+}
+
+LadybugError
+LadybugStreamWriter::openIndex( LadybugContext cameraContext, const char* pszFirstSegment )
+{
+    // Whatever the SDK wrote on opening the segment comes before the first frame
+    struct stat segment;
+    m_uiSegmentHeaderBytes = stat( pszFirstSegment, &segment ) == 0 ? (uint32_t)segment.st_size : 0;
+
+    LadybugError error = ladybugWriteConfigurationFile( cameraContext, ( m_segmentBase + ".cal" ).c_str() );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    LadybugFrameIndexFileHeader header;
+    memset( &header, 0, sizeof( header ) );
+    header.uiSegmentHeaderBytes = m_uiSegmentHeaderBytes;
+    LadybugCameraInfo cameraInfo;
+    if ( ladybugGetCameraInfo( cameraContext, &cameraInfo ) == LADYBUG_OK )
+    {
+        header.uiSerialBase = cameraInfo.serialBase;
+        header.uiSerialHead = cameraInfo.serialHead;
+    }
+
+    m_indexSegmentFd = open( pszFirstSegment, O_RDONLY | O_CLOEXEC );
+    if ( m_indexSegmentFd < 0 )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    LadybugFrameIndexWriterConfig indexConfig;
+    indexConfig.uiSyncFrames = m_config.uiIndexSyncFrames;
+    indexConfig.uiSyncMs = m_config.uiIndexSyncMs;
+    error = m_index.open( ( m_segmentBase + ".idx" ).c_str(), m_segmentBase.c_str(), header, indexConfig );
+    if ( error != LADYBUG_OK )
+    {
+        close( m_indexSegmentFd );
+        m_indexSegmentFd = -1;
+        return error;
+    }
+
+    m_uiIndexSegment = m_uiFirstSegment;
+    m_ulIndexedFrames = 0;
+    m_uiDataOffset = FRAME_INDEX_UNKNOWN_OFFSET;
+    m_nmeaParser.reset();
+    return LADYBUG_OK;
+}
+
+unsigned long long
+LadybugStreamWriter::getSegmentSize() const
+{
+    struct stat segment;
+    return fstat( m_indexSegmentFd, &segment ) == 0 ? (unsigned long long)segment.st_size : 0;
+}
+
+void
+LadybugStreamWriter::indexFrame( const LadybugImage& image, unsigned long long ulSizeBefore )
+{
+    LadybugFrameIndexRecord record = LadybugFrameIndexRecord();
+    record.ulFrame = m_ulIndexedFrames++;
+    record.ulOffset = ulSizeBefore;
+
+    // A frame that does not fit goes to a new segment, which the SDK
+    // creates during the write
+    unsigned long long ulSizeAfter = getSegmentSize();
+    if ( ulSizeAfter <= ulSizeBefore )
+    {
+        const int nextFd = open( getSegmentPath( m_uiIndexSegment + 1 ).c_str(), O_RDONLY | O_CLOEXEC );
+        if ( nextFd >= 0 )
+        {
+            close( m_indexSegmentFd );
+            m_indexSegmentFd = nextFd;
+            m_uiIndexSegment++;
+            record.ulOffset = m_uiSegmentHeaderBytes;
+            ulSizeAfter = getSegmentSize();
+        }
+    }
+    record.uiSegment = m_uiIndexSegment;
+    record.uiLength = ulSizeAfter > record.ulOffset ? (uint32_t)( ulSizeAfter - record.ulOffset ) : 0;
+
+    // The SDK keeps the image data as it is, behind a header of its own.
+    // Find the start of the data in the first frames written; its offset is
+    // the same in every frame after.
+    if ( m_uiDataOffset == FRAME_INDEX_UNKNOWN_OFFSET && record.ulFrame < DATA_SEARCH_FRAMES &&
+        image.uiDataSizeBytes >= DATA_PROBE_BYTES && record.uiLength >= DATA_PROBE_BYTES )
+    {
+        std::vector<unsigned char> written( std::min( (size_t)record.uiLength, DATA_SEARCH_BYTES ) );
+        const ssize_t bytesRead = pread( m_indexSegmentFd, written.data(), written.size(), (off_t)record.ulOffset );
+        if ( bytesRead >= (ssize_t)DATA_PROBE_BYTES )
+        {
+            const void* pFound = memmem( written.data(), (size_t)bytesRead, image.pData, DATA_PROBE_BYTES );
+            if ( pFound != NULL )
+            {
+                m_uiDataOffset = (uint32_t)( (const unsigned char*)pFound - written.data() );
+            }
+        }
+    }
+    record.uiDataOffset = m_uiDataOffset;
+    record.uiDataCheck = ladybugFrameIndexHash(
+        image.pData, std::min( (size_t)image.uiDataSizeBytes, (size_t)FRAME_INDEX_CHECK_BYTES ) );
+
+    unsigned char sentences[ LADYBUG_NMEA_MAX_BYTES ];
+    unsigned int uiLength = 0;
+    LadybugGpsFix fix;
+    if ( ladybugGetGPSNMEASentencesFromImage( &image, sentences, sizeof( sentences ), &uiLength ) == LADYBUG_OK &&
+        m_nmeaParser.parse( (const char*)sentences, uiLength, &fix ) )
+    {
+        record.uiFlags |= FRAME_INDEX_GPS;
+        record.dLatitude = fix.dLatitude;
+        record.dLongitude = fix.dLongitude;
+        record.dAltitude = fix.dAltitude;
+    }
+
+    record.image = image;
+    m_index.append( record );
+}
+
+void
+LadybugStreamWriter::getStats( LadybugStreamWriterStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+
+    const std::chrono::duration<double> elapsed = m_lastWrite - m_firstWrite;
+    pStats->dSustainedMBps = elapsed.count() > 0.0 ? m_stats.ulBytesWritten / BYTES_PER_MB / elapsed.count() : 0.0;
+    pStats->dWriteP50Ms = toMs( m_writeLatency.getQuantile( 0.5 ) );
+    pStats->dWriteP99Ms = toMs( m_writeLatency.getQuantile( 0.99 ) );
+    pStats->dWriteMaxMs = toMs( m_writeLatency.getMax() );
+    pStats->dQueueP99Ms = toMs( m_queueLatency.getQuantile( 0.99 ) );
+    m_index.getStats( &pStats->index );
+}
+
+void
+LadybugStreamWriter::printStats( const char* pszName ) const
+{
+    LadybugStreamWriterStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu of %llu frames (%.1fMB) at %.1fMB/s, write p50 %.2fms p99 %.2fms max %.2fms, "
+        "queue p99 %.2fms, in flight high water %u of %u (%.1fMB), %llu backpressure waits (%.1fms), "
+        "%llu refused, %llu lost, %u segments (%u reserved, %u short of space, %.1fMB released), "
+        "%llu of %llu frames indexed (sync p99 %.2fms max %.2fms, %llu errors%s)%s%s\n",
+        pszName,
+        stats.ulFramesWritten,
+        stats.ulFramesQueued,
+        stats.dMBWritten,
+        stats.dSustainedMBps,
+        stats.dWriteP50Ms,
+        stats.dWriteP99Ms,
+        stats.dWriteMaxMs,
+        stats.dQueueP99Ms,
+        stats.uiInFlightHighWater,
+        stats.uiMaxInFlightFrames,
+        stats.ulInFlightBytesHighWater / BYTES_PER_MB,
+        stats.ulBackpressureWaits,
+        stats.dBackpressureMs,
+        stats.ulFramesRefused,
+        stats.ulFramesLost,
+        stats.uiSegments,
+        stats.uiSegmentsPreallocated,
+        stats.uiReservationsShortened,
+        stats.ulBytesReleased / BYTES_PER_MB,
+        stats.index.ulRecordsSynced,
+        stats.index.ulRecordsAppended,
+        stats.index.dSyncP99Ms,
+        stats.index.dSyncMaxMs,
+        stats.index.ulErrors,
+        stats.index.bIncomplete ? ", index incomplete" : "",
+        stats.error != LADYBUG_OK ? ", stopped by " : "",
+        stats.error != LADYBUG_OK ? ladybugErrorToString( stats.error ) : "" );
+}
@@ -0,0 +1,334 @@
+//=============================================================================
+// ladybugStreamWriter.h
+//
+// Records images to a PGR stream on a background thread, so the thread that
+// grabs them never waits for the disk.
+//
+// write() copies the image into a buffer and returns; the writer thread
+// writes the copies in order with ladybugWriteImageToStream(). The stream
+// is opened synchronous (bAsync false), so each write on the writer thread
+// completes before the next and the writer knows exactly which frames are
+// on disk. The SDK's own asynchronous mode buffers without limit and may
+// lose the last images on an error.
+//
+// The copies in flight are bounded by a number of frames and of bytes.
+// write() blocks while either is reached. Buffers are reused, so there is
+// no allocation once the budget has been used once.
+//
+// The SDK splits the stream into segments of up to 2GB, -000000.pgr,
+// -000001.pgr and so on, and refuses to write with less than 2GB free. A
+// segment that grows a write at a time fragments on ext4 and XFS, and the
+// allocations stall writes. With bPreallocateSegments, a preparer thread
+// watches for each new segment and reserves the rest of it at once with
+// fallocate( FALLOC_FL_KEEP_SIZE ), so the SDK's later writes fill blocks
+// that are already allocated and contiguous. When the SDK moves on to the
+// next segment, or the stream is closed, the unused part of the
+// reservation is released.
+//
+// Only the rest of a segment is reserved, once the SDK has created it. The
+// SDK creates and opens each segment itself, and the preparer sees it
+// within uiSegmentCheckMs; the writes the SDK makes to the segment before
+// then still extend the file. A file made ahead under the next segment's
+// name would not help, as the SDK may truncate it on opening it, which
+// frees the reservation.
+//
+// The part of a reservation not yet written lowers the free space the SDK
+// checks. The preparer therefore reserves no more than leaves the SDK's
+// 2GB and ulDiskReserveBytes free, and the writer counts that part as space
+// the stream can still use.
+//
+// The writer checks the free space on the stream's file system about once
+// a second. Once the free space, less the bytes in flight and the 2GB the
+// SDK needs, falls below ulDiskReserveBytes, write() refuses new frames with
+// LADYBUG_ERROR_DISK_NOT_ENOUGH_SPACE and the frames already queued are
+// still written. If the SDK reports an error anyway, writing stops, and
+// the frames still queued are counted as lost.
+//
+// With bWriteFrameIndex, every frame written is also recorded in a frame
+// index next to the stream, <base>.idx, and the camera's calibration is
+// saved as <base>.cal (see ladybugFrameIndex.h). The writer thread finds
+// where each frame landed from the size of the segment before and after
+// the write, and hands the record to the index's own thread, which makes
+// it durable in batches. A stream cut short by a crash can be rebuilt from
+// its index.
+//
+// Every write is timed. getStats() reports the write latency, the delay
+// from write() to the frame being on disk, the frames in flight and the
+// sustained rate. Writes are also counted against LADYBUG_STAGE_WRITE.
+//
+// Usage:
+//    LadybugStreamWriter writer;
+//    writer.start( context, "ladybugImage" );
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        if ( writer.write( image ) != LADYBUG_OK ) ... stop recording ...
+//        ladybugUnlock( context, image.uiBufferIndex );
+//    }
+//    writer.stop();
+//=============================================================================
+
+#ifndef LADYBUGSTREAMWRITER_H
+#define LADYBUGSTREAMWRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+#include <ladybugstream.h>
+
+#include "ladybugFrameIndex.h"
+#include "ladybugMetrics.h"
+#include "ladybugNmeaParser.h"
+#include "ladybugStreamSink.h"
+
+struct LadybugStreamWriterConfig
+{
+    LadybugStreamWriterConfig()
+        : uiMaxInFlightFrames( 16 ),
+          ulMaxInFlightBytes( 512ULL * 1024 * 1024 ),
+          ulDiskReserveBytes( 64ULL * 1024 * 1024 ),
+          bPreallocateSegments( true ),
+          ulSegmentBytes( 2ULL * 1024 * 1024 * 1024 ),
+          uiSegmentCheckMs( 20 ),
+          bWriteFrameIndex( true ),
+          uiIndexSyncFrames( 30 ),
+          uiIndexSyncMs( 1000 )
+    {
+    }
+
+    /** Frames that can be queued or being written before write() blocks. */
+    unsigned int uiMaxInFlightFrames;
+
+    /** Bytes that can be queued or being written before write() blocks. */
+    unsigned long long ulMaxInFlightBytes;
+
+    /**
+     * Free space to leave on the disk, beyond the 2GB the SDK needs to
+     * write. 0 leaves the check to the SDK.
+     */
+    unsigned long long ulDiskReserveBytes;
+
+    /** Reserve the rest of each segment once the SDK has created it. */
+    bool bPreallocateSegments;
+
+    /** Size to reserve for each segment. */
+    unsigned long long ulSegmentBytes;
+
+    /** How often the preparer looks for a new segment. */
+    unsigned int uiSegmentCheckMs;
+
+    /** Keep a frame index and a copy of the calibration next to the stream. */
+    bool bWriteFrameIndex;
+
+    /** Flush the index every this many frames, or this often. */
+    unsigned int uiIndexSyncFrames;
+    unsigned int uiIndexSyncMs;
+};
+
+/** Counters reported by LadybugStreamWriter::getStats(). */
+struct LadybugStreamWriterStats
+{
+    /** Frames accepted by write(), and frames written to the stream. */
+    unsigned long long ulFramesQueued;
+    unsigned long long ulFramesWritten;
+
+    /** Image bytes written, and the stream size reported by the SDK. */
+    unsigned long long ulBytesWritten;
+    double dMBWritten;
+
+    /** Frames refused because the disk was nearly full or writing had stopped. */
+    unsigned long long ulFramesRefused;
+
+    /** Frames accepted but never written because a write failed. */
+    unsigned long long ulFramesLost;
+
+    /** Number of write() calls that blocked on the budget, and for how long in total. */
+    unsigned long long ulBackpressureWaits;
+    double dBackpressureMs;
+
+    /** Frames and bytes queued or being written now, and the most ever at once. */
+    unsigned int uiInFlightFrames;
+    unsigned int uiInFlightHighWater;
+    unsigned int uiMaxInFlightFrames;
+    unsigned long long ulInFlightBytes;
+    unsigned long long ulInFlightBytesHighWater;
+
+    /** Rate from the first write to the last, in MB/s. */
+    double dSustainedMBps;
+
+    /** Time spent in ladybugWriteImageToStream(). */
+    double dWriteP50Ms;
+    double dWriteP99Ms;
+    double dWriteMaxMs;
+
+    /** Time from write() to the frame being written. */
+    double dQueueP99Ms;
+
+    /** Segments written to, and segments reserved. */
+    unsigned int uiSegments;
+    unsigned int uiSegmentsPreallocated;
+
+    /** Reservations cut short, or skipped, to leave the disk's free space to the SDK. */
+    unsigned int uiReservationsShortened;
+
+    /** Segments that could not be reserved, e.g. on a file system without fallocate(). */
+    unsigned int uiPreallocFailures;
+
+    /** Reserved bytes released when segments were closed. */
+    unsigned long long ulBytesReleased;
+
+    /** Free space last seen on the stream's file system. 0 if unknown. */
+    unsigned long long ulDiskFreeBytes;
+
+    /** Frames recorded in the frame index, and the index's flushes. */
+    LadybugFrameIndexWriterStats index;
+
+    /** The error that stopped writing, or LADYBUG_OK. */
+    LadybugError error;
+};
+
+class LadybugStreamWriter : public LadybugStreamSink
+{
+public:
+    LadybugStreamWriter();
+    ~LadybugStreamWriter();
+
+    /**
+     * Open a stream for the camera and start the writer thread.
+     *
+     * @param cameraContext     - Context of the camera the images come from.
+     * @param pszBaseFileName   - Base name of the stream files.
+     * @param config            - In-flight budget and disk reserve.
+     * @param pszFileNameOpened - Receives the name of the first stream file,
+     *                            at least _MAX_PATH characters. May be NULL.
+     */
+    LadybugError start(
+        LadybugContext cameraContext,
+        const char* pszBaseFileName,
+        const LadybugStreamWriterConfig& config = LadybugStreamWriterConfig(),
+        char* pszFileNameOpened = NULL );
+
+    /**
+     * Write every queued frame, close the stream and stop the writer
+     * thread. Returns the error that stopped writing, or LADYBUG_OK.
+     */
+    LadybugError stop();
+
+    bool isRunning() const;
+
+    /**
+     * Queue a copy of an image. The image can be unlocked as soon as this
+     * returns. Returns the error that stopped writing, if any, or
+     * LADYBUG_ERROR_DISK_NOT_ENOUGH_SPACE once the disk reserve is reached.
+     */
+    LadybugError write( const LadybugImage& image );
+
+    /** Frames in flight as a fraction of the budget, 0 - 1. */
+    double getBacklog() const;
+
+    void getStats( LadybugStreamWriterStats* pStats ) const;
+
+    /** Print the writer counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugStreamWriter( const LadybugStreamWriter& );
+    LadybugStreamWriter& operator=( const LadybugStreamWriter& );
+
+    struct Frame
+    {
+        LadybugImage image;
+        std::vector<unsigned char> data;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    void writeLoop();
+
+    // Reserve each segment as the SDK creates it. Runs on its own thread.
+    void segmentLoop();
+
+    // Open segment uiSegment and reserve the rest of it. Returns the file
+    // descriptor, or -1 if the segment does not exist yet.
+    int openSegment( unsigned int uiSegment );
+
+    // Release the reservation past the end of a finished segment and close it.
+    void closeSegment( int fd );
+
+    std::string getSegmentPath( unsigned int uiSegment ) const;
+
+    // Create the frame index and save the calibration next to the stream
+    LadybugError openIndex( LadybugContext cameraContext, const char* pszFirstSegment );
+
+    // Size of the segment the index last saw written, 0 if unknown
+    unsigned long long getSegmentSize() const;
+
+    // Record a frame just written. The segment was ulSizeBefore bytes
+    // before the write.
+    void indexFrame( const LadybugImage& image, unsigned long long ulSizeBefore );
+
+    LadybugStreamContext m_streamContext;
+    std::string m_directory;
+    LadybugStreamWriterConfig m_config;
+
+    std::deque<Frame> m_queue;
+
+    // Buffers of written frames, kept for reuse
+    std::vector<std::vector<unsigned char> > m_spareBuffers;
+
+    bool m_bRunning;
+    bool m_bDiskFull;
+
+    // Frames write() is copying, which the writer must wait for before stopping
+    unsigned int m_uiCopying;
+
+    // ulBytesWritten when ulDiskFreeBytes was measured, and the bytes
+    // reserved in the segment but not yet written then
+    unsigned long long m_ulBytesAtDiskCheck;
+    unsigned long long m_ulReservedAtDiskCheck;
+
+    // ulBytesWritten once the reservation of the newest segment is filled
+    unsigned long long m_ulReserveEnd;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameQueued;
+    std::condition_variable m_spaceFreed;
+
+    std::thread m_thread;
+
+    // Segment names are m_segmentBase-NNNNNN.pgr
+    std::string m_segmentBase;
+    unsigned int m_uiFirstSegment;
+    std::thread m_segmentThread;
+    std::condition_variable m_segmentWake;
+    bool m_bPreparing;
+
+    // Owned by the writer thread
+    std::chrono::steady_clock::time_point m_lastDiskCheck;
+
+    std::chrono::steady_clock::time_point m_firstWrite;
+    std::chrono::steady_clock::time_point m_lastWrite;
+
+    // Owned by the writer thread: the frame index, the segment being
+    // written, opened to read back where frames land, and the offset of the
+    // image data in a frame once it has been found
+    LadybugFrameIndexWriter m_index;
+    LadybugNmeaParser m_nmeaParser;
+    uint32_t m_uiSegmentHeaderBytes;
+    unsigned int m_uiIndexSegment;
+    int m_indexSegmentFd;
+    unsigned long long m_ulIndexedFrames;
+    uint32_t m_uiDataOffset;
+
+    LadybugHistogram m_writeLatency;
+    LadybugHistogram m_queueLatency;
+
+    LadybugStreamWriterStats m_stats;
+};
+
+#endif // LADYBUGSTREAMWRITER_H
@@ -0,0 +1,532 @@
+//=============================================================================
+// ladybugStripedStreamWriter.cpp
+//=============================================================================
+
+#include "ladybugStripedStreamWriter.h"
+#include "ladybugThreadPlacement.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+const double BYTES_PER_MB = 1024.0 * 1024.0;
+
+// Longest path in a manifest
+const size_t MAX_PATH_LENGTH = 4096;
+
+// Write what is buffered for a manifest and flush it to the disk
+bool
+syncFile( FILE* pFile )
+{
+    return fflush( pFile ) == 0 && fdatasync( fileno( pFile ) ) == 0;
+}
+
+// Add one stripe's counters to the counters of all of them
+void addStats( const LadybugStreamWriterStats& stripe, LadybugStreamWriterStats* pTotal )
+{
+    pTotal->ulFramesWritten += stripe.ulFramesWritten;
+    pTotal->ulBytesWritten += stripe.ulBytesWritten;
+    pTotal->dMBWritten += stripe.dMBWritten;
+    pTotal->ulFramesLost += stripe.ulFramesLost;
+    pTotal->ulBackpressureWaits += stripe.ulBackpressureWaits;
+    pTotal->dBackpressureMs += stripe.dBackpressureMs;
+    pTotal->uiInFlightFrames += stripe.uiInFlightFrames;
+    pTotal->uiInFlightHighWater += stripe.uiInFlightHighWater;
+    pTotal->uiMaxInFlightFrames += stripe.uiMaxInFlightFrames;
+    pTotal->ulInFlightBytes += stripe.ulInFlightBytes;
+    pTotal->ulInFlightBytesHighWater += stripe.ulInFlightBytesHighWater;
+    pTotal->dSustainedMBps += stripe.dSustainedMBps;
+    pTotal->dWriteP50Ms = std::max( pTotal->dWriteP50Ms, stripe.dWriteP50Ms );
+    pTotal->dWriteP99Ms = std::max( pTotal->dWriteP99Ms, stripe.dWriteP99Ms );
+    pTotal->dWriteMaxMs = std::max( pTotal->dWriteMaxMs, stripe.dWriteMaxMs );
+    pTotal->dQueueP99Ms = std::max( pTotal->dQueueP99Ms, stripe.dQueueP99Ms );
+    pTotal->uiSegments += stripe.uiSegments;
+    pTotal->uiSegmentsPreallocated += stripe.uiSegmentsPreallocated;
+    pTotal->uiPreallocFailures += stripe.uiPreallocFailures;
+    pTotal->uiReservationsShortened += stripe.uiReservationsShortened;
+    pTotal->ulBytesReleased += stripe.ulBytesReleased;
+    pTotal->ulDiskFreeBytes += stripe.ulDiskFreeBytes;
+    pTotal->index.ulRecordsAppended += stripe.index.ulRecordsAppended;
+    pTotal->index.ulRecordsSynced += stripe.index.ulRecordsSynced;
+    pTotal->index.ulBatches += stripe.index.ulBatches;
+    pTotal->index.dSyncP99Ms = std::max( pTotal->index.dSyncP99Ms, stripe.index.dSyncP99Ms );
+    pTotal->index.dSyncMaxMs = std::max( pTotal->index.dSyncMaxMs, stripe.index.dSyncMaxMs );
+    pTotal->index.ulErrors += stripe.index.ulErrors;
+    pTotal->index.bIncomplete = pTotal->index.bIncomplete || stripe.index.bIncomplete;
+}
+
+} // namespace
+
+LadybugStripedStreamWriter::LadybugStripedStreamWriter()
+    : m_uiNextStripe( 0 ),
+      m_lastError( LADYBUG_OK ),
+      m_ulFrames( 0 ),
+      m_ulFramesRefused( 0 ),
+      m_pManifest( NULL ),
+      m_uiPendingFrames( 0 ),
+      m_uiSyncFrames( 30 ),
+      m_uiSyncMs( 1000 ),
+      m_bSyncing( false ),
+      m_bManifestError( false ),
+      m_bRunning( false )
+{
+}
+
+LadybugStripedStreamWriter::~LadybugStripedStreamWriter()
+{
+    stop();
+}
+
+LadybugError
+LadybugStripedStreamWriter::start(
+    LadybugContext cameraContext,
+    const char* pszBaseName,
+    const LadybugStripedStreamWriterConfig& config,
+    char* pszManifestOpened )
+{
+    std::lock_guard<std::mutex> writeLock( m_writeMutex );
+
+    if ( isRunning() )
+    {
+        return LADYBUG_ALREADY_STARTED;
+    }
+    if ( config.directories.empty() )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    std::vector<Stripe> stripes( config.directories.size() );
+    std::vector<std::string> streams( stripes.size() );
+    LadybugError error = LADYBUG_OK;
+    for ( size_t i = 0; i < stripes.size() && error == LADYBUG_OK; i++ )
+    {
+        char pszStripeName[ MAX_PATH_LENGTH ];
+        char pszOpened[ MAX_PATH_LENGTH ] = { 0 };
+        snprintf( pszStripeName, sizeof( pszStripeName ), "%s/%s_stripe%zu",
+            config.directories[ i ].c_str(), pszBaseName, i );
+
+        stripes[ i ].directory = config.directories[ i ];
+        stripes[ i ].pWriter.reset( new LadybugStreamWriter() );
+        stripes[ i ].ulFrames = 0;
+        stripes[ i ].bStopped = false;
+        error = stripes[ i ].pWriter->start( cameraContext, pszStripeName, config.stripe, pszOpened );
+        streams[ i ] = pszOpened;
+    }
+
+    std::string manifest = config.directories[ 0 ] + "/" + pszBaseName + ".manifest";
+    FILE* pManifest = NULL;
+    if ( error == LADYBUG_OK )
+    {
+        pManifest = fopen( manifest.c_str(), "w" );
+        if ( pManifest == NULL )
+        {
+            error = LADYBUG_COULD_NOT_OPEN_FILE;
+        }
+    }
+    if ( error != LADYBUG_OK )
+    {
+        // Close the streams already opened. They are left empty on disk.
+        for ( size_t i = 0; i < stripes.size() && stripes[ i ].pWriter; i++ )
+        {
+            stripes[ i ].pWriter->stop();
+        }
+        return error;
+    }
+
+    fprintf( pManifest, "# Ladybug striped stream manifest\n" );
+    fprintf( pManifest, "stripes %zu\n", streams.size() );
+    for ( size_t i = 0; i < streams.size(); i++ )
+    {
+        fprintf( pManifest, "stripe %zu %s\n", i, streams[ i ].c_str() );
+    }
+    fprintf( pManifest, "frames\n" );
+
+    // A reader needs the stripes even if no frame line ever makes it
+    const bool bHeaderSynced = syncFile( pManifest );
+
+    if ( pszManifestOpened != NULL )
+    {
+        strcpy( pszManifestOpened, manifest.c_str() );
+    }
+
+    m_pManifest = pManifest;
+    m_manifestPending.clear();
+    m_uiPendingFrames = 0;
+    m_uiSyncFrames = std::max( config.stripe.uiIndexSyncFrames, 1u );
+    m_uiSyncMs = std::max( config.stripe.uiIndexSyncMs, 1u );
+    m_bSyncing = true;
+    m_bManifestError = !bHeaderSynced;
+    m_syncThread = std::thread( &LadybugStripedStreamWriter::syncLoop, this );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stripes.swap( stripes );
+    m_uiNextStripe = 0;
+    m_lastError = LADYBUG_OK;
+    m_ulFrames = 0;
+    m_ulFramesRefused = 0;
+    m_bRunning = true;
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugStripedStreamWriter::stop()
+{
+    std::lock_guard<std::mutex> writeLock( m_writeMutex );
+
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_bRunning )
+        {
+            return m_lastError;
+        }
+        m_bRunning = false;
+    }
+
+    // The sync thread writes the frame lines left before it exits
+    {
+        std::lock_guard<std::mutex> lock( m_manifestMutex );
+        m_bSyncing = false;
+    }
+    m_frameAppended.notify_all();
+    m_syncThread.join();
+
+    // Each stripe writes what it has queued; they finish side by side
+    LadybugError error = LADYBUG_OK;
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        const LadybugError stripeError = m_stripes[ i ].pWriter->stop();
+        if ( error == LADYBUG_OK )
+        {
+            error = stripeError;
+        }
+    }
+
+    fprintf( m_pManifest, "end %llu\n", m_ulFrames );
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        LadybugStreamWriterStats stats;
+        m_stripes[ i ].pWriter->getStats( &stats );
+        fprintf( m_pManifest, "written %zu %llu\n", i, stats.ulFramesWritten );
+    }
+    const bool bSynced = syncFile( m_pManifest ) && !m_bManifestError;
+    if ( ( fclose( m_pManifest ) != 0 || !bSynced ) && error == LADYBUG_OK )
+    {
+        error = LADYBUG_FAILED;
+    }
+    m_pManifest = NULL;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_lastError == LADYBUG_OK )
+    {
+        m_lastError = error;
+    }
+    return error;
+}
+
+bool
+LadybugStripedStreamWriter::isRunning() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_bRunning;
+}
+
+int
+LadybugStripedStreamWriter::chooseStripe() const
+{
+    // The next in turn that is not full. If they all are, the next in turn
+    // anyway, and write() waits for it.
+    int iFirst = -1;
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        const unsigned int uiStripe = ( m_uiNextStripe + i ) % m_stripes.size();
+        if ( m_stripes[ uiStripe ].bStopped )
+        {
+            continue;
+        }
+        if ( m_stripes[ uiStripe ].pWriter->getBacklog() < 1.0 )
+        {
+            return (int)uiStripe;
+        }
+        if ( iFirst < 0 )
+        {
+            iFirst = (int)uiStripe;
+        }
+    }
+    return iFirst;
+}
+
+LadybugError
+LadybugStripedStreamWriter::write( const LadybugImage& image )
+{
+    std::lock_guard<std::mutex> writeLock( m_writeMutex );
+
+    if ( !isRunning() )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+
+    while ( true )
+    {
+        const int iStripe = chooseStripe();
+        if ( iStripe < 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_ulFramesRefused++;
+            return m_lastError;
+        }
+
+        Stripe& stripe = m_stripes[ iStripe ];
+        const LadybugError error = stripe.pWriter->write( image );
+
+        // A stripe that returns an error has stopped. Unless it took the
+        // frame before a write failed, the frame goes to the next stripe.
+        bool bTaken = error == LADYBUG_OK;
+        if ( !bTaken )
+        {
+            LadybugStreamWriterStats stats;
+            stripe.pWriter->getStats( &stats );
+            bTaken = stats.ulFramesQueued > stripe.ulFrames;
+
+            printf( "Striped stream writer: stripe %d (%s) stopped by %s\n",
+                iStripe, stripe.directory.c_str(), ladybugErrorToString( error ) );
+
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_lastError = error;
+            stripe.bStopped = true;
+        }
+        if ( !bTaken )
+        {
+            continue;
+        }
+
+        char pszLine[ 128 ];
+        snprintf( pszLine, sizeof( pszLine ), "%llu %d %llu %lld %u\n",
+            m_ulFrames, iStripe, stripe.ulFrames,
+            (long long)image.timeStamp.ulSeconds, image.timeStamp.ulMicroSeconds );
+        {
+            std::lock_guard<std::mutex> lock( m_manifestMutex );
+            m_manifestPending += pszLine;
+            if ( ++m_uiPendingFrames >= m_uiSyncFrames )
+            {
+                m_frameAppended.notify_one();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock( m_mutex );
+        stripe.ulFrames++;
+        m_ulFrames++;
+        m_uiNextStripe = ( iStripe + 1 ) % m_stripes.size();
+        return LADYBUG_OK;
+    }
+}
+
+void
+LadybugStripedStreamWriter::syncLoop()
+{
+    LadybugPlacedThread placed( LADYBUG_STAGE_WRITE, "stripe manifest" );
+
+    std::string batch;
+    std::unique_lock<std::mutex> lock( m_manifestMutex );
+    while ( true )
+    {
+        m_frameAppended.wait_for( lock, std::chrono::milliseconds( m_uiSyncMs ), [this] {
+            return !m_bSyncing || m_uiPendingFrames >= m_uiSyncFrames; } );
+        const bool bStopping = !m_bSyncing;
+
+        batch.swap( m_manifestPending );
+        m_uiPendingFrames = 0;
+        if ( !batch.empty() )
+        {
+            lock.unlock();
+            const bool bWritten =
+                fwrite( batch.data(), 1, batch.size(), m_pManifest ) == batch.size() && syncFile( m_pManifest );
+            lock.lock();
+
+            if ( !bWritten && !m_bManifestError )
+            {
+                printf( "Striped stream writer: could not write the manifest\n" );
+            }
+            m_bManifestError = m_bManifestError || !bWritten;
+            batch.clear();
+        }
+
+        if ( bStopping )
+        {
+            break;
+        }
+    }
+}
+
+double
+LadybugStripedStreamWriter::getBacklog() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    double dBacklog = 1.0;
+    bool bWriting = false;
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        if ( !m_stripes[ i ].bStopped )
+        {
+            dBacklog = std::min( dBacklog, m_stripes[ i ].pWriter->getBacklog() );
+            bWriting = true;
+        }
+    }
+    return bWriting ? dBacklog : 0.0;
+}
+
+void
+LadybugStripedStreamWriter::getStats( LadybugStreamWriterStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    memset( pStats, 0, sizeof( *pStats ) );
+    pStats->ulFramesQueued = m_ulFrames;
+    pStats->ulFramesRefused = m_ulFramesRefused;
+
+    bool bWriting = false;
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        LadybugStreamWriterStats stripeStats;
+        m_stripes[ i ].pWriter->getStats( &stripeStats );
+        addStats( stripeStats, pStats );
+        bWriting = bWriting || ( !m_stripes[ i ].bStopped && stripeStats.error == LADYBUG_OK );
+    }
+
+    // Writing has stopped only once every stripe has
+    pStats->error = bWriting || m_stripes.empty() ? LADYBUG_OK : m_lastError;
+}
+
+unsigned int
+LadybugStripedStreamWriter::getStripeCount() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return (unsigned int)m_stripes.size();
+}
+
+void
+LadybugStripedStreamWriter::getStripeStats( unsigned int uiStripe, LadybugStreamWriterStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( uiStripe < m_stripes.size() )
+    {
+        m_stripes[ uiStripe ].pWriter->getStats( pStats );
+    }
+    else
+    {
+        memset( pStats, 0, sizeof( *pStats ) );
+    }
+}
+
+void
+LadybugStripedStreamWriter::printStats( const char* pszName ) const
+{
+    LadybugStreamWriterStats stats;
+    getStats( &stats );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    printf(
+        "%s: %zu stripes, %llu of %llu frames (%.1fMB) at %.1fMB/s, write p99 %.2fms max %.2fms, "
+        "%llu backpressure waits (%.1fms), %llu refused, %llu lost, %.1fMB free%s%s\n",
+        pszName,
+        m_stripes.size(),
+        stats.ulFramesWritten,
+        stats.ulFramesQueued,
+        stats.dMBWritten,
+        stats.dSustainedMBps,
+        stats.dWriteP99Ms,
+        stats.dWriteMaxMs,
+        stats.ulBackpressureWaits,
+        stats.dBackpressureMs,
+        stats.ulFramesRefused,
+        stats.ulFramesLost,
+        stats.ulDiskFreeBytes / BYTES_PER_MB,
+        stats.error != LADYBUG_OK ? ", stopped by " : "",
+        stats.error != LADYBUG_OK ? ladybugErrorToString( stats.error ) : "" );
+
+    for ( size_t i = 0; i < m_stripes.size(); i++ )
+    {
+        char pszStripeName[ MAX_PATH_LENGTH ];
+        snprintf( pszStripeName, sizeof( pszStripeName ), "  stripe %zu (%s)", i, m_stripes[ i ].directory.c_str() );
+        m_stripes[ i ].pWriter->printStats( pszStripeName );
+    }
+}
+
+LadybugError
+LadybugStripeManifest::load( const char* pszManifest )
+{
+    m_streams.clear();
+    m_frames.clear();
+    m_bComplete = false;
+
+    FILE* pFile = fopen( pszManifest, "r" );
+    if ( pFile == NULL )
+    {
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    std::vector<unsigned long long> written;
+    char pszLine[ MAX_PATH_LENGTH + 64 ];
+    char pszPath[ MAX_PATH_LENGTH ];
+    while ( fgets( pszLine, sizeof( pszLine ), pFile ) != NULL )
+    {
+        unsigned int uiStripe = 0;
+        unsigned long long ulFrame = 0;
+        unsigned long long ulIndex = 0;
+        if ( pszLine[ 0 ] == '#' )
+        {
+            continue;
+        }
+        else if ( sscanf( pszLine, "stripe %u %4095[^\n]", &uiStripe, pszPath ) == 2 )
+        {
+            if ( uiStripe >= m_streams.size() )
+            {
+                m_streams.resize( uiStripe + 1 );
+            }
+            m_streams[ uiStripe ] = pszPath;
+        }
+        else if ( sscanf( pszLine, "end %llu", &ulFrame ) == 1 )
+        {
+            m_bComplete = true;
+            written.assign( m_streams.size(), 0 );
+        }
+        else if ( sscanf( pszLine, "written %u %llu", &uiStripe, &ulIndex ) == 2 )
+        {
+            if ( uiStripe < written.size() )
+            {
+                written[ uiStripe ] = ulIndex;
+            }
+        }
+        else if ( sscanf( pszLine, "%llu %u %llu", &ulFrame, &uiStripe, &ulIndex ) == 3 )
+        {
+            if ( uiStripe < m_streams.size() )
+            {
+                Frame frame;
+                frame.uiStripe = uiStripe;
+                frame.uiIndex = (unsigned int)ulIndex;
+                m_frames.push_back( frame );
+            }
+        }
+    }
+    fclose( pFile );
+
+    if ( m_streams.empty() )
+    {
+        return LADYBUG_INVALID_STREAM_FILE_NAME;
+    }
+
+    // Leave out the frames each stripe lost
+    if ( m_bComplete )
+    {
+        m_frames.erase(
+            std::remove_if( m_frames.begin(), m_frames.end(),
+                [&written]( const Frame& frame ) { return frame.uiIndex >= written[ frame.uiStripe ]; } ),
+            m_frames.end() );
+    }
+    return LADYBUG_OK;
+}
@@ -0,0 +1,253 @@
+//=============================================================================
+// ladybugStripedStreamWriter.h
+//
+// Records images across several disks at once, so the frame rate is not
+// capped by what one disk can write.
+//
+// start() opens one PGR stream in each directory, each written by its own
+// LadybugStreamWriter (see ladybugStreamWriter.h) and so its own writer
+// thread, in-flight budget, disk space check and segment preallocation.
+// Put each directory on a different device. write() hands every image to
+// one stripe, the next in turn that is not full. A slower disk is given
+// fewer frames rather than holding the others back, and write() only
+// blocks once every stripe is full.
+//
+// Each stripe is a complete stream on its own, <directory>/<base>_stripeN,
+// with the camera's configuration and calibration, and its own frame index
+// numbered by that stripe's frames. Which stripe each frame went to, and
+// where in that stripe's stream, is kept in a manifest, <base>.manifest in
+// the first directory. LadybugStripeManifest reads it, so a reader can go
+// through the frames in the order they were grabbed:
+//
+//    # Ladybug striped stream manifest
+//    stripes 2
+//    stripe 0 /mnt/ssd0/ladybugImage_stripe0-000000.pgr
+//    stripe 1 /mnt/ssd1/ladybugImage_stripe1-000000.pgr
+//    frames
+//    0 0 0 1500000000 125000
+//    1 1 0 1500000000 191666
+//    2 0 1 1500000000 258333
+//    ...
+//    end 3
+//    written 0 2
+//    written 1 1
+//
+// A frame line is the frame number in the recording, the stripe, the
+// frame number in that stripe's stream, and the image's timestamp in
+// seconds and microseconds. The lines after "end" are written when the
+// recording stops, with the frames each stripe wrote; a frame numbered
+// past its stripe's count was lost. A manifest without them was not closed,
+// and its stripes may end before it does.
+//
+// The frame lines are written by a thread of the writer's own, in batches
+// of stripe.uiIndexSyncFrames frames or every stripe.uiIndexSyncMs,
+// whichever comes first, and each batch is flushed with fdatasync(). After
+// a crash the manifest holds every frame up to the last batch, so a stream
+// that was never closed can still be put back in order. write() never
+// waits for the manifest to reach the disk.
+//
+// When a stripe stops on an error or a full disk, the recording goes on
+// with the others. write() fails only once every stripe has stopped.
+//
+// Usage:
+//    LadybugStripedStreamWriterConfig config;
+//    config.directories.push_back( "/mnt/ssd0" );
+//    config.directories.push_back( "/mnt/ssd1" );
+//    LadybugStripedStreamWriter writer;
+//    writer.start( context, "ladybugImage", config );
+//    while ( ... )
+//    {
+//        ladybugLockNext( context, &image );
+//        if ( writer.write( image ) != LADYBUG_OK ) ... stop recording ...
+//        ladybugUnlock( context, image.uiBufferIndex );
+//    }
+//    writer.stop();
+//=============================================================================
+
+#ifndef LADYBUGSTRIPEDSTREAMWRITER_H
+#define LADYBUGSTRIPEDSTREAMWRITER_H
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugStreamSink.h"
+#include "ladybugStreamWriter.h"
+
+struct LadybugStripedStreamWriterConfig
+{
+    /** One directory per stripe, each on its own disk. */
+    std::vector<std::string> directories;
+
+    /**
+     * Budget, disk reserve and preallocation of each stripe. Its index sync
+     * settings also set how often the manifest is flushed.
+     */
+    LadybugStreamWriterConfig stripe;
+};
+
+class LadybugStripedStreamWriter : public LadybugStreamSink
+{
+public:
+    LadybugStripedStreamWriter();
+    ~LadybugStripedStreamWriter();
+
+    /**
+     * Open a stream in each directory and the manifest.
+     *
+     * @param cameraContext     - Context of the camera the images come from.
+     * @param pszBaseName       - Base name of the streams and the manifest,
+     *                            without a directory.
+     * @param config            - Directories, and the settings of each stripe.
+     * @param pszManifestOpened - Receives the name of the manifest, at least
+     *                            _MAX_PATH characters. May be NULL.
+     */
+    LadybugError start(
+        LadybugContext cameraContext,
+        const char* pszBaseName,
+        const LadybugStripedStreamWriterConfig& config,
+        char* pszManifestOpened = NULL );
+
+    /**
+     * Write every queued frame, close the streams and finish the manifest.
+     * Returns the first error that stopped a stripe, or LADYBUG_OK.
+     */
+    LadybugError stop();
+
+    bool isRunning() const;
+
+    /**
+     * Queue a copy of an image on one of the stripes. Returns an error only
+     * once no stripe can take it.
+     */
+    LadybugError write( const LadybugImage& image );
+
+    /** The least backlog of the stripes still writing, 0 - 1. */
+    double getBacklog() const;
+
+    /**
+     * Counters of all the stripes together. The rate is the sum of the
+     * stripes' rates, and the latencies the worst of them.
+     */
+    void getStats( LadybugStreamWriterStats* pStats ) const;
+
+    unsigned int getStripeCount() const;
+
+    /** Counters of one stripe. */
+    void getStripeStats( unsigned int uiStripe, LadybugStreamWriterStats* pStats ) const;
+
+    /** Print the counters of all the stripes, then of each one, to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugStripedStreamWriter( const LadybugStripedStreamWriter& );
+    LadybugStripedStreamWriter& operator=( const LadybugStripedStreamWriter& );
+
+    struct Stripe
+    {
+        std::string directory;
+        std::unique_ptr<LadybugStreamWriter> pWriter;
+
+        // Frames given to this stripe. The next one is this frame in its stream.
+        unsigned long long ulFrames;
+
+        // Stopped taking frames, on an error or a full disk
+        bool bStopped;
+    };
+
+    // The stripe for the next frame, or -1 if every stripe has stopped
+    int chooseStripe() const;
+
+    // Write and flush the frame lines queued by write()
+    void syncLoop();
+
+    std::vector<Stripe> m_stripes;
+
+    // Owned by the thread that writes
+    unsigned int m_uiNextStripe;
+
+    LadybugError m_lastError;
+
+    // Frames accepted, and refused because every stripe had stopped
+    unsigned long long m_ulFrames;
+    unsigned long long m_ulFramesRefused;
+
+    FILE* m_pManifest;
+
+    // Frame lines not written to the manifest yet, and how many there are.
+    // The sync thread owns m_pManifest while it runs.
+    std::string m_manifestPending;
+    unsigned int m_uiPendingFrames;
+    unsigned int m_uiSyncFrames;
+    unsigned int m_uiSyncMs;
+    bool m_bSyncing;
+    bool m_bManifestError;
+    std::mutex m_manifestMutex;
+    std::condition_variable m_frameAppended;
+    std::thread m_syncThread;
+
+    // Serializes write() and stop()
+    std::mutex m_writeMutex;
+
+    // Guards m_stripes' counters, m_lastError and m_bRunning for the other calls
+    mutable std::mutex m_mutex;
+    bool m_bRunning;
+};
+
+/**
+ * The frames of a striped recording, in the order they were grabbed, read
+ * from its manifest.
+ */
+class LadybugStripeManifest
+{
+public:
+    LadybugStripeManifest()
+        : m_bComplete( false )
+    {
+    }
+
+    struct Frame
+    {
+        unsigned int uiStripe;
+
+        /** Frame number in the stripe's stream. */
+        unsigned int uiIndex;
+    };
+
+    /**
+     * Read a manifest. Frames a stripe did not write, if the manifest says
+     * so, are left out.
+     */
+    LadybugError load( const char* pszManifest );
+
+    /** The first segment of each stripe's stream. */
+    const std::vector<std::string>& getStreams() const
+    {
+        return m_streams;
+    }
+
+    const std::vector<Frame>& getFrames() const
+    {
+        return m_frames;
+    }
+
+    /** True if the recording was stopped and the manifest finished. */
+    bool isComplete() const
+    {
+        return m_bComplete;
+    }
+
+private:
+    std::vector<std::string> m_streams;
+    std::vector<Frame> m_frames;
+    bool m_bComplete;
+};
+
+#endif // LADYBUGSTRIPEDSTREAMWRITER_H
@@ -0,0 +1,629 @@
+//=============================================================================
+// ladybugSyntheticSource.cpp
+//=============================================================================
+
+#include "ladybugSyntheticSource.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <thread>
+
+#include <jpeglib.h>
+
+namespace
+{
+// Ladybug cycle time: 8000 counts per second, wrapping after 128 seconds
+const unsigned int CYCLE_COUNTS_PER_SECOND = 8000;
+const unsigned int CYCLE_SECONDS_WRAP = 128;
+
+// Channel (0 = red, 1 = green, 2 = blue) of the top left pixel of each 2x2 cell, row major
+void getBayerChannels( LadybugStippledFormat pattern, unsigned int aruiChannels[ 4 ] )
+{
+    static const unsigned int s_rggb[ 4 ] = { 0, 1, 1, 2 };
+    static const unsigned int s_grbg[ 4 ] = { 1, 0, 2, 1 };
+    static const unsigned int s_gbrg[ 4 ] = { 1, 2, 0, 1 };
+    static const unsigned int s_bggr[ 4 ] = { 2, 1, 1, 0 };
+
+    const unsigned int* pChannels = s_rggb;
+    switch ( pattern )
+    {
+    case LADYBUG_GRBG:
+        pChannels = s_grbg;
+        break;
+    case LADYBUG_GBRG:
+        pChannels = s_gbrg;
+        break;
+    case LADYBUG_BGGR:
+        pChannels = s_bggr;
+        break;
+    default:
+        break;
+    }
+    memcpy( aruiChannels, pChannels, 4 * sizeof( unsigned int ) );
+}
+
+// Mosaic one RGB image into an 8-bit Bayer image
+void mosaic(
+    const unsigned char* pRgb,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    LadybugStippledFormat pattern,
+    unsigned char* pBayer )
+{
+    unsigned int aruiChannels[ 4 ];
+    getBayerChannels( pattern, aruiChannels );
+
+    for ( unsigned int uiRow = 0; uiRow < uiRows; uiRow++ )
+    {
+        const unsigned int* pRowChannels = &aruiChannels[ ( uiRow & 1 ) * 2 ];
+        const unsigned char* pSrc = pRgb + (size_t)uiRow * uiCols * 3;
+        unsigned char* pDst = pBayer + (size_t)uiRow * uiCols;
+        for ( unsigned int uiCol = 0; uiCol < uiCols; uiCol++ )
+        {
+            pDst[ uiCol ] = pSrc[ uiCol * 3 + pRowChannels[ uiCol & 1 ] ];
+        }
+    }
+}
+
+// Color bars tinted per camera, with a bright vertical stripe that moves every frame
+void drawPattern(
+    unsigned int uiCamera,
+    unsigned int uiFrame,
+    unsigned int uiNumFrames,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    unsigned char* pRgb )
+{
+    static const unsigned char s_bars[ 8 ][ 3 ] = {
+        { 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+        { 255, 0, 255 }, { 255, 0, 0 }, { 0, 0, 255 }, { 0, 0, 0 } };
+
+    const unsigned int uiStripeWidth = std::max( uiCols / 32, 1u );
+    const unsigned int uiStripeCol = (unsigned int)( (unsigned long long)uiFrame * ( uiCols - uiStripeWidth ) / std::max( uiNumFrames, 1u ) );
+
+    for ( unsigned int uiRow = 0; uiRow < uiRows; uiRow++ )
+    {
+        // Fade each bar from top to bottom so the image is not flat
+        const unsigned int uiShade = 64 + 191 * ( uiRows - uiRow ) / uiRows;
+        unsigned char* pDst = pRgb + (size_t)uiRow * uiCols * 3;
+        for ( unsigned int uiCol = 0; uiCol < uiCols; uiCol++ )
+        {
+            const unsigned int uiBar = ( uiCol * 8 / uiCols + uiCamera ) % 8;
+            const bool bStripe = uiCol >= uiStripeCol && uiCol < uiStripeCol + uiStripeWidth;
+            for ( unsigned int c = 0; c < 3; c++ )
+            {
+                pDst[ uiCol * 3 + c ] = bStripe ? 255 : (unsigned char)( s_bars[ uiBar ][ c ] * uiShade / 255 );
+            }
+        }
+    }
+}
+
+bool readPpmToken( FILE* pFile, unsigned int* puiValue )
+{
+    int c = fgetc( pFile );
+    while ( c != EOF && ( c == '#' || isspace( c ) ) )
+    {
+        if ( c == '#' )
+        {
+            while ( c != EOF && c != '\n' )
+            {
+                c = fgetc( pFile );
+            }
+        }
+        c = fgetc( pFile );
+    }
+
+    if ( c == EOF || !isdigit( c ) )
+    {
+        return false;
+    }
+
+    unsigned int uiValue = 0;
+    while ( c != EOF && isdigit( c ) )
+    {
+        uiValue = uiValue * 10 + ( c - '0' );
+        c = fgetc( pFile );
+    }
+
+    // One whitespace character ends the header
+    *puiValue = uiValue;
+    return true;
+}
+
+// Read a binary PPM (P6) with 8 or 16 bits per sample into 8-bit RGB
+bool readPpm( const std::string& path, unsigned int* puiCols, unsigned int* puiRows, std::vector<unsigned char>* pRgb )
+{
+    FILE* pFile = fopen( path.c_str(), "rb" );
+    if ( pFile == NULL )
+    {
+        printf( "Error: could not open %s\n", path.c_str() );
+        return false;
+    }
+
+    unsigned int uiCols = 0, uiRows = 0, uiMaxValue = 0;
+    const bool bHeaderOk =
+        fgetc( pFile ) == 'P' && fgetc( pFile ) == '6' &&
+        readPpmToken( pFile, &uiCols ) && readPpmToken( pFile, &uiRows ) && readPpmToken( pFile, &uiMaxValue ) &&
+        uiCols > 0 && uiRows > 0 && uiMaxValue > 0 && uiMaxValue < 65536;
+    if ( !bHeaderOk )
+    {
+        printf( "Error: %s is not a binary PPM file\n", path.c_str() );
+        fclose( pFile );
+        return false;
+    }
+
+    const unsigned int uiBytesPerSample = uiMaxValue > 255 ? 2 : 1;
+    const size_t numSamples = (size_t)uiCols * uiRows * 3;
+    std::vector<unsigned char> data( numSamples * uiBytesPerSample );
+    const bool bReadOk = fread( data.data(), 1, data.size(), pFile ) == data.size();
+    fclose( pFile );
+    if ( !bReadOk )
+    {
+        printf( "Error: %s is truncated\n", path.c_str() );
+        return false;
+    }
+
+    pRgb->resize( numSamples );
+    for ( size_t i = 0; i < numSamples; i++ )
+    {
+        // 16-bit samples are big-endian
+        const unsigned int uiValue = ( uiBytesPerSample == 2 ) ? ( data[ i * 2 ] << 8 ) | data[ i * 2 + 1 ] : data[ i ];
+        ( *pRgb )[ i ] = (unsigned char)( std::min( uiValue, uiMaxValue ) * 255 / uiMaxValue );
+    }
+
+    *puiCols = uiCols;
+    *puiRows = uiRows;
+    return true;
+}
+
+// Append a grayscale JPEG of an 8-bit image to pOutput
+bool encodeGrayJpeg(
+    const unsigned char* pGray,
+    unsigned int uiCols,
+    unsigned int uiRows,
+    int iQuality,
+    std::vector<unsigned char>* pOutput )
+{
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error( &jerr );
+    jpeg_create_compress( &cinfo );
+
+    unsigned char* pJpeg = NULL;
+    unsigned long ulJpegSize = 0;
+    jpeg_mem_dest( &cinfo, &pJpeg, &ulJpegSize );
+
+    cinfo.image_width = uiCols;
+    cinfo.image_height = uiRows;
+    cinfo.input_components = 1;
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    jpeg_set_defaults( &cinfo );
+    jpeg_set_quality( &cinfo, iQuality, TRUE );
+
+    jpeg_start_compress( &cinfo, TRUE );
+    while ( cinfo.next_scanline < cinfo.image_height )
+    {
+        JSAMPROW row = (JSAMPROW)( pGray + (size_t)cinfo.next_scanline * uiCols );
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+
+    pOutput->insert( pOutput->end(), pJpeg, pJpeg + ulJpegSize );
+    free( pJpeg );
+    return ulJpegSize > 0;
+}
+
+} // namespace
+
+LadybugSyntheticSource::LadybugSyntheticSource()
+    : m_bInitialized( false ),
+      m_uiNextBuffer( 0 ),
+      m_uiTimeoutMs( UINT_MAX ),
+      m_bStarted( false ),
+      m_ulSequence( 0 )
+{
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+LadybugSyntheticSource::~LadybugSyntheticSource()
+{
+}
+
+LadybugError
+LadybugSyntheticSource::initialize( const LadybugSyntheticConfig& config )
+{
+    if ( config.dataFormat != LADYBUG_DATAFORMAT_RAW8 &&
+         config.dataFormat != LADYBUG_DATAFORMAT_RAW16 &&
+         config.dataFormat != LADYBUG_DATAFORMAT_JPEG8 )
+    {
+        return LADYBUG_NOT_SUPPORTED;
+    }
+
+    if ( config.uiNumBuffers == 0 || config.dFrameRate < 0.0 ||
+         ( config.ppmDirectory.empty() && ( config.uiCols < 2 || config.uiRows < 2 || config.uiNumPatternFrames == 0 ) ) )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_config = config;
+    m_frames.clear();
+    m_locked.assign( config.uiNumBuffers, false );
+    m_uiNextBuffer = 0;
+    m_bStarted = false;
+    m_ulSequence = 0;
+    memset( &m_stats, 0, sizeof( m_stats ) );
+
+    const LadybugError error = config.ppmDirectory.empty() ? generateFrames() : loadPpmFrames();
+    m_bInitialized = ( error == LADYBUG_OK );
+
+    return error;
+}
+
+LadybugError
+LadybugSyntheticSource::addFrame( const std::vector<unsigned char>& bayer )
+{
+    const size_t imageSize = (size_t)m_config.uiCols * m_config.uiRows;
+
+    m_frames.push_back( std::vector<unsigned char>() );
+    std::vector<unsigned char>& frame = m_frames.back();
+
+    switch ( m_config.dataFormat )
+    {
+    case LADYBUG_DATAFORMAT_RAW8:
+        frame = bayer;
+        break;
+
+    case LADYBUG_DATAFORMAT_RAW16:
+        frame.resize( bayer.size() * 2 );
+        for ( size_t i = 0; i < bayer.size(); i++ )
+        {
+            frame[ i * 2 ] = bayer[ i ];
+            frame[ i * 2 + 1 ] = bayer[ i ];
+        }
+        break;
+
+    default:
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            if ( !encodeGrayJpeg( bayer.data() + uiCamera * imageSize, m_config.uiCols, m_config.uiRows, m_config.iJpegQuality, &frame ) )
+            {
+                return LADYBUG_JPEG_ERROR;
+            }
+        }
+        break;
+    }
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::generateFrames()
+{
+    const size_t imageSize = (size_t)m_config.uiCols * m_config.uiRows;
+    std::vector<unsigned char> rgb( imageSize * 3 );
+    std::vector<unsigned char> bayer( imageSize * LADYBUG_NUM_CAMERAS );
+
+    for ( unsigned int uiFrame = 0; uiFrame < m_config.uiNumPatternFrames; uiFrame++ )
+    {
+        for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+        {
+            drawPattern( uiCamera, uiFrame, m_config.uiNumPatternFrames, m_config.uiCols, m_config.uiRows, rgb.data() );
+            mosaic( rgb.data(), m_config.uiCols, m_config.uiRows, m_config.stippledFormat, bayer.data() + uiCamera * imageSize );
+        }
+
+        const LadybugError error = addFrame( bayer );
+        if ( error != LADYBUG_OK )
+        {
+            return error;
+        }
+    }
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::loadPpmFrames()
+{
+    DIR* pDir = opendir( m_config.ppmDirectory.c_str() );
+    if ( pDir == NULL )
+    {
+        printf( "Error: could not open directory %s\n", m_config.ppmDirectory.c_str() );
+        return LADYBUG_COULD_NOT_OPEN_FILE;
+    }
+
+    std::vector<std::string> names;
+    for ( dirent* pEntry = readdir( pDir ); pEntry != NULL; pEntry = readdir( pDir ) )
+    {
+        const size_t length = strlen( pEntry->d_name );
+        if ( length > 4 && strcasecmp( pEntry->d_name + length - 4, ".ppm" ) == 0 )
+        {
+            names.push_back( pEntry->d_name );
+        }
+    }
+    closedir( pDir );
+
+    std::sort( names.begin(), names.end() );
+    if ( names.size() < LADYBUG_NUM_CAMERAS )
+    {
+        printf( "Error: %s needs at least %u PPM files\n", m_config.ppmDirectory.c_str(), LADYBUG_NUM_CAMERAS );
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    if ( names.size() % LADYBUG_NUM_CAMERAS != 0 )
+    {
+        printf( "Warning: ignoring the last %u PPM files, which do not make a whole frame\n",
+            (unsigned int)( names.size() % LADYBUG_NUM_CAMERAS ) );
+    }
+
+    std::vector<unsigned char> rgb;
+    std::vector<unsigned char> bayer;
+    const size_t numFrames = names.size() / LADYBUG_NUM_CAMERAS;
+    for ( size_t i = 0; i < numFrames * LADYBUG_NUM_CAMERAS; i++ )
+    {
+        const std::string path = m_config.ppmDirectory + "/" + names[ i ];
+        unsigned int uiCols = 0, uiRows = 0;
+        if ( !readPpm( path, &uiCols, &uiRows, &rgb ) )
+        {
+            return LADYBUG_FAILED;
+        }
+
+        // The first file sets the image size
+        if ( i == 0 )
+        {
+            m_config.uiCols = uiCols;
+            m_config.uiRows = uiRows;
+            bayer.resize( (size_t)uiCols * uiRows * LADYBUG_NUM_CAMERAS );
+        }
+        else if ( uiCols != m_config.uiCols || uiRows != m_config.uiRows )
+        {
+            printf( "Error: %s is %ux%u, expected %ux%u\n", path.c_str(), uiCols, uiRows, m_config.uiCols, m_config.uiRows );
+            return LADYBUG_INVALID_ARGUMENT;
+        }
+
+        const unsigned int uiCamera = (unsigned int)( i % LADYBUG_NUM_CAMERAS );
+        mosaic( rgb.data(), uiCols, uiRows, m_config.stippledFormat, bayer.data() + (size_t)uiCamera * uiCols * uiRows );
+
+        if ( uiCamera == LADYBUG_NUM_CAMERAS - 1 )
+        {
+            const LadybugError error = addFrame( bayer );
+            if ( error != LADYBUG_OK )
+            {
+                return error;
+            }
+        }
+    }
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::nextImage( LadybugImage* pImage, unsigned int uiBufferIndex, std::unique_lock<std::mutex>& lock )
+{
+    if ( !m_bStarted )
+    {
+        m_start = std::chrono::steady_clock::now();
+        m_bStarted = true;
+    }
+
+    unsigned long long ulSequence = m_ulSequence;
+
+    if ( m_config.dFrameRate > 0.0 )
+    {
+        const std::chrono::duration<double> period( 1.0 / m_config.dFrameRate );
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point due =
+            m_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>( period * (double)ulSequence );
+
+        if ( now < due )
+        {
+            // Like the camera, give up after the grab timeout
+            if ( m_uiTimeoutMs != UINT_MAX && due - now > std::chrono::milliseconds( m_uiTimeoutMs ) )
+            {
+                lock.unlock();
+                std::this_thread::sleep_for( std::chrono::milliseconds( m_uiTimeoutMs ) );
+                lock.lock();
+                return LADYBUG_TIMEOUT;
+            }
+        }
+        else
+        {
+            // The caller fell behind; the camera would have overwritten the frames in between
+            const std::chrono::duration<double> elapsed = now - m_start;
+            const unsigned long long ulCurrent = (unsigned long long)( elapsed.count() * m_config.dFrameRate );
+            if ( ulCurrent > ulSequence )
+            {
+                m_stats.ulFramesSkipped += ulCurrent - ulSequence;
+                ulSequence = ulCurrent;
+                due = now;
+            }
+        }
+
+        // Claim the frame before waiting so other callers get the next one
+        m_ulSequence = ulSequence + 1;
+        lock.unlock();
+        std::this_thread::sleep_until( due );
+        lock.lock();
+    }
+    else
+    {
+        m_ulSequence = ulSequence + 1;
+    }
+
+    std::vector<unsigned char>& frame = m_frames[ ulSequence % m_frames.size() ];
+
+    *pImage = LadybugImage();
+    pImage->uiCols = m_config.uiCols;
+    pImage->uiRows = m_config.uiRows;
+    pImage->uiFullCols = m_config.uiCols;
+    pImage->uiFullRows = m_config.uiRows;
+    pImage->dataFormat = m_config.dataFormat;
+    pImage->resolution = ( m_config.uiCols == 2048 && m_config.uiRows == 2448 ) ? LADYBUG_RESOLUTION_2448x2048 : LADYBUG_RESOLUTION_ANY;
+    pImage->pData = frame.data();
+    pImage->uiDataSizeBytes = (unsigned int)frame.size();
+    pImage->bStippled = true;
+    pImage->stippledFormat = m_config.stippledFormat;
+    pImage->uiBufferIndex = uiBufferIndex;
+
+    const std::chrono::microseconds wallClock =
+        std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::system_clock::now().time_since_epoch() );
+    const unsigned long long ulCycleCounts =
+        (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - m_start ).count() *
+        CYCLE_COUNTS_PER_SECOND / 1000000;
+
+    LadybugTimestamp& timeStamp = pImage->timeStamp;
+    timeStamp.ulSeconds = wallClock.count() / 1000000;
+    timeStamp.ulMicroSeconds = (unsigned int)( wallClock.count() % 1000000 );
+    timeStamp.ulCycleSeconds = (unsigned int)( ulCycleCounts / CYCLE_COUNTS_PER_SECOND % CYCLE_SECONDS_WRAP );
+    timeStamp.ulCycleCount = (unsigned int)( ulCycleCounts % CYCLE_COUNTS_PER_SECOND );
+
+    LadybugImageInfo& info = pImage->imageInfo;
+    info.ulFingerprint = LADYBUGIMAGEINFO_STRUCT_FINGERPRINT;
+    info.ulVersion = LADYBUGIMAGEINFO_STRUCT_VERSION;
+    info.ulTimeSeconds = (unsigned int)timeStamp.ulSeconds;
+    info.ulTimeMicroSeconds = timeStamp.ulMicroSeconds;
+    info.ulSequenceId = (unsigned int)ulSequence;
+    info.ulSerialNum = m_config.uiSerialNumber;
+
+    // A room at rest
+    pImage->imageHeader.uiTemperature = 2980;
+    pImage->imageHeader.uiHumidity = 40;
+    pImage->imageHeader.uiAirPressure = 101325;
+    pImage->imageHeader.accelerometer.z = 1.0f;
+
+    m_stats.ulFramesDelivered++;
+
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::grabImage( LadybugImage* pImage )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( !m_bInitialized )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+
+    return nextImage( pImage, 0, lock );
+}
+
+LadybugError
+LadybugSyntheticSource::lockNext( LadybugImage* pImage )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    if ( !m_bInitialized )
+    {
+        return LADYBUG_NOT_STARTED;
+    }
+
+    // Take the free buffers in turn, as the driver does
+    const unsigned int uiNumBuffers = (unsigned int)m_locked.size();
+    unsigned int uiBufferIndex = uiNumBuffers;
+    for ( unsigned int i = 0; i < uiNumBuffers; i++ )
+    {
+        const unsigned int uiCandidate = ( m_uiNextBuffer + i ) % uiNumBuffers;
+        if ( !m_locked[ uiCandidate ] )
+        {
+            uiBufferIndex = uiCandidate;
+            break;
+        }
+    }
+
+    if ( uiBufferIndex == uiNumBuffers )
+    {
+        m_stats.ulLockFailures++;
+        return LADYBUG_TOO_MANY_LOCKED_BUFFERS;
+    }
+
+    // Hold the buffer while waiting for the frame so no other caller takes it
+    m_locked[ uiBufferIndex ] = true;
+    const LadybugError error = nextImage( pImage, uiBufferIndex, lock );
+    if ( error != LADYBUG_OK )
+    {
+        m_locked[ uiBufferIndex ] = false;
+        return error;
+    }
+
+    m_uiNextBuffer = ( uiBufferIndex + 1 ) % uiNumBuffers;
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::unlock( unsigned int uiBufferIndex )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    if ( uiBufferIndex >= m_locked.size() || !m_locked[ uiBufferIndex ] )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    m_locked[ uiBufferIndex ] = false;
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::unlockAll()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    std::fill( m_locked.begin(), m_locked.end(), false );
+    return LADYBUG_OK;
+}
+
+LadybugError
+LadybugSyntheticSource::setGrabTimeout( unsigned int uiTimeoutMs )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_uiTimeoutMs = uiTimeoutMs;
+    return LADYBUG_OK;
+}
+
+void
+LadybugSyntheticSource::getCameraInfo( LadybugCameraInfo* pCameraInfo ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    memset( pCameraInfo, 0, sizeof( *pCameraInfo ) );
+    pCameraInfo->serialBase = m_config.uiSerialNumber;
+    pCameraInfo->serialHead = m_config.uiSerialNumber;
+    pCameraInfo->bIsColourCamera = true;
+    pCameraInfo->deviceType = LADYBUG_DEVICE_LADYBUG5;
+    snprintf( pCameraInfo->pszModelName, sizeof( pCameraInfo->pszModelName ), "Synthetic Ladybug" );
+    snprintf( pCameraInfo->pszSensorInfo, sizeof( pCameraInfo->pszSensorInfo ), "Synthetic %ux%u", m_config.uiCols, m_config.uiRows );
+    snprintf( pCameraInfo->pszVendorName, sizeof( pCameraInfo->pszVendorName ), "None" );
+    pCameraInfo->maxBusSpeed = LADYBUG_SPEED_UNKNOWN;
+    pCameraInfo->interfaceType = LADYBUG_INTERFACE_UNKNOWN;
+}
+
+void
+LadybugSyntheticSource::getStats( LadybugSyntheticStats* pStats ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+}
+
+void
+LadybugSyntheticSource::printStats( const char* pszName ) const
+{
+    LadybugSyntheticStats stats;
+    getStats( &stats );
+
+    printf(
+        "%s: %llu frames delivered, %llu skipped because the caller fell behind, %llu lock failures\n",
+        pszName,
+        stats.ulFramesDelivered,
+        stats.ulFramesSkipped,
+        stats.ulLockFailures );
+}
@@ -0,0 +1,160 @@
+//=============================================================================
+// ladybugSyntheticSource.h
+//
+// A LadybugFrameSource that needs no camera, so the capture tools can be
+// run and benchmarked on any Linux machine.
+//
+// Frames are built once by initialize(), either from a generated test
+// pattern (color bars with a moving stripe, different for every camera) or
+// from a directory of binary PPM (P6) files. The PPM files are taken in name
+// order, six per frame, one per camera. They are mosaiced into the
+// configured Bayer pattern and stored as:
+//  - LADYBUG_DATAFORMAT_RAW8: six 8-bit Bayer images, back to back.
+//  - LADYBUG_DATAFORMAT_RAW16: six 16-bit little-endian Bayer images.
+//  - LADYBUG_DATAFORMAT_JPEG8: six grayscale JPEGs of the 8-bit Bayer
+//    images, back to back. This is not the SDK's indexed JPEG layout, so
+//    ladybugConvertImage() cannot decode it.
+//
+// grabImage() and lockNext() hand out the prepared frames in turn without
+// copying, paced to the configured frame rate. The image fields the tools
+// read are filled in: size, data format, Bayer pattern, timestamp (wall
+// clock plus a cycle time derived from it), sequence ID, serial number and
+// a constant sensor header. If the caller falls behind, the sequence IDs
+// skip the frames the camera would have produced in the meantime, as a
+// real camera's would. lockNext() fails with
+// LADYBUG_TOO_MANY_LOCKED_BUFFERS when every buffer is locked.
+//
+// Usage:
+//    LadybugSyntheticConfig config;
+//    config.dFrameRate = 15.0;
+//    LadybugSyntheticSource source;
+//    source.initialize( config );
+//    source.lockNext( &image );
+//    ...
+//    source.unlock( image.uiBufferIndex );
+//=============================================================================
+
+#ifndef LADYBUGSYNTHETICSOURCE_H
+#define LADYBUGSYNTHETICSOURCE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugFrameSource.h"
+
+struct LadybugSyntheticConfig
+{
+    /** Size of each camera image. Ignored when frames are read from PPM files. */
+    unsigned int uiCols;
+    unsigned int uiRows;
+
+    /** LADYBUG_DATAFORMAT_RAW8, LADYBUG_DATAFORMAT_RAW16 or LADYBUG_DATAFORMAT_JPEG8. */
+    LadybugDataFormat dataFormat;
+
+    LadybugStippledFormat stippledFormat;
+
+    /** Frames per second. 0 hands out frames as fast as they are asked for. */
+    double dFrameRate;
+
+    /** Number of buffers lockNext() can lock at once. */
+    unsigned int uiNumBuffers;
+
+    /** Number of distinct generated frames. */
+    unsigned int uiNumPatternFrames;
+
+    /** Directory of PPM frames. Empty to generate a test pattern. */
+    std::string ppmDirectory;
+
+    unsigned int uiSerialNumber;
+
+    /** Quality of LADYBUG_DATAFORMAT_JPEG8 payloads. */
+    int iJpegQuality;
+
+    LadybugSyntheticConfig()
+        : uiCols( 2048 ),
+          uiRows( 2448 ),
+          dataFormat( LADYBUG_DATAFORMAT_RAW8 ),
+          stippledFormat( LADYBUG_RGGB ),
+          dFrameRate( 10.0 ),
+          uiNumBuffers( 8 ),
+          uiNumPatternFrames( 2 ),
+          uiSerialNumber( 99999999 ),
+          iJpegQuality( 85 )
+    {
+    }
+};
+
+/** Counters reported by LadybugSyntheticSource::getStats(). */
+struct LadybugSyntheticStats
+{
+    /** Number of images handed out by grabImage() and lockNext(). */
+    unsigned long long ulFramesDelivered;
+
+    /** Frames skipped because the caller fell behind the frame rate. */
+    unsigned long long ulFramesSkipped;
+
+    /** Number of lockNext() calls that failed because every buffer was locked. */
+    unsigned long long ulLockFailures;
+};
+
+class LadybugSyntheticSource : public LadybugFrameSource
+{
+public:
+    LadybugSyntheticSource();
+    ~LadybugSyntheticSource();
+
+    /** Build the frames. This can take a few seconds for large images. */
+    LadybugError initialize( const LadybugSyntheticConfig& config );
+
+    LadybugError grabImage( LadybugImage* pImage );
+    LadybugError lockNext( LadybugImage* pImage );
+    LadybugError unlock( unsigned int uiBufferIndex );
+    LadybugError unlockAll();
+    LadybugError setGrabTimeout( unsigned int uiTimeoutMs );
+
+    /** Fill in camera information like ladybugGetCameraInfo(). */
+    void getCameraInfo( LadybugCameraInfo* pCameraInfo ) const;
+
+    void getStats( LadybugSyntheticStats* pStats ) const;
+
+    /** Print the source counters to stdout. */
+    void printStats( const char* pszName ) const;
+
+private:
+    LadybugSyntheticSource( const LadybugSyntheticSource& );
+    LadybugSyntheticSource& operator=( const LadybugSyntheticSource& );
+
+    // Store one frame of six 8-bit Bayer images in the configured format
+    LadybugError addFrame( const std::vector<unsigned char>& bayer );
+
+    LadybugError generateFrames();
+    LadybugError loadPpmFrames();
+
+    // Wait for the next frame to be due and fill in the image. Called with
+    // m_mutex held; it is released while waiting.
+    LadybugError nextImage( LadybugImage* pImage, unsigned int uiBufferIndex, std::unique_lock<std::mutex>& lock );
+
+    LadybugSyntheticConfig m_config;
+    bool m_bInitialized;
+
+    std::vector<std::vector<unsigned char> > m_frames;
+
+    std::vector<bool> m_locked;
+    unsigned int m_uiNextBuffer;
+
+    unsigned int m_uiTimeoutMs;
+
+    bool m_bStarted;
+    std::chrono::steady_clock::time_point m_start;
+    unsigned long long m_ulSequence;
+
+    mutable std::mutex m_mutex;
+
+    LadybugSyntheticStats m_stats;
+};
+
+#endif // LADYBUGSYNTHETICSOURCE_H
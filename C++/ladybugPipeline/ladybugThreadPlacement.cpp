@@ -0,0 +1,503 @@
+//=============================================================================
+// ladybugThreadPlacement.cpp
+//=============================================================================
+
+#include "ladybugThreadPlacement.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#endif
+
+namespace
+{
+// Stage the calling thread was placed in, or LADYBUG_NUM_STAGES if none
+thread_local LadybugStage t_currentStage = LADYBUG_NUM_STAGES;
+
+// Parse a CPU list like "0-3,8" into CPU numbers. Returns false on a syntax error.
+bool parseCpuList( const char* pszCpuList, std::vector<int>* pCpus )
+{
+    pCpus->clear();
+
+    const char* p = pszCpuList;
+    while ( *p != '\0' )
+    {
+        while ( *p == ' ' || *p == ',' )
+        {
+            p++;
+        }
+        if ( *p == '\0' || *p == '\n' )
+        {
+            break;
+        }
+
+        char* pEnd = NULL;
+        const long lFirst = strtol( p, &pEnd, 10 );
+        if ( pEnd == p || lFirst < 0 )
+        {
+            return false;
+        }
+        long lLast = lFirst;
+        p = pEnd;
+
+        if ( *p == '-' )
+        {
+            lLast = strtol( p + 1, &pEnd, 10 );
+            if ( pEnd == p + 1 || lLast < lFirst )
+            {
+                return false;
+            }
+            p = pEnd;
+        }
+
+        for ( long lCpu = lFirst; lCpu <= lLast; lCpu++ )
+        {
+            pCpus->push_back( (int)lCpu );
+        }
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+
+int getCurrentTid()
+{
+    return (int)syscall( SYS_gettid );
+}
+
+// Read "key : value" or "key: value" from a /proc file. Returns -1 if it is missing.
+long long readProcValue( const char* pszPath, const char* pszKey )
+{
+    FILE* pFile = fopen( pszPath, "r" );
+    if ( pFile == NULL )
+    {
+        return -1;
+    }
+
+    const size_t keyLength = strlen( pszKey );
+    long long llValue = -1;
+    char szLine[ 256 ];
+    while ( fgets( szLine, sizeof( szLine ), pFile ) != NULL )
+    {
+        if ( strncmp( szLine, pszKey, keyLength ) == 0 &&
+            ( szLine[ keyLength ] == ' ' || szLine[ keyLength ] == ':' ) )
+        {
+            const char* pValue = strchr( szLine + keyLength, ':' );
+            if ( pValue != NULL )
+            {
+                llValue = atoll( pValue + 1 );
+            }
+            break;
+        }
+    }
+
+    fclose( pFile );
+    return llValue;
+}
+
+long long readMigrations( int iTid )
+{
+    char szPath[ 64 ];
+    snprintf( szPath, sizeof( szPath ), "/proc/self/task/%d/sched", iTid );
+    return readProcValue( szPath, "se.nr_migrations" );
+}
+
+long long readPreemptions( int iTid )
+{
+    char szPath[ 64 ];
+    snprintf( szPath, sizeof( szPath ), "/proc/self/task/%d/status", iTid );
+    return readProcValue( szPath, "nonvoluntary_ctxt_switches" );
+}
+
+// Map every CPU to its NUMA node from /sys/devices/system/node
+void readCpuNodes( std::vector<int>* pCpuNodes )
+{
+    pCpuNodes->clear();
+
+    DIR* pDir = opendir( "/sys/devices/system/node" );
+    if ( pDir == NULL )
+    {
+        return;
+    }
+
+    struct dirent* pEntry;
+    while ( ( pEntry = readdir( pDir ) ) != NULL )
+    {
+        int iNode = 0;
+        if ( sscanf( pEntry->d_name, "node%d", &iNode ) != 1 )
+        {
+            continue;
+        }
+
+        char szPath[ 512 ];
+        snprintf( szPath, sizeof( szPath ), "/sys/devices/system/node/%s/cpulist", pEntry->d_name );
+        FILE* pFile = fopen( szPath, "r" );
+        if ( pFile == NULL )
+        {
+            continue;
+        }
+
+        char szCpuList[ 1024 ] = { 0 };
+        std::vector<int> cpus;
+        if ( fgets( szCpuList, sizeof( szCpuList ), pFile ) != NULL && parseCpuList( szCpuList, &cpus ) )
+        {
+            for ( size_t i = 0; i < cpus.size(); i++ )
+            {
+                if ( (size_t)cpus[ i ] >= pCpuNodes->size() )
+                {
+                    pCpuNodes->resize( cpus[ i ] + 1, -1 );
+                }
+                ( *pCpuNodes )[ cpus[ i ] ] = iNode;
+            }
+        }
+        fclose( pFile );
+    }
+
+    closedir( pDir );
+}
+
+#endif
+
+} // namespace
+
+//=============================================================================
+// LadybugThreadPlacement
+//=============================================================================
+
+LadybugThreadPlacement&
+LadybugThreadPlacement::instance()
+{
+    static LadybugThreadPlacement placement;
+    return placement;
+}
+
+LadybugThreadPlacement::LadybugThreadPlacement()
+    : m_iGrabPriority( 0 )
+{
+#ifdef __linux__
+    readCpuNodes( &m_cpuNodes );
+
+    // Threads of stages without CPUs go back to the CPUs the process started with
+    cpu_set_t cpuSet;
+    CPU_ZERO( &cpuSet );
+    if ( sched_getaffinity( 0, sizeof( cpuSet ), &cpuSet ) == 0 )
+    {
+        for ( int iCpu = 0; iCpu < CPU_SETSIZE; iCpu++ )
+        {
+            if ( CPU_ISSET( iCpu, &cpuSet ) )
+            {
+                m_processCpus.push_back( iCpu );
+            }
+        }
+    }
+#endif
+}
+
+LadybugError
+LadybugThreadPlacement::setStageCpus( LadybugStage stage, const char* pszCpuList )
+{
+    if ( stage < 0 || stage >= LADYBUG_NUM_STAGES )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    std::vector<int> cpus;
+    if ( pszCpuList != NULL && !parseCpuList( pszCpuList, &cpus ) )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+#ifdef __linux__
+    for ( size_t i = 0; i < cpus.size(); i++ )
+    {
+        if ( cpus[ i ] >= CPU_SETSIZE )
+        {
+            return LADYBUG_INVALID_ARGUMENT;
+        }
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stageCpus[ stage ].swap( cpus );
+    m_stageCpuLists[ stage ] = ( pszCpuList != NULL ) ? pszCpuList : "";
+    return LADYBUG_OK;
+}
+
+bool
+LadybugThreadPlacement::hasStageCpus( LadybugStage stage ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return stage >= 0 && stage < LADYBUG_NUM_STAGES && !m_stageCpus[ stage ].empty();
+}
+
+void
+LadybugThreadPlacement::getProcessCpus( std::vector<int>* pCpus ) const
+{
+    // Only set by the constructor
+    *pCpus = m_processCpus;
+}
+
+LadybugError
+LadybugThreadPlacement::setGrabRealtimePriority( int iPriority )
+{
+    if ( iPriority < 0 || iPriority > 99 )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_iGrabPriority = iPriority;
+    return LADYBUG_OK;
+}
+
+int
+LadybugThreadPlacement::getStageNode( LadybugStage stage ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( stage < 0 || stage >= LADYBUG_NUM_STAGES || m_stageCpus[ stage ].empty() )
+    {
+        return -1;
+    }
+
+    const size_t cpu = (size_t)m_stageCpus[ stage ][ 0 ];
+    return ( cpu < m_cpuNodes.size() ) ? m_cpuNodes[ cpu ] : -1;
+}
+
+LadybugError
+LadybugThreadPlacement::applyToCurrentThread( LadybugStage stage, bool bReset, bool* pbRealtime ) const
+{
+    *pbRealtime = false;
+
+#ifdef __linux__
+    std::vector<int> cpus;
+    int iPriority = 0;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( stage < LADYBUG_NUM_STAGES )
+        {
+            cpus = m_stageCpus[ stage ];
+        }
+        if ( stage == LADYBUG_STAGE_GRAB )
+        {
+            iPriority = m_iGrabPriority;
+        }
+    }
+
+    LadybugError error = LADYBUG_OK;
+
+    // Unless resetting, a stage without CPUs leaves the thread where it is,
+    // which may be a core its owner pinned it to
+    if ( cpus.empty() && bReset )
+    {
+        cpus = m_processCpus;
+    }
+    if ( !cpus.empty() )
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        for ( size_t i = 0; i < cpus.size(); i++ )
+        {
+            CPU_SET( cpus[ i ], &cpuSet );
+        }
+        if ( pthread_setaffinity_np( pthread_self(), sizeof( cpuSet ), &cpuSet ) != 0 )
+        {
+            error = LADYBUG_FAILED;
+        }
+    }
+
+    // SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least iPriority
+    struct sched_param param;
+    memset( &param, 0, sizeof( param ) );
+    param.sched_priority = iPriority;
+    if ( iPriority > 0 || bReset )
+    {
+        const int iPolicy = ( iPriority > 0 ) ? SCHED_FIFO : SCHED_OTHER;
+        if ( pthread_setschedparam( pthread_self(), iPolicy, &param ) == 0 )
+        {
+            *pbRealtime = ( iPolicy == SCHED_FIFO );
+        }
+        else
+        {
+            error = LADYBUG_FAILED;
+        }
+    }
+
+    return error;
+#else
+    (void)stage;
+    (void)bReset;
+    return LADYBUG_NOT_SUPPORTED;
+#endif
+}
+
+LadybugError
+LadybugThreadPlacement::placeCurrentThread( LadybugStage stage, const char* pszName )
+{
+    if ( stage < 0 || stage >= LADYBUG_NUM_STAGES )
+    {
+        return LADYBUG_INVALID_ARGUMENT;
+    }
+
+    bool bRealtime = false;
+    const LadybugError error = applyToCurrentThread( stage, false, &bRealtime );
+    t_currentStage = stage;
+
+#ifdef __linux__
+    const int iTid = getCurrentTid();
+
+    ThreadRecord record;
+    record.iTid = iTid;
+    record.name = ( pszName != NULL ) ? pszName : "";
+    record.stage = stage;
+    record.bRealtime = bRealtime;
+    record.bExited = false;
+    record.llStartMigrations = readMigrations( iTid );
+    record.llStartPreemptions = readPreemptions( iTid );
+    record.llEndMigrations = -1;
+    record.llEndPreemptions = -1;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for ( size_t i = 0; i < m_threads.size(); i++ )
+    {
+        if ( m_threads[ i ].iTid == iTid && !m_threads[ i ].bExited )
+        {
+            m_threads[ i ] = record;
+            return error;
+        }
+    }
+    m_threads.push_back( record );
+#else
+    (void)pszName;
+#endif
+
+    return error;
+}
+
+void
+LadybugThreadPlacement::unregisterCurrentThread()
+{
+    t_currentStage = LADYBUG_NUM_STAGES;
+
+#ifdef __linux__
+    const int iTid = getCurrentTid();
+    const long long llMigrations = readMigrations( iTid );
+    const long long llPreemptions = readPreemptions( iTid );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for ( size_t i = 0; i < m_threads.size(); i++ )
+    {
+        if ( m_threads[ i ].iTid == iTid && !m_threads[ i ].bExited )
+        {
+            m_threads[ i ].bExited = true;
+            m_threads[ i ].llEndMigrations = llMigrations;
+            m_threads[ i ].llEndPreemptions = llPreemptions;
+        }
+    }
+#endif
+}
+
+bool
+LadybugThreadPlacement::bindMemory( LadybugStage stage, void* pBlock, size_t size ) const
+{
+    const int iNode = getStageNode( stage );
+    if ( iNode < 0 || pBlock == NULL )
+    {
+        return false;
+    }
+
+#ifdef __linux__
+    // MPOL_PREFERRED falls back to other nodes when the node is full
+    const unsigned long ulMaxNode = sizeof( unsigned long ) * 8;
+    if ( (unsigned long)iNode >= ulMaxNode )
+    {
+        return false;
+    }
+    const unsigned long ulNodeMask = 1UL << iNode;
+    return syscall( SYS_mbind, pBlock, size, MPOL_PREFERRED, &ulNodeMask, ulMaxNode, 0 ) == 0;
+#else
+    (void)size;
+    return false;
+#endif
+}
+
+void
+LadybugThreadPlacement::printReport( const char* pszName ) const
+{
+    std::vector<ThreadRecord> threads;
+    std::string cpuLists[ LADYBUG_NUM_STAGES ];
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        threads = m_threads;
+        for ( unsigned int i = 0; i < LADYBUG_NUM_STAGES; i++ )
+        {
+            cpuLists[ i ] = m_stageCpuLists[ i ];
+        }
+    }
+
+    for ( size_t i = 0; i < threads.size(); i++ )
+    {
+        const ThreadRecord& record = threads[ i ];
+
+        long long llMigrations = record.llEndMigrations;
+        long long llPreemptions = record.llEndPreemptions;
+#ifdef __linux__
+        if ( !record.bExited )
+        {
+            llMigrations = readMigrations( record.iTid );
+            llPreemptions = readPreemptions( record.iTid );
+        }
+#endif
+
+        char szMigrations[ 32 ] = "n/a";
+        if ( llMigrations >= 0 && record.llStartMigrations >= 0 )
+        {
+            snprintf( szMigrations, sizeof( szMigrations ), "%lld", llMigrations - record.llStartMigrations );
+        }
+        char szPreemptions[ 32 ] = "n/a";
+        if ( llPreemptions >= 0 && record.llStartPreemptions >= 0 )
+        {
+            snprintf( szPreemptions, sizeof( szPreemptions ), "%lld", llPreemptions - record.llStartPreemptions );
+        }
+
+        printf(
+            "%s: %s (tid %d, %s, CPUs %s%s): %s CPU migrations, %s preemptions\n",
+            pszName,
+            record.name.c_str(),
+            record.iTid,
+            LadybugMetrics::getStageName( record.stage ),
+            cpuLists[ record.stage ].empty() ? "any" : cpuLists[ record.stage ].c_str(),
+            record.bRealtime ? ", SCHED_FIFO" : "",
+            szMigrations,
+            szPreemptions );
+    }
+}
+
+//=============================================================================
+// LadybugScopedPlacement
+//=============================================================================
+
+LadybugScopedPlacement::LadybugScopedPlacement( LadybugStage stage )
+    : m_previousStage( t_currentStage )
+{
+    bool bRealtime = false;
+    LadybugThreadPlacement::instance().applyToCurrentThread( stage, true, &bRealtime );
+    t_currentStage = stage;
+}
+
+LadybugScopedPlacement::~LadybugScopedPlacement()
+{
+    bool bRealtime = false;
+    LadybugThreadPlacement::instance().applyToCurrentThread( m_previousStage, true, &bRealtime );
+    t_currentStage = m_previousStage;
+}
@@ -0,0 +1,175 @@
+//=============================================================================
+// ladybugThreadPlacement.h
+//
+// Places the pipeline's threads on CPUs and its buffers on NUMA nodes.
+//
+// Each stage (see LadybugStage in ladybugMetrics.h) can be given a list of
+// CPUs. The capture, demosaic, JPEG encoder, file writer and multi-head sink
+// threads place themselves with LadybugPlacedThread when they start, and are
+// then restricted to their stage's CPUs. Grab threads can also be run
+// SCHED_FIFO so nothing else on their CPUs preempts them. A stage without
+// CPUs is left to the scheduler, so nothing changes until a tool configures
+// the placement.
+//
+// bindMemory() asks the kernel to put a block's pages on the NUMA node of a
+// stage's CPUs. LadybugFramePool binds its buffers to the convert stage,
+// which fills them.
+//
+// Threads inherit the placement of the thread that creates them. Wrap calls
+// that start SDK threads, such as ladybugInitializeStreamForWriting(), in a
+// LadybugScopedPlacement for the stage those threads belong to.
+//
+// Every placed thread is registered. printReport() shows how often each one
+// moved between CPUs (se.nr_migrations in /proc/self/task/TID/sched) and was
+// preempted since it was placed.
+//
+// Only Linux is supported; elsewhere the calls do nothing.
+//
+// Usage:
+//    LadybugThreadPlacement& placement = LadybugThreadPlacement::instance();
+//    placement.setStageCpus( LADYBUG_STAGE_GRAB, "2" );
+//    placement.setStageCpus( LADYBUG_STAGE_ENCODE, "4-11" );
+//    placement.setGrabRealtimePriority( 50 );
+//    placement.placeCurrentThread( LADYBUG_STAGE_GRAB, "main" );
+//    ...
+//    placement.printReport( "Threads" );
+//=============================================================================
+
+#ifndef LADYBUGTHREADPLACEMENT_H
+#define LADYBUGTHREADPLACEMENT_H
+
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ladybug.h>
+
+#include "ladybugMetrics.h"
+
+class LadybugThreadPlacement
+{
+public:
+    /** The process-wide placement used by the pipeline threads. */
+    static LadybugThreadPlacement& instance();
+
+    LadybugThreadPlacement();
+
+    /**
+     * Restrict a stage's threads to the CPUs in pszCpuList, written like
+     * "0-3,8". NULL or "" removes the restriction. Threads already placed
+     * keep their CPUs until they are placed again.
+     */
+    LadybugError setStageCpus( LadybugStage stage, const char* pszCpuList );
+
+    bool hasStageCpus( LadybugStage stage ) const;
+
+    /**
+     * The CPUs the process was allowed to run on when the placement was
+     * created, as limited by taskset or a cgroup. Empty if unknown.
+     */
+    void getProcessCpus( std::vector<int>* pCpus ) const;
+
+    /** Run grab threads SCHED_FIFO at iPriority, 1 - 99. 0 keeps SCHED_OTHER. */
+    LadybugError setGrabRealtimePriority( int iPriority );
+
+    /** NUMA node of the first CPU of a stage, or -1 if it has no CPUs. */
+    int getStageNode( LadybugStage stage ) const;
+
+    /**
+     * Apply a stage's CPUs and scheduling policy to the calling thread and
+     * register it under pszName for printReport().
+     */
+    LadybugError placeCurrentThread( LadybugStage stage, const char* pszName );
+
+    /** Record the calling thread's final counters. Call before it exits. */
+    void unregisterCurrentThread();
+
+    /**
+     * Prefer the NUMA node of a stage for a block's pages. The block must not
+     * have been touched yet. Returns false if the stage has no node or the
+     * kernel refused.
+     */
+    bool bindMemory( LadybugStage stage, void* pBlock, size_t size ) const;
+
+    /** Print one line per registered thread to stdout. */
+    void printReport( const char* pszName ) const;
+
+private:
+    LadybugThreadPlacement( const LadybugThreadPlacement& );
+    LadybugThreadPlacement& operator=( const LadybugThreadPlacement& );
+
+    friend class LadybugScopedPlacement;
+
+    struct ThreadRecord
+    {
+        int iTid;
+        std::string name;
+        LadybugStage stage;
+        bool bRealtime;
+        bool bExited;
+
+        // Counters when the thread was placed, and when it exited
+        long long llStartMigrations;
+        long long llStartPreemptions;
+        long long llEndMigrations;
+        long long llEndPreemptions;
+    };
+
+    // Apply a stage's CPUs and policy to the calling thread. With bReset, a
+    // stage without CPUs, or LADYBUG_NUM_STAGES, gets the process's CPUs and
+    // SCHED_OTHER back; otherwise the thread is left as it is.
+    LadybugError applyToCurrentThread( LadybugStage stage, bool bReset, bool* pbRealtime ) const;
+
+    mutable std::mutex m_mutex;
+    std::vector<int> m_stageCpus[ LADYBUG_NUM_STAGES ];
+    std::string m_stageCpuLists[ LADYBUG_NUM_STAGES ];
+    int m_iGrabPriority;
+
+    // NUMA node of every CPU, indexed by CPU number
+    std::vector<int> m_cpuNodes;
+
+    // CPUs the process was allowed to run on when the placement was created
+    std::vector<int> m_processCpus;
+
+    std::vector<ThreadRecord> m_threads;
+};
+
+/** Places the calling thread for as long as the object lives. */
+class LadybugPlacedThread
+{
+public:
+    LadybugPlacedThread( LadybugStage stage, const char* pszName )
+    {
+        LadybugThreadPlacement::instance().placeCurrentThread( stage, pszName );
+    }
+
+    ~LadybugPlacedThread()
+    {
+        LadybugThreadPlacement::instance().unregisterCurrentThread();
+    }
+
+private:
+    LadybugPlacedThread( const LadybugPlacedThread& );
+    LadybugPlacedThread& operator=( const LadybugPlacedThread& );
+};
+
+/**
+ * Moves the calling thread to another stage's placement for a scope, then
+ * back to the stage it was placed in.
+ */
+class LadybugScopedPlacement
+{
+public:
+    explicit LadybugScopedPlacement( LadybugStage stage );
+    ~LadybugScopedPlacement();
+
+private:
+    LadybugScopedPlacement( const LadybugScopedPlacement& );
+    LadybugScopedPlacement& operator=( const LadybugScopedPlacement& );
+
+    LadybugStage m_previousStage;
+};
+
+#endif // LADYBUGTHREADPLACEMENT_H
@@ -0,0 +1,853 @@
+//=============================================================================
+// ladybugBenchmark.cpp
+//
+// Measures throughput and tail latency of the processing steps the sample
+// programs are built from, and writes the results to a JSON file so they can
+// be compared across releases.
+//
+// Cases (names are "group/case"):
+//  - convert/METHOD/FORMAT  ladybugConvertImage() for every color processing
+//                           method, to LADYBUG_BGRU and LADYBUG_BGRU16
+//  - save/FORMAT            ladybugSaveImage() of one camera image as BMP,
+//                           JPG, PNG and TIFF
+//  - stream/read, stream/read-async
+//                           ladybugReadImageFromStream()
+//  - stream/write           ladybugWriteImageToStream()
+//  - render/...             ladybugUpdateTextures() and a 2048x1024
+//                           ladybugRenderOffScreenImage() panorama (-r only)
+//  - pnm/...                ppm8ReadPacked() and pgm8Read() from pgrpnmio.cpp
+//  - mesh/read3DMesh        read3DMesh() from ladybugStitchFrom3DMesh
+//
+// The convert, save, stream and render cases need a stream file (-i) for the
+// images and calibration. The pnm and mesh cases use generated files and run
+// without one.
+//
+// Every case is called once to warm up, then timed ITERATIONS times. The
+// JSON file holds one entry per case with the status, the number of
+// iterations, the bytes processed per iteration (raw image bytes for the
+// convert and stream cases, file bytes for the others), the mean, p50, p90,
+// p99 and maximum latency in milliseconds, and calls and MB per second.
+//
+// Usage: LadybugBenchmark [-i STREAM] [-n ITERATIONS] [-f FILTER] [-o JSON]
+//                         [-t DIR] [-r]
+//
+//  -i STREAM      .pgr stream file for the SDK cases
+//  -n ITERATIONS  Timed calls per case (default 20)
+//  -f FILTER      Only run cases whose name contains FILTER
+//  -o JSON        Result file (default ladybugBenchmark.json)
+//  -t DIR         Directory for the files the cases write (default /tmp)
+//  -r             Also run the render cases. This needs OpenGL.
+//=============================================================================
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <ladybug.h>
+#include <ladybuggeom.h>
+#include <ladybugrenderer.h>
+#include <ladybugstream.h>
+
+#include "ladybug3DMesh.h"
+#include "pgrpnmio.h"
+
+namespace
+{
+// Images loaded from the stream and cycled through by the convert cases
+const unsigned int MAX_IMAGES = 8;
+
+const unsigned int PANORAMA_COLS = 2048;
+const unsigned int PANORAMA_ROWS = 1024;
+
+// Size of the generated mesh for each camera
+const int MESH_COLS = 256;
+const int MESH_ROWS = 192;
+
+struct ColorMethod
+{
+    LadybugColorProcessingMethod method;
+    const char* pszName;
+};
+
+const ColorMethod s_colorMethods[] = {
+    { LADYBUG_NEAREST_NEIGHBOR_FAST, "nearest-fast" },
+    { LADYBUG_EDGE_SENSING, "edge-sensing" },
+    { LADYBUG_RIGOROUS, "rigorous" },
+    { LADYBUG_DOWNSAMPLE4, "downsample4" },
+    { LADYBUG_DOWNSAMPLE16, "downsample16" },
+    { LADYBUG_MONO, "mono" },
+    { LADYBUG_HQLINEAR, "hqlinear" },
+    { LADYBUG_HQLINEAR_GPU, "hqlinear-gpu" },
+    { LADYBUG_DIRECTIONAL_FILTER, "directional" },
+    { LADYBUG_WEIGHTED_DIRECTIONAL_FILTER, "weighted-directional" } };
+
+struct SaveFormat
+{
+    LadybugSaveFileFormat format;
+    const char* pszName;
+};
+
+const SaveFormat s_saveFormats[] = {
+    { LADYBUG_FILEFORMAT_BMP, "bmp" },
+    { LADYBUG_FILEFORMAT_JPG, "jpg" },
+    { LADYBUG_FILEFORMAT_PNG, "png" },
+    { LADYBUG_FILEFORMAT_TIFF, "tiff" } };
+
+/** The outcome of one case. */
+struct CaseResult
+{
+    std::string name;
+
+    /** "ok", "error" or "skipped". */
+    std::string status;
+
+    /** Error or reason for skipping. */
+    std::string detail;
+
+    /** Latency of each timed call, in seconds. */
+    std::vector<double> samples;
+
+    double dBytesPerIteration;
+};
+
+/** One timed call. Sets *pdBytes to the bytes it processed. */
+typedef std::function<LadybugError( unsigned int uiIteration, double* pdBytes )> CaseFunction;
+
+struct Options
+{
+    std::string streamPath;
+    unsigned int uiIterations;
+    std::string filter;
+    std::string jsonPath;
+    std::string scratchDirectory;
+    bool bRender;
+};
+
+class Benchmark
+{
+public:
+    explicit Benchmark( const Options& options )
+        : m_options( options )
+    {
+    }
+
+    bool isSelected( const std::string& name ) const
+    {
+        return m_options.filter.empty() || name.find( m_options.filter ) != std::string::npos;
+    }
+
+    void run( const std::string& name, const CaseFunction& function )
+    {
+        if ( !isSelected( name ) )
+        {
+            return;
+        }
+
+        CaseResult result;
+        result.name = name;
+        result.status = "ok";
+        result.dBytesPerIteration = 0.0;
+
+        double dBytes = 0.0;
+        LadybugError error = function( 0, &dBytes );
+        double dTotalBytes = 0.0;
+        for ( unsigned int i = 0; i < m_options.uiIterations && error == LADYBUG_OK; i++ )
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            error = function( i + 1, &dBytes );
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            result.samples.push_back( elapsed.count() );
+            dTotalBytes += dBytes;
+        }
+
+        if ( error != LADYBUG_OK )
+        {
+            result.status = "error";
+            result.detail = ::ladybugErrorToString( error );
+            result.samples.clear();
+        }
+        else
+        {
+            result.dBytesPerIteration = dTotalBytes / result.samples.size();
+        }
+
+        printResult( result );
+        m_results.push_back( result );
+    }
+
+    void skip( const std::string& name, const std::string& reason )
+    {
+        if ( !isSelected( name ) )
+        {
+            return;
+        }
+
+        CaseResult result;
+        result.name = name;
+        result.status = "skipped";
+        result.detail = reason;
+        result.dBytesPerIteration = 0.0;
+
+        printResult( result );
+        m_results.push_back( result );
+    }
+
+    bool writeJson() const;
+
+private:
+    void printResult( const CaseResult& result ) const;
+
+    Options m_options;
+    std::vector<CaseResult> m_results;
+};
+
+double getPercentile( const std::vector<double>& sorted, double dPercentile )
+{
+    const size_t index = (size_t)std::ceil( dPercentile / 100.0 * sorted.size() );
+    return sorted[ std::min( std::max( index, (size_t)1 ), sorted.size() ) - 1 ];
+}
+
+double getMean( const std::vector<double>& samples )
+{
+    double dSum = 0.0;
+    for ( size_t i = 0; i < samples.size(); i++ )
+    {
+        dSum += samples[ i ];
+    }
+    return dSum / samples.size();
+}
+
+void Benchmark::printResult( const CaseResult& result ) const
+{
+    if ( result.status != "ok" )
+    {
+        printf( "%-36s %s: %s\n", result.name.c_str(), result.status.c_str(), result.detail.c_str() );
+        return;
+    }
+
+    std::vector<double> sorted( result.samples );
+    std::sort( sorted.begin(), sorted.end() );
+    const double dMean = getMean( sorted );
+
+    printf( "%-36s %9.2f %9.2f %9.2f %9.2f %9.1f\n",
+        result.name.c_str(),
+        dMean * 1000.0,
+        getPercentile( sorted, 50 ) * 1000.0,
+        getPercentile( sorted, 99 ) * 1000.0,
+        sorted.back() * 1000.0,
+        result.dBytesPerIteration / dMean / ( 1024.0 * 1024.0 ) );
+}
+
+std::string escapeJson( const std::string& text )
+{
+    std::string escaped;
+    for ( size_t i = 0; i < text.size(); i++ )
+    {
+        const unsigned char c = (unsigned char)text[ i ];
+        if ( c == '"' || c == '\\' )
+        {
+            escaped += '\\';
+            escaped += (char)c;
+        }
+        else if ( c < 0x20 )
+        {
+            char szCode[ 8 ];
+            snprintf( szCode, sizeof( szCode ), "\\u%04x", c );
+            escaped += szCode;
+        }
+        else
+        {
+            escaped += (char)c;
+        }
+    }
+    return escaped;
+}
+
+bool Benchmark::writeJson() const
+{
+    FILE* pFile = fopen( m_options.jsonPath.c_str(), "w" );
+    if ( pFile == NULL )
+    {
+        printf( "Error: could not write %s\n", m_options.jsonPath.c_str() );
+        return false;
+    }
+
+    char szTime[ 32 ];
+    const time_t now = time( NULL );
+    strftime( szTime, sizeof( szTime ), "%Y-%m-%dT%H:%M:%SZ", gmtime( &now ) );
+
+    char szHost[ 256 ] = { 0 };
+    gethostname( szHost, sizeof( szHost ) - 1 );
+
+    fprintf( pFile, "{\n" );
+    fprintf( pFile, "  \"benchmark\": \"ladybugBenchmark\",\n" );
+    fprintf( pFile, "  \"time\": \"%s\",\n", szTime );
+    fprintf( pFile, "  \"host\": \"%s\",\n", escapeJson( szHost ).c_str() );
+    fprintf( pFile, "  \"stream\": \"%s\",\n", escapeJson( m_options.streamPath ).c_str() );
+    fprintf( pFile, "  \"iterations\": %u,\n", m_options.uiIterations );
+    fprintf( pFile, "  \"cases\": [" );
+
+    for ( size_t i = 0; i < m_results.size(); i++ )
+    {
+        const CaseResult& result = m_results[ i ];
+        fprintf( pFile, "%s\n    {\n", i == 0 ? "" : "," );
+        fprintf( pFile, "      \"name\": \"%s\",\n", escapeJson( result.name ).c_str() );
+
+        if ( result.status != "ok" )
+        {
+            fprintf( pFile, "      \"status\": \"%s\",\n", result.status.c_str() );
+            fprintf( pFile, "      \"detail\": \"%s\"\n    }", escapeJson( result.detail ).c_str() );
+            continue;
+        }
+
+        std::vector<double> sorted( result.samples );
+        std::sort( sorted.begin(), sorted.end() );
+        const double dMean = getMean( sorted );
+
+        fprintf( pFile, "      \"status\": \"ok\",\n" );
+        fprintf( pFile, "      \"iterations\": %zu,\n", sorted.size() );
+        fprintf( pFile, "      \"bytes_per_iteration\": %.0f,\n", result.dBytesPerIteration );
+        fprintf( pFile, "      \"mean_ms\": %.4f,\n", dMean * 1000.0 );
+        fprintf( pFile, "      \"p50_ms\": %.4f,\n", getPercentile( sorted, 50 ) * 1000.0 );
+        fprintf( pFile, "      \"p90_ms\": %.4f,\n", getPercentile( sorted, 90 ) * 1000.0 );
+        fprintf( pFile, "      \"p99_ms\": %.4f,\n", getPercentile( sorted, 99 ) * 1000.0 );
+        fprintf( pFile, "      \"max_ms\": %.4f,\n", sorted.back() * 1000.0 );
+        fprintf( pFile, "      \"calls_per_s\": %.3f,\n", 1.0 / dMean );
+        fprintf( pFile, "      \"mb_per_s\": %.3f\n    }", result.dBytesPerIteration / dMean / ( 1024.0 * 1024.0 ) );
+    }
+
+    fprintf( pFile, "\n  ]\n}\n" );
+
+    const bool bOk = ( fclose( pFile ) == 0 );
+    if ( bOk )
+    {
+        printf( "\nResults written to %s\n", m_options.jsonPath.c_str() );
+    }
+    return bOk;
+}
+
+double getFileSize( const std::string& path )
+{
+    struct stat status;
+    return ( stat( path.c_str(), &status ) == 0 ) ? (double)status.st_size : 0.0;
+}
+
+// Remove the files in a directory and the directory itself
+void removeDirectory( const std::string& path )
+{
+    DIR* pDir = opendir( path.c_str() );
+    if ( pDir == NULL )
+    {
+        return;
+    }
+
+    for ( dirent* pEntry = readdir( pDir ); pEntry != NULL; pEntry = readdir( pDir ) )
+    {
+        if ( strcmp( pEntry->d_name, "." ) != 0 && strcmp( pEntry->d_name, ".." ) != 0 )
+        {
+            remove( ( path + "/" + pEntry->d_name ).c_str() );
+        }
+    }
+    closedir( pDir );
+    rmdir( path.c_str() );
+}
+
+//
+// Images, calibration and header of the stream given with -i
+//
+struct StreamData
+{
+    LadybugStreamHeadInfo header;
+    std::string configPath;
+    std::vector<std::vector<unsigned char> > imageData;
+    std::vector<LadybugImage> images;
+};
+
+LadybugError loadStream( const Options& options, LadybugContext context, StreamData* pData )
+{
+    LadybugStreamContext streamContext;
+    LadybugError error = ::ladybugCreateStreamContext( &streamContext );
+    if ( error != LADYBUG_OK )
+    {
+        return error;
+    }
+
+    error = ::ladybugInitializeStreamForReading( streamContext, options.streamPath.c_str() );
+    if ( error == LADYBUG_OK )
+    {
+        error = ::ladybugGetStreamHeader( streamContext, &pData->header );
+    }
+
+    if ( error == LADYBUG_OK )
+    {
+        pData->configPath = options.scratchDirectory + "/ladybugBenchmark.cal";
+        error = ::ladybugGetStreamConfigFile( streamContext, pData->configPath.c_str() );
+    }
+
+    if ( error == LADYBUG_OK )
+    {
+        error = ::ladybugLoadConfig( context, pData->configPath.c_str() );
+    }
+
+    // Copy the images, as the stream reuses its buffer
+    for ( unsigned int i = 0; i < MAX_IMAGES && error == LADYBUG_OK; i++ )
+    {
+        LadybugImage image;
+        if ( ::ladybugReadImageFromStream( streamContext, &image ) != LADYBUG_OK )
+        {
+            break;
+        }
+
+        pData->imageData.push_back( std::vector<unsigned char>( image.pData, image.pData + image.uiDataSizeBytes ) );
+        pData->images.push_back( image );
+    }
+
+    for ( size_t i = 0; i < pData->images.size(); i++ )
+    {
+        pData->images[ i ].pData = pData->imageData[ i ].data();
+    }
+
+    if ( error == LADYBUG_OK && pData->images.empty() )
+    {
+        error = LADYBUG_FAILED;
+    }
+
+    ::ladybugStopStream( streamContext );
+    ::ladybugDestroyStreamContext( &streamContext );
+
+    return error;
+}
+
+// Time sequential reads, going back to the start at the end of the stream
+void benchStreamRead( Benchmark& benchmark, const Options& options, const char* pszName, bool bAsync )
+{
+    if ( !benchmark.isSelected( pszName ) )
+    {
+        return;
+    }
+
+    LadybugStreamContext streamContext;
+    LadybugError error = ::ladybugCreateStreamContext( &streamContext );
+    if ( error == LADYBUG_OK )
+    {
+        error = ::ladybugInitializeStreamForReading( streamContext, options.streamPath.c_str(), bAsync );
+    }
+
+    unsigned int uiNumImages = 0;
+    if ( error == LADYBUG_OK )
+    {
+        error = ::ladybugGetStreamNumOfImages( streamContext, &uiNumImages );
+    }
+
+    if ( error != LADYBUG_OK || uiNumImages == 0 )
+    {
+        benchmark.skip( pszName, "could not open the stream" );
+    }
+    else
+    {
+        unsigned int uiNext = 0;
+        benchmark.run( pszName, [&]( unsigned int, double* pdBytes ) {
+            if ( uiNext == uiNumImages )
+            {
+                ::ladybugGoToImage( streamContext, 0 );
+                uiNext = 0;
+            }
+            LadybugImage image;
+            const LadybugError readError = ::ladybugReadImageFromStream( streamContext, &image );
+            uiNext++;
+            *pdBytes = image.uiDataSizeBytes;
+            return readError;
+        } );
+
+        ::ladybugStopStream( streamContext );
+    }
+
+    ::ladybugDestroyStreamContext( &streamContext );
+}
+
+void benchSdk( Benchmark& benchmark, const Options& options )
+{
+    LadybugContext context;
+    LadybugError error = ::ladybugCreateContext( &context );
+    if ( error != LADYBUG_OK )
+    {
+        printf( "Error: could not create a context - %s\n", ::ladybugErrorToString( error ) );
+        return;
+    }
+
+    StreamData stream;
+    error = loadStream( options, context, &stream );
+    if ( error != LADYBUG_OK )
+    {
+        printf( "Error: could not load %s - %s\n", options.streamPath.c_str(), ::ladybugErrorToString( error ) );
+        ::ladybugDestroyContext( &context );
+        return;
+    }
+
+    const LadybugImage& firstImage = stream.images[ 0 ];
+    const unsigned int uiCols = firstImage.uiCols;
+    const unsigned int uiRows = firstImage.uiRows;
+    printf( "Stream: %u images of %ux%u loaded\n\n", (unsigned int)stream.images.size(), uiCols, uiRows );
+
+    // Large enough for any method at LADYBUG_BGRU16
+    std::vector<unsigned char> convertBuffer( (size_t)uiCols * uiRows * 8 * LADYBUG_NUM_CAMERAS );
+    unsigned char* arpBuffers[ LADYBUG_NUM_CAMERAS ];
+    for ( unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++ )
+    {
+        arpBuffers[ uiCamera ] = convertBuffer.data() + (size_t)uiCamera * uiCols * uiRows * 8;
+    }
+
+    //
+    // Color processing
+    //
+    const LadybugPixelFormat pixelFormats[] = { LADYBUG_BGRU, LADYBUG_BGRU16 };
+    const char* pixelFormatNames[] = { "bgru", "bgru16" };
+    for ( size_t m = 0; m < sizeof( s_colorMethods ) / sizeof( s_colorMethods[ 0 ] ); m++ )
+    {
+        for ( size_t f = 0; f < 2; f++ )
+        {
+            const std::string name = std::string( "convert/" ) + s_colorMethods[ m ].pszName + "/" + pixelFormatNames[ f ];
+            if ( !benchmark.isSelected( name ) )
+            {
+                continue;
+            }
+
+            error = ::ladybugSetColorProcessingMethod( context, s_colorMethods[ m ].method );
+            if ( error != LADYBUG_OK )
+            {
+                benchmark.skip( name, ::ladybugErrorToString( error ) );
+                continue;
+            }
+
+            benchmark.run( name, [&]( unsigned int uiIteration, double* pdBytes ) {
+                const LadybugImage& image = stream.images[ uiIteration % stream.images.size() ];
+                *pdBytes = image.uiDataSizeBytes;
+                return ::ladybugConvertImage( context, &image, arpBuffers, pixelFormats[ f ] );
+            } );
+        }
+    }
+
+    //
+    // Saving one camera image. The image is converted once up front.
+    //
+    ::ladybugSetColorProcessingMethod( context, LADYBUG_NEAREST_NEIGHBOR_FAST );
+    error = ::ladybugConvertImage( context, &firstImage, arpBuffers, LADYBUG_BGRU );
+
+    LadybugProcessedImage processedImage;
+    processedImage.uiCols = uiCols;
+    processedImage.uiRows = uiRows;
+    processedImage.pData = arpBuffers[ 0 ];
+    processedImage.pixelFormat = LADYBUG_BGRU;
+
+    for ( size_t s = 0; s < sizeof( s_saveFormats ) / sizeof( s_saveFormats[ 0 ] ); s++ )
+    {
+        const std::string name = std::string( "save/" ) + s_saveFormats[ s ].pszName;
+        if ( error != LADYBUG_OK )
+        {
+            benchmark.skip( name, "could not convert the image to save" );
+            continue;
+        }
+
+        const std::string path = options.scratchDirectory + "/ladybugBenchmark." + s_saveFormats[ s ].pszName;
+        benchmark.run( name, [&]( unsigned int, double* pdBytes ) {
+            const LadybugError saveError = ::ladybugSaveImage( context, &processedImage, path.c_str(), s_saveFormats[ s ].format );
+            *pdBytes = getFileSize( path );
+            return saveError;
+        } );
+        remove( path.c_str() );
+    }
+
+    //
+    // Stream reading and writing
+    //
+    benchStreamRead( benchmark, options, "stream/read", false );
+    benchStreamRead( benchmark, options, "stream/read-async", true );
+
+    if ( benchmark.isSelected( "stream/write" ) )
+    {
+        const std::string directory = options.scratchDirectory + "/ladybugBenchmarkStream";
+        mkdir( directory.c_str(), 0755 );
+        const std::string basePath = directory + "/ladybugBenchmark";
+
+        LadybugStreamContext streamContext;
+        error = ::ladybugCreateStreamContext( &streamContext );
+        if ( error == LADYBUG_OK )
+        {
+            error = ::ladybugInitializeStreamForWritingEx(
+                streamContext, basePath.c_str(), &stream.header, stream.configPath.c_str(), false );
+        }
+
+        if ( error != LADYBUG_OK )
+        {
+            benchmark.skip( "stream/write", ::ladybugErrorToString( error ) );
+        }
+        else
+        {
+            benchmark.run( "stream/write", [&]( unsigned int uiIteration, double* pdBytes ) {
+                const LadybugImage& image = stream.images[ uiIteration % stream.images.size() ];
+                *pdBytes = image.uiDataSizeBytes;
+                return ::ladybugWriteImageToStream( streamContext, &image );
+            } );
+            ::ladybugStopStream( streamContext );
+        }
+
+        ::ladybugDestroyStreamContext( &streamContext );
+        removeDirectory( directory );
+    }
+
+    //
+    // Off-screen rendering of a panorama
+    //
+    if ( options.bRender && ( benchmark.isSelected( "render/update-textures" ) || benchmark.isSelected( "render/panoramic" ) ) )
+    {
+        error = ::ladybugConvertImage( context, &firstImage, arpBuffers, LADYBUG_BGRU );
+        if ( error == LADYBUG_OK )
+        {
+            error = ::ladybugConfigureOutputImages( context, LADYBUG_PANORAMIC );
+        }
+        if ( error == LADYBUG_OK )
+        {
+            error = ::ladybugSetOffScreenImageSize( context, LADYBUG_PANORAMIC, PANORAMA_COLS, PANORAMA_ROWS );
+        }
+
+        if ( error != LADYBUG_OK )
+        {
+            benchmark.skip( "render/update-textures", ::ladybugErrorToString( error ) );
+            benchmark.skip( "render/panoramic", ::ladybugErrorToString( error ) );
+        }
+        else
+        {
+            benchmark.run( "render/update-textures", [&]( unsigned int, double* pdBytes ) {
+                *pdBytes = (double)uiCols * uiRows * 4 * LADYBUG_NUM_CAMERAS;
+                return ::ladybugUpdateTextures( context, LADYBUG_NUM_CAMERAS, (const unsigned char**)arpBuffers, LADYBUG_BGRU );
+            } );
+
+            benchmark.run( "render/panoramic", [&]( unsigned int, double* pdBytes ) {
+                LadybugProcessedImage panorama;
+                *pdBytes = (double)PANORAMA_COLS * PANORAMA_ROWS * 3;
+                return ::ladybugRenderOffScreenImage( context, LADYBUG_PANORAMIC, LADYBUG_BGR, &panorama );
+            } );
+        }
+    }
+
+    remove( stream.configPath.c_str() );
+    ::ladybugDestroyContext( &context );
+}
+
+//
+// PNM reading with pgrpnmio.cpp, on generated files
+//
+bool writePnm( const std::string& path, const char* pszMagic, unsigned int uiCols, unsigned int uiRows, unsigned int uiChannels )
+{
+    FILE* pFile = fopen( path.c_str(), "wb" );
+    if ( pFile == NULL )
+    {
+        return false;
+    }
+
+    fprintf( pFile, "%s\n# ladybugBenchmark\n%u %u\n255\n", pszMagic, uiCols, uiRows );
+    std::vector<unsigned char> row( (size_t)uiCols * uiChannels );
+    for ( unsigned int uiRow = 0; uiRow < uiRows; uiRow++ )
+    {
+        for ( size_t i = 0; i < row.size(); i++ )
+        {
+            row[ i ] = (unsigned char)( i + uiRow );
+        }
+        fwrite( row.data(), 1, row.size(), pFile );
+    }
+
+    return fclose( pFile ) == 0;
+}
+
+void benchPnm( Benchmark& benchmark, const Options& options, unsigned int uiCols, unsigned int uiRows )
+{
+    const std::string ppmPath = options.scratchDirectory + "/ladybugBenchmark.ppm";
+    if ( benchmark.isSelected( "pnm/ppm8ReadPacked" ) )
+    {
+        if ( !writePnm( ppmPath, "P6", uiCols, uiRows, 3 ) )
+        {
+            benchmark.skip( "pnm/ppm8ReadPacked", "could not write " + ppmPath );
+        }
+        else
+        {
+            benchmark.run( "pnm/ppm8ReadPacked", [&]( unsigned int, double* pdBytes ) {
+                char szComment[ 256 ];
+                int iRows, iCols;
+                unsigned char* pData = NULL;
+                const bool bOk = ppm8ReadPacked( ppmPath.c_str(), szComment, &iRows, &iCols, &pData );
+                free( pData );
+                *pdBytes = getFileSize( ppmPath );
+                return bOk ? LADYBUG_OK : LADYBUG_FAILED;
+            } );
+        }
+        remove( ppmPath.c_str() );
+    }
+
+    const std::string pgmPath = options.scratchDirectory + "/ladybugBenchmark.pgm";
+    if ( benchmark.isSelected( "pnm/pgm8Read" ) )
+    {
+        if ( !writePnm( pgmPath, "P5", uiCols, uiRows, 1 ) )
+        {
+            benchmark.skip( "pnm/pgm8Read", "could not write " + pgmPath );
+        }
+        else
+        {
+            benchmark.run( "pnm/pgm8Read", [&]( unsigned int, double* pdBytes ) {
+                char szComment[ 256 ];
+                int iRows, iCols;
+                unsigned char* pData = NULL;
+                const bool bOk = pgm8Read( pgmPath.c_str(), szComment, &iRows, &iCols, &pData );
+                free( pData );
+                *pdBytes = getFileSize( pgmPath );
+                return bOk ? LADYBUG_OK : LADYBUG_FAILED;
+            } );
+        }
+        remove( pgmPath.c_str() );
+    }
+}
+
+//
+// 3D mesh loading, on a generated mesh of six spherical patches
+//
+bool writeMesh( const std::string& path )
+{
+    FILE* pFile = fopen( path.c_str(), "w" );
+    if ( pFile == NULL )
+    {
+        return false;
+    }
+
+    const double dPi = 3.14159265358979323846;
+    fprintf( pFile, "cols %d rows %d\n", MESH_COLS, MESH_ROWS );
+    for ( int c = 0; c < LADYBUG_NUM_CAMERAS; c++ )
+    {
+        for ( int iRow = 0; iRow < MESH_ROWS; iRow++ )
+        {
+            for ( int iCol = 0; iCol < MESH_COLS; iCol++ )
+            {
+                const double dAzimuth = ( c + (double)iCol / ( MESH_COLS - 1 ) ) * 2.0 * dPi / LADYBUG_NUM_CAMERAS;
+                const double dElevation = ( (double)iRow / ( MESH_ROWS - 1 ) - 0.5 ) * dPi;
+                fprintf( pFile, "%f, %f, %f\n",
+                    20.0 * std::cos( dElevation ) * std::cos( dAzimuth ),
+                    20.0 * std::cos( dElevation ) * std::sin( dAzimuth ),
+                    20.0 * std::sin( dElevation ) );
+            }
+        }
+    }
+
+    return fclose( pFile ) == 0;
+}
+
+void benchMesh( Benchmark& benchmark, const Options& options )
+{
+    if ( !benchmark.isSelected( "mesh/read3DMesh" ) )
+    {
+        return;
+    }
+
+    const std::string meshPath = options.scratchDirectory + "/ladybugBenchmark.mesh";
+    if ( !writeMesh( meshPath ) )
+    {
+        benchmark.skip( "mesh/read3DMesh", "could not write " + meshPath );
+        return;
+    }
+
+    benchmark.run( "mesh/read3DMesh", [&]( unsigned int, double* pdBytes ) {
+        int iCols, iRows;
+        double* arpTable[ LADYBUG_NUM_CAMERAS ] = { NULL };
+        const bool bOk = read3DMesh( meshPath.c_str(), &iCols, &iRows, arpTable );
+        for ( int c = 0; c < LADYBUG_NUM_CAMERAS; c++ )
+        {
+            delete[] arpTable[ c ];
+        }
+        *pdBytes = getFileSize( meshPath );
+        return bOk ? LADYBUG_OK : LADYBUG_FAILED;
+    } );
+
+    remove( meshPath.c_str() );
+}
+
+} // namespace
+
+int main( int argc, char* argv[] )
+{
+    Options options;
+    options.uiIterations = 20;
+    options.jsonPath = "ladybugBenchmark.json";
+    options.scratchDirectory = "/tmp";
+    options.bRender = false;
+
+    for ( int i = 1; i < argc; i++ )
+    {
+        if ( i + 1 < argc && strcmp( argv[ i ], "-i" ) == 0 )
+        {
+            options.streamPath = argv[ ++i ];
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-n" ) == 0 )
+        {
+            options.uiIterations = (unsigned int)atoi( argv[ ++i ] );
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-f" ) == 0 )
+        {
+            options.filter = argv[ ++i ];
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-o" ) == 0 )
+        {
+            options.jsonPath = argv[ ++i ];
+        }
+        else if ( i + 1 < argc && strcmp( argv[ i ], "-t" ) == 0 )
+        {
+            options.scratchDirectory = argv[ ++i ];
+        }
+        else if ( strcmp( argv[ i ], "-r" ) == 0 )
+        {
+            options.bRender = true;
+        }
+        else
+        {
+            printf( "Usage: %s [-i STREAM] [-n ITERATIONS] [-f FILTER] [-o JSON] [-t DIR] [-r]\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( options.uiIterations == 0 )
+    {
+        printf( "Error: the number of iterations must be at least 1\n" );
+        return EXIT_FAILURE;
+    }
+
+    Benchmark benchmark( options );
+    printf( "%-36s %9s %9s %9s %9s %9s\n", "case", "mean ms", "p50 ms", "p99 ms", "max ms", "MB/s" );
+
+    if ( options.streamPath.empty() )
+    {
+        benchmark.skip( "convert", "no stream given with -i" );
+        benchmark.skip( "save", "no stream given with -i" );
+        benchmark.skip( "stream", "no stream given with -i" );
+        if ( options.bRender )
+        {
+            benchmark.skip( "render", "no stream given with -i" );
+        }
+    }
+    else
+    {
+        benchSdk( benchmark, options );
+    }
+
+    // One Ladybug5 camera image
+    benchPnm( benchmark, options, 2048, 2448 );
+    benchMesh( benchmark, options );
+
+    return benchmark.writeJson() ? 0 : EXIT_FAILURE;
+}
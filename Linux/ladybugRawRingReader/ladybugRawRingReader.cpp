@@ -0,0 +1,217 @@
+//=============================================================================
+// ladybugRawRingReader.cpp
+//
+// Reads a ring file recorded by LadybugSimpleGrab --raw (see
+// ladybugRawRing.h). Lists the frames it holds and optionally converts them
+// to one JPEG per camera, using the calibration saved next to the ring file.
+//
+// Usage: LadybugRawRingReader RING [-o DIR] [-c CALIBRATION] [-q QUALITY]
+//                             [-f FIRST] [-n COUNT]
+//
+//  RING            Ring file to read
+//  -o DIR          Convert the frames and write them to DIR as
+//                  ladybug_frameNNNNNN_camera_NN.jpg. Without -o the frames
+//                  are only listed.
+//  -c CALIBRATION  Calibration file (default RING.cal)
+//  -q QUALITY      JPEG quality (default 85)
+//  -f FIRST        Index of the first frame, 0 being the oldest (default 0)
+//  -n COUNT        Number of frames (default all)
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <ladybug.h>
+#include <ladybuggeom.h>
+
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugRawRing.h"
+
+#define _HANDLE_ERROR                                 \
+    if (error != LADYBUG_OK)                          \
+    {                                                 \
+        printf(                                       \
+            "Error: Ladybug library reported - %s\n", \
+            ::ladybugErrorToString(error));           \
+        return EXIT_FAILURE;                          \
+    }
+
+namespace
+{
+void printUsage(const char* pszProgram)
+{
+    printf(
+        "Usage: %s RING [-o DIR] [-c CALIBRATION] [-q QUALITY] [-f FIRST] [-n COUNT]\n",
+        pszProgram);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const char* pszRingPath = NULL;
+    const char* pszOutputDirectory = NULL;
+    std::string calibrationPath;
+    int iQuality = 85;
+    unsigned long long ulFirst = 0;
+    unsigned long long ulCount = ~0ULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "-o") == 0)
+        {
+            pszOutputDirectory = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-c") == 0)
+        {
+            calibrationPath = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-q") == 0)
+        {
+            iQuality = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-f") == 0)
+        {
+            ulFirst = strtoull(argv[++i], NULL, 10);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+        {
+            ulCount = strtoull(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && pszRingPath == NULL)
+        {
+            pszRingPath = argv[i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (pszRingPath == NULL)
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (calibrationPath.empty())
+    {
+        calibrationPath = std::string(pszRingPath) + ".cal";
+    }
+
+    LadybugRawRingReader ringReader;
+    LadybugError error = ringReader.open(pszRingPath);
+    _HANDLE_ERROR;
+
+    const unsigned long long ulNumFrames = ringReader.getNumFrames();
+    printf(
+        "%s: %llu frames, %llu recorded\n",
+        pszRingPath,
+        ulNumFrames,
+        ringReader.getFramesWritten());
+
+    const unsigned long long ulEnd =
+        (ulFirst > ulNumFrames || ulCount > ulNumFrames - ulFirst) ? ulNumFrames : ulFirst + ulCount;
+
+    LadybugContext context = NULL;
+    LadybugFramePool framePool;
+    LadybugJpegEncoder jpegEncoder;
+    LadybugFileWriter fileWriter;
+    if (pszOutputDirectory != NULL)
+    {
+        error = ::ladybugCreateContext(&context);
+        _HANDLE_ERROR;
+
+        printf("Loading calibration %s...\n", calibrationPath.c_str());
+        error = ::ladybugLoadConfig(context, calibrationPath.c_str());
+        _HANDLE_ERROR;
+
+        error = ::ladybugSetColorProcessingMethod(context, LADYBUG_HQLINEAR);
+        _HANDLE_ERROR;
+
+        error = jpegEncoder.initialize(0, iQuality);
+        _HANDLE_ERROR;
+
+        error = fileWriter.start();
+        _HANDLE_ERROR;
+    }
+
+    for (unsigned long long i = ulFirst; i < ulEnd; i++)
+    {
+        LadybugImage image;
+        error = ringReader.readFrame(i, &image);
+        if (error != LADYBUG_OK)
+        {
+            // The slot was overwritten or is incomplete; skip it
+            printf("Frame %llu: %s\n", i, ::ladybugErrorToString(error));
+            continue;
+        }
+
+        printf(
+            "Frame %llu: sequence %u, %lld.%06u s, %ux%u, %u bytes\n",
+            i,
+            image.imageInfo.ulSequenceId,
+            image.timeStamp.ulSeconds,
+            image.timeStamp.ulMicroSeconds,
+            image.uiCols,
+            image.uiRows,
+            image.uiDataSizeBytes);
+
+        if (pszOutputDirectory == NULL)
+        {
+            continue;
+        }
+
+        if (!framePool.isInitialized())
+        {
+            error = framePool.initialize(1, image.uiCols, image.uiRows, LADYBUG_BGRU);
+            _HANDLE_ERROR;
+        }
+        LadybugBufferSet* pBufferSet = framePool.acquire();
+
+        {
+            LadybugStageTimer convertTimer(LADYBUG_STAGE_CONVERT);
+            error = ::ladybugConvertImage(context, &image, pBufferSet->arpBuffers, LADYBUG_BGRU);
+            convertTimer.setBytes(image.uiDataSizeBytes);
+        }
+        if (error != LADYBUG_OK)
+        {
+            framePool.release(pBufferSet);
+            _HANDLE_ERROR;
+        }
+
+        std::vector<unsigned char> jpegs[LADYBUG_NUM_CAMERAS];
+        error = jpegEncoder.encodeImages(
+            pBufferSet->arpBuffers, LADYBUG_NUM_CAMERAS, image.uiCols, image.uiRows, LADYBUG_BGRU, jpegs);
+        framePool.release(pBufferSet);
+        _HANDLE_ERROR;
+
+        for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+        {
+            char pszFileName[64] = {0};
+            sprintf(pszFileName, "/ladybug_frame%06u_camera_%02u.jpg", image.uiBufferIndex, uiCamera);
+            error = fileWriter.write(std::string(pszOutputDirectory) + pszFileName, std::move(jpegs[uiCamera]));
+            _HANDLE_ERROR;
+        }
+    }
+
+    if (pszOutputDirectory != NULL)
+    {
+        fileWriter.stop();
+        jpegEncoder.shutdown();
+
+        jpegEncoder.printStats("JPEG encoder");
+        fileWriter.printStats("File writer");
+        LadybugMetrics::instance().printSummary();
+
+        error = ::ladybugDestroyContext(&context);
+        _HANDLE_ERROR;
+    }
+
+    return 0;
+}
@@ -7,9 +7,20 @@ Must be compiled with:  g++ -pthread -o <name> grabMultiThread.cpp
 
 Kieran Hunt 21/01/2019
 
+Usage: LadybugSimpleGrab [--frames N] [--raw PATH [--ring-mb MB]]
+
+  --frames N   Number of frames to grab (default 10)
+  --raw PATH   Write the raw camera data of every frame into the ring file
+               PATH (see ladybugRawRing.h) instead of converting and
+               encoding it. The camera calibration is saved to PATH.cal.
+               Read the frames back with LadybugRawRingReader.
+  --ring-mb MB Size of the ring file (default 4096). The oldest frames are
+               overwritten once it is full.
+
 */
 
 #include <iostream>
+#include <climits>
 #include <pthread.h>
 #include <cstdlib>
 #include <stdlib.h>
@@ -17,6 +28,13 @@ Kieran Hunt 21/01/2019
 #include <string>
 #include "ladybug.h"
 #include "ladybugstream.h"
+#include "ladybugFileWriter.h"
+#include "ladybugFramePool.h"
+#include "ladybugJpegEncoder.h"
+#include "ladybugMetrics.h"
+#include "ladybugRawRing.h"
+#include <string.h>
+#include <vector>
 
 // networking headers
 #include <netdb.h>
@@ -104,6 +122,13 @@ struct threadData
         int threadID;
 }; 
 
+// Buffers for the 6 processed images, reused for every frame
+LadybugFramePool framePool;
+
+// JPEGs are encoded in memory and written on a background thread
+LadybugJpegEncoder jpegEncoder;
+LadybugFileWriter fileWriter;
+
 void error(const char* msg) {
 	perror(msg);
 	exit(1);
@@ -161,15 +186,9 @@ void *saveSingleImage(void *threadID)
     struct threadData *myData;
     myData = (struct threadData *) threadID;
     
-    // Allocate memory for the 6 processed images
-    unsigned char *arpBuffers[LADYBUG_NUM_CAMERAS] = {0};
-    for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
-    {
-        arpBuffers[uiCamera] = new unsigned char[myData->image.uiRows * myData->image.uiCols * 4];
-
-        // Initialize the entire buffer so that the alpha channel has a valid (maximum) value.
-        memset(arpBuffers[uiCamera], 0xff, myData->image.uiRows * myData->image.uiCols * 4);
-    }
+    // Get the buffers for the 6 processed images
+    LadybugBufferSet *pBufferSet = framePool.acquire();
+    unsigned char **arpBuffers = pBufferSet->arpBuffers;
 
     // Color-process the image
     printf("Converting image...\n");
@@ -186,32 +205,108 @@ void *saveSingleImage(void *threadID)
     // Save the image as 6 individual raw (unstitched, distorted) images
     printf("Saving images...\n");
 
-    LadybugProcessedImage processedImage;
-    processedImage.pData = arpBuffers[myData->uiCamera];
-    processedImage.pixelFormat = LADYBUG_BGRU;
-    processedImage.uiCols = myData->image.uiCols;
-    processedImage.uiRows = myData->image.uiRows;
-
     char pszOutputFilePath[256] = {0};
     sprintf(pszOutputFilePath, "ladybug_frame%03u_%u_camera_%02u.jpg", myData->frames, myData->caminfo.serialHead, myData->uiCamera);
     const std::string outputPath = getWriteableDirectory() + std::string(pszOutputFilePath);
 
-    error = ::ladybugSaveImage(myData->context, &processedImage, outputPath.c_str(), LADYBUG_FILEFORMAT_JPG);
+    std::vector<unsigned char> jpeg;
+    error = jpegEncoder.encodeImage(arpBuffers[myData->uiCamera], myData->image.uiCols, myData->image.uiRows, LADYBUG_BGRU, &jpeg);
+    if (error == LADYBUG_OK)
+    {
+        error = fileWriter.write(outputPath, std::move(jpeg));
+    }
     //_HANDLE_ERROR;
 
-    printf("Saved camera %u image to %s.\n", myData->uiCamera, outputPath.c_str());
+    printf("Queued camera %u image for %s.\n", myData->uiCamera, outputPath.c_str());
+
+    // Return the buffers to the pool
+    framePool.release(pBufferSet);
+
+    return NULL;
+}
+
+// Grab frames and copy their raw data into a ring file, with no conversion
+int grabRaw(LadybugContext context, const char *pszRingPath, unsigned long long ulRingBytes, int numFrames)
+{
+    // Keep the calibration with the recording so it can be converted offline
+    const std::string calibrationPath = std::string(pszRingPath) + ".cal";
+    LadybugError error = ::ladybugWriteConfigurationFile(context, calibrationPath.c_str());
+    _HANDLE_ERROR;
 
-    // Clean up the buffers
-    for (unsigned int uiCamera = 0; uiCamera < LADYBUG_NUM_CAMERAS; uiCamera++)
+    // Only frames actually grabbed count; give up after as many timeouts in
+    // a row as the converting loop tries
+    LadybugRawRingWriter ringWriter;
+    int timeouts = 0;
+    for (int frames = 0; frames < numFrames;)
     {
-        delete arpBuffers[uiCamera];
+        LadybugImage image;
+        {
+            LadybugStageTimer grabTimer(LADYBUG_STAGE_GRAB);
+            error = ::ladybugGrabImage(context, &image);
+            grabTimer.setBytes(image.uiDataSizeBytes);
+        }
+        if (error == LADYBUG_TIMEOUT && ++timeouts < 10)
+        {
+            continue;
+        }
+        _HANDLE_ERROR;
+        timeouts = 0;
+        frames++;
+
+        // Slots are sized from the first frame, which every RAW frame matches
+        if (!ringWriter.isOpen())
+        {
+            error = ringWriter.open(pszRingPath, ulRingBytes, image.uiDataSizeBytes);
+            _HANDLE_ERROR;
+        }
+
+        error = ringWriter.write(image);
+        _HANDLE_ERROR;
     }
 
-    pthread_exit(NULL);
+    error = ringWriter.close();
+    _HANDLE_ERROR;
+
+    ringWriter.printStats("Raw ring");
+    LadybugMetrics::instance().printSummary();
+    printf("Wrote %s and %s.\n", pszRingPath, calibrationPath.c_str());
+
+    return 0;
 }
 
-int main(int /* argc */, char ** /* argv[] */)
+int main(int argc, char **argv)
 {
+    int numFrames = 10;
+    const char *pszRingPath = NULL;
+    unsigned long long ulRingBytes = 4096ULL * 1024 * 1024;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && strcmp(argv[i], "--frames") == 0)
+        {
+            char *pszEnd = NULL;
+            const long lFrames = strtol(argv[++i], &pszEnd, 10);
+            if (pszEnd == argv[i] || *pszEnd != '\0' || lFrames < 1 || lFrames > INT_MAX)
+            {
+                printf("--frames must be a number of frames, at least 1: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            numFrames = (int)lFrames;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--raw") == 0)
+        {
+            pszRingPath = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--ring-mb") == 0)
+        {
+            ulRingBytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        }
+        else
+        {
+            printf("Usage: %s [--frames N] [--raw PATH [--ring-mb MB]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     // Initialize context.
     LadybugContext context;
     LadybugError error = ::ladybugCreateContext(&context);
@@ -233,12 +328,28 @@ int main(int /* argc */, char ** /* argv[] */)
     error = ::ladybugStart(context, LADYBUG_DATAFORMAT_RAW8);
     _HANDLE_ERROR;
 
+    if (pszRingPath != NULL)
+    {
+        const int result = grabRaw(context, pszRingPath, ulRingBytes, numFrames);
+
+        printf("Destroying context...\n");
+        error = ::ladybugDestroyContext(&context);
+        _HANDLE_ERROR;
+
+        return result;
+    }
+
     // Set color processing method
     printf("Setting debayering method...\n");
     error = ::ladybugSetColorProcessingMethod(context, LADYBUG_NEAREST_NEIGHBOR_FAST);
     _HANDLE_ERROR;
 
-    for (int frames = 0; frames < 10; frames++)
+    error = jpegEncoder.initialize(0);
+    _HANDLE_ERROR;
+    error = fileWriter.start();
+    _HANDLE_ERROR;
+
+    for (int frames = 0; frames < numFrames; frames++)
     {
 
         // Grab a single image.
@@ -254,6 +365,12 @@ int main(int /* argc */, char ** /* argv[] */)
         printf("\n");
         _HANDLE_ERROR;
 
+        // The pool is sized from the first frame
+        if (!framePool.isInitialized())
+        {
+            error = framePool.initialize(1, image.uiCols, image.uiRows, LADYBUG_BGRU);
+            _HANDLE_ERROR;
+        }
 
         //call threads here
 
@@ -284,6 +401,13 @@ int main(int /* argc */, char ** /* argv[] */)
         // pthread_exit(NULL);
     }
 
+    fileWriter.stop();
+    jpegEncoder.shutdown();
+
+    framePool.printStats("Frame pool");
+    jpegEncoder.printStats("JPEG encoder");
+    fileWriter.printStats("File writer");
+
     // Destroy the context
     printf("Destroying context...\n");
     error = ::ladybugDestroyContext(&context);
@@ -0,0 +1,69 @@
+//=============================================================================
+// Copyright (c) 2001-2018 FLIR Systems, Inc. All Rights Reserved.
+//
+// This software is the confidential and proprietary information of FLIR
+// Integrated Imaging Solutions, Inc. ("Confidential Information"). You
+// shall not disclose such Confidential Information and shall use it only in
+// accordance with the terms of the license agreement you entered into
+// with FLIR Integrated Imaging Solutions, Inc. (FLIR).
+//
+// FLIR MAKES NO REPRESENTATIONS OR WARRANTIES ABOUT THE SUITABILITY OF THE
+// SOFTWARE, EITHER EXPRESSED OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NON-INFRINGEMENT. FLIR SHALL NOT BE LIABLE FOR ANY DAMAGES
+// SUFFERED BY LICENSEE AS A RESULT OF USING, MODIFYING OR DISTRIBUTING
+// THIS SOFTWARE OR ITS DERIVATIVES.
+//=============================================================================
+
+#include <stdio.h>
+
+#include "ladybug3DMesh.h"
+
+bool
+read3DMesh( const char* pszPath,
+            int*        pCols,
+            int*        pRows,
+            double*     arpTable[ 6 ] )
+{
+   FILE *fp = fopen( pszPath, "r");
+   if ( fp == NULL){
+      printf( "Can't read 3D mesh file: %s\n", pszPath);
+      return false;
+   }
+
+   int cols, rows;
+   if ( fscanf( fp, "cols %d rows %d\n", &cols, &rows) != 2 || cols <= 0 || rows <= 0){
+      printf( "Can't read cols/rows in 3d mesh file.\n");
+      fclose( fp);
+      return false;
+   }
+
+   for ( int c = 0; c < 6; c++)
+   {
+      arpTable[ c] = new double[ cols * rows * 3];
+   }
+
+   for ( int c = 0; c < 6; c++)
+   {
+      double* pTable = arpTable[ c];
+      for ( int i = 0; i < cols * rows; i++ )
+      {
+         if ( fscanf( fp, "%lf, %lf, %lf", &pTable[ i * 3 + 0], &pTable[ i * 3 + 1], &pTable[ i * 3 + 2]) != 3){
+            printf( "Can't read grid data in 3d mesh file.\n");
+            fclose( fp);
+            for ( int t = 0; t < 6; t++)
+            {
+               delete [] arpTable[ t];
+               arpTable[ t] = NULL;
+            }
+            return false;
+         }
+      }
+   }
+
+   fclose( fp);
+
+   *pCols = cols;
+   *pRows = rows;
+   return true;
+}
@@ -0,0 +1,44 @@
+//=============================================================================
+// Copyright (c) 2001-2018 FLIR Systems, Inc. All Rights Reserved.
+//
+// This software is the confidential and proprietary information of FLIR
+// Integrated Imaging Solutions, Inc. ("Confidential Information"). You
+// shall not disclose such Confidential Information and shall use it only in
+// accordance with the terms of the license agreement you entered into
+// with FLIR Integrated Imaging Solutions, Inc. (FLIR).
+//
+// FLIR MAKES NO REPRESENTATIONS OR WARRANTIES ABOUT THE SUITABILITY OF THE
+// SOFTWARE, EITHER EXPRESSED OR IMPLIED, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NON-INFRINGEMENT. FLIR SHALL NOT BE LIABLE FOR ANY DAMAGES
+// SUFFERED BY LICENSEE AS A RESULT OF USING, MODIFYING OR DISTRIBUTING
+// THIS SOFTWARE OR ITS DERIVATIVES.
+//=============================================================================
+#ifndef _LADYBUG3DMESH_H_
+#define _LADYBUG3DMESH_H_
+
+//=============================================================================
+//
+// ladybug3DMesh:
+//
+// This file reads the 3D mesh files produced by the program
+// ladybugOutput3DMesh. It has no OpenGL dependency, so it can be used
+// outside ladybugStitchFrom3DMesh.
+//
+// The file starts with "cols <cols> rows <rows>", followed by
+// cols * rows "x, y, z" points for each of the 6 cameras, row by row.
+//=============================================================================
+
+//
+// read3DMesh() -
+//      This function reads a 3D mesh file. On success, arpTable[ c ] holds
+//      the (*pCols) * (*pRows) points of camera c as x, y, z triplets,
+//      allocated with new[]. The caller has to delete[] them.
+//
+bool
+read3DMesh( const char* pszPath,
+            int*        pCols,
+            int*        pRows,
+            double*     arpTable[ 6 ] );
+
+#endif //#ifndef _LADYBUG3DMESH_H_
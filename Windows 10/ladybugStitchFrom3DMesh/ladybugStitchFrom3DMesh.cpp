@@ -36,6 +36,7 @@
 #include <GL/glu.h>
 #include <GL/glut.h>
 #include "pgrpnmio.h"
+#include "ladybug3DMesh.h"
 
 // define this if you want to see 3D polygon meshes
 //#define DRAW_MESH
@@ -84,41 +85,7 @@ int get_minimum_power_of_two( int in)
 
 bool read_3d_mesh( char *mesh_file_path)
 {
-   FILE *fp = fopen( mesh_file_path, "r");
-   if ( fp == NULL){
-      printf( "Can't read 3D mesh file: %s\n", mesh_file_path);
-      return false;
-   }
-
-   if ( fscanf( fp, "cols %d rows %d\n", &gCols, &gRows) != 2){
-      printf( "Can't read cols/rows in 3d mesh file.\n");
-	  fclose( fp);
-      return false;
-   }
-
-   for ( int c = 0; c < 6; c++)
-   {
-      gTable[ c] = new double[ gCols * gRows * 3];
-
-      for ( int iRow = 0; iRow < gRows; iRow++ )
-      {
-         for ( int iCol = 0; iCol < gCols; iCol++ )
-         {
-            double x, y, z;
-            if ( fscanf( fp, "%lf, %lf, %lf", &x, &y, &z) != 3){
-               printf( "Can't read grid data in 3d mesh file.\n");
-               fclose(fp);
-               return false;
-            }
-            gTable[c][ ( iRow * gCols + iCol) * 3 + 0] = x;
-            gTable[c][ ( iRow * gCols + iCol) * 3 + 1] = y;
-            gTable[c][ ( iRow * gCols + iCol) * 3 + 2] = z;
-         }
-      }
-   }
-
-   fclose(fp);
-   return true;
+   return read3DMesh( mesh_file_path, &gCols, &gRows, gTable);
 }
 
 